@@ -31,6 +31,7 @@ extern "C" {
 #endif
 
 #include <stdbool.h>
+#include <stdint.h>
 #include <stdarg.h>
 #include <sys/types.h>
 #include <sys/socket.h>
@@ -55,6 +56,21 @@ typedef size_t gensiods; /* Data size */
 #define GENSIO_EVENT_POSTCERT_VERIFY	7
 #define GENSIO_EVENT_PASSWORD_VERIFY	8
 #define GENSIO_EVENT_REQUEST_PASSWORD	9
+#define GENSIO_EVENT_WRITE_COMPLETE	10
+#define GENSIO_EVENT_WRITE_HIGH		11
+#define GENSIO_EVENT_WRITE_LOW		12
+
+/*
+ * For GENSIO_EVENT_WRITE_COMPLETE, buf points to one of these.  The
+ * zero-copy writes numbered first through last (inclusive) are done
+ * and their buffers may be reused.  If copied is set, the kernel had
+ * to copy the data anyway.
+ */
+struct gensio_write_complete {
+    uint32_t first;
+    uint32_t last;
+    bool copied;
+};
 
 /*
  * Serial callbacks start here and run to 2000.
@@ -88,6 +104,16 @@ int str_to_gensio(const char *str,
 		  gensio_event cb, void *user_data,
 		  struct gensio **gensio);
 
+/*
+ * Like str_to_gensio(), but any name lookups are done without
+ * blocking the caller.  done is called from the os handler with the
+ * new gensio, or with an error and a NULL gensio.
+ */
+int str_to_gensio_async(const char *str,
+			struct gensio_os_funcs *o,
+			gensio_event cb, void *user_data,
+			gensio_done_err done, void *done_data);
+
 int str_to_gensio_child(struct gensio *child, const char *str,
 			struct gensio_os_funcs *o,
 			gensio_event cb, void *user_data,
@@ -113,6 +139,22 @@ int gensio_write_sg(struct gensio *io, gensiods *count,
 		    const struct gensio_sg *sg, gensiods sglen,
 		    const char *const *auxdata);
 
+/*
+ * A single message for gensio_write_msgs().  count and err are
+ * filled in by the write with the number of bytes written and any
+ * error for that particular message.
+ */
+struct gensio_msg {
+    const struct gensio_sg *sg;
+    gensiods sglen;
+    const char *const *auxdata;
+    gensiods count;
+    int err;
+};
+
+int gensio_write_msgs(struct gensio *io, gensiods *count,
+		      struct gensio_msg *msgs, gensiods nmsgs);
+
 int gensio_raddr_to_str(struct gensio *io, gensiods *pos,
 			char *buf, gensiods buflen);
 
@@ -174,6 +216,23 @@ int gensio_control(struct gensio *io, int depth, bool get,
 #define GENSIO_CONTROL_ENVIRONMENT		10
 #define GENSIO_CONTROL_MAX_WRITE_PACKET		11
 #define GENSIO_CONTROL_ARGS			12
+#define GENSIO_CONTROL_ACCEPT_STATS		13
+#define GENSIO_CONTROL_POOL_STATS		14
+#define GENSIO_CONTROL_READ_BUFFER_SIZE		15
+#define GENSIO_CONTROL_SNDBUF			16
+#define GENSIO_CONTROL_RCVBUF			17
+#define GENSIO_CONTROL_NOTSENT_LOWAT		18
+#define GENSIO_CONTROL_CORK			19
+#define GENSIO_CONTROL_QUICKACK			20
+#define GENSIO_CONTROL_BUSY_POLL		21
+#define GENSIO_CONTROL_USER_TIMEOUT		22
+#define GENSIO_CONTROL_WRITE_CORK		23
+#define GENSIO_CONTROL_WRITE_COALESCE		24
+#define GENSIO_CONTROL_WRITE_HIGH_WATER		25
+#define GENSIO_CONTROL_WRITE_LOW_WATER		26
+#define GENSIO_CONTROL_WRITE_QUEUED		27
+#define GENSIO_CONTROL_COMPRESS_STATS		28
+#define GENSIO_CONTROL_RATELIMIT_STATS		29
 
 const char *gensio_get_type(struct gensio *io, unsigned int depth);
 struct gensio *gensio_get_child(struct gensio *io, unsigned int depth);
@@ -185,14 +244,76 @@ bool gensio_is_encrypted(struct gensio *io);
 bool gensio_is_message(struct gensio *io);
 
 int gensio_set_sync(struct gensio *io);
+int gensio_set_sync_ring(struct gensio *io, gensiods ring_size);
 int gensio_clear_sync(struct gensio *io);
 int gensio_read_s(struct gensio *io, gensiods *count,
 		  void *data, gensiods datalen,
 		  struct timeval *timeout);
+int gensio_read_s_min(struct gensio *io, gensiods *count,
+		      void *data, gensiods datalen, gensiods minlen,
+		      struct timeval *timeout);
+int gensio_read_s_delim(struct gensio *io, gensiods *count,
+			void *data, gensiods datalen, unsigned char delim,
+			struct timeval *timeout);
 int gensio_write_s(struct gensio *io, gensiods *count,
 		   const void *data, gensiods datalen,
 		   struct timeval *timeout);
 
+/*
+ * A pool of open client gensios created from the same string, see
+ * gensio_pool(3).
+ */
+struct gensio_pool;
+
+typedef void (*gensio_pool_done)(struct gensio_pool *pool, struct gensio *io,
+				 int err, void *done_data);
+
+int gensio_pool_alloc(struct gensio_os_funcs *o, const char *str,
+		      const char * const args[], struct gensio_pool **pool);
+int gensio_pool_get(struct gensio_pool *pool,
+		    gensio_event cb, void *user_data,
+		    gensio_pool_done done, void *done_data);
+int gensio_pool_release(struct gensio_pool *pool, struct gensio *io);
+int gensio_pool_drop(struct gensio_pool *pool, struct gensio *io);
+void gensio_pool_free(struct gensio_pool *pool);
+
+/*
+ * Send part of a file out a gensio in the background, see
+ * gensio_sendfile(3).
+ */
+typedef void (*gensio_sendfile_done)(struct gensio *io, int err,
+				     gensiods count, void *done_data);
+
+int gensio_sendfile(struct gensio *io, int fd, off_t offset, gensiods len,
+		    const char * const args[],
+		    gensio_sendfile_done done, void *done_data);
+
+/*
+ * Queue data to be written in the background, see
+ * gensio_write_queued(3).
+ */
+typedef void (*gensio_write_queued_done)(struct gensio *io, int err,
+					 gensiods count, void *done_data);
+
+int gensio_write_queued(struct gensio *io, const void *data, gensiods datalen,
+			gensio_write_queued_done done, void *done_data);
+
+/*
+ * Pass data between two open gensios in both directions, see
+ * gensio_relay(3).
+ */
+struct gensio_relay;
+
+typedef void (*gensio_relay_done)(struct gensio_relay *relay, int err,
+				  void *done_data);
+
+int gensio_relay_alloc(struct gensio_os_funcs *o,
+		       struct gensio *io1, struct gensio *io2,
+		       const char * const args[],
+		       gensio_relay_done done, void *done_data,
+		       struct gensio_relay **relay);
+int gensio_relay_start(struct gensio_relay *relay);
+void gensio_relay_free(struct gensio_relay *relay);
 
 struct gensio_accepter;
 
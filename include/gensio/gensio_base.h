@@ -200,6 +200,22 @@ int gensio_filter_control(struct gensio_filter *filter, bool get,
 int gensio_filter_open_channel(struct gensio_filter *filter,
 			       struct gensio_func_open_channel_data *data);
 
+/*
+ * Is the filter refusing to take data from the bottom right now?  If
+ * so, reads on the lower layer are not enabled.  The filter must
+ * report GENSIO_FILTER_CB_OUTPUT_READY when this may have changed.
+ */
+#define GENSIO_FILTER_FUNC_LL_READ_BLOCKED	17
+bool gensio_filter_ll_read_blocked(struct gensio_filter *filter);
+
+/*
+ * Is the filter refusing to take data from the top right now?  If
+ * so, write ready is not reported to the user.  The filter must
+ * report GENSIO_FILTER_CB_OUTPUT_READY when this may have changed.
+ */
+#define GENSIO_FILTER_FUNC_UL_WRITE_BLOCKED	18
+bool gensio_filter_ul_write_blocked(struct gensio_filter *filter);
+
 typedef int (*gensio_filter_func)(struct gensio_filter *filter, int op,
 				  const void *func, void *data,
 				  gensiods *count, void *buf,
@@ -218,6 +234,17 @@ void gensio_filter_free_data(struct gensio_filter *filter);
 
 void *gensio_filter_get_user_data(struct gensio_filter *filter);
 
+/*
+ * Allocate a filter that runs the given filters stacked on top of
+ * each other, filters[0] on top, so a stack of filters can run in a
+ * single gensio.  The chain owns the filters if this succeeds.  A
+ * chain in the array has its filters merged into the new chain.
+ */
+int gensio_filter_chain_alloc(struct gensio_os_funcs *o,
+			      struct gensio_filter **filters,
+			      unsigned int nfilters,
+			      struct gensio_filter **rfilter);
+
 struct gensio_ll;
 
 typedef void (*gensio_ll_open_done)(void *cb_data, int err, void *open_data);
@@ -225,6 +252,8 @@ typedef void (*gensio_ll_close_done)(void *cb_data, void *close_data);
 
 #define GENSIO_LL_CB_READ		1
 #define GENSIO_LL_CB_WRITE_READY	2
+/* buf is a struct gensio_write_complete. */
+#define GENSIO_LL_CB_WRITE_COMPLETE	3
 
 typedef gensiods (*gensio_ll_cb)(void *cb_data, int op, int val,
 				 void *buf, gensiods buflen,
@@ -326,6 +355,26 @@ int gensio_ll_control(struct gensio_ll *ll, bool get, int option, char *data,
 #define GENSIO_LL_FUNC_DISABLE			12
 void gensio_ll_disable(struct gensio_ll *ll);
 
+/*
+ * Write multiple messages to the ll.  Return GE_NOTSUP if not
+ * supported.
+ *
+ * rcount => count
+ * msgs => buf
+ * nmsgs => buflen
+ */
+#define GENSIO_LL_FUNC_WRITE_MSGS		13
+int gensio_ll_write_msgs(struct gensio_ll *ll, gensiods *rcount,
+			 struct gensio_msg *msgs, gensiods nmsgs);
+
+/*
+ * See GENSIO_FUNC_RAW_FD.  Return GE_NOTSUP if not supported.
+ *
+ * raw => buf
+ */
+#define GENSIO_LL_FUNC_RAW_FD			14
+int gensio_ll_raw_fd(struct gensio_ll *ll, struct gensio_raw_fd *raw);
+
 typedef int (*gensio_ll_func)(struct gensio_ll *ll, int op,
 			      gensiods *count,
 			      void *buf, const void *cbuf,
@@ -356,6 +405,13 @@ struct gensio *base_gensio_alloc(struct gensio_os_funcs *o,
 				 const char *typename,
 				 gensio_event cb, void *user_data);
 
+/*
+ * Allow a filter gensio to be merged into the gensio above it, see
+ * GENSIO_FUNC_FUSE.  Only do this if nothing outside the filter
+ * refers to the gensio, since it goes away when it is merged.
+ */
+int base_gensio_set_fusable(struct gensio *io);
+
 struct gensio *base_gensio_server_alloc(struct gensio_os_funcs *o,
 					struct gensio_ll *ll,
 					struct gensio_filter *filter,
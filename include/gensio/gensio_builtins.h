@@ -64,6 +64,22 @@ int str_to_ssl_gensio_accepter(const char *str, const char * const args[],
 			       gensio_accepter_event cb,
 			       void *user_data,
 			       struct gensio_accepter **new_acc);
+int str_to_compress_gensio_accepter(const char *str, const char * const args[],
+				    struct gensio_os_funcs *o,
+				    gensio_accepter_event cb,
+				    void *user_data,
+				    struct gensio_accepter **new_acc);
+int str_to_ratelimit_gensio_accepter(const char *str,
+				     const char * const args[],
+				     struct gensio_os_funcs *o,
+				     gensio_accepter_event cb,
+				     void *user_data,
+				     struct gensio_accepter **new_acc);
+int str_to_msgdelim_gensio_accepter(const char *str, const char * const args[],
+				    struct gensio_os_funcs *o,
+				    gensio_accepter_event cb,
+				    void *user_data,
+				    struct gensio_accepter **new_acc);
 int str_to_certauth_gensio_accepter(const char *str, const char * const args[],
 				    struct gensio_os_funcs *o,
 				    gensio_accepter_event cb,
@@ -103,6 +119,18 @@ int str_to_ssl_gensio(const char *str, const char * const args[],
 		      struct gensio_os_funcs *o,
 		      gensio_event cb, void *user_data,
 		      struct gensio **new_gensio);
+int str_to_compress_gensio(const char *str, const char * const args[],
+			   struct gensio_os_funcs *o,
+			   gensio_event cb, void *user_data,
+			   struct gensio **new_gensio);
+int str_to_ratelimit_gensio(const char *str, const char * const args[],
+			    struct gensio_os_funcs *o,
+			    gensio_event cb, void *user_data,
+			    struct gensio **new_gensio);
+int str_to_msgdelim_gensio(const char *str, const char * const args[],
+			   struct gensio_os_funcs *o,
+			   gensio_event cb, void *user_data,
+			   struct gensio **new_gensio);
 int str_to_certauth_gensio(const char *str, const char * const args[],
 			   struct gensio_os_funcs *o,
 			   gensio_event cb, void *user_data,
@@ -165,6 +193,27 @@ int ssl_gensio_accepter_alloc(struct gensio_accepter *child,
 			      void *user_data,
 			      struct gensio_accepter **accepter);
 
+int compress_gensio_accepter_alloc(struct gensio_accepter *child,
+				   const char * const args[],
+				   struct gensio_os_funcs *o,
+				   gensio_accepter_event cb,
+				   void *user_data,
+				   struct gensio_accepter **accepter);
+
+int ratelimit_gensio_accepter_alloc(struct gensio_accepter *child,
+				    const char * const args[],
+				    struct gensio_os_funcs *o,
+				    gensio_accepter_event cb,
+				    void *user_data,
+				    struct gensio_accepter **accepter);
+
+int msgdelim_gensio_accepter_alloc(struct gensio_accepter *child,
+				   const char * const args[],
+				   struct gensio_os_funcs *o,
+				   gensio_accepter_event cb,
+				   void *user_data,
+				   struct gensio_accepter **accepter);
+
 int certauth_gensio_accepter_alloc(struct gensio_accepter *child,
 				   const char * const args[],
 				   struct gensio_os_funcs *o,
@@ -240,6 +289,21 @@ int ssl_gensio_alloc(struct gensio *child, const char * const args[],
 		     gensio_event cb, void *user_data,
 		     struct gensio **io);
 
+int compress_gensio_alloc(struct gensio *child, const char * const args[],
+			  struct gensio_os_funcs *o,
+			  gensio_event cb, void *user_data,
+			  struct gensio **net);
+
+int ratelimit_gensio_alloc(struct gensio *child, const char * const args[],
+			   struct gensio_os_funcs *o,
+			   gensio_event cb, void *user_data,
+			   struct gensio **net);
+
+int msgdelim_gensio_alloc(struct gensio *child, const char * const args[],
+			  struct gensio_os_funcs *o,
+			  gensio_event cb, void *user_data,
+			  struct gensio **net);
+
 int certauth_gensio_alloc(struct gensio *child, const char * const args[],
 			  struct gensio_os_funcs *o,
 			  gensio_event cb, void *user_data,
@@ -115,6 +115,69 @@ struct gensio_func_open_channel_data {
  */
 #define GENSIO_FUNC_OPEN_NOCHILD	14
 
+/*
+ * Write multiple messages at once.  Return GE_NOTSUP if the gensio
+ * can't do this, the caller will fall back to GENSIO_FUNC_WRITE_SG
+ * for each message.
+ *
+ * count => count
+ * msgs => buf
+ * nmsgs => buflen
+ */
+#define GENSIO_FUNC_WRITE_MSGS		15
+
+/*
+ * Get direct access to the file descriptor under a gensio, so data
+ * can be moved to and from it without going through user buffers.
+ * This is only supported for gensios that are a plain byte stream
+ * over an fd with nothing in between (no filter).  While read_ready
+ * is set, when the gensio's read callback is enabled and the fd is
+ * readable, read_ready is called instead of the gensio reading the
+ * data.  The read callback is disabled before read_ready is called.
+ * Pass a NULL read_ready to go back to normal operation.
+ *
+ * GE_INUSE is returned while the gensio is holding written data that
+ * has not gone to the fd yet (see gensio_write_queued() and
+ * write_coalesce_size), the user should use normal writes then.  A
+ * NULL read_ready is still cleared in that case.
+ *
+ * raw => buf
+ */
+struct gensio_raw_fd {
+    int fd; /* Returned */
+    void (*read_ready)(int fd, void *cb_data);
+    void *cb_data;
+};
+#define GENSIO_FUNC_RAW_FD		16
+
+/*
+ * Queue data to be written when the lower layer is ready, calling
+ * done when it has all been written or the write fails.  The data
+ * is not copied, it must stay around until done is called.  Return
+ * GE_NOTSUP if the gensio doesn't support this.
+ *
+ * req => buf
+ */
+struct gensio_write_queued_req {
+    const void *data;
+    gensiods datalen;
+    gensio_write_queued_done done;
+    void *done_data;
+};
+#define GENSIO_FUNC_WRITE_QUEUED	17
+
+/*
+ * Merge the filter gensios under this one into it, so the stack runs
+ * as one gensio with a chain of filters (see
+ * gensio_filter_chain_alloc()).  Only done before the gensio is
+ * opened, and only for gensios marked with base_gensio_set_fusable().
+ * The merged gensios are freed and the new child is returned.
+ * Returns GE_NOTSUP if there is nothing to merge.
+ *
+ * child => buf (struct gensio **)
+ */
+#define GENSIO_FUNC_FUSE		18
+
 typedef int (*gensio_func)(struct gensio *io, int func, gensiods *count,
 			   const void *cbuf, gensiods buflen, void *buf,
 			   const char *const *auxdata);
@@ -128,6 +191,9 @@ typedef int (*gensio_func)(struct gensio *io, int func, gensiods *count,
  */
 void gensio_ref(struct gensio *io);
 
+/* See GENSIO_FUNC_RAW_FD. */
+int gensio_raw_fd(struct gensio *io, struct gensio_raw_fd *raw);
+
 struct gensio *gensio_data_alloc(struct gensio_os_funcs *o,
 				 gensio_event cb, void *user_data,
 				 gensio_func func, struct gensio *child,
@@ -141,6 +207,7 @@ void gensio_set_is_reliable(struct gensio *io, bool is_reliable);
 void gensio_set_is_authenticated(struct gensio *io, bool is_authenticate);
 void gensio_set_is_encrypted(struct gensio *io, bool is_encrypted);
 void gensio_set_is_message(struct gensio *io, bool is_message);
+struct gensio_os_funcs *gensio_get_os_funcs(struct gensio *io);
 gensio_event gensio_get_cb(struct gensio *io);
 void gensio_set_cb(struct gensio *io, gensio_event cb, void *user_data);
 int gensio_cb(struct gensio *io, int event, int err,
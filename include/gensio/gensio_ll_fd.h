@@ -61,9 +61,20 @@ struct gensio_fd_ll_ops {
 
     void (*except_ready)(void *handler_data, int fd);
 
+    /*
+     * Optional, if gensio_fd_ll_watch_errqueue() has been called,
+     * this is called on an exception before except_ready.  Return
+     * true if something was handled from the fd's error queue.
+     */
+    bool (*errqueue_ready)(void *handler_data, int fd);
+
     int (*write)(void *handler_data, int fd, gensiods *count,
 		 const struct gensio_sg *sg, gensiods sglen,
 		 const char *const *auxdata);
+
+    /* Optional, write multiple messages in one operation. */
+    int (*write_msgs)(void *handler_data, int fd, gensiods *count,
+		      struct gensio_msg *msgs, gensiods nmsgs);
 };
 
 gensiods gensio_fd_ll_callback(struct gensio_ll *ll, int op, int val,
@@ -85,5 +96,51 @@ struct gensio_ll *fd_gensio_ll_alloc(struct gensio_os_funcs *o,
 				     gensiods max_read_size,
 				     bool write_only);
 
+/*
+ * If the ops have a retry_open, race connection attempts when
+ * opening.  If an attempt has not completed in msecs milliseconds,
+ * retry_open is called to start another one in parallel, and the
+ * first to complete is used.  Zero (the default) disables this, and
+ * retry_open is only called when an attempt fails.  Each fd returned
+ * by sub_open and retry_open is passed to check_open when it
+ * completes.
+ */
+void gensio_fd_ll_set_open_stagger(struct gensio_ll *ll, unsigned int msecs);
+
+/*
+ * The fd will get messages on its error queue (like MSG_ZEROCOPY
+ * completions) that must be handled even if reads are disabled.  Keep
+ * the except handler enabled while the fd is open and call the
+ * errqueue_ready op from it.
+ */
+void gensio_fd_ll_watch_errqueue(struct gensio_ll *ll);
+
+/*
+ * The fd is a plain byte stream, allow the user to get at it directly
+ * with GENSIO_FUNC_RAW_FD (see gensio_class.h).  Only set this if the
+ * ops don't do anything to the data on a normal read or write.
+ */
+void gensio_fd_ll_allow_raw(struct gensio_ll *ll);
+
+/*
+ * When the fd is readable, keep reading and delivering data until
+ * budget bytes have been read, the fd runs out of data, or the user
+ * doesn't take all the data.  This saves a trip through the selector
+ * for each buffer on a busy fd while still letting other fds run.
+ * Zero (the default) does one read each time the fd is readable.
+ */
+void gensio_fd_ll_set_read_budget(struct gensio_ll *ll, gensiods budget);
+
+/*
+ * Let the read buffer size float between min and max.  The buffer
+ * is doubled when reads keep filling it and halved when reads keep
+ * using only a small part of it.  It starts at the max_read_size
+ * passed to fd_gensio_ll_alloc().  If max is not greater than min,
+ * the buffer size stays fixed (the default).  The current size is
+ * available from the GENSIO_CONTROL_READ_BUFFER_SIZE control.
+ */
+void gensio_fd_ll_set_read_size_range(struct gensio_ll *ll,
+				      gensiods min, gensiods max);
+
 
 #endif /* GENSIO_LL_FD_H */
@@ -192,7 +192,9 @@ struct gensio_os_funcs {
 
     /*
      * Run a runner.  Return EBUSY if the runner is already scheduled
-     * to run.
+     * to run.  A runner scheduled from a callback runs before the
+     * service call that made the callback returns; otherwise a
+     * thread waiting in the os handler is woken to run it.
      */
     int (*run)(struct gensio_runner *runner);
 
@@ -272,6 +274,22 @@ struct gensio_os_funcs {
      * an error, the child is likely to be unusable.
      */
     int (*handle_fork)(struct gensio_os_funcs *f);
+
+    /****** Fibers ******/
+    /*
+     * Run func in a new fiber with its own stack of stack_size bytes
+     * (0 for the default).  The fiber runs from the threads servicing
+     * the os handler.  When code in the fiber calls wait() or
+     * wait_intr(), the fiber is suspended and the thread goes back to
+     * handling events instead of blocking, so synchronous code (like
+     * gensio_open_s() and gensio_read_s()) can run in many fibers on
+     * a few threads.  A suspended fiber may be resumed in a different
+     * thread, so it must not hold a lock while it waits.  The fiber
+     * ends when func returns.  This may be NULL, or return
+     * GE_NOTSUP, if the os handler doesn't support fibers.
+     */
+    int (*start_fiber)(struct gensio_os_funcs *f, unsigned int stack_size,
+		       void (*func)(void *cb_data), void *cb_data);
 };
 
 void gensio_vlog(struct gensio_os_funcs *o, enum gensio_log_levels level,
@@ -34,6 +34,15 @@ int gensio_os_write(struct gensio_os_funcs *o,
 int gensio_os_read(struct gensio_os_funcs *o,
 		   int fd, void *buf, gensiods buflen, gensiods *rcount);
 
+/*
+ * Move up to len bytes from fd_in to fd_out with splice().  One of
+ * the fds must be a pipe.  Like gensio_os_read(), end of file on
+ * fd_in is returned as an error and a zero rcount means nothing could
+ * be moved right now.
+ */
+int gensio_os_splice(struct gensio_os_funcs *o,
+		     int fd_in, int fd_out, gensiods len, gensiods *rcount);
+
 int gensio_os_recv(struct gensio_os_funcs *o,
 		   int fd, void *buf, gensiods buflen, gensiods *rcount,
 		   int flags);
@@ -47,10 +56,36 @@ int gensio_os_sendto(struct gensio_os_funcs *o,
 		     gensiods *rcount, int flags,
 		     const struct sockaddr *raddr,socklen_t raddrlen);
 
+/*
+ * Send multiple messages with sendmmsg().  The count and err for each
+ * message is filled in.  rcount is set to the number of messages
+ * sent.  If an error occurs, the error is returned and rcount is the
+ * index of the message that failed.
+ */
+int gensio_os_sendmmsg(struct gensio_os_funcs *o,
+		       int fd, struct gensio_msg *msgs, gensiods nmsgs,
+		       gensiods *rcount, int flags,
+		       const struct sockaddr *raddr, socklen_t raddrlen);
+
 int gensio_os_recvfrom(struct gensio_os_funcs *o,
 		       int fd, void *buf, gensiods buflen, gensiods *rcount,
 		       int flags, struct sockaddr *raddr, socklen_t *raddrlen);
 
+/*
+ * Like gensio_os_recvfrom(), but if the data was coalesced by UDP
+ * GRO, the size of each datagram in the data is returned in segsize.
+ * segsize is set to zero if the data is a single datagram.
+ */
+int gensio_os_recvfrom_gro(struct gensio_os_funcs *o,
+			   int fd, void *buf, gensiods buflen,
+			   gensiods *rcount, int flags,
+			   struct sockaddr *raddr, socklen_t *raddrlen,
+			   gensiods *segsize);
+
+/*
+ * Accept a connection.  The new socket is already non-blocking and
+ * close-on-exec.  Returns GE_NODATA if no connection is pending.
+ */
 int gensio_os_accept(struct gensio_os_funcs *o,
 		     int fd, struct sockaddr *addr, socklen_t *addrlen,
 		     int *newsock);
@@ -64,6 +99,30 @@ int gensio_os_sctp_send(struct gensio_os_funcs *o,
 			gensiods *rcount,
                         const struct sctp_sndrcvinfo *sinfo, uint32_t flags);
 
+/*
+ * Like gensio_os_sendmmsg(), but each message gets the corresponding
+ * sinfo from the sinfo array.
+ */
+int gensio_os_sctp_sendmmsg(struct gensio_os_funcs *o,
+			    int fd, struct gensio_msg *msgs, gensiods nmsgs,
+			    gensiods *rcount,
+			    const struct sctp_sndrcvinfo *sinfo);
+
+/*
+ * Like getaddrinfo(), but the result is allocated with the os funcs
+ * and must be freed with gensio_free_addrinfo().  Host name results
+ * are cached for the time given in the "dns_ttl" default.  If the
+ * "dns_hosts" default is set, that file (in hosts(5) format) is
+ * checked before the system resolver.
+ */
+int gensio_os_getaddrinfo(struct gensio_os_funcs *o,
+			  const char *node, const char *service,
+			  const struct addrinfo *hints,
+			  struct addrinfo **rai);
+
+/* Throw away everything in the DNS cache. */
+void gensio_os_dns_flush(struct gensio_os_funcs *o);
+
 int gensio_setupnewprog(void);
 
 int gensio_setup_child_on_pty(struct gensio_os_funcs *o,
@@ -73,6 +132,20 @@ int gensio_setup_child_on_pty(struct gensio_os_funcs *o,
 int gensio_get_random(struct gensio_os_funcs *o,
 		      void *data, unsigned int len);
 
+/*
+ * Flags for gensio_open_socket() and gensio_setup_listen_socket().
+ *
+ * GENSIO_OPENSOCK_REUSEPORT - Set SO_REUSEPORT on the socket, so
+ *   other sockets can bind to the same address.
+ *
+ * GENSIO_OPENSOCK_FASTOPEN(qlen) - Enable TCP fast open on stream
+ *   listening sockets, allowing up to qlen (max 65535) pending fast
+ *   open requests.  A qlen of 0 leaves it disabled.
+ */
+#define GENSIO_OPENSOCK_REUSEPORT	(1 << 0)
+#define GENSIO_OPENSOCK_FASTOPEN(qlen)	(((qlen) & 0xffff) << 16)
+#define GENSIO_OPENSOCK_FASTOPEN_QLEN(flags) (((flags) >> 16) & 0xffff)
+
 struct opensocks
 {
     int fd;
@@ -94,9 +167,25 @@ int gensio_open_socket(struct gensio_os_funcs *o,
 		       void (*readhndlr)(int, void *),
 		       void (*writehndlr)(int, void *),
 		       void (*fd_handler_cleared)(int, void *),
-		       void *data,
+		       void *data, unsigned int opensock_flags,
 		       struct opensocks **socks, unsigned int *nr_fds);
 
+/*
+ * Like gensio_open_socket(), but open nr_per_addr sockets for each
+ * address, all bound to the same address with SO_REUSEPORT so the
+ * kernel spreads incoming connections across them.  If the port is
+ * dynamically assigned, the additional sockets get the port assigned
+ * to the first one.
+ */
+int gensio_open_socket_multi(struct gensio_os_funcs *o,
+			     struct addrinfo *ai,
+			     void (*readhndlr)(int, void *),
+			     void (*writehndlr)(int, void *),
+			     void (*fd_handler_cleared)(int, void *),
+			     void *data, unsigned int opensock_flags,
+			     unsigned int nr_per_addr,
+			     struct opensocks **socks, unsigned int *nr_fds);
+
 /*
  * Setup a receiving socket given the socket() parameters.  If do_listen
  * is true, call listen on the socket.  This sets nonblocking, reuse,
@@ -110,7 +199,7 @@ int gensio_setup_listen_socket(struct gensio_os_funcs *o, bool do_listen,
 			       void (*writehndlr)(int, void *), void *data,
 			       void (*fd_handler_cleared)(int, void *),
 			       int (*call_b4_listen)(int, void *),
-			       int *rfd);
+			       unsigned int opensock_flags, int *rfd);
 
 /* Returns a NULL if the fd is ok, a non-NULL error string if not */
 const char *gensio_check_tcpd_ok(int new_fd);
@@ -22,6 +22,7 @@
 #ifndef WAITER_H
 #define WAITER_H
 
+#include <stdbool.h>
 #include <gensio/selector.h>
 
 typedef struct waiter_s waiter_t;
@@ -42,4 +43,10 @@ int wait_for_waiter_intr(waiter_t *waiter, unsigned int count);
 
 void wake_waiter(waiter_t *waiter);
 
+/*
+ * Take count wakeups if they are there, without waiting.  Returns
+ * true if they were taken.
+ */
+bool try_wait_for_waiter(waiter_t *waiter, unsigned int count);
+
 #endif /* WAITER_H */
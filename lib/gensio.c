@@ -32,12 +32,18 @@
 #ifdef HAVE_LIBSCTP
 #include <netinet/sctp.h>
 #endif
+#ifdef USE_PTHREADS
+#include <pthread.h>
+#endif
 
 #include <gensio/gensio.h>
 #include <gensio/gensio_builtins.h>
 #include <gensio/gensio_class.h>
+#include <gensio/gensio_osops.h>
 
 #include "utils.h"
+#include "gensio_pool.h"
+#include "gensio_sendfile.h"
 
 static unsigned int gensio_log_mask =
     (1 << GENSIO_LOG_FATAL) | (1 << GENSIO_LOG_ERR);
@@ -111,6 +117,18 @@ struct gensio {
 
     struct gensio_sync_io *sync_io;
 
+    /*
+     * Ring data left over from gensio_clear_sync(), delivered before
+     * any new read data.
+     */
+    struct gensio_sync_io *readahead;
+
+    /* If allocated by a pool, the pool's data for this gensio. */
+    void *pool_data;
+
+    /* A gensio_sendfile() in progress, it gets the write ready events. */
+    void *sendfile_data;
+
     struct gensio_link pending_link;
 };
 
@@ -142,11 +160,17 @@ gensio_data_alloc(struct gensio_os_funcs *o,
     return io;
 }
 
+static void gensio_sync_io_free(struct gensio_os_funcs *o,
+				struct gensio_sync_io *sync_io);
+
 void
 gensio_data_free(struct gensio *io)
 {
     assert(gensio_list_empty(&io->waiters));
 
+    if (io->readahead)
+	gensio_sync_io_free(io->o, io->readahead);
+
     while (io->classes) {
 	struct gensio_classobj *c = io->classes;
 
@@ -163,6 +187,41 @@ gensio_get_gensio_data(struct gensio *io)
     return io->gensio_data;
 }
 
+void
+gensio_set_pool_data(struct gensio *io, void *pool_data)
+{
+    io->pool_data = pool_data;
+}
+
+void *
+gensio_get_pool_data(struct gensio *io)
+{
+    return io->pool_data;
+}
+
+int
+gensio_set_sendfile_data(struct gensio *io, void *sendfile_data)
+{
+    int err = 0;
+
+    io->o->lock(io->lock);
+    if (sendfile_data && io->sendfile_data)
+	err = GE_INUSE;
+    else if (!sendfile_data && !io->sendfile_data)
+	err = GE_NOTREADY;
+    else
+	io->sendfile_data = sendfile_data;
+    io->o->unlock(io->lock);
+
+    return err;
+}
+
+struct gensio_os_funcs *
+gensio_get_os_funcs(struct gensio *io)
+{
+    return io->o;
+}
+
 gensio_event
 gensio_get_cb(struct gensio *io)
 {
@@ -180,14 +239,19 @@ gensio_cb(struct gensio *io, int event, int err,
 	  unsigned char *buf, gensiods *buflen, const char *const *auxdata)
 {
     struct gensio_os_funcs *o = io->o;
+    void *sendfile_data;
     int rv;
 
     if (!io->cb)
 	return GE_NOTSUP;
     o->lock(io->lock);
     io->cb_count++;
+    sendfile_data = io->sendfile_data;
     o->unlock(io->lock);
-    rv = io->cb(io, io->user_data, event, err, buf, buflen, auxdata);
+    if (event == GENSIO_EVENT_WRITE_READY && sendfile_data)
+	rv = gensio_sendfile_write_ready(sendfile_data);
+    else
+	rv = io->cb(io, io->user_data, event, err, buf, buflen, auxdata);
     o->lock(io->lock);
     assert(io->cb_count > 0);
     io->cb_count--;
@@ -374,7 +438,7 @@ scan_ips(struct gensio_os_funcs *o, const char *str, bool listen, int ifamily,
 	 int socktype, int protocol, bool *is_port_set, struct addrinfo **rai)
 {
     char *strtok_data, *strtok_buffer;
-    struct addrinfo hints, *ai = NULL, *ai2 = NULL, *ai3, *ai4;
+    struct addrinfo hints, *ai2 = NULL, *ai3 = NULL, *ai4;
     char *ip;
     char *port;
     int portnum;
@@ -424,8 +488,10 @@ scan_ips(struct gensio_os_funcs *o, const char *str, bool listen, int ifamily,
 	hints.ai_family = family;
 	hints.ai_socktype = socktype;
 	hints.ai_protocol = protocol;
-	if (getaddrinfo(ip, port, &hints, &ai)) {
-	    rv = GE_INVAL;
+	rv = gensio_os_getaddrinfo(o, ip, port, &hints, &ai3);
+	if (rv) {
+	    if (rv != GE_NOMEM)
+		rv = GE_INVAL;
 	    goto out_err;
 	}
 
@@ -433,7 +499,7 @@ scan_ips(struct gensio_os_funcs *o, const char *str, bool listen, int ifamily,
 	 * If a port was/was not set, this must be consistent for all
 	 * addresses.
 	 */
-	portnum = gensio_sockaddr_get_port(ai->ai_addr);
+	portnum = gensio_sockaddr_get_port(ai3->ai_addr);
 	if (portnum == -1) {
 	    /* Not AF_INET or AF_INET6. */
 	    rv = GE_INVAL;
@@ -449,12 +515,6 @@ scan_ips(struct gensio_os_funcs *o, const char *str, bool listen, int ifamily,
 	    }
 	}
 
-	ai3 = gensio_dup_addrinfo(o, ai);
-	if (!ai3) {
-	    rv = GE_NOMEM;
-	    goto out_err;
-	}
-
 	for (ai4 = ai3; ai4; ai4 = ai4->ai_next)
 	    ai4->ai_flags = rflags;
 
@@ -462,6 +522,7 @@ scan_ips(struct gensio_os_funcs *o, const char *str, bool listen, int ifamily,
 	    ai2 = gensio_cat_addrinfo(o, ai2, ai3);
 	else
 	    ai2 = ai3;
+	ai3 = NULL;
 	ip = strtok_r(NULL, ",", &strtok_data);
 	first = false;
     }
@@ -477,8 +538,8 @@ scan_ips(struct gensio_os_funcs *o, const char *str, bool listen, int ifamily,
     *rai = ai2;
 
  out_err:
-    if (ai)
-	freeaddrinfo(ai);
+    if (ai3)
+	gensio_free_addrinfo(o, ai3);
     o->free(o, strtok_buffer);
     if (rv && ai2)
 	gensio_free_addrinfo(o, ai2);
@@ -672,6 +733,80 @@ gensio_write_sg(struct gensio *io, gensiods *count,
     return io->func(io, GENSIO_FUNC_WRITE_SG, count, sg, sglen, NULL, auxdata);
 }
 
+static gensiods
+gensio_msg_len(const struct gensio_msg *msg)
+{
+    gensiods i, len = 0;
+
+    for (i = 0; i < msg->sglen; i++)
+	len += msg->sg[i].buflen;
+    return len;
+}
+
+int
+gensio_raw_fd(struct gensio *io, struct gensio_raw_fd *raw)
+{
+    return io->func(io, GENSIO_FUNC_RAW_FD, NULL, NULL, 0, raw, NULL);
+}
+
+int
+gensio_write_queued(struct gensio *io, const void *data, gensiods datalen,
+		    gensio_write_queued_done done, void *done_data)
+{
+    struct gensio_write_queued_req req;
+
+    if (!done)
+	return GE_INVAL;
+
+    req.data = data;
+    req.datalen = datalen;
+    req.done = done;
+    req.done_data = done_data;
+    return io->func(io, GENSIO_FUNC_WRITE_QUEUED, NULL, NULL, 0, &req, NULL);
+}
+
+int
+gensio_write_msgs(struct gensio *io, gensiods *count,
+		  struct gensio_msg *msgs, gensiods nmsgs)
+{
+    gensiods i;
+    int rv;
+
+    for (i = 0; i < nmsgs; i++) {
+	msgs[i].count = 0;
+	msgs[i].err = 0;
+    }
+
+    if (nmsgs == 0) {
+	if (count)
+	    *count = 0;
+	return 0;
+    }
+
+    rv = io->func(io, GENSIO_FUNC_WRITE_MSGS, count, NULL, nmsgs, msgs, NULL);
+    if (rv != GE_NOTSUP)
+	return rv;
+
+    /*
+     * The gensio can't do this itself, do one write per message.
+     * Stop on an error or anything that doesn't fully go out, the
+     * user has to handle flow control from there.
+     */
+    for (i = 0; i < nmsgs; i++) {
+	rv = gensio_write_sg(io, &msgs[i].count, msgs[i].sg, msgs[i].sglen,
+			     msgs[i].auxdata);
+	if (rv) {
+	    msgs[i].err = rv;
+	    break;
+	}
+	if (msgs[i].count < gensio_msg_len(&msgs[i]))
+	    break;
+    }
+    if (count)
+	*count = i;
+    return rv;
+}
+
 int
 gensio_raddr_to_str(struct gensio *io, gensiods *pos,
 		    char *buf, gensiods buflen)
@@ -806,6 +941,13 @@ gensio_control(struct gensio *io, int depth, bool get,
 {
     struct gensio *c = io;
 
+    if (option == GENSIO_CONTROL_POOL_STATS) {
+	/* Handled here, the pool is not part of the gensio stack. */
+	if (!io->pool_data)
+	    return GE_NOTSUP;
+	return gensio_pool_stats(io->pool_data, get, data, datalen);
+    }
+
     if (depth == GENSIO_CONTROL_DEPTH_ALL) {
 	if (get)
 	    return GE_INVAL;
@@ -876,6 +1018,15 @@ gensio_get_child(struct gensio *io, unsigned int depth)
 int
 gensio_close(struct gensio *io, gensio_done close_done, void *close_data)
 {
+    void *sendfile_data;
+
+    io->o->lock(io->lock);
+    sendfile_data = io->sendfile_data;
+    io->sendfile_data = NULL;
+    io->o->unlock(io->lock);
+    if (sendfile_data)
+	gensio_sendfile_abort(sendfile_data);
+
     return io->func(io, GENSIO_FUNC_CLOSE, NULL, close_done, 0, close_data,
 		    NULL);
 }
@@ -928,9 +1079,14 @@ gensio_free(struct gensio *io)
     io->func(io, GENSIO_FUNC_FREE, NULL, NULL, 0, NULL, NULL);
 }
 
+static bool gensio_readahead_set_read_enable(struct gensio *io,
+					     bool enabled);
+
 void
 gensio_set_read_callback_enable(struct gensio *io, bool enabled)
 {
+    if (io->readahead && gensio_readahead_set_read_enable(io, enabled))
+	return;
     io->func(io, GENSIO_FUNC_SET_READ_CALLBACK, NULL, NULL, enabled, NULL,
 	     NULL);
 }
@@ -1113,8 +1269,8 @@ gensio_acc_control(struct gensio_accepter *acc, int depth, bool get,
 	if (get)
 	    return GE_INVAL;
 	while (c) {
-	    int rv = c->func(c, GENSIO_ACC_FUNC_CONTROL, get, NULL, NULL,
-			     data, NULL, datalen);
+	    int rv = c->func(c, GENSIO_ACC_FUNC_CONTROL, get,
+			     (const char *) &option, NULL, data, NULL, datalen);
 
 	    if (rv && rv != GE_NOTSUP)
 		return rv;
@@ -1125,8 +1281,8 @@ gensio_acc_control(struct gensio_accepter *acc, int depth, bool get,
 
     if (depth == GENSIO_CONTROL_DEPTH_FIRST) {
 	while (c) {
-	    int rv = c->func(c, GENSIO_ACC_FUNC_CONTROL, get, NULL, NULL,
-			     data, NULL, datalen);
+	    int rv = c->func(c, GENSIO_ACC_FUNC_CONTROL, get,
+			     (const char *) &option, NULL, data, NULL, datalen);
 
 	    if (rv != GE_NOTSUP)
 		return rv;
@@ -1145,8 +1301,8 @@ gensio_acc_control(struct gensio_accepter *acc, int depth, bool get,
 	c = c->child;
     }
 
-    return c->func(c, GENSIO_ACC_FUNC_CONTROL, get, NULL, NULL,
-		   data, NULL, datalen);
+    return c->func(c, GENSIO_ACC_FUNC_CONTROL, get, (const char *) &option,
+		   NULL, data, NULL, datalen);
 }
 
 void
@@ -1287,6 +1443,15 @@ add_default_gensio_accepters(void *cb_data)
     register_gensio_accepter(o, "stdio", str_to_stdio_gensio_accepter);
     register_filter_gensio_accepter(o, "ssl", str_to_ssl_gensio_accepter,
 				    ssl_gensio_accepter_alloc);
+    register_filter_gensio_accepter(o, "compress",
+				    str_to_compress_gensio_accepter,
+				    compress_gensio_accepter_alloc);
+    register_filter_gensio_accepter(o, "ratelimit",
+				    str_to_ratelimit_gensio_accepter,
+				    ratelimit_gensio_accepter_alloc);
+    register_filter_gensio_accepter(o, "msgdelim",
+				    str_to_msgdelim_gensio_accepter,
+				    msgdelim_gensio_accepter_alloc);
     register_filter_gensio_accepter(o, "certauth",
 				    str_to_certauth_gensio_accepter,
 				    certauth_gensio_accepter_alloc);
@@ -1455,6 +1620,12 @@ add_default_gensios(void *cb_data)
     register_gensio(o, "stdio", str_to_stdio_gensio);
     register_gensio(o, "pty", str_to_pty_gensio);
     register_filter_gensio(o, "ssl", str_to_ssl_gensio, ssl_gensio_alloc);
+    register_filter_gensio(o, "compress", str_to_compress_gensio,
+			   compress_gensio_alloc);
+    register_filter_gensio(o, "ratelimit", str_to_ratelimit_gensio,
+			   ratelimit_gensio_alloc);
+    register_filter_gensio(o, "msgdelim", str_to_msgdelim_gensio,
+			   msgdelim_gensio_alloc);
     register_filter_gensio(o, "certauth", str_to_certauth_gensio,
 			   certauth_gensio_alloc);
     register_filter_gensio(o, "telnet", str_to_telnet_gensio,
@@ -1496,6 +1667,25 @@ register_gensio(struct gensio_os_funcs *o,
     return register_filter_gensio(o, name, handler, NULL);
 }
 
+/*
+ * If asked to, merge the filter gensios of a new stack into the top
+ * one.  This is only done here, where nobody else can have a
+ * reference to the gensios under the top.
+ */
+static void
+gensio_fuse(struct gensio_os_funcs *o, struct gensio *io)
+{
+    struct gensio *child;
+    int ival;
+
+    if (gensio_get_default(o, io->typename, "fuse_filters", false,
+			   GENSIO_DEFAULT_BOOL, NULL, &ival) || !ival)
+	return;
+
+    if (io->func(io, GENSIO_FUNC_FUSE, NULL, NULL, 0, &child, NULL) == 0)
+	io->child = child;
+}
+
 int
 str_to_gensio(const char *str,
 	      struct gensio_os_funcs *o,
@@ -1526,6 +1716,8 @@ str_to_gensio(const char *str,
 	    err = r->handler(str, args, o, cb, user_data, gensio);
 	if (args)
 	    gensio_argv_free(o, args);
+	if (!err)
+	    gensio_fuse(o, *gensio);
 	return err;
     }
 
@@ -1560,6 +1752,158 @@ str_to_gensio(const char *str,
     return err;
 }
 
+struct str_to_gensio_async_data {
+    struct gensio_os_funcs *o;
+    char *str;
+    gensio_event cb;
+    void *user_data;
+    gensio_done_err done;
+    void *done_data;
+    struct gensio_timer *timer;
+    struct gensio *io;
+    int err;
+    struct str_to_gensio_async_data *next;
+};
+
+static void
+str_to_gensio_async_done(struct gensio_timer *t, void *cb_data)
+{
+    struct str_to_gensio_async_data *d = cb_data;
+    struct gensio_os_funcs *o = d->o;
+
+    d->done(d->io, d->err, d->done_data);
+    o->free_timer(d->timer);
+    o->free(o, d->str);
+    o->free(o, d);
+}
+
+static void
+str_to_gensio_async_alloc(struct str_to_gensio_async_data *d)
+{
+    struct timeval zerotime = { 0, 0 };
+
+    d->err = str_to_gensio(d->str, d->o, d->cb, d->user_data, &d->io);
+    if (d->err)
+	d->io = NULL;
+
+    /* Report from the os handler, timers wake up the selector. */
+    d->o->start_timer(d->timer, &zerotime);
+}
+
+#ifdef USE_PTHREADS
+/*
+ * Name lookups may block for a long time, so async allocations are
+ * queued to resolver threads.  The number of threads is capped by the
+ * "dns_threads" default, a thread exits when it finds the queue empty.
+ */
+static pthread_mutex_t async_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct str_to_gensio_async_data *async_head, *async_tail;
+static unsigned int async_nthreads;
+
+static void *
+str_to_gensio_async_thread(void *data)
+{
+    struct str_to_gensio_async_data *d;
+
+    pthread_mutex_lock(&async_lock);
+    while (async_head) {
+	d = async_head;
+	async_head = d->next;
+	if (!async_head)
+	    async_tail = NULL;
+	pthread_mutex_unlock(&async_lock);
+	str_to_gensio_async_alloc(d);
+	pthread_mutex_lock(&async_lock);
+    }
+    async_nthreads--;
+    pthread_mutex_unlock(&async_lock);
+    return NULL;
+}
+
+static int
+str_to_gensio_async_queue(struct str_to_gensio_async_data *d)
+{
+    struct gensio_os_funcs *o = d->o;
+    pthread_attr_t attr;
+    pthread_t thread;
+    int max_threads = 4, rv = 0;
+
+    gensio_get_default(o, NULL, "dns_threads", false, GENSIO_DEFAULT_INT,
+		       NULL, &max_threads);
+
+    pthread_mutex_lock(&async_lock);
+    if (async_tail)
+	async_tail->next = d;
+    else
+	async_head = d;
+    async_tail = d;
+    if (async_nthreads < (unsigned int) max_threads) {
+	rv = pthread_attr_init(&attr);
+	if (rv == 0) {
+	    pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+	    rv = pthread_create(&thread, &attr, str_to_gensio_async_thread,
+				NULL);
+	    pthread_attr_destroy(&attr);
+	}
+	if (rv == 0) {
+	    async_nthreads++;
+	} else if (async_nthreads > 0) {
+	    /* A running thread will get to it. */
+	    rv = 0;
+	} else {
+	    /* Nothing to run it, take it back off the queue. */
+	    async_head = async_tail = NULL;
+	}
+    }
+    pthread_mutex_unlock(&async_lock);
+
+    return rv;
+}
+#endif
+
+int
+str_to_gensio_async(const char *str,
+		    struct gensio_os_funcs *o,
+		    gensio_event cb, void *user_data,
+		    gensio_done_err done, void *done_data)
+{
+    struct str_to_gensio_async_data *d;
+
+    if (!done)
+	return GE_INVAL;
+
+    d = o->zalloc(o, sizeof(*d));
+    if (!d)
+	return GE_NOMEM;
+    d->o = o;
+    d->cb = cb;
+    d->user_data = user_data;
+    d->done = done;
+    d->done_data = done_data;
+
+    d->str = gensio_strdup(o, str);
+    if (!d->str)
+	goto out_nomem;
+
+    d->timer = o->alloc_timer(o, str_to_gensio_async_done, d);
+    if (!d->timer)
+	goto out_nomem;
+
+#ifdef USE_PTHREADS
+    if (str_to_gensio_async_queue(d) == 0)
+	return 0;
+    /* Couldn't start a thread, just do it here. */
+#endif
+    str_to_gensio_async_alloc(d);
+    return 0;
+
+ out_nomem:
+    if (d->str)
+	o->free(o, d->str);
+    o->free(o, d);
+    return GE_NOMEM;
+}
+
 int
 str_to_gensio_child(struct gensio *child,
 		    const char *str,
@@ -1987,11 +2331,93 @@ struct gensio_def_entry builtin_defaults[] = {
     /* Defaults for TCP, UDP, and SCTP. */
     { "nodelay",	GENSIO_DEFAULT_BOOL,	.def.intval = 0 },
     { "laddr",		GENSIO_DEFAULT_STR,	.def.strval = NULL },
+    /* fd based gensios (tcp, sctp, pty, serialdev) */
+    { "read_budget",	GENSIO_DEFAULT_INT,	.min = 0, .max = INT_MAX,
+						.def.intval = 65536 },
+    { "readbuf_min",	GENSIO_DEFAULT_INT,	.min = 1, .max = INT_MAX,
+						.def.intval = 1024 },
+    { "readbuf_max",	GENSIO_DEFAULT_INT,	.min = 0, .max = INT_MAX,
+						.def.intval = 0 },
+    /* Write buffering, for all gensios, the class is the gensio type. */
+    { "write_coalesce",	GENSIO_DEFAULT_INT,	.min = 0, .max = INT_MAX,
+						.def.intval = 0 },
+    { "write_coalesce_size", GENSIO_DEFAULT_INT, .min = 1, .max = INT_MAX,
+						.def.intval = 16384 },
+    { "write_high_water", GENSIO_DEFAULT_INT,	.min = 0, .max = INT_MAX,
+						.def.intval = 0 },
+    { "write_low_water", GENSIO_DEFAULT_INT,	.min = 0, .max = INT_MAX,
+						.def.intval = 0 },
+    /* Name resolution */
+    { "dns_ttl",	GENSIO_DEFAULT_INT,	.min = 0, .max = INT_MAX,
+						.def.intval = 0 },
+    { "dns_threads",	GENSIO_DEFAULT_INT,	.min = 1, .max = 64,
+						.def.intval = 4 },
+    { "dns_hosts",	GENSIO_DEFAULT_STR,	.def.strval = NULL },
+    /* tcp */
+    { "connect_stagger", GENSIO_DEFAULT_INT,	.min = 0, .max = INT_MAX,
+						.def.intval = 250 },
+    { "listeners",	GENSIO_DEFAULT_INT,	.min = 1, .max = 64,
+						.def.intval = 1 },
+    { "zerocopy",	GENSIO_DEFAULT_INT,	.min = 0, .max = INT_MAX,
+						.def.intval = 0 },
+    { "fastopen",	GENSIO_DEFAULT_INT,	.min = 0, .max = 65535,
+						.def.intval = 0 },
+    /* -1 for sndbuf means size it automatically. */
+    { "sndbuf",		GENSIO_DEFAULT_INT,	.min = -1, .max = INT_MAX,
+						.def.intval = 0 },
+    { "rcvbuf",		GENSIO_DEFAULT_INT,	.min = 0, .max = INT_MAX,
+						.def.intval = 0 },
+    { "notsent_lowat",	GENSIO_DEFAULT_INT,	.min = 0, .max = INT_MAX,
+						.def.intval = 0 },
+    { "cork",		GENSIO_DEFAULT_BOOL,	.def.intval = 0 },
+    { "quickack",	GENSIO_DEFAULT_BOOL,	.def.intval = 0 },
+    { "busy_poll",	GENSIO_DEFAULT_INT,	.min = 0, .max = INT_MAX,
+						.def.intval = 0 },
+    { "user_timeout",	GENSIO_DEFAULT_INT,	.min = 0, .max = INT_MAX,
+						.def.intval = 0 },
+    /* tcp and sctp */
+    { "accept_budget",	GENSIO_DEFAULT_INT,	.min = 1, .max = INT_MAX,
+						.def.intval = 32 },
+    /* udp */
+    { "gro",		GENSIO_DEFAULT_BOOL,	.def.intval = 0 },
+    { "gso",		GENSIO_DEFAULT_INT,	.min = 0, .max = 65507,
+						.def.intval = 0 },
+    { "peersock",	GENSIO_DEFAULT_BOOL,	.def.intval = 0 },
     /* sctp */
     { "instreams",	GENSIO_DEFAULT_INT,	.min = 1, .max = INT_MAX,
 						.def.intval = 1 },
     { "ostreams",	GENSIO_DEFAULT_INT,	.min = 1, .max = INT_MAX,
 						.def.intval = 1 },
+    /* Connection pools */
+    { "max_idle",	GENSIO_DEFAULT_INT,	.min = 0, .max = INT_MAX,
+						.def.intval = 8 },
+    { "max_total",	GENSIO_DEFAULT_INT,	.min = 0, .max = INT_MAX,
+						.def.intval = 0 },
+    { "idle_timeout",	GENSIO_DEFAULT_INT,	.min = 0, .max = INT_MAX,
+						.def.intval = 60 },
+    /* Filter gensios */
+    { "fuse_filters",	GENSIO_DEFAULT_BOOL,	.def.intval = 0 },
+    /* compress */
+    { "level",		GENSIO_DEFAULT_INT,	.min = 0, .max = 9,
+						.def.intval = 6 },
+    { "flush_delay",	GENSIO_DEFAULT_INT,	.min = 0, .max = INT_MAX,
+						.def.intval = 0 },
+    /* ratelimit, rates are in bytes per second, 0 is unlimited */
+    { "read_rate",	GENSIO_DEFAULT_INT,	.min = 0, .max = INT_MAX,
+						.def.intval = 0 },
+    { "write_rate",	GENSIO_DEFAULT_INT,	.min = 0, .max = INT_MAX,
+						.def.intval = 0 },
+    { "burst",		GENSIO_DEFAULT_INT,	.min = 0, .max = INT_MAX,
+						.def.intval = 0 },
+    /* msgdelim */
+    { "maxmsg",		GENSIO_DEFAULT_INT,	.min = 1, .max = INT_MAX,
+						.def.intval = 65536 },
+    /* Relays */
+    { "splice",		GENSIO_DEFAULT_BOOL,	.def.intval = 1 },
+    /* File transfers */
+    { "bufsize",	GENSIO_DEFAULT_INT,	.min = 1, .max = INT_MAX,
+						.def.intval = 262144 },
+    { "use_sendfile",	GENSIO_DEFAULT_BOOL,	.def.intval = 1 },
     /* serialdev */
     { "rtscts",		GENSIO_DEFAULT_BOOL,	.def.intval = 0 },
     { "local",		GENSIO_DEFAULT_BOOL,	.def.intval = 0 },
@@ -2590,6 +3016,15 @@ struct gensio_sync_op {
     int err;
     struct gensio_waiter *waiter;
     struct gensio_link link;
+
+    /*
+     * For reads, pos is how much has been read into buf.  The read
+     * is done when pos reaches minlen, when the delimiter is read (if
+     * delim is not -1), or when buf is full.
+     */
+    gensiods pos;
+    gensiods minlen;
+    int delim;
 };
 
 struct gensio_sync_io {
@@ -2601,6 +3036,26 @@ struct gensio_sync_io {
 
     struct gensio_lock *lock;
     struct gensio_waiter *close_waiter;
+
+    /*
+     * If ring_size is not zero, data is read ahead into the ring so
+     * a read event can satisfy many reads.  Read ops are only waiting
+     * when the ring is empty.
+     */
+    unsigned char *ring;
+    gensiods ring_size;
+    gensiods ring_start;
+    gensiods ring_len;
+
+    /*
+     * After gensio_clear_sync(), data left in the ring is delivered
+     * to the user from this runner while the user has reads enabled.
+     * The lower gensio's reads stay disabled until the ring is empty.
+     */
+    struct gensio_runner *ring_runner;
+    bool ring_read_enabled;
+    bool ring_runner_pending;
+    bool ring_in_deliver;
 };
 
 static void
@@ -2632,6 +3087,98 @@ gensio_sync_flush_waiters(struct gensio_sync_io *sync_io,
     }
 }
 
+/*
+ * Copy data into a read op, stopping after the delimiter if it has
+ * one.  Returns the number of bytes taken, *done is set if the op is
+ * finished.
+ */
+static gensiods
+gensio_sync_op_fill(struct gensio_sync_op *op,
+		    const unsigned char *buf, gensiods buflen, bool *done)
+{
+    const unsigned char *d;
+    gensiods len = op->len - op->pos;
+
+    if (len > buflen)
+	len = buflen;
+    if (op->delim >= 0) {
+	d = memchr(buf, op->delim, len);
+	if (d) {
+	    len = d - buf + 1;
+	    *done = true;
+	}
+    }
+    memcpy(op->buf + op->pos, buf, len);
+    op->pos += len;
+    if (op->pos >= op->minlen || op->pos == op->len)
+	*done = true;
+
+    return len;
+}
+
+/* Fill the op from the ring, returns true if the op is finished. */
+static bool
+gensio_sync_ring_to_op(struct gensio_sync_io *sync_io,
+		       struct gensio_sync_op *op)
+{
+    bool done = false;
+    gensiods len;
+
+    while (sync_io->ring_len && !done) {
+	len = sync_io->ring_size - sync_io->ring_start;
+	if (len > sync_io->ring_len)
+	    len = sync_io->ring_len;
+	len = gensio_sync_op_fill(op, sync_io->ring + sync_io->ring_start,
+				  len, &done);
+	sync_io->ring_start = (sync_io->ring_start + len) % sync_io->ring_size;
+	sync_io->ring_len -= len;
+    }
+    if (!sync_io->ring_len)
+	sync_io->ring_start = 0;
+
+    return done;
+}
+
+/* Put as much as will fit into the ring, returns the amount taken. */
+static gensiods
+gensio_sync_to_ring(struct gensio_sync_io *sync_io,
+		    const unsigned char *buf, gensiods buflen)
+{
+    gensiods end, len, count = 0;
+
+    while (buflen && sync_io->ring_len < sync_io->ring_size) {
+	end = (sync_io->ring_start + sync_io->ring_len) % sync_io->ring_size;
+	if (end < sync_io->ring_start)
+	    len = sync_io->ring_start - end;
+	else
+	    len = sync_io->ring_size - end;
+	if (len > buflen)
+	    len = buflen;
+	memcpy(sync_io->ring + end, buf, len);
+	sync_io->ring_len += len;
+	buf += len;
+	buflen -= len;
+	count += len;
+    }
+
+    return count;
+}
+
+/*
+ * Without a ring, only read while someone is waiting.  With one,
+ * read ahead until it is full.
+ */
+static void
+gensio_sync_set_read_enable(struct gensio *io, struct gensio_sync_io *sync_io)
+{
+    if (sync_io->ring_size)
+	gensio_set_read_callback_enable(io,
+				sync_io->ring_len < sync_io->ring_size);
+    else
+	gensio_set_read_callback_enable(io,
+				!gensio_list_empty(&sync_io->readops));
+}
+
 static int
 gensio_syncio_event(struct gensio *io, void *user_data,
 		    int event, int err,
@@ -2641,6 +3188,7 @@ gensio_syncio_event(struct gensio *io, void *user_data,
     struct gensio_os_funcs *o = io->o;
     struct gensio_sync_io *sync_io = io->sync_io;
     gensiods done_len;
+    bool done;
 
     switch (event) {
     case GENSIO_EVENT_READ:
@@ -2651,31 +3199,28 @@ gensio_syncio_event(struct gensio *io, void *user_data,
 	    gensio_sync_flush_waiters(sync_io, o);
 	    goto read_unlock;
 	}
-	if (gensio_list_empty(&sync_io->readops)) {
-	    *buflen = 0;
-	    gensio_set_read_callback_enable(io, false);
-	    goto read_unlock;
-	}
-	done_len = *buflen;
-	while (*buflen && !gensio_list_empty(&sync_io->readops)) {
+	/* Waiting ops mean the ring is empty, give them the data first. */
+	done_len = 0;
+	while (done_len < *buflen && !gensio_list_empty(&sync_io->readops)) {
 	    struct gensio_link *l = gensio_list_first(&sync_io->readops);
 	    struct gensio_sync_op *op = gensio_container_of(l,
 							struct gensio_sync_op,
 							link);
-	    gensiods len = done_len;
-
-	    if (len > op->len)
-		len = op->len;
-	    memcpy(op->buf, buf, len);
-	    op->len = len;
-	    gensio_list_rm(&sync_io->readops, l);
-	    op->queued = false;
-	    o->wake(op->waiter);
-	    done_len -= len;
+
+	    done = false;
+	    done_len += gensio_sync_op_fill(op, buf + done_len,
+					    *buflen - done_len, &done);
+	    if (done) {
+		gensio_list_rm(&sync_io->readops, l);
+		op->queued = false;
+		o->wake(op->waiter);
+	    }
 	}
-	*buflen -= done_len;
-	if (done_len > 0)
-	    gensio_set_read_callback_enable(io, false);
+	if (sync_io->ring_size)
+	    done_len += gensio_sync_to_ring(sync_io, buf + done_len,
+					    *buflen - done_len);
+	*buflen = done_len;
+	gensio_sync_set_read_enable(io, sync_io);
     read_unlock:
 	o->unlock(sync_io->lock);
 	return 0;
@@ -2724,26 +3269,67 @@ gensio_syncio_event(struct gensio *io, void *user_data,
     }
 }
 
-int
-gensio_set_sync(struct gensio *io)
+static void
+gensio_sync_io_free(struct gensio_os_funcs *o, struct gensio_sync_io *sync_io)
+{
+    if (sync_io->ring_runner)
+	o->free_runner(sync_io->ring_runner);
+    if (sync_io->ring)
+	o->free(o, sync_io->ring);
+    if (sync_io->close_waiter)
+	o->free_waiter(sync_io->close_waiter);
+    if (sync_io->lock)
+	o->free_lock(sync_io->lock);
+    o->free(o, sync_io);
+}
+
+static void gensio_readahead_deliver(struct gensio_runner *runner,
+				     void *cb_data);
+
+static int
+i_gensio_set_sync(struct gensio *io, gensiods ring_size)
 {
     struct gensio_os_funcs *o = io->o;
-    struct gensio_sync_io *sync_io = o->zalloc(o, sizeof(*sync_io));
+    struct gensio_sync_io *sync_io;
+
+    if (io->sync_io)
+	return GE_INUSE;
+
+    if (io->readahead) {
+	sync_io = io->readahead;
+	o->lock(sync_io->lock);
+	if (sync_io->ring_len || sync_io->ring_runner_pending ||
+		sync_io->ring_in_deliver) {
+	    /* Old read ahead data has not been delivered yet. */
+	    o->unlock(sync_io->lock);
+	    return GE_INUSE;
+	}
+	o->unlock(sync_io->lock);
+	io->readahead = NULL;
+	gensio_sync_io_free(o, sync_io);
+    }
 
+    sync_io = o->zalloc(o, sizeof(*sync_io));
     if (!sync_io)
 	return GE_NOMEM;
 
     sync_io->lock = o->alloc_lock(o);
-    if (!sync_io->lock) {
-	o->free(o, sync_io);
-	return GE_NOMEM;
-    }
+    if (!sync_io->lock)
+	goto out_nomem;
 
     sync_io->close_waiter = o->alloc_waiter(o);
-    if (!sync_io->close_waiter) {
-	o->free_lock(sync_io->lock);
-	o->free(o, sync_io);
-	return GE_NOMEM;
+    if (!sync_io->close_waiter)
+	goto out_nomem;
+
+    if (ring_size) {
+	sync_io->ring = o->zalloc(o, ring_size);
+	if (!sync_io->ring)
+	    goto out_nomem;
+	sync_io->ring_size = ring_size;
+	sync_io->ring_runner = o->alloc_runner(o, gensio_readahead_deliver,
+					       io);
+	if (!sync_io->ring_runner)
+	    goto out_nomem;
     }
 
     gensio_list_init(&sync_io->readops);
@@ -2756,7 +3342,106 @@ gensio_set_sync(struct gensio *io)
     io->sync_io = sync_io;
     sync_io->old_cb = io->cb;
     io->cb = gensio_syncio_event;
+    if (ring_size)
+	gensio_set_read_callback_enable(io, true);
     return 0;
+
+ out_nomem:
+    gensio_sync_io_free(o, sync_io);
+    return GE_NOMEM;
+}
+
+int
+gensio_set_sync(struct gensio *io)
+{
+    return i_gensio_set_sync(io, 0);
+}
+
+int
+gensio_set_sync_ring(struct gensio *io, gensiods ring_size)
+{
+    if (ring_size == 0)
+	return GE_INVAL;
+    return i_gensio_set_sync(io, ring_size);
+}
+
+/* Called with the sync_io lock held. */
+static void
+gensio_readahead_sched(struct gensio *io, struct gensio_sync_io *sync_io)
+{
+    if (sync_io->ring_runner_pending || sync_io->ring_in_deliver)
+	return;
+    sync_io->ring_runner_pending = true;
+    gensio_ref(io); /* Released by the runner. */
+    io->o->run(sync_io->ring_runner);
+}
+
+/*
+ * Returns true if the read ahead ring still has data, the enable is
+ * then recorded and applied to the lower gensio once it is empty.
+ */
+static bool
+gensio_readahead_set_read_enable(struct gensio *io, bool enabled)
+{
+    struct gensio_os_funcs *o = io->o;
+    struct gensio_sync_io *sync_io = io->readahead;
+    bool rv = false;
+
+    o->lock(sync_io->lock);
+    if (sync_io->ring_len) {
+	sync_io->ring_read_enabled = enabled;
+	if (enabled)
+	    gensio_readahead_sched(io, sync_io);
+	rv = true;
+    }
+    o->unlock(sync_io->lock);
+
+    return rv;
+}
+
+static void
+gensio_readahead_deliver(struct gensio_runner *runner, void *cb_data)
+{
+    struct gensio *io = cb_data;
+    struct gensio_os_funcs *o = io->o;
+    struct gensio_sync_io *sync_io = io->readahead;
+    gensiods len, count;
+
+    o->lock(sync_io->lock);
+    sync_io->ring_runner_pending = false;
+    sync_io->ring_in_deliver = true;
+    while (sync_io->ring_read_enabled && sync_io->ring_len) {
+	len = sync_io->ring_size - sync_io->ring_start;
+	if (len > sync_io->ring_len)
+	    len = sync_io->ring_len;
+	count = len;
+	o->unlock(sync_io->lock);
+	gensio_cb(io, GENSIO_EVENT_READ, 0,
+		  sync_io->ring + sync_io->ring_start, &count, NULL);
+	o->lock(sync_io->lock);
+	if (count > len)
+	    count = len;
+	/* Anything not taken is presented again when reads are enabled. */
+	if (count == 0)
+	    break;
+	sync_io->ring_start = (sync_io->ring_start + count) %
+	    sync_io->ring_size;
+	sync_io->ring_len -= count;
+    }
+    sync_io->ring_in_deliver = false;
+    if (!sync_io->ring_len) {
+	/*
+	 * Done, let the lower gensio read again.  This is done with
+	 * the lock held so it can't get reordered with an enable from
+	 * the user.
+	 */
+	sync_io->ring_start = 0;
+	io->func(io, GENSIO_FUNC_SET_READ_CALLBACK, NULL, NULL,
+		 sync_io->ring_read_enabled, NULL, NULL);
+    }
+    o->unlock(sync_io->lock);
+
+    gensio_free(io); /* Release the ref taken when scheduled. */
 }
 
 int
@@ -2773,18 +3458,24 @@ gensio_clear_sync(struct gensio *io)
     gensio_wait_no_cb(io, sync_io->close_waiter, NULL);
 
     io->cb = sync_io->old_cb;
-
-    o->free_waiter(sync_io->close_waiter);
-    o->free_lock(sync_io->lock);
-    o->free(o, sync_io);
     io->sync_io = NULL;
 
+    /*
+     * Data read ahead into the ring is kept until the user enables
+     * reads and takes it.
+     */
+    if (sync_io->ring_len)
+	io->readahead = sync_io;
+    else
+	gensio_sync_io_free(o, sync_io);
+
     return 0;
 }
 
-int
-gensio_read_s(struct gensio *io, gensiods *count, void *data, gensiods datalen,
-	      struct timeval *timeout)
+static int
+i_gensio_read_s(struct gensio *io, gensiods *count,
+		void *data, gensiods datalen, gensiods minlen, int delim,
+		struct timeval *timeout)
 {
     struct gensio_os_funcs *o = io->o;
     struct gensio_sync_io *sync_io = io->sync_io;
@@ -2804,38 +3495,79 @@ gensio_read_s(struct gensio *io, gensiods *count, void *data, gensiods datalen,
     op.buf = data;
     op.len = datalen;
     op.err = 0;
-    op.waiter = o->alloc_waiter(o);
-    if (!op.waiter)
-	return GE_NOMEM;
+    op.pos = 0;
+    op.minlen = minlen;
+    op.delim = delim;
+    op.waiter = NULL;
+
     o->lock(sync_io->lock);
+    /*
+     * If the ring has enough, this is done without waiting.  Only
+     * wait if nobody else is, so reads finish in order.
+     */
+    if (gensio_list_empty(&sync_io->readops) &&
+		gensio_sync_ring_to_op(sync_io, &op)) {
+	gensio_sync_set_read_enable(io, sync_io);
+	goto out_count;
+    }
     if (sync_io->err) {
 	rv = sync_io->err;
-	goto out_unlock;
+	goto out_count;
+    }
+
+    op.waiter = o->alloc_waiter(o);
+    if (!op.waiter) {
+	rv = GE_NOMEM;
+	goto out_count;
     }
-    gensio_set_read_callback_enable(io, true);
     gensio_list_add_tail(&sync_io->readops, &op.link);
+    gensio_sync_set_read_enable(io, sync_io);
 
     o->unlock(sync_io->lock);
     o->wait_intr(op.waiter, 1, timeout);
     o->lock(sync_io->lock);
-    if (op.err) {
-	rv = op.err;
-    } else if (op.queued) {
-	if (count)
-	    *count = 0;
+    if (op.queued)
 	gensio_list_rm(&sync_io->readops, &op.link);
-    } else if (count) {
-	*count = op.len;
-    }
-    if (gensio_list_empty(&sync_io->readops))
-	gensio_set_read_callback_enable(io, false);
- out_unlock:
+    if (op.err)
+	rv = op.err;
+    gensio_sync_set_read_enable(io, sync_io);
+ out_count:
+    /* On a timeout, count has whatever was read so far. */
+    if (count)
+	*count = op.pos;
     o->unlock(sync_io->lock);
-    o->free_waiter(op.waiter);
+    if (op.waiter)
+	o->free_waiter(op.waiter);
 
     return rv;
 }
 
+int
+gensio_read_s(struct gensio *io, gensiods *count, void *data, gensiods datalen,
+	      struct timeval *timeout)
+{
+    return i_gensio_read_s(io, count, data, datalen, 1, -1, timeout);
+}
+
+int
+gensio_read_s_min(struct gensio *io, gensiods *count,
+		  void *data, gensiods datalen, gensiods minlen,
+		  struct timeval *timeout)
+{
+    if (minlen > datalen)
+	return GE_INVAL;
+    return i_gensio_read_s(io, count, data, datalen, minlen, -1, timeout);
+}
+
+int
+gensio_read_s_delim(struct gensio *io, gensiods *count,
+		    void *data, gensiods datalen, unsigned char delim,
+		    struct timeval *timeout)
+{
+    return i_gensio_read_s(io, count, data, datalen, datalen, delim,
+			   timeout);
+}
+
 int
 gensio_write_s(struct gensio *io, gensiods *count,
 	       const void *data, gensiods datalen,
@@ -102,10 +102,61 @@ struct basen_data {
     bool deferred_read;
     bool deferred_open;
     bool deferred_close;
+    bool deferred_wdone;
+    bool deferred_wmark;
+
+    /*
+     * Small writes are collected here and written together.  With
+     * coalesce_delay set, data sits in the buffer for at most that
+     * many microseconds.  When corked, it stays until the cork is
+     * removed.  Either way it goes out when the buffer fills.
+     * cbuf_due is set when the data should have gone out but the
+     * lower layer didn't take it all, write ready finishes it.
+     */
+    unsigned char *cbuf;
+    gensiods cbuf_size;
+    gensiods cbuf_len;
+    bool cbuf_due;
+    unsigned int coalesce_delay;
+    bool corked;
+    struct gensio_timer *coalesce_timer;
+    bool coalesce_timer_running;
+
+    /*
+     * Writes from gensio_write_queued().  Entries move to wdone when
+     * they are finished, to have their done called without the lock.
+     * wqueue_len is the number of bytes in wqueue not yet written.
+     */
+    struct gensio_list wqueue;
+    struct gensio_list wdone;
+    gensiods wqueue_len;
+
+    /*
+     * When the data held for writing (queued and coalesced) goes up to
+     * high_water, tell the user with GENSIO_EVENT_WRITE_HIGH.  When it
+     * goes back down to low_water, GENSIO_EVENT_WRITE_LOW.  wmark_high
+     * is the last state reported.  high_water of 0 disables this.
+     */
+    gensiods high_water;
+    gensiods low_water;
+    bool wmark_high;
 
     struct stel_req *reqs;
 };
 
+/* Maximum number of user sg entries to write along with the buffer. */
+#define BASEN_COALESCE_MAX_SG 16
+
+/* Maximum number of queued writes to do in one write call. */
+#define BASEN_WQUEUE_MAX_SG 64
+
+struct basen_wq_entry {
+    struct gensio_link link;
+    struct gensio_write_queued_req req;
+    gensiods pos;
+    int err;
+};
+
 struct gensio_ll {
     struct gensio_os_funcs *o;
     struct basen_data  *ndata;
@@ -139,6 +190,18 @@ basen_finish_free(struct basen_data *ndata)
 	ndata->o->free_lock(ndata->lock);
     if (ndata->timer)
 	ndata->o->free_timer(ndata->timer);
+    if (ndata->coalesce_timer)
+	ndata->o->free_timer(ndata->coalesce_timer);
+    if (ndata->cbuf)
+	ndata->o->free(ndata->o, ndata->cbuf);
+    /* Only possible if the gensio was disabled. */
+    while (!gensio_list_empty(&ndata->wqueue)) {
+	struct gensio_link *l = gensio_list_first(&ndata->wqueue);
+
+	gensio_list_rm(&ndata->wqueue, l);
+	ndata->o->free(ndata->o,
+		       gensio_container_of(l, struct basen_wq_entry, link));
+    }
     if (ndata->deferred_op_runner)
 	ndata->o->free_runner(ndata->deferred_op_runner);
     if (ndata->filter)
@@ -248,6 +311,22 @@ filter_ll_read_needed(struct basen_data *ndata)
     return false;
 }
 
+static bool
+filter_ll_read_blocked(struct basen_data *ndata)
+{
+    if (ndata->filter)
+	return gensio_filter_ll_read_blocked(ndata->filter);
+    return false;
+}
+
+static bool
+filter_ul_write_blocked(struct basen_data *ndata)
+{
+    if (ndata->filter)
+	return gensio_filter_ul_write_blocked(ndata->filter);
+    return false;
+}
+
 /* Provides a way to verify keys and such. */
 static int
 filter_check_open_done(struct basen_data *ndata)
@@ -361,11 +440,66 @@ ll_set_write_callback_enable(struct basen_data *ndata, bool enable)
     gensio_ll_set_write_callback(ndata->ll, enable);
 }
 
+/* Is there data from the user that needs to go to the ll? */
+static bool
+basen_write_pending(struct basen_data *ndata)
+{
+    return ndata->cbuf_due || !gensio_list_empty(&ndata->wqueue) ||
+	filter_ll_write_pending(ndata);
+}
+
+/* Amount of data taken from the user but not written to the ll. */
+static gensiods
+basen_write_held(struct basen_data *ndata)
+{
+    return ndata->wqueue_len + ndata->cbuf_len;
+}
+
+/* Returns the watermark event to deliver, or 0 if none. */
+static int
+basen_wmark_event(struct basen_data *ndata)
+{
+    if (!ndata->high_water || ndata->state != BASEN_OPEN)
+	return 0;
+    if (!ndata->wmark_high && basen_write_held(ndata) >= ndata->high_water)
+	return GENSIO_EVENT_WRITE_HIGH;
+    if (ndata->wmark_high && basen_write_held(ndata) <= ndata->low_water)
+	return GENSIO_EVENT_WRITE_LOW;
+    return 0;
+}
+
+/*
+ * Called after the amount of held data changes.  The event is
+ * delivered from the deferred op, as this may be in a user's call.
+ * If it goes back before then, nothing is delivered.
+ */
+static void
+basen_wmark_check(struct basen_data *ndata)
+{
+    if (basen_wmark_event(ndata)) {
+	ndata->deferred_wmark = true;
+	basen_sched_deferred_op(ndata);
+    }
+}
+
+static void
+basen_wmark_deliver(struct basen_data *ndata)
+{
+    int event = basen_wmark_event(ndata);
+
+    if (!event)
+	return;
+    ndata->wmark_high = event == GENSIO_EVENT_WRITE_HIGH;
+    basen_unlock(ndata);
+    gensio_cb(ndata->io, event, 0, NULL, NULL, NULL);
+    basen_lock(ndata);
+}
+
 static void
 basen_set_ll_enables(struct basen_data *ndata)
 {
-    if (filter_ll_write_pending(ndata) || ndata->xmit_enabled ||
-		ndata->tmp_xmit_enabled)
+    if ((basen_write_pending(ndata) || ndata->xmit_enabled ||
+		ndata->tmp_xmit_enabled) && !filter_ul_write_blocked(ndata))
 	ll_set_write_callback_enable(ndata, true);
     else
 	ll_set_write_callback_enable(ndata, false);
@@ -373,7 +507,7 @@ basen_set_ll_enables(struct basen_data *ndata)
 		filter_ll_read_needed(ndata)) && ndata->state == BASEN_OPEN) ||
 	    ndata->state == BASEN_IN_FILTER_OPEN ||
 	    ndata->state == BASEN_IN_FILTER_CLOSE) &&
-	   !ndata->in_read)
+	   !ndata->in_read && !filter_ll_read_blocked(ndata))
 	ll_set_read_callback_enable(ndata, true);
     else
 	ll_set_read_callback_enable(ndata, false);
@@ -389,6 +523,139 @@ basen_write_data_handler(void *cb_data, gensiods *rcount,
     return ll_write(ndata, rcount, sg, sglen, auxdata);
 }
 
+/*
+ * Takes nothing, so a filter has to keep the data until it is
+ * flushed with basen_write_data_handler.
+ */
+static int
+basen_hold_data_handler(void *cb_data, gensiods *rcount,
+			const struct gensio_sg *sg, gensiods sglen,
+			const char *const *auxdata)
+{
+    *rcount = 0;
+    return 0;
+}
+
+/*
+ * Each write on a packet gensio is its own packet (an ssl record, a
+ * datagram), merging writes would change the packets.
+ */
+static bool
+basen_coalescing(struct basen_data *ndata)
+{
+    if (gensio_is_packet(ndata->io))
+	return false;
+    return ndata->corked || ndata->coalesce_delay;
+}
+
+/*
+ * Write the coalesce buffer and the given data (if any) together.
+ * The buffer goes first, the count returned is for the user data.
+ */
+static int
+basen_coalesce_flush(struct basen_data *ndata, gensiods *rcount,
+		     const struct gensio_sg *sg, gensiods sglen)
+{
+    struct gensio_sg xsg[BASEN_COALESCE_MAX_SG + 1];
+    gensiods i, count = 0;
+    int err;
+
+    if (rcount)
+	*rcount = 0;
+    if (sglen > BASEN_COALESCE_MAX_SG) {
+	/* Too many to combine, do the buffer then the data. */
+	err = basen_coalesce_flush(ndata, NULL, NULL, 0);
+	if (err || ndata->cbuf_len)
+	    return err;
+	return filter_ul_write(ndata, basen_write_data_handler, rcount,
+			       sg, sglen, NULL);
+    }
+
+    xsg[0].buf = ndata->cbuf;
+    xsg[0].buflen = ndata->cbuf_len;
+    for (i = 0; i < sglen; i++)
+	xsg[i + 1] = sg[i];
+
+    err = filter_ul_write(ndata, basen_write_data_handler, &count,
+			  xsg, sglen + 1, NULL);
+    if (err)
+	return err;
+
+    if (count < ndata->cbuf_len) {
+	ndata->cbuf_len -= count;
+	memmove(ndata->cbuf, ndata->cbuf + count, ndata->cbuf_len);
+    } else {
+	count -= ndata->cbuf_len;
+	ndata->cbuf_len = 0;
+	if (rcount)
+	    *rcount = count;
+    }
+    ndata->cbuf_due = ndata->cbuf_len > 0;
+
+    return 0;
+}
+
+static void
+basen_coalesce_timeout(struct gensio_timer *timer, void *cb_data)
+{
+    struct basen_data *ndata = cb_data;
+    int err;
+
+    basen_lock(ndata);
+    ndata->coalesce_timer_running = false;
+    if (ndata->cbuf_len && !ndata->corked && (ndata->state == BASEN_OPEN ||
+				ndata->state == BASEN_CLOSE_WAIT_DRAIN)) {
+	err = basen_coalesce_flush(ndata, NULL, NULL, 0);
+	if (err)
+	    ndata->saved_xmit_err = err;
+	basen_wmark_check(ndata);
+	basen_set_ll_enables(ndata);
+    }
+    basen_deref_and_unlock(ndata);
+}
+
+static int
+basen_coalesce_write(struct basen_data *ndata, gensiods *rcount,
+		     const struct gensio_sg *sg, gensiods sglen)
+{
+    struct timeval timeout;
+    gensiods i, total = 0;
+
+    if (!ndata->cbuf) {
+	ndata->cbuf = ndata->o->zalloc(ndata->o, ndata->cbuf_size);
+	if (!ndata->cbuf)
+	    return GE_NOMEM;
+    }
+
+    for (i = 0; i < sglen; i++)
+	total += sg[i].buflen;
+
+    if (ndata->cbuf_len + total > ndata->cbuf_size)
+	/* Doesn't fit, send it all out together. */
+	return basen_coalesce_flush(ndata, rcount, sg, sglen);
+
+    for (i = 0; i < sglen; i++) {
+	memcpy(ndata->cbuf + ndata->cbuf_len, sg[i].buf, sg[i].buflen);
+	ndata->cbuf_len += sg[i].buflen;
+    }
+    if (rcount)
+	*rcount = total;
+
+    if (ndata->cbuf_len == ndata->cbuf_size)
+	return basen_coalesce_flush(ndata, NULL, NULL, 0);
+
+    if (!ndata->corked && ndata->cbuf_len && !ndata->coalesce_timer_running) {
+	timeout.tv_sec = ndata->coalesce_delay / 1000000;
+	timeout.tv_usec = ndata->coalesce_delay % 1000000;
+	if (ndata->o->start_timer(ndata->coalesce_timer, &timeout) == 0) {
+	    ndata->coalesce_timer_running = true;
+	    basen_ref(ndata);
+	}
+    }
+
+    return 0;
+}
+
 static int
 basen_write(struct basen_data *ndata, gensiods *rcount,
 	    const struct gensio_sg *sg, gensiods sglen,
@@ -407,9 +674,268 @@ basen_write(struct basen_data *ndata, gensiods *rcount,
 	goto out_unlock;
     }
 
+    if (!gensio_list_empty(&ndata->wqueue)) {
+	/* Queued data has to go first. */
+	if (rcount)
+	    *rcount = 0;
+	goto out_unlock;
+    }
+
+    /* Writes with auxdata may need special handling, don't combine them. */
+    if (basen_coalescing(ndata) && !auxdata) {
+	err = basen_coalesce_write(ndata, rcount, sg, sglen);
+	goto out_unlock;
+    }
+
+    if (ndata->cbuf_len) {
+	/* Get the earlier data out first to keep things in order. */
+	err = basen_coalesce_flush(ndata, NULL, NULL, 0);
+	if (err || ndata->cbuf_len) {
+	    if (rcount)
+		*rcount = 0;
+	    goto out_unlock;
+	}
+    }
+
     err = filter_ul_write(ndata, basen_write_data_handler, rcount, sg, sglen,
 			  auxdata);
 
+ out_unlock:
+    basen_wmark_check(ndata);
+    basen_set_ll_enables(ndata);
+    basen_unlock(ndata);
+
+    return err;
+}
+
+/*
+ * Hand the messages to a message filter, which has to buffer them
+ * since the hold handler takes nothing, then push them all to the
+ * lower layer in one write.
+ */
+static int
+basen_filter_write_msgs(struct basen_data *ndata, gensiods *rcount,
+			struct gensio_msg *msgs, gensiods nmsgs)
+{
+    gensiods i, j, len;
+    int err = 0;
+
+    for (i = 0; i < nmsgs; i++) {
+	for (j = 0, len = 0; j < msgs[i].sglen; j++)
+	    len += msgs[i].sg[j].buflen;
+	err = filter_ul_write(ndata, basen_hold_data_handler, &msgs[i].count,
+			      msgs[i].sg, msgs[i].sglen, msgs[i].auxdata);
+	if (err) {
+	    msgs[i].err = err;
+	    break;
+	}
+	if (msgs[i].count < len)
+	    break;
+    }
+    if (rcount)
+	*rcount = i;
+
+    if (!err)
+	err = filter_ul_write(ndata, basen_write_data_handler, NULL,
+			      NULL, 0, NULL);
+    return err;
+}
+
+static int
+basen_write_msgs(struct basen_data *ndata, gensiods *rcount,
+		 struct gensio_msg *msgs, gensiods nmsgs)
+{
+    int err = 0;
+
+    /*
+     * Most filters work on a byte stream, let the caller do single
+     * writes.  A message filter can combine the messages itself.
+     */
+    if (ndata->filter && !gensio_is_message(ndata->io))
+	return GE_NOTSUP;
+
+    basen_lock(ndata);
+    if (ndata->state != BASEN_OPEN) {
+	err = GE_NOTREADY;
+	goto out_unlock;
+    }
+    if (ndata->saved_xmit_err) {
+	err = ndata->saved_xmit_err;
+	ndata->saved_xmit_err = 0;
+	goto out_unlock;
+    }
+
+    if (!gensio_list_empty(&ndata->wqueue)) {
+	*rcount = 0;
+	goto out_unlock;
+    }
+
+    if (ndata->cbuf_len) {
+	err = basen_coalesce_flush(ndata, NULL, NULL, 0);
+	if (err || ndata->cbuf_len) {
+	    *rcount = 0;
+	    goto out_unlock;
+	}
+    }
+
+    if (ndata->filter)
+	err = basen_filter_write_msgs(ndata, rcount, msgs, nmsgs);
+    else
+	err = gensio_ll_write_msgs(ndata->ll, rcount, msgs, nmsgs);
+
+ out_unlock:
+    basen_set_ll_enables(ndata);
+    basen_unlock(ndata);
+
+    return err;
+}
+
+static void
+basen_wqueue_finish(struct basen_data *ndata, struct basen_wq_entry *e,
+		    int err)
+{
+    gensio_list_rm(&ndata->wqueue, &e->link);
+    ndata->wqueue_len -= e->req.datalen - e->pos;
+    e->err = err;
+    gensio_list_add_tail(&ndata->wdone, &e->link);
+}
+
+/* Fail everything in the write queue with the given error. */
+static void
+basen_wqueue_fail(struct basen_data *ndata, int err)
+{
+    struct gensio_link *l;
+
+    while (!gensio_list_empty(&ndata->wqueue)) {
+	l = gensio_list_first(&ndata->wqueue);
+	basen_wqueue_finish(ndata,
+			    gensio_container_of(l, struct basen_wq_entry, link),
+			    err);
+    }
+}
+
+/*
+ * Write out as much of the write queue as the lower layer will take,
+ * in one write.  Anything in the coalesce buffer was written by the
+ * user first, so it goes first.
+ */
+static int
+basen_wqueue_flush(struct basen_data *ndata)
+{
+    struct gensio_sg sg[BASEN_WQUEUE_MAX_SG];
+    struct gensio_link *l;
+    struct basen_wq_entry *e;
+    gensiods n = 0, count = 0, total = 0, left;
+    int err;
+
+    if (ndata->cbuf_len) {
+	err = basen_coalesce_flush(ndata, NULL, NULL, 0);
+	if (err || ndata->cbuf_len)
+	    return err;
+    }
+
+    gensio_list_for_each(&ndata->wqueue, l) {
+	if (n == BASEN_WQUEUE_MAX_SG)
+	    break;
+	/* Each queued buffer on a packet gensio is its own packet. */
+	if (n == 1 && gensio_is_packet(ndata->io))
+	    break;
+	e = gensio_container_of(l, struct basen_wq_entry, link);
+	sg[n].buf = ((const unsigned char *) e->req.data) + e->pos;
+	sg[n].buflen = e->req.datalen - e->pos;
+	total += sg[n].buflen;
+	n++;
+    }
+
+    /* Zero-length writes just get finished. */
+    if (total) {
+	err = filter_ul_write(ndata, basen_write_data_handler, &count,
+			      sg, n, NULL);
+	if (err)
+	    return err;
+    }
+
+    while (!gensio_list_empty(&ndata->wqueue)) {
+	l = gensio_list_first(&ndata->wqueue);
+	e = gensio_container_of(l, struct basen_wq_entry, link);
+	left = e->req.datalen - e->pos;
+	if (count < left) {
+	    e->pos += count;
+	    ndata->wqueue_len -= count;
+	    break;
+	}
+	count -= left;
+	ndata->wqueue_len -= left;
+	e->pos = e->req.datalen;
+	basen_wqueue_finish(ndata, e, 0);
+    }
+
+    return 0;
+}
+
+/* Call the done handlers for finished queued writes, with the lock held. */
+static void
+basen_wqueue_deliver(struct basen_data *ndata)
+{
+    struct gensio_link *l;
+    struct basen_wq_entry *e;
+
+    while (!gensio_list_empty(&ndata->wdone)) {
+	l = gensio_list_first(&ndata->wdone);
+	gensio_list_rm(&ndata->wdone, l);
+	e = gensio_container_of(l, struct basen_wq_entry, link);
+	basen_unlock(ndata);
+	e->req.done(ndata->io, e->err, e->pos, e->req.done_data);
+	ndata->o->free(ndata->o, e);
+	basen_lock(ndata);
+    }
+}
+
+static int
+basen_write_queued(struct basen_data *ndata,
+		   struct gensio_write_queued_req *req)
+{
+    struct basen_wq_entry *e;
+    int err = 0;
+
+    basen_lock(ndata);
+    if (ndata->state != BASEN_OPEN) {
+	err = GE_NOTREADY;
+	goto out_unlock;
+    }
+    if (ndata->saved_xmit_err) {
+	err = ndata->saved_xmit_err;
+	ndata->saved_xmit_err = 0;
+	goto out_unlock;
+    }
+
+    e = ndata->o->zalloc(ndata->o, sizeof(*e));
+    if (!e) {
+	err = GE_NOMEM;
+	goto out_unlock;
+    }
+    e->req = *req;
+    gensio_list_add_tail(&ndata->wqueue, &e->link);
+    ndata->wqueue_len += req->datalen;
+
+    /*
+     * If this is the only thing waiting, try to get it out now.  Don't
+     * call the done handler from here, the user is in a call to us.
+     */
+    if (!filter_ll_write_pending(ndata) &&
+		gensio_list_first(&ndata->wqueue) == &e->link) {
+	err = basen_wqueue_flush(ndata);
+	if (err) {
+	    basen_wqueue_fail(ndata, err);
+	    err = 0;
+	}
+	if (!gensio_list_empty(&ndata->wdone)) {
+	    ndata->deferred_wdone = true;
+	    basen_sched_deferred_op(ndata);
+	}
+    }
+    basen_wmark_check(ndata);
+
  out_unlock:
     basen_set_ll_enables(ndata);
     basen_unlock(ndata);
@@ -461,6 +987,16 @@ basen_deferred_op(struct gensio_runner *runner, void *cbdata)
 	basen_finish_close(ndata);
     }
 
+    if (ndata->deferred_wdone) {
+	ndata->deferred_wdone = false;
+	basen_wqueue_deliver(ndata);
+    }
+
+    if (ndata->deferred_wmark) {
+	ndata->deferred_wmark = false;
+	basen_wmark_deliver(ndata);
+    }
+
     if (ndata->deferred_read) {
 	if (ndata->state != BASEN_OPEN)
 	    goto out_unlock;
@@ -475,7 +1011,9 @@ basen_deferred_op(struct gensio_runner *runner, void *cbdata)
 	/* FIXME - error handling? */
     }
 
-    if (ndata->deferred_read || ndata->deferred_open || ndata->deferred_close)
+    if (ndata->deferred_read || ndata->deferred_open ||
+		ndata->deferred_close || ndata->deferred_wdone ||
+		ndata->deferred_wmark)
 	goto retry;
 
  out_unlock:
@@ -500,6 +1038,8 @@ basen_finish_close(struct basen_data *ndata)
 {
     filter_cleanup(ndata);
     basen_set_state(ndata, BASEN_CLOSED);
+    basen_wqueue_fail(ndata, GE_NOTREADY);
+    basen_wqueue_deliver(ndata);
     basen_deref(ndata);
     if (ndata->close_done) {
 	basen_unlock(ndata);
@@ -627,6 +1167,9 @@ basen_open(struct basen_data *ndata, gensio_done_err open_done, void *open_data)
 	ndata->read_enabled = false;
 	ndata->xmit_enabled = false;
 	ndata->timer_start_pending = false;
+	ndata->cbuf_len = 0;
+	ndata->cbuf_due = false;
+	ndata->wmark_high = false;
 
 	ndata->open_done = open_done;
 	ndata->open_data = open_data;
@@ -670,6 +1213,9 @@ basen_open_nochild(struct basen_data *ndata,
 	ndata->read_enabled = false;
 	ndata->xmit_enabled = false;
 	ndata->timer_start_pending = false;
+	ndata->cbuf_len = 0;
+	ndata->cbuf_due = false;
+	ndata->wmark_high = false;
 
 	ndata->open_done = open_done;
 	ndata->open_data = open_data;
@@ -715,9 +1261,12 @@ basen_i_close(struct basen_data *ndata,
 {
     ndata->close_done = close_done;
     ndata->close_data = close_data;
+    if (ndata->cbuf_len)
+	/* Whatever is held back goes out before the close. */
+	ndata->cbuf_due = true;
     if (ndata->ll_err_occurred || ndata->state == BASEN_IN_LL_OPEN) {
 	ll_close(ndata, basen_ll_close_done, NULL);
-    } else if (filter_ll_write_pending(ndata)) {
+    } else if (basen_write_pending(ndata)) {
 	basen_set_state(ndata, BASEN_CLOSE_WAIT_DRAIN);
     } else {
 	basen_set_state(ndata, BASEN_IN_FILTER_CLOSE);
@@ -856,17 +1405,76 @@ basen_set_write_callback_enable(struct basen_data *ndata, bool enabled)
 }
 
 static int
-gensio_base_func(struct gensio *io, int func, gensiods *count,
-		 const void *cbuf, gensiods buflen, void *buf,
-		 const char *const *auxdata)
+basen_write_control(struct basen_data *ndata, bool get,
+		    unsigned int option, char *data, gensiods *datalen)
 {
-    struct basen_data *ndata = gensio_get_gensio_data(io);
+    unsigned long val;
+    int err = 0;
+
+    basen_lock(ndata);
+    if (get) {
+	switch (option) {
+	case GENSIO_CONTROL_WRITE_CORK: val = ndata->corked; break;
+	case GENSIO_CONTROL_WRITE_COALESCE: val = ndata->coalesce_delay; break;
+	case GENSIO_CONTROL_WRITE_HIGH_WATER: val = ndata->high_water; break;
+	case GENSIO_CONTROL_WRITE_LOW_WATER: val = ndata->low_water; break;
+	default: val = basen_write_held(ndata); break;
+	}
+	*datalen = snprintf(data, *datalen, "%lu", val);
+	goto out_unlock;
+    }
+
+    val = strtoul(data, NULL, 0);
+    switch (option) {
+    case GENSIO_CONTROL_WRITE_CORK: ndata->corked = val; break;
+    case GENSIO_CONTROL_WRITE_COALESCE: ndata->coalesce_delay = val; break;
+    case GENSIO_CONTROL_WRITE_HIGH_WATER:
+	ndata->high_water = val;
+	if (!val)
+	    ndata->wmark_high = false;
+	basen_wmark_check(ndata);
+	goto out_unlock;
+    case GENSIO_CONTROL_WRITE_LOW_WATER:
+	ndata->low_water = val;
+	basen_wmark_check(ndata);
+	goto out_unlock;
+    default:
+	err = GE_NOTSUP;
+	goto out_unlock;
+    }
+
+    /* Anything held back that shouldn't be any more goes out now. */
+    if (!basen_coalescing(ndata) && ndata->cbuf_len &&
+		ndata->state == BASEN_OPEN) {
+	err = basen_coalesce_flush(ndata, NULL, NULL, 0);
+	basen_set_ll_enables(ndata);
+    }
+ out_unlock:
+    basen_unlock(ndata);
+
+    return err;
+}
+
+static int basen_fuse(struct basen_data *ndata, struct gensio **rchild);
+
+static int
+gensio_base_func(struct gensio *io, int func, gensiods *count,
+		 const void *cbuf, gensiods buflen, void *buf,
+		 const char *const *auxdata)
+{
+    struct basen_data *ndata = gensio_get_gensio_data(io);
     int rv, rv2;
 
     switch (func) {
     case GENSIO_FUNC_WRITE_SG:
 	return basen_write(ndata, count, cbuf, buflen, auxdata);
 
+    case GENSIO_FUNC_WRITE_MSGS:
+	return basen_write_msgs(ndata, count, buf, buflen);
+
+    case GENSIO_FUNC_WRITE_QUEUED:
+	return basen_write_queued(ndata, buf);
+
     case GENSIO_FUNC_RADDR_TO_STR:
 	return gensio_ll_raddr_to_str(ndata->ll, count, buf, buflen);
 
@@ -905,6 +1513,10 @@ gensio_base_func(struct gensio *io, int func, gensiods *count,
 	return gensio_filter_open_channel(ndata->filter, buf);
 
     case GENSIO_FUNC_CONTROL:
+	if (buflen >= GENSIO_CONTROL_WRITE_CORK &&
+		buflen <= GENSIO_CONTROL_WRITE_QUEUED)
+	    return basen_write_control(ndata, *((bool *) cbuf), buflen,
+				       buf, count);
 	rv = GE_NOTSUP;
 	if (ndata->filter) {
 	    rv = gensio_filter_control(ndata->filter, *((bool *) cbuf), buflen,
@@ -918,6 +1530,32 @@ gensio_base_func(struct gensio *io, int func, gensiods *count,
 	    return rv;
 	return rv2;
 
+    case GENSIO_FUNC_FUSE:
+	return basen_fuse(ndata, buf);
+
+    case GENSIO_FUNC_RAW_FD: {
+	struct gensio_raw_fd *raw = buf;
+	gensiods held;
+
+	/* A filter has to see the data, so no going around it. */
+	if (ndata->filter)
+	    return GE_NOTSUP;
+	/*
+	 * Data we are holding for the user has to go out before
+	 * anything written to the fd directly.  Clearing read_ready
+	 * must always work, though.
+	 */
+	basen_lock(ndata);
+	held = basen_write_held(ndata);
+	basen_unlock(ndata);
+	if (held && raw->read_ready)
+	    return GE_INUSE;
+	rv = gensio_ll_raw_fd(ndata->ll, raw);
+	if (!rv && held)
+	    rv = GE_INUSE;
+	return rv;
+    }
+
     case GENSIO_FUNC_DISABLE:
 	if (ndata->state != BASEN_CLOSED) {
 	    basen_set_state(ndata, BASEN_CLOSED);
@@ -1010,22 +1648,34 @@ basen_ll_write_ready(void *cb_data)
 
     basen_lock_and_ref(ndata);
     ll_set_write_callback_enable(ndata, false);
-    if (filter_ll_write_pending(ndata)) {
+    if (!gensio_list_empty(&ndata->wqueue)) {
+	err = basen_wqueue_flush(ndata);
+	if (err) {
+	    basen_wqueue_fail(ndata, err);
+	    ndata->saved_xmit_err = err;
+	}
+	basen_wqueue_deliver(ndata);
+    } else if (ndata->cbuf_due) {
+	err = basen_coalesce_flush(ndata, NULL, NULL, 0);
+	if (err)
+	    ndata->saved_xmit_err = err;
+    } else if (filter_ll_write_pending(ndata)) {
 	err = filter_ul_write(ndata, basen_write_data_handler, NULL, NULL, 0,
 			      NULL);
 	if (err)
 	    ndata->saved_xmit_err = err;
     }
+    basen_wmark_deliver(ndata);
 
     if (ndata->state == BASEN_CLOSE_WAIT_DRAIN &&
-		!filter_ll_write_pending(ndata))
+		!basen_write_pending(ndata))
 	basen_set_state(ndata, BASEN_IN_FILTER_CLOSE);
     if (ndata->state == BASEN_IN_FILTER_OPEN)
 	basen_try_connect(ndata);
     if (ndata->state == BASEN_IN_FILTER_CLOSE)
 	basen_try_close(ndata);
-    if (ndata->state != BASEN_IN_FILTER_OPEN && !filter_ll_write_pending(ndata)
-		&& ndata->xmit_enabled) {
+    if (ndata->state != BASEN_IN_FILTER_OPEN && !basen_write_pending(ndata)
+		&& ndata->xmit_enabled && !filter_ul_write_blocked(ndata)) {
 	basen_unlock(ndata);
 	gensio_cb(ndata->io, GENSIO_EVENT_WRITE_READY, 0, NULL, 0, NULL);
 	basen_lock(ndata);
@@ -1037,6 +1687,26 @@ basen_ll_write_ready(void *cb_data)
     basen_deref_and_unlock(ndata);
 }
 
+static void
+basen_ll_write_complete(void *cb_data, struct gensio_write_complete *wc)
+{
+    struct basen_data *ndata = cb_data;
+    gensiods len = sizeof(*wc);
+
+    basen_lock_and_ref(ndata);
+    /*
+     * With a filter the data written to the ll is the filter's, not
+     * the user's, so there is nothing to tell the user.
+     */
+    if (!ndata->filter && ndata->state == BASEN_OPEN) {
+	basen_unlock(ndata);
+	gensio_cb(ndata->io, GENSIO_EVENT_WRITE_COMPLETE, 0,
+		  (unsigned char *) wc, &len, NULL);
+	basen_lock(ndata);
+    }
+    basen_deref_and_unlock(ndata);
+}
+
 static gensiods
 gensio_ll_base_cb(void *cb_data, int op, int val,
 		  void *buf, gensiods buflen,
@@ -1050,6 +1720,10 @@ gensio_ll_base_cb(void *cb_data, int op, int val,
 	basen_ll_write_ready(cb_data);
 	return 0;
 
+    case GENSIO_LL_CB_WRITE_COMPLETE:
+	basen_ll_write_complete(cb_data, buf);
+	return 0;
+
     default:
 	return 0;
     }
@@ -1095,6 +1769,78 @@ gensio_base_filter_cb(void *cb_data, int op, void *data)
     }
 }
 
+/*
+ * Pull the filters out of the fusable gensios under this one into a
+ * chain filter on this one, and take over the lowest one's ll.  The
+ * gensios in between are freed when the old ll is freed, since it
+ * holds the only reference to the first of them.
+ */
+static int
+basen_fuse(struct basen_data *ndata, struct gensio **rchild)
+{
+    struct gensio_os_funcs *o = ndata->o;
+    struct basen_data *c, *bottom = NULL;
+    struct gensio_filter **filters, *chain;
+    struct gensio_ll *old_ll;
+    unsigned int n = 1, i = 0;
+    int err;
+
+    if (!ndata->filter || !ndata->child || ndata->state != BASEN_CLOSED)
+	return GE_NOTSUP;
+
+    for (c = gensio_getclass(ndata->child, "base_fusable");
+	 c && c->filter && c->child && c->state == BASEN_CLOSED &&
+	     c->freeref == 1;
+	 c = gensio_getclass(c->child, "base_fusable")) {
+	bottom = c;
+	n++;
+    }
+    if (!bottom)
+	return GE_NOTSUP;
+
+    filters = o->zalloc(o, n * sizeof(*filters));
+    if (!filters)
+	return GE_NOMEM;
+    filters[i++] = ndata->filter;
+    c = ndata;
+    do {
+	c = gensio_getclass(c->child, "base_fusable");
+	filters[i++] = c->filter;
+    } while (c != bottom);
+    err = gensio_filter_chain_alloc(o, filters, n, &chain);
+    o->free(o, filters);
+    if (err)
+	return err;
+
+    c = ndata;
+    do {
+	c = gensio_getclass(c->child, "base_fusable");
+	c->filter = NULL;
+    } while (c != bottom);
+
+    old_ll = ndata->ll;
+    ndata->ll = bottom->ll;
+    bottom->ll = NULL;
+    ndata->child = bottom->child;
+    ndata->ll->ndata = ndata;
+    gensio_ll_set_callback(ndata->ll, gensio_ll_base_cb, ndata);
+
+    ndata->filter = chain;
+    chain->ndata = ndata;
+    gensio_filter_set_callback(chain, gensio_base_filter_cb, ndata);
+
+    gensio_ll_free(old_ll);
+
+    *rchild = ndata->child;
+    return 0;
+}
+
+int
+base_gensio_set_fusable(struct gensio *io)
+{
+    return gensio_addclass(io, "base_fusable", gensio_get_gensio_data(io));
+}
+
 static struct gensio *
 gensio_i_alloc(struct gensio_os_funcs *o,
 	       struct gensio_ll *ll,
@@ -1106,6 +1852,7 @@ gensio_i_alloc(struct gensio_os_funcs *o,
 	       gensio_event cb, void *user_data)
 {
     struct basen_data *ndata = o->zalloc(o, sizeof(*ndata));
+    int ival;
 
     if (!ndata)
 	return NULL;
@@ -1113,6 +1860,22 @@ gensio_i_alloc(struct gensio_os_funcs *o,
     ndata->o = o;
     ndata->refcount = 1;
     ndata->freeref = 1;
+    gensio_list_init(&ndata->wqueue);
+    gensio_list_init(&ndata->wdone);
+
+    ndata->cbuf_size = 16384;
+    if (!gensio_get_default(o, typename, "write_coalesce_size", false,
+			    GENSIO_DEFAULT_INT, NULL, &ival))
+	ndata->cbuf_size = ival;
+    if (!gensio_get_default(o, typename, "write_coalesce", false,
+			    GENSIO_DEFAULT_INT, NULL, &ival))
+	ndata->coalesce_delay = ival;
+    if (!gensio_get_default(o, typename, "write_high_water", false,
+			    GENSIO_DEFAULT_INT, NULL, &ival))
+	ndata->high_water = ival;
+    if (!gensio_get_default(o, typename, "write_low_water", false,
+			    GENSIO_DEFAULT_INT, NULL, &ival))
+	ndata->low_water = ival;
 
     ndata->lock = o->alloc_lock(o);
     if (!ndata->lock)
@@ -1122,6 +1885,10 @@ gensio_i_alloc(struct gensio_os_funcs *o,
     if (!ndata->timer)
 	goto out_nomem;
 
+    ndata->coalesce_timer = o->alloc_timer(o, basen_coalesce_timeout, ndata);
+    if (!ndata->coalesce_timer)
+	goto out_nomem;
+
     ndata->deferred_op_runner = o->alloc_runner(o, basen_deferred_op, ndata);
     if (!ndata->deferred_op_runner)
 	goto out_nomem;
@@ -1216,6 +1983,21 @@ gensio_filter_ll_read_needed(struct gensio_filter *filter)
 			NULL, NULL, NULL, NULL, NULL, 0, NULL);
 }
 
+/* Filters that don't block return GE_NOTSUP for these. */
+bool
+gensio_filter_ll_read_blocked(struct gensio_filter *filter)
+{
+    return filter->func(filter, GENSIO_FILTER_FUNC_LL_READ_BLOCKED,
+			NULL, NULL, NULL, NULL, NULL, 0, NULL) == true;
+}
+
+bool
+gensio_filter_ul_write_blocked(struct gensio_filter *filter)
+{
+    return filter->func(filter, GENSIO_FILTER_FUNC_UL_WRITE_BLOCKED,
+			NULL, NULL, NULL, NULL, NULL, 0, NULL) == true;
+}
+
 int
 gensio_filter_check_open_done(struct gensio_filter *filter,
 			      struct gensio *io)
@@ -1349,6 +2131,491 @@ gensio_filter_get_user_data(struct gensio_filter *filter)
     return filter->user_data;
 }
 
+/*
+ * A filter made of other filters stacked on top of each other,
+ * filters[0] on top.  Data passes from one filter straight into the
+ * next through the handlers, so the whole stack runs in one gensio.
+ *
+ * While opening, the filters connect from the bottom up, and a
+ * filter gets nothing from below until the filters under it are
+ * connected, just like it would if it was in its own gensio.
+ */
+struct fchain {
+    struct gensio_os_funcs *o;
+    struct gensio_filter *filter;
+
+    /* Filters that have finished connecting, counted from the bottom. */
+    unsigned int connected;
+
+    /* Filters that have finished disconnecting, counted from the top. */
+    unsigned int disconnected;
+
+    unsigned int nfilters;
+    struct gensio_filter *filters[];
+};
+
+struct fchain_ul_data {
+    struct fchain *chain;
+    unsigned int level;
+    gensio_ul_filter_data_handler handler;
+    void *cb_data;
+};
+
+struct fchain_ll_data {
+    struct fchain *chain;
+    unsigned int level;
+    gensio_ll_filter_data_handler handler; /* NULL takes nothing. */
+    void *cb_data;
+};
+
+static int gensio_fchain_func(struct gensio_filter *filter, int op,
+			      const void *func, void *data,
+			      gensiods *count,
+			      void *buf, const void *cbuf,
+			      gensiods buflen,
+			      const char *const *auxdata);
+
+/* The highest filter that may pass data. */
+static unsigned int
+fchain_first_active(struct fchain *chain)
+{
+    if (chain->connected >= chain->nfilters)
+	return 0;
+    return chain->nfilters - 1 - chain->connected;
+}
+
+static void
+fchain_set_callback(struct fchain *chain, gensio_filter_cb cb, void *cb_data)
+{
+    unsigned int i;
+
+    for (i = 0; i < chain->nfilters; i++) {
+	chain->filters[i]->ndata = chain->filter->ndata;
+	gensio_filter_set_callback(chain->filters[i], cb, cb_data);
+    }
+}
+
+static bool
+fchain_ul_read_pending(struct fchain *chain)
+{
+    unsigned int i;
+
+    for (i = fchain_first_active(chain); i < chain->nfilters; i++) {
+	if (gensio_filter_ul_read_pending(chain->filters[i]))
+	    return true;
+    }
+    return false;
+}
+
+static bool
+fchain_ll_write_pending(struct fchain *chain)
+{
+    unsigned int i;
+
+    for (i = fchain_first_active(chain); i < chain->nfilters; i++) {
+	if (gensio_filter_ll_write_pending(chain->filters[i]))
+	    return true;
+    }
+    return false;
+}
+
+static bool
+fchain_ll_read_needed(struct fchain *chain)
+{
+    unsigned int i;
+
+    for (i = fchain_first_active(chain); i < chain->nfilters; i++) {
+	if (gensio_filter_ll_read_needed(chain->filters[i]))
+	    return true;
+    }
+    return false;
+}
+
+/* Data passes through every filter, so any of them can hold it up. */
+static bool
+fchain_ll_read_blocked(struct fchain *chain)
+{
+    unsigned int i;
+
+    for (i = fchain_first_active(chain); i < chain->nfilters; i++) {
+	if (gensio_filter_ll_read_blocked(chain->filters[i]))
+	    return true;
+    }
+    return false;
+}
+
+static bool
+fchain_ul_write_blocked(struct fchain *chain)
+{
+    unsigned int i;
+
+    for (i = fchain_first_active(chain); i < chain->nfilters; i++) {
+	if (gensio_filter_ul_write_blocked(chain->filters[i]))
+	    return true;
+    }
+    return false;
+}
+
+static int
+fchain_ll_handler(void *cb_data, gensiods *rcount,
+		  unsigned char *buf, gensiods buflen,
+		  const char *const *auxdata)
+{
+    struct fchain_ll_data *d = cb_data, next = *d;
+
+    if (d->level == 0) {
+	if (!d->handler) {
+	    *rcount = 0;
+	    return 0;
+	}
+	return d->handler(d->cb_data, rcount, buf, buflen, auxdata);
+    }
+
+    next.level--;
+    if (next.level < fchain_first_active(d->chain)) {
+	/* The filter above isn't running yet, hold the data until it is. */
+	*rcount = 0;
+	return 0;
+    }
+    return gensio_filter_ll_write(d->chain->filters[next.level],
+				  fchain_ll_handler, &next, rcount,
+				  buf, buflen, auxdata);
+}
+
+static int
+fchain_ul_handler(void *cb_data, gensiods *rcount,
+		  const struct gensio_sg *sg, gensiods sglen,
+		  const char *const *auxdata)
+{
+    struct fchain_ul_data *d = cb_data, next = *d;
+
+    next.level++;
+    if (next.level == d->chain->nfilters)
+	return d->handler(d->cb_data, rcount, sg, sglen, auxdata);
+    return gensio_filter_ul_write(d->chain->filters[next.level],
+				  fchain_ul_handler, &next, rcount,
+				  sg, sglen, auxdata);
+}
+
+/* Pass up anything a filter got before the one above it was running. */
+static int
+fchain_push_up(struct fchain *chain, unsigned int level)
+{
+    struct fchain_ll_data d = { chain, level, NULL, NULL };
+
+    return gensio_filter_ll_write(chain->filters[level], fchain_ll_handler,
+				  &d, NULL, NULL, 0, NULL);
+}
+
+static int
+fchain_try_connect(struct fchain *chain, struct timeval *timeout)
+{
+    struct gensio *io = gensio_filter_get_gensio(chain->filter);
+    unsigned int i;
+    int err;
+
+    while (chain->connected < chain->nfilters) {
+	i = chain->nfilters - 1 - chain->connected;
+	err = gensio_filter_try_connect(chain->filters[i], timeout);
+	if (!err)
+	    err = gensio_filter_check_open_done(chain->filters[i], io);
+	if (err)
+	    return err;
+	chain->connected++;
+	if (i > 0) {
+	    err = fchain_push_up(chain, i);
+	    if (err)
+		return err;
+	}
+    }
+
+    return 0;
+}
+
+static int
+fchain_try_disconnect(struct fchain *chain, struct timeval *timeout)
+{
+    unsigned int i;
+    int err;
+
+    while (chain->disconnected < chain->nfilters) {
+	i = chain->disconnected;
+	/* Don't disconnect filters that never got connected. */
+	if (i >= chain->nfilters - chain->connected) {
+	    err = gensio_filter_try_disconnect(chain->filters[i], timeout);
+	    if (err)
+		return err;
+	}
+	chain->disconnected++;
+    }
+
+    return 0;
+}
+
+static int
+fchain_ul_write(struct fchain *chain,
+		gensio_ul_filter_data_handler handler, void *cb_data,
+		gensiods *rcount,
+		const struct gensio_sg *sg, gensiods sglen,
+		const char *const *auxdata)
+{
+    struct fchain_ul_data d = { chain, 0, handler, cb_data };
+    unsigned int i;
+    int err;
+
+    if (sg)
+	return gensio_filter_ul_write(chain->filters[0], fchain_ul_handler, &d,
+				      rcount, sg, sglen, auxdata);
+
+    /* Push out whatever is pending, the oldest (lowest) first. */
+    for (i = chain->nfilters; i > fchain_first_active(chain); ) {
+	d.level = --i;
+	err = gensio_filter_ul_write(chain->filters[i], fchain_ul_handler, &d,
+				     NULL, NULL, 0, NULL);
+	if (err)
+	    return err;
+    }
+    if (rcount)
+	*rcount = 0;
+    return 0;
+}
+
+static int
+fchain_ll_write(struct fchain *chain,
+		gensio_ll_filter_data_handler handler, void *cb_data,
+		gensiods *rcount,
+		unsigned char *buf, gensiods buflen,
+		const char *const *auxdata)
+{
+    struct fchain_ll_data d = { chain, chain->nfilters - 1, handler, cb_data };
+    unsigned int i;
+    int err;
+
+    if (buf)
+	return gensio_filter_ll_write(chain->filters[d.level],
+				      fchain_ll_handler, &d, rcount,
+				      buf, buflen, auxdata);
+
+    /* Deliver whatever is pending, the top first to make room below. */
+    for (i = fchain_first_active(chain); i < chain->nfilters; i++) {
+	d.level = i;
+	err = gensio_filter_ll_write(chain->filters[i], fchain_ll_handler, &d,
+				     NULL, NULL, 0, NULL);
+	if (err)
+	    return err;
+    }
+    if (rcount)
+	*rcount = 0;
+    return 0;
+}
+
+static void
+fchain_timeout(struct fchain *chain)
+{
+    unsigned int i;
+
+    for (i = 0; i < chain->nfilters; i++)
+	gensio_filter_timeout(chain->filters[i]);
+}
+
+static int
+fchain_setup(struct fchain *chain, struct gensio *io)
+{
+    unsigned int i;
+    int err;
+
+    for (i = 0; i < chain->nfilters; i++) {
+	err = gensio_filter_setup(chain->filters[i], io);
+	if (err) {
+	    while (i > 0)
+		gensio_filter_cleanup(chain->filters[--i]);
+	    return err;
+	}
+    }
+    return 0;
+}
+
+static void
+fchain_cleanup(struct fchain *chain)
+{
+    unsigned int i;
+
+    for (i = 0; i < chain->nfilters; i++)
+	gensio_filter_cleanup(chain->filters[i]);
+    chain->connected = 0;
+    chain->disconnected = 0;
+}
+
+static void
+fchain_free(struct fchain *chain)
+{
+    unsigned int i;
+
+    for (i = 0; i < chain->nfilters; i++)
+	gensio_filter_free(chain->filters[i]);
+    gensio_filter_free_data(chain->filter);
+    chain->o->free(chain->o, chain);
+}
+
+/*
+ * A get goes to the first filter from the top that supports it, a
+ * set goes to all of them.
+ */
+static int
+fchain_control(struct fchain *chain, bool get, unsigned int option,
+	       char *data, gensiods *datalen)
+{
+    unsigned int i;
+    int rv = GE_NOTSUP, rv2;
+
+    for (i = 0; i < chain->nfilters; i++) {
+	rv2 = gensio_filter_control(chain->filters[i], get, option,
+				    data, datalen);
+	if (rv2 == GE_NOTSUP)
+	    continue;
+	if (get || rv2)
+	    return rv2;
+	rv = 0;
+    }
+    return rv;
+}
+
+static int
+fchain_open_channel(struct fchain *chain,
+		    struct gensio_func_open_channel_data *data)
+{
+    unsigned int i;
+    int rv;
+
+    for (i = 0; i < chain->nfilters; i++) {
+	rv = gensio_filter_open_channel(chain->filters[i], data);
+	if (rv != GE_NOTSUP)
+	    return rv;
+    }
+    return GE_NOTSUP;
+}
+
+static int
+gensio_fchain_func(struct gensio_filter *filter, int op,
+		   const void *func, void *data,
+		   gensiods *count,
+		   void *buf, const void *cbuf,
+		   gensiods buflen,
+		   const char *const *auxdata)
+{
+    struct fchain *chain = filter->user_data;
+
+    switch (op) {
+    case GENSIO_FILTER_FUNC_SET_CALLBACK:
+	fchain_set_callback(chain, func, data);
+	return 0;
+
+    case GENSIO_FILTER_FUNC_UL_READ_PENDING:
+	return fchain_ul_read_pending(chain);
+
+    case GENSIO_FILTER_FUNC_UL_WRITE_PENDING:
+	return fchain_ll_write_pending(chain);
+
+    case GENSIO_FILTER_FUNC_LL_READ_NEEDED:
+	return fchain_ll_read_needed(chain);
+
+    case GENSIO_FILTER_FUNC_LL_READ_BLOCKED:
+	return fchain_ll_read_blocked(chain);
+
+    case GENSIO_FILTER_FUNC_UL_WRITE_BLOCKED:
+	return fchain_ul_write_blocked(chain);
+
+    case GENSIO_FILTER_FUNC_CHECK_OPEN_DONE:
+	/* Each filter was checked as it finished connecting. */
+	return 0;
+
+    case GENSIO_FILTER_FUNC_TRY_CONNECT:
+	return fchain_try_connect(chain, data);
+
+    case GENSIO_FILTER_FUNC_TRY_DISCONNECT:
+	return fchain_try_disconnect(chain, data);
+
+    case GENSIO_FILTER_FUNC_UL_WRITE_SG:
+	return fchain_ul_write(chain, func, data, count, cbuf, buflen,
+			       auxdata);
+
+    case GENSIO_FILTER_FUNC_LL_WRITE:
+	return fchain_ll_write(chain, func, data, count, buf, buflen, auxdata);
+
+    case GENSIO_FILTER_FUNC_TIMEOUT:
+	fchain_timeout(chain);
+	return 0;
+
+    case GENSIO_FILTER_FUNC_SETUP:
+	return fchain_setup(chain, data);
+
+    case GENSIO_FILTER_FUNC_CLEANUP:
+	fchain_cleanup(chain);
+	return 0;
+
+    case GENSIO_FILTER_FUNC_FREE:
+	fchain_free(chain);
+	return 0;
+
+    case GENSIO_FILTER_FUNC_CONTROL:
+	return fchain_control(chain, *((bool *) cbuf), buflen, data, count);
+
+    case GENSIO_FILTER_FUNC_OPEN_CHANNEL:
+	return fchain_open_channel(chain, data);
+
+    default:
+	return GE_NOTSUP;
+    }
+}
+
+int
+gensio_filter_chain_alloc(struct gensio_os_funcs *o,
+			  struct gensio_filter **filters,
+			  unsigned int nfilters,
+			  struct gensio_filter **rfilter)
+{
+    struct fchain *chain, *sub;
+    unsigned int i, j, count = 0;
+
+    if (nfilters == 0)
+	return GE_INVAL;
+
+    for (i = 0; i < nfilters; i++) {
+	if (filters[i]->func == gensio_fchain_func)
+	    count += ((struct fchain *) filters[i]->user_data)->nfilters;
+	else
+	    count++;
+    }
+
+    chain = o->zalloc(o, sizeof(*chain) + count * sizeof(chain->filters[0]));
+    if (!chain)
+	return GE_NOMEM;
+    chain->o = o;
+
+    chain->filter = gensio_filter_alloc_data(o, gensio_fchain_func, chain);
+    if (!chain->filter) {
+	o->free(o, chain);
+	return GE_NOMEM;
+    }
+
+    /* Nothing can fail from here, so it's safe to take the filters. */
+    for (i = 0; i < nfilters; i++) {
+	if (filters[i]->func != gensio_fchain_func) {
+	    chain->filters[chain->nfilters++] = filters[i];
+	    continue;
+	}
+	/* Merge the chain's filters in and throw the chain away. */
+	sub = filters[i]->user_data;
+	for (j = 0; j < sub->nfilters; j++)
+	    chain->filters[chain->nfilters++] = sub->filters[j];
+	gensio_filter_free_data(sub->filter);
+	o->free(o, sub);
+    }
+
+    *rfilter = chain->filter;
+    return 0;
+}
+
 void
 gensio_ll_set_callback(struct gensio_ll *ll,
 		       gensio_ll_cb cb, void *cb_data)
@@ -1365,6 +2632,20 @@ gensio_ll_write(struct gensio_ll *ll, gensiods *rcount,
 		    auxdata);
 }
 
+int
+gensio_ll_write_msgs(struct gensio_ll *ll, gensiods *rcount,
+		     struct gensio_msg *msgs, gensiods nmsgs)
+{
+    return ll->func(ll, GENSIO_LL_FUNC_WRITE_MSGS, rcount, msgs, NULL, nmsgs,
+		    NULL);
+}
+
+int
+gensio_ll_raw_fd(struct gensio_ll *ll, struct gensio_raw_fd *raw)
+{
+    return ll->func(ll, GENSIO_LL_FUNC_RAW_FD, NULL, raw, NULL, 0, NULL);
+}
+
 int
 gensio_ll_raddr_to_str(struct gensio_ll *ll, gensiods *pos,
 		       char *buf, gensiods buflen)
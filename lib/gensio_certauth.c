@@ -85,6 +85,12 @@ certauth_gensio_alloc(struct gensio *child, const char *const args[],
     gensio_set_is_encrypted(io, true);
     gensio_free(child); /* Lose the ref we acquired. */
 
+    err = base_gensio_set_fusable(io);
+    if (err) {
+	gensio_free(io);
+	return err;
+    }
+
     *net = io;
     return 0;
 }
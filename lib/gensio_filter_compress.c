@@ -0,0 +1,770 @@
+/*
+ *  gensio - A library for abstracting stream I/O
+ *  Copyright (C) 2019  Corey Minyard <minyard@acm.org>
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public
+ *  License as published by the Free Software Foundation; either
+ *  version 2 of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307  USA
+ */
+
+/*
+ * A filter that runs the data stream through zlib's deflate on the
+ * way out and inflate on the way in.
+ *
+ * Output is normally sync flushed on every write, so everything the
+ * user writes shows up on the other end right away.  If flush_delay
+ * is set, the flush is put off for up to that long so that small
+ * writes compress together; the deadline keeps interactive data from
+ * sitting in the compressor.
+ */
+
+#include "config.h"
+#include <errno.h>
+#include <assert.h>
+#include <stdio.h>
+
+#include <gensio/gensio_class.h>
+
+#include "gensio_filter_compress.h"
+
+#ifdef HAVE_ZLIB
+
+#include <limits.h>
+#include <string.h>
+#include <zlib.h>
+
+struct gensio_compress_filter_data {
+    struct gensio_os_funcs *o;
+    unsigned int level;
+    unsigned int flush_delay; /* In microseconds, 0 means flush now. */
+    gensiods max_read_size;
+    gensiods max_write_size;
+};
+
+struct compress_filter {
+    struct gensio_filter *filter;
+    struct gensio_os_funcs *o;
+    struct gensio_lock *lock;
+
+    gensio_filter_cb filter_cb;
+    void *filter_cb_data;
+
+    unsigned int flush_delay;
+
+    /*
+     * The zlib streams and the buffers live as long as the filter, a
+     * reopen just resets them.
+     */
+    z_stream dstrm;
+    bool dstrm_init;
+    z_stream istrm;
+    bool istrm_init;
+
+    /* Compressed data waiting to go to the lower layer. */
+    unsigned char *xmit_buf;
+    gensiods max_write_size;
+    gensiods xmit_buf_len;
+    gensiods xmit_buf_pos;
+
+    /* Uncompressed data waiting to go to the user. */
+    unsigned char *read_data;
+    gensiods max_read_size;
+    gensiods read_data_len;
+    gensiods read_data_pos;
+
+    /* The last inflate filled read_data, it may have more. */
+    bool inflate_more;
+
+    /* Data has gone into deflate since the last flush. */
+    bool unflushed;
+
+    /* Flush the deflate stream on the next write. */
+    bool flush_due;
+
+    /*
+     * The filter holds a reference while the flush timer is running,
+     * and the timer handler keeps flush_timer_running set until it
+     * is done calling back into the base.  The filter is freed when
+     * the last reference goes away.
+     */
+    struct gensio_timer *flush_timer;
+    bool flush_timer_running;
+    unsigned int refcount;
+    bool freed;
+
+    /* Statistics */
+    unsigned long long raw_out;
+    unsigned long long compressed_out;
+    unsigned long long compressed_in;
+    unsigned long long raw_in;
+};
+
+#define filter_to_compress(v) ((struct compress_filter *) \
+			       gensio_filter_get_user_data(v))
+
+static void
+compress_lock(struct compress_filter *cfilter)
+{
+    cfilter->o->lock(cfilter->lock);
+}
+
+static void
+compress_unlock(struct compress_filter *cfilter)
+{
+    cfilter->o->unlock(cfilter->lock);
+}
+
+static voidpf
+compress_zalloc(voidpf opaque, uInt items, uInt size)
+{
+    struct gensio_os_funcs *o = opaque;
+
+    return o->zalloc(o, items * size);
+}
+
+static void
+compress_zfree(voidpf opaque, voidpf address)
+{
+    struct gensio_os_funcs *o = opaque;
+
+    o->free(o, address);
+}
+
+static void
+compress_set_callbacks(struct gensio_filter *filter,
+		       gensio_filter_cb cb, void *cb_data)
+{
+    struct compress_filter *cfilter = filter_to_compress(filter);
+
+    cfilter->filter_cb = cb;
+    cfilter->filter_cb_data = cb_data;
+}
+
+static bool
+compress_ul_read_pending(struct gensio_filter *filter)
+{
+    struct compress_filter *cfilter = filter_to_compress(filter);
+    bool rv;
+
+    compress_lock(cfilter);
+    rv = cfilter->read_data_len || cfilter->inflate_more;
+    compress_unlock(cfilter);
+    return rv;
+}
+
+static bool
+compress_ll_write_pending(struct gensio_filter *filter)
+{
+    struct compress_filter *cfilter = filter_to_compress(filter);
+    bool rv;
+
+    compress_lock(cfilter);
+    rv = cfilter->xmit_buf_len || cfilter->flush_due;
+    compress_unlock(cfilter);
+    return rv;
+}
+
+static bool
+compress_ll_read_needed(struct gensio_filter *filter)
+{
+    return false;
+}
+
+static int
+compress_check_open_done(struct gensio_filter *filter, struct gensio *io)
+{
+    return 0;
+}
+
+static int
+compress_try_connect(struct gensio_filter *filter, struct timeval *timeout)
+{
+    return 0;
+}
+
+static void
+compress_start_flush_timer(struct compress_filter *cfilter)
+{
+    struct timeval timeout;
+
+    timeout.tv_sec = cfilter->flush_delay / 1000000;
+    timeout.tv_usec = cfilter->flush_delay % 1000000;
+    if (cfilter->o->start_timer(cfilter->flush_timer, &timeout) == 0) {
+	cfilter->flush_timer_running = true;
+	cfilter->refcount++; /* Released by the timeout or the stop. */
+    } else {
+	cfilter->flush_due = true;
+    }
+}
+
+static void
+compress_stop_flush_timer(struct compress_filter *cfilter)
+{
+    if (cfilter->flush_timer_running &&
+		cfilter->o->stop_timer(cfilter->flush_timer) == 0) {
+	cfilter->flush_timer_running = false;
+	/* The caller holds a ref, so this cannot go to zero. */
+	assert(cfilter->refcount > 1);
+	cfilter->refcount--;
+    }
+}
+
+static void cfilter_free(struct compress_filter *cfilter);
+
+static void
+compress_deref_and_unlock(struct compress_filter *cfilter)
+{
+    unsigned int count;
+
+    assert(cfilter->refcount > 0);
+    count = --cfilter->refcount;
+    compress_unlock(cfilter);
+    if (count == 0)
+	cfilter_free(cfilter);
+}
+
+static int
+compress_try_disconnect(struct gensio_filter *filter, struct timeval *timeout)
+{
+    struct compress_filter *cfilter = filter_to_compress(filter);
+    int rv = 0;
+
+    compress_lock(cfilter);
+    /* Push out anything still in the compressor before closing. */
+    compress_stop_flush_timer(cfilter);
+    if (cfilter->unflushed)
+	cfilter->flush_due = true;
+    if (cfilter->xmit_buf_len || cfilter->flush_due) {
+	rv = GE_INPROGRESS;
+    } else if (cfilter->flush_timer_running) {
+	/* The timer handler is running, don't let the base go away. */
+	timeout->tv_sec = 0;
+	timeout->tv_usec = 1000;
+	rv = GE_RETRY;
+    }
+    compress_unlock(cfilter);
+
+    return rv;
+}
+
+static void
+compress_flush_timeout(struct gensio_timer *t, void *cb_data)
+{
+    struct compress_filter *cfilter = cb_data;
+    bool output_ready = false;
+
+    compress_lock(cfilter);
+    if (cfilter->unflushed && !cfilter->flush_due && !cfilter->freed) {
+	cfilter->flush_due = true;
+	output_ready = true;
+    }
+    compress_unlock(cfilter);
+
+    if (output_ready && cfilter->filter_cb)
+	cfilter->filter_cb(cfilter->filter_cb_data,
+			   GENSIO_FILTER_CB_OUTPUT_READY, NULL);
+
+    compress_lock(cfilter);
+    cfilter->flush_timer_running = false;
+    /* Data written while the callback ran needs a flush, too. */
+    if (cfilter->unflushed && !cfilter->flush_due && !cfilter->freed)
+	compress_start_flush_timer(cfilter);
+    compress_deref_and_unlock(cfilter);
+}
+
+/*
+ * Run deflate into the empty xmit buffer.  Returns the number of
+ * bytes of input consumed.
+ */
+static gensiods
+compress_deflate(struct compress_filter *cfilter,
+		 const unsigned char *buf, gensiods buflen, int flush)
+{
+    z_stream *strm = &cfilter->dstrm;
+    uInt avail_in = buflen > UINT_MAX ? UINT_MAX : buflen;
+
+    strm->next_in = (Bytef *) buf;
+    strm->avail_in = avail_in;
+    strm->next_out = cfilter->xmit_buf;
+    strm->avail_out = cfilter->max_write_size;
+
+    /* This can only fail with Z_BUF_ERROR, meaning nothing to do. */
+    deflate(strm, flush);
+
+    cfilter->xmit_buf_len = cfilter->max_write_size - strm->avail_out;
+    cfilter->xmit_buf_pos = 0;
+    if (flush == Z_SYNC_FLUSH && strm->avail_out != 0) {
+	/* The flush is complete. */
+	cfilter->flush_due = false;
+	cfilter->unflushed = false;
+    }
+
+    return avail_in - strm->avail_in;
+}
+
+static int
+compress_ul_write(struct gensio_filter *filter,
+		  gensio_ul_filter_data_handler handler, void *cb_data,
+		  gensiods *rcount,
+		  const struct gensio_sg *sg, gensiods sglen,
+		  const char *const *auxdata)
+{
+    struct compress_filter *cfilter = filter_to_compress(filter);
+    gensiods i, pos = 0, count = 0, used;
+    int err = 0;
+
+    compress_lock(cfilter);
+    i = 0;
+    while (true) {
+	if (cfilter->xmit_buf_len) {
+	    gensiods written = 0;
+	    struct gensio_sg osg = {
+		cfilter->xmit_buf + cfilter->xmit_buf_pos,
+		cfilter->xmit_buf_len - cfilter->xmit_buf_pos
+	    };
+
+	    err = handler(cb_data, &written, &osg, 1, NULL);
+	    if (err) {
+		cfilter->xmit_buf_len = 0;
+		cfilter->flush_due = false;
+		break;
+	    }
+	    cfilter->compressed_out += written;
+	    cfilter->xmit_buf_pos += written;
+	    if (cfilter->xmit_buf_pos < cfilter->xmit_buf_len)
+		/* The lower layer is full, try again on write ready. */
+		break;
+	    cfilter->xmit_buf_len = 0;
+	}
+
+	while (i < sglen && pos == sg[i].buflen) {
+	    i++;
+	    pos = 0;
+	}
+	if (i < sglen) {
+	    used = compress_deflate(cfilter,
+				    ((const unsigned char *) sg[i].buf) + pos,
+				    sg[i].buflen - pos, Z_NO_FLUSH);
+	    pos += used;
+	    count += used;
+	    if (!used && !cfilter->xmit_buf_len)
+		break; /* Can't happen with an empty buffer, but be safe. */
+	    cfilter->unflushed = true;
+	    continue;
+	}
+
+	if (cfilter->unflushed && !cfilter->flush_due) {
+	    if (cfilter->flush_delay) {
+		if (!cfilter->flush_timer_running)
+		    compress_start_flush_timer(cfilter);
+	    } else {
+		cfilter->flush_due = true;
+	    }
+	}
+	if (!cfilter->flush_due)
+	    break;
+	compress_stop_flush_timer(cfilter);
+	compress_deflate(cfilter, NULL, 0, Z_SYNC_FLUSH);
+	if (!cfilter->xmit_buf_len)
+	    break;
+    }
+    cfilter->raw_out += count;
+    compress_unlock(cfilter);
+
+    if (rcount)
+	*rcount = count;
+
+    return err;
+}
+
+static int
+compress_ll_write(struct gensio_filter *filter,
+		  gensio_ll_filter_data_handler handler, void *cb_data,
+		  gensiods *rcount,
+		  unsigned char *buf, gensiods buflen,
+		  const char *const *auxdata)
+{
+    struct compress_filter *cfilter = filter_to_compress(filter);
+    z_stream *strm = &cfilter->istrm;
+    gensiods pos = 0;
+    uInt avail_in;
+    int err = 0, zerr;
+
+    compress_lock(cfilter);
+ process_more:
+    if (!cfilter->read_data_len && (pos < buflen || cfilter->inflate_more)) {
+	avail_in = buflen - pos > UINT_MAX ? UINT_MAX : buflen - pos;
+	strm->next_in = buf + pos;
+	strm->avail_in = avail_in;
+	strm->next_out = cfilter->read_data;
+	strm->avail_out = cfilter->max_read_size;
+
+	zerr = inflate(strm, Z_SYNC_FLUSH);
+	if (zerr == Z_NEED_DICT || zerr == Z_DATA_ERROR ||
+		zerr == Z_STREAM_ERROR) {
+	    gensio_log(cfilter->o, GENSIO_LOG_ERR,
+		       "compress: Invalid compressed data: %s",
+		       strm->msg ? strm->msg : "unknown error");
+	    err = GE_PROTOERR;
+	    goto out_unlock;
+	} else if (zerr == Z_MEM_ERROR) {
+	    err = GE_NOMEM;
+	    goto out_unlock;
+	} else if (zerr == Z_STREAM_END) {
+	    /* The remote end started a new stream. */
+	    inflateReset(strm);
+	}
+
+	pos += avail_in - strm->avail_in;
+	cfilter->compressed_in += avail_in - strm->avail_in;
+	cfilter->read_data_len = cfilter->max_read_size - strm->avail_out;
+	cfilter->read_data_pos = 0;
+	cfilter->raw_in += cfilter->read_data_len;
+	cfilter->inflate_more = strm->avail_out == 0;
+    }
+
+    if (cfilter->read_data_len) {
+	gensiods count = 0;
+
+	compress_unlock(cfilter);
+	err = handler(cb_data, &count,
+		      cfilter->read_data + cfilter->read_data_pos,
+		      cfilter->read_data_len, NULL);
+	compress_lock(cfilter);
+	if (!err) {
+	    if (count >= cfilter->read_data_len) {
+		cfilter->read_data_len = 0;
+		cfilter->read_data_pos = 0;
+		goto process_more;
+	    } else {
+		cfilter->read_data_len -= count;
+		cfilter->read_data_pos += count;
+	    }
+	}
+    }
+ out_unlock:
+    compress_unlock(cfilter);
+
+    if (rcount)
+	*rcount = pos;
+
+    return err;
+}
+
+static int
+compress_setup(struct gensio_filter *filter, struct gensio *io)
+{
+    struct compress_filter *cfilter = filter_to_compress(filter);
+
+    if (deflateReset(&cfilter->dstrm) != Z_OK)
+	return GE_INVAL;
+    if (inflateReset(&cfilter->istrm) != Z_OK)
+	return GE_INVAL;
+    return 0;
+}
+
+static void
+compress_cleanup(struct gensio_filter *filter)
+{
+    struct compress_filter *cfilter = filter_to_compress(filter);
+
+    compress_lock(cfilter);
+    compress_stop_flush_timer(cfilter);
+    cfilter->xmit_buf_len = 0;
+    cfilter->xmit_buf_pos = 0;
+    cfilter->read_data_len = 0;
+    cfilter->read_data_pos = 0;
+    cfilter->inflate_more = false;
+    cfilter->unflushed = false;
+    cfilter->flush_due = false;
+    compress_unlock(cfilter);
+}
+
+static void
+cfilter_free(struct compress_filter *cfilter)
+{
+    struct gensio_os_funcs *o = cfilter->o;
+
+    if (cfilter->flush_timer)
+	o->free_timer(cfilter->flush_timer);
+    if (cfilter->dstrm_init)
+	deflateEnd(&cfilter->dstrm);
+    if (cfilter->istrm_init)
+	inflateEnd(&cfilter->istrm);
+    if (cfilter->lock)
+	o->free_lock(cfilter->lock);
+    if (cfilter->read_data)
+	o->free(o, cfilter->read_data);
+    if (cfilter->xmit_buf)
+	o->free(o, cfilter->xmit_buf);
+    if (cfilter->filter)
+	gensio_filter_free_data(cfilter->filter);
+    o->free(o, cfilter);
+}
+
+static void
+compress_free(struct gensio_filter *filter)
+{
+    struct compress_filter *cfilter = filter_to_compress(filter);
+
+    compress_lock(cfilter);
+    cfilter->freed = true;
+    compress_stop_flush_timer(cfilter);
+    compress_deref_and_unlock(cfilter);
+}
+
+static int
+compress_filter_control(struct gensio_filter *filter, bool get, int op,
+			char *data, gensiods *datalen)
+{
+    struct compress_filter *cfilter = filter_to_compress(filter);
+
+    switch (op) {
+    case GENSIO_CONTROL_COMPRESS_STATS:
+	compress_lock(cfilter);
+	if (get) {
+	    *datalen = snprintf(data, *datalen,
+				"raw_out=%llu compressed_out=%llu"
+				" compressed_in=%llu raw_in=%llu",
+				cfilter->raw_out, cfilter->compressed_out,
+				cfilter->compressed_in, cfilter->raw_in);
+	} else {
+	    cfilter->raw_out = 0;
+	    cfilter->compressed_out = 0;
+	    cfilter->compressed_in = 0;
+	    cfilter->raw_in = 0;
+	}
+	compress_unlock(cfilter);
+	return 0;
+
+    default:
+	return GE_NOTSUP;
+    }
+}
+
+static int gensio_compress_filter_func(struct gensio_filter *filter, int op,
+				       const void *func, void *data,
+				       gensiods *count,
+				       void *buf, const void *cbuf,
+				       gensiods buflen,
+				       const char *const *auxdata)
+{
+    switch (op) {
+    case GENSIO_FILTER_FUNC_SET_CALLBACK:
+	compress_set_callbacks(filter, func, data);
+	return 0;
+
+    case GENSIO_FILTER_FUNC_UL_READ_PENDING:
+	return compress_ul_read_pending(filter);
+
+    case GENSIO_FILTER_FUNC_UL_WRITE_PENDING:
+	return compress_ll_write_pending(filter);
+
+    case GENSIO_FILTER_FUNC_LL_READ_NEEDED:
+	return compress_ll_read_needed(filter);
+
+    case GENSIO_FILTER_FUNC_CHECK_OPEN_DONE:
+	return compress_check_open_done(filter, data);
+
+    case GENSIO_FILTER_FUNC_TRY_CONNECT:
+	return compress_try_connect(filter, data);
+
+    case GENSIO_FILTER_FUNC_TRY_DISCONNECT:
+	return compress_try_disconnect(filter, data);
+
+    case GENSIO_FILTER_FUNC_UL_WRITE_SG:
+	return compress_ul_write(filter, func, data, count, cbuf, buflen, buf);
+
+    case GENSIO_FILTER_FUNC_LL_WRITE:
+	return compress_ll_write(filter, func, data, count, buf, buflen, NULL);
+
+    case GENSIO_FILTER_FUNC_SETUP:
+	return compress_setup(filter, data);
+
+    case GENSIO_FILTER_FUNC_CLEANUP:
+	compress_cleanup(filter);
+	return 0;
+
+    case GENSIO_FILTER_FUNC_FREE:
+	compress_free(filter);
+	return 0;
+
+    case GENSIO_FILTER_FUNC_CONTROL:
+	return compress_filter_control(filter, *((bool *) cbuf), buflen, data,
+				       count);
+
+    case GENSIO_FILTER_FUNC_TIMEOUT:
+    default:
+	return GE_NOTSUP;
+    }
+}
+
+static struct gensio_filter *
+gensio_compress_filter_raw_alloc(struct gensio_os_funcs *o,
+				 int level, unsigned int flush_delay,
+				 gensiods max_read_size,
+				 gensiods max_write_size)
+{
+    struct compress_filter *cfilter;
+
+    cfilter = o->zalloc(o, sizeof(*cfilter));
+    if (!cfilter)
+	return NULL;
+
+    cfilter->o = o;
+    cfilter->refcount = 1;
+    cfilter->flush_delay = flush_delay;
+    cfilter->max_read_size = max_read_size;
+    cfilter->max_write_size = max_write_size;
+
+    cfilter->lock = o->alloc_lock(o);
+    if (!cfilter->lock)
+	goto out_nomem;
+
+    cfilter->flush_timer = o->alloc_timer(o, compress_flush_timeout, cfilter);
+    if (!cfilter->flush_timer)
+	goto out_nomem;
+
+    cfilter->read_data = o->zalloc(o, max_read_size);
+    if (!cfilter->read_data)
+	goto out_nomem;
+
+    cfilter->xmit_buf = o->zalloc(o, max_write_size);
+    if (!cfilter->xmit_buf)
+	goto out_nomem;
+
+    cfilter->dstrm.zalloc = compress_zalloc;
+    cfilter->dstrm.zfree = compress_zfree;
+    cfilter->dstrm.opaque = o;
+    if (deflateInit(&cfilter->dstrm, level) != Z_OK)
+	goto out_nomem;
+    cfilter->dstrm_init = true;
+
+    cfilter->istrm.zalloc = compress_zalloc;
+    cfilter->istrm.zfree = compress_zfree;
+    cfilter->istrm.opaque = o;
+    if (inflateInit(&cfilter->istrm) != Z_OK)
+	goto out_nomem;
+    cfilter->istrm_init = true;
+
+    cfilter->filter = gensio_filter_alloc_data(o, gensio_compress_filter_func,
+					       cfilter);
+    if (!cfilter->filter)
+	goto out_nomem;
+
+    return cfilter->filter;
+
+ out_nomem:
+    cfilter_free(cfilter);
+    return NULL;
+}
+
+int
+gensio_compress_filter_config(struct gensio_os_funcs *o,
+			      const char * const args[],
+			      struct gensio_compress_filter_data **rdata)
+{
+    unsigned int i;
+    struct gensio_compress_filter_data *data = o->zalloc(o, sizeof(*data));
+    int rv, ival;
+
+    if (!data)
+	return GE_NOMEM;
+    data->o = o;
+    data->level = 6;
+    data->max_read_size = 16384;
+    data->max_write_size = 16384;
+
+    rv = gensio_get_default(o, "compress", "level", false,
+			    GENSIO_DEFAULT_INT, NULL, &ival);
+    if (!rv)
+	data->level = ival;
+    rv = gensio_get_default(o, "compress", "flush_delay", false,
+			    GENSIO_DEFAULT_INT, NULL, &ival);
+    if (!rv)
+	data->flush_delay = ival;
+
+    for (i = 0; args && args[i]; i++) {
+	if (gensio_check_keyuint(args[i], "level", &data->level) > 0)
+	    continue;
+	if (gensio_check_keyuint(args[i], "flush_delay",
+				 &data->flush_delay) > 0)
+	    continue;
+	if (gensio_check_keyds(args[i], "readbuf", &data->max_read_size) > 0)
+	    continue;
+	if (gensio_check_keyds(args[i], "writebuf", &data->max_write_size) > 0)
+	    continue;
+	goto out_inval;
+    }
+
+    if (data->level > 9)
+	goto out_inval;
+    /* deflate needs a little room to make progress on a flush. */
+    if (data->max_read_size == 0 || data->max_write_size < 16)
+	goto out_inval;
+
+    *rdata = data;
+    return 0;
+
+ out_inval:
+    o->free(o, data);
+    return GE_INVAL;
+}
+
+void
+gensio_compress_filter_config_free(struct gensio_compress_filter_data *data)
+{
+    if (data)
+	data->o->free(data->o, data);
+}
+
+int
+gensio_compress_filter_alloc(struct gensio_compress_filter_data *data,
+			     struct gensio_filter **rfilter)
+{
+    struct gensio_filter *filter;
+
+    filter = gensio_compress_filter_raw_alloc(data->o, data->level,
+					      data->flush_delay,
+					      data->max_read_size,
+					      data->max_write_size);
+    if (!filter)
+	return GE_NOMEM;
+
+    *rfilter = filter;
+    return 0;
+}
+
+#else /* HAVE_ZLIB */
+
+int
+gensio_compress_filter_config(struct gensio_os_funcs *o,
+			      const char * const args[],
+			      struct gensio_compress_filter_data **rdata)
+{
+    return GE_NOTSUP;
+}
+
+void
+gensio_compress_filter_config_free(struct gensio_compress_filter_data *data)
+{
+}
+
+int
+gensio_compress_filter_alloc(struct gensio_compress_filter_data *data,
+			     struct gensio_filter **rfilter)
+{
+    return GE_NOTSUP;
+}
+
+#endif /* HAVE_ZLIB */
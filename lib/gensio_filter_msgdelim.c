@@ -0,0 +1,603 @@
+/*
+ *  gensio - A library for abstracting stream I/O
+ *  Copyright (C) 2019  Corey Minyard <minyard@acm.org>
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public
+ *  License as published by the Free Software Foundation; either
+ *  version 2 of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307  USA
+ */
+
+/*
+ * A filter that puts message boundaries on a byte stream.  Each
+ * write is sent as a message with a 4 byte big endian length in
+ * front of it, and each read delivers exactly one message.
+ *
+ * When the lower layer can take it, a message goes out straight from
+ * the user's buffer with the header in front.  Once the lower layer
+ * backs up, messages are copied into the transmit buffer behind each
+ * other so they go out together in one lower layer write.
+ *
+ * On the receive side, a message that is all in the lower layer's
+ * buffer is handed to the user from there.  A message that is split
+ * over more than one lower layer read is put together in the read
+ * buffer first.
+ */
+
+#include "config.h"
+#include <errno.h>
+#include <string.h>
+
+#include <gensio/gensio_class.h>
+
+#include "gensio_filter_msgdelim.h"
+
+#define MSGDELIM_HDR_LEN 4
+
+/* The most scatter-gather entries a user write can have and go direct. */
+#define MSGDELIM_MAX_SG 16
+
+struct gensio_msgdelim_filter_data {
+    struct gensio_os_funcs *o;
+    gensiods max_msg_size;
+    gensiods max_write_size;
+};
+
+struct msgdelim_filter {
+    struct gensio_filter *filter;
+    struct gensio_os_funcs *o;
+    struct gensio_lock *lock;
+
+    gensio_filter_cb filter_cb;
+    void *filter_cb_data;
+
+    gensiods max_msg_size;
+
+    /* Framed messages waiting to go to the lower layer. */
+    unsigned char *xmit_buf;
+    gensiods max_write_size;
+    gensiods xmit_buf_len;
+    gensiods xmit_buf_pos;
+
+    /* The header of the incoming message, valid when hdr_len is full. */
+    unsigned char hdr[MSGDELIM_HDR_LEN];
+    unsigned int hdr_len;
+    gensiods msg_len;
+
+    /* How much of the incoming message has come from the lower layer. */
+    gensiods msg_pos;
+
+    /*
+     * The part of the incoming message put together here because it
+     * was split up by the lower layer.  It goes to the user once the
+     * whole message is in.
+     */
+    unsigned char *read_data;
+    gensiods read_data_len;
+    gensiods read_data_pos;
+};
+
+#define filter_to_msgdelim(v) ((struct msgdelim_filter *) \
+			       gensio_filter_get_user_data(v))
+
+static const char *msgdelim_eom[] = { "eom", NULL };
+
+static void
+msgdelim_lock(struct msgdelim_filter *mfilter)
+{
+    mfilter->o->lock(mfilter->lock);
+}
+
+static void
+msgdelim_unlock(struct msgdelim_filter *mfilter)
+{
+    mfilter->o->unlock(mfilter->lock);
+}
+
+static void
+msgdelim_set_callbacks(struct gensio_filter *filter,
+		       gensio_filter_cb cb, void *cb_data)
+{
+    struct msgdelim_filter *mfilter = filter_to_msgdelim(filter);
+
+    mfilter->filter_cb = cb;
+    mfilter->filter_cb_data = cb_data;
+}
+
+static bool
+msgdelim_msg_ready(struct msgdelim_filter *mfilter)
+{
+    return (mfilter->read_data_len &&
+	    mfilter->hdr_len == MSGDELIM_HDR_LEN &&
+	    mfilter->msg_pos == mfilter->msg_len);
+}
+
+static bool
+msgdelim_ul_read_pending(struct gensio_filter *filter)
+{
+    struct msgdelim_filter *mfilter = filter_to_msgdelim(filter);
+    bool rv;
+
+    msgdelim_lock(mfilter);
+    rv = msgdelim_msg_ready(mfilter);
+    msgdelim_unlock(mfilter);
+    return rv;
+}
+
+static bool
+msgdelim_ll_write_pending(struct gensio_filter *filter)
+{
+    struct msgdelim_filter *mfilter = filter_to_msgdelim(filter);
+    bool rv;
+
+    msgdelim_lock(mfilter);
+    rv = mfilter->xmit_buf_len;
+    msgdelim_unlock(mfilter);
+    return rv;
+}
+
+static bool
+msgdelim_ll_read_needed(struct gensio_filter *filter)
+{
+    return false;
+}
+
+static int
+msgdelim_check_open_done(struct gensio_filter *filter, struct gensio *io)
+{
+    return 0;
+}
+
+static int
+msgdelim_try_connect(struct gensio_filter *filter, struct timeval *timeout)
+{
+    return 0;
+}
+
+static int
+msgdelim_try_disconnect(struct gensio_filter *filter, struct timeval *timeout)
+{
+    return 0;
+}
+
+static void
+msgdelim_put_hdr(unsigned char *hdr, gensiods len)
+{
+    hdr[0] = (len >> 24) & 0xff;
+    hdr[1] = (len >> 16) & 0xff;
+    hdr[2] = (len >> 8) & 0xff;
+    hdr[3] = len & 0xff;
+}
+
+static gensiods
+msgdelim_get_hdr(const unsigned char *hdr)
+{
+    return (((gensiods) hdr[0] << 24) | ((gensiods) hdr[1] << 16) |
+	    ((gensiods) hdr[2] << 8) | hdr[3]);
+}
+
+/* Copy the sg list, starting at byte offset skip, into the xmit buffer. */
+static void
+msgdelim_copy_sg(struct msgdelim_filter *mfilter,
+		 const struct gensio_sg *sg, gensiods sglen, gensiods skip)
+{
+    gensiods i, len;
+
+    for (i = 0; i < sglen; i++) {
+	len = sg[i].buflen;
+	if (skip >= len) {
+	    skip -= len;
+	    continue;
+	}
+	len -= skip;
+	memcpy(mfilter->xmit_buf + mfilter->xmit_buf_len,
+	       ((const unsigned char *) sg[i].buf) + skip, len);
+	mfilter->xmit_buf_len += len;
+	skip = 0;
+    }
+}
+
+static int
+msgdelim_ul_write(struct gensio_filter *filter,
+		  gensio_ul_filter_data_handler handler, void *cb_data,
+		  gensiods *rcount,
+		  const struct gensio_sg *sg, gensiods sglen,
+		  const char *const *auxdata)
+{
+    struct msgdelim_filter *mfilter = filter_to_msgdelim(filter);
+    struct gensio_sg vec[MSGDELIM_MAX_SG + 1];
+    unsigned char hdr[MSGDELIM_HDR_LEN];
+    gensiods i, count = 0, total = 0, written;
+    int err = 0;
+
+    msgdelim_lock(mfilter);
+    if (mfilter->xmit_buf_len) {
+	struct gensio_sg osg = {
+	    mfilter->xmit_buf + mfilter->xmit_buf_pos,
+	    mfilter->xmit_buf_len - mfilter->xmit_buf_pos
+	};
+
+	written = 0;
+	err = handler(cb_data, &written, &osg, 1, NULL);
+	if (err) {
+	    mfilter->xmit_buf_len = 0;
+	    mfilter->xmit_buf_pos = 0;
+	    goto out_unlock;
+	}
+	mfilter->xmit_buf_pos += written;
+	if (mfilter->xmit_buf_pos >= mfilter->xmit_buf_len) {
+	    mfilter->xmit_buf_len = 0;
+	    mfilter->xmit_buf_pos = 0;
+	}
+    }
+
+    for (i = 0; i < sglen; i++)
+	total += sg[i].buflen;
+    if (total == 0)
+	goto out_unlock;
+    if (total > mfilter->max_msg_size) {
+	err = GE_TOOBIG;
+	goto out_unlock;
+    }
+
+    msgdelim_put_hdr(hdr, total);
+    if (!mfilter->xmit_buf_len && sglen <= MSGDELIM_MAX_SG) {
+	/* Nothing is waiting, try to send it from the user's buffer. */
+	vec[0].buf = hdr;
+	vec[0].buflen = MSGDELIM_HDR_LEN;
+	for (i = 0; i < sglen; i++)
+	    vec[i + 1] = sg[i];
+	written = 0;
+	err = handler(cb_data, &written, vec, sglen + 1, NULL);
+	if (err)
+	    goto out_unlock;
+	/* The write buffer always has room for one message. */
+	if (written < MSGDELIM_HDR_LEN) {
+	    memcpy(mfilter->xmit_buf, hdr + written,
+		   MSGDELIM_HDR_LEN - written);
+	    mfilter->xmit_buf_len = MSGDELIM_HDR_LEN - written;
+	    written = 0;
+	} else {
+	    written -= MSGDELIM_HDR_LEN;
+	}
+	msgdelim_copy_sg(mfilter, sg, sglen, written);
+	count = total;
+    } else {
+	/*
+	 * The lower layer is backed up, add the message to the ones
+	 * waiting so they all go out together.
+	 */
+	if (mfilter->xmit_buf_pos) {
+	    memmove(mfilter->xmit_buf,
+		    mfilter->xmit_buf + mfilter->xmit_buf_pos,
+		    mfilter->xmit_buf_len - mfilter->xmit_buf_pos);
+	    mfilter->xmit_buf_len -= mfilter->xmit_buf_pos;
+	    mfilter->xmit_buf_pos = 0;
+	}
+	if (mfilter->max_write_size - mfilter->xmit_buf_len <
+		total + MSGDELIM_HDR_LEN)
+	    goto out_unlock;
+	memcpy(mfilter->xmit_buf + mfilter->xmit_buf_len, hdr,
+	       MSGDELIM_HDR_LEN);
+	mfilter->xmit_buf_len += MSGDELIM_HDR_LEN;
+	msgdelim_copy_sg(mfilter, sg, sglen, 0);
+	count = total;
+    }
+
+ out_unlock:
+    msgdelim_unlock(mfilter);
+
+    if (rcount)
+	*rcount = count;
+
+    return err;
+}
+
+static void
+msgdelim_msg_done(struct msgdelim_filter *mfilter)
+{
+    mfilter->hdr_len = 0;
+    mfilter->msg_len = 0;
+    mfilter->msg_pos = 0;
+    mfilter->read_data_len = 0;
+    mfilter->read_data_pos = 0;
+}
+
+static int
+msgdelim_ll_write(struct gensio_filter *filter,
+		  gensio_ll_filter_data_handler handler, void *cb_data,
+		  gensiods *rcount,
+		  unsigned char *buf, gensiods buflen,
+		  const char *const *auxdata)
+{
+    struct msgdelim_filter *mfilter = filter_to_msgdelim(filter);
+    gensiods pos = 0, count, len;
+    int err = 0;
+
+    msgdelim_lock(mfilter);
+    while (true) {
+	if (msgdelim_msg_ready(mfilter)) {
+	    count = 0;
+	    msgdelim_unlock(mfilter);
+	    err = handler(cb_data, &count,
+			  mfilter->read_data + mfilter->read_data_pos,
+			  mfilter->read_data_len - mfilter->read_data_pos,
+			  msgdelim_eom);
+	    msgdelim_lock(mfilter);
+	    if (err)
+		break;
+	    mfilter->read_data_pos += count;
+	    if (mfilter->read_data_pos < mfilter->read_data_len)
+		break;
+	    msgdelim_msg_done(mfilter);
+	    continue;
+	}
+
+	if (pos >= buflen)
+	    break;
+
+	if (mfilter->hdr_len < MSGDELIM_HDR_LEN) {
+	    len = MSGDELIM_HDR_LEN - mfilter->hdr_len;
+	    if (len > buflen - pos)
+		len = buflen - pos;
+	    memcpy(mfilter->hdr + mfilter->hdr_len, buf + pos, len);
+	    mfilter->hdr_len += len;
+	    pos += len;
+	    if (mfilter->hdr_len < MSGDELIM_HDR_LEN)
+		break;
+
+	    mfilter->msg_len = msgdelim_get_hdr(mfilter->hdr);
+	    if (mfilter->msg_len > mfilter->max_msg_size) {
+		gensio_log(mfilter->o, GENSIO_LOG_ERR,
+			   "msgdelim: Received a %lu byte message, the"
+			   " maximum is %lu",
+			   (unsigned long) mfilter->msg_len,
+			   (unsigned long) mfilter->max_msg_size);
+		err = GE_PROTOERR;
+		break;
+	    }
+	    if (mfilter->msg_len == 0)
+		/* Nothing to deliver. */
+		msgdelim_msg_done(mfilter);
+	    continue;
+	}
+
+	len = mfilter->msg_len - mfilter->msg_pos;
+	if (!mfilter->read_data_len && buflen - pos >= len) {
+	    /* The rest of the message is all here, give it out directly. */
+	    count = 0;
+	    msgdelim_unlock(mfilter);
+	    err = handler(cb_data, &count, buf + pos, len, msgdelim_eom);
+	    msgdelim_lock(mfilter);
+	    if (err)
+		break;
+	    pos += count;
+	    mfilter->msg_pos += count;
+	    if (count < len)
+		/* The rest stays in the lower layer until asked for. */
+		break;
+	    msgdelim_msg_done(mfilter);
+	    continue;
+	}
+
+	if (len > buflen - pos)
+	    len = buflen - pos;
+	memcpy(mfilter->read_data + mfilter->read_data_len, buf + pos, len);
+	mfilter->read_data_len += len;
+	mfilter->msg_pos += len;
+	pos += len;
+    }
+    msgdelim_unlock(mfilter);
+
+    if (rcount)
+	*rcount = pos;
+
+    return err;
+}
+
+static int
+msgdelim_setup(struct gensio_filter *filter, struct gensio *io)
+{
+    return 0;
+}
+
+static void
+msgdelim_cleanup(struct gensio_filter *filter)
+{
+    struct msgdelim_filter *mfilter = filter_to_msgdelim(filter);
+
+    msgdelim_lock(mfilter);
+    mfilter->xmit_buf_len = 0;
+    mfilter->xmit_buf_pos = 0;
+    msgdelim_msg_done(mfilter);
+    msgdelim_unlock(mfilter);
+}
+
+static void
+mfilter_free(struct msgdelim_filter *mfilter)
+{
+    struct gensio_os_funcs *o = mfilter->o;
+
+    if (mfilter->lock)
+	o->free_lock(mfilter->lock);
+    if (mfilter->read_data)
+	o->free(o, mfilter->read_data);
+    if (mfilter->xmit_buf)
+	o->free(o, mfilter->xmit_buf);
+    if (mfilter->filter)
+	gensio_filter_free_data(mfilter->filter);
+    o->free(o, mfilter);
+}
+
+static void
+msgdelim_free(struct gensio_filter *filter)
+{
+    struct msgdelim_filter *mfilter = filter_to_msgdelim(filter);
+
+    mfilter_free(mfilter);
+}
+
+static int gensio_msgdelim_filter_func(struct gensio_filter *filter, int op,
+				       const void *func, void *data,
+				       gensiods *count,
+				       void *buf, const void *cbuf,
+				       gensiods buflen,
+				       const char *const *auxdata)
+{
+    switch (op) {
+    case GENSIO_FILTER_FUNC_SET_CALLBACK:
+	msgdelim_set_callbacks(filter, func, data);
+	return 0;
+
+    case GENSIO_FILTER_FUNC_UL_READ_PENDING:
+	return msgdelim_ul_read_pending(filter);
+
+    case GENSIO_FILTER_FUNC_UL_WRITE_PENDING:
+	return msgdelim_ll_write_pending(filter);
+
+    case GENSIO_FILTER_FUNC_LL_READ_NEEDED:
+	return msgdelim_ll_read_needed(filter);
+
+    case GENSIO_FILTER_FUNC_CHECK_OPEN_DONE:
+	return msgdelim_check_open_done(filter, data);
+
+    case GENSIO_FILTER_FUNC_TRY_CONNECT:
+	return msgdelim_try_connect(filter, data);
+
+    case GENSIO_FILTER_FUNC_TRY_DISCONNECT:
+	return msgdelim_try_disconnect(filter, data);
+
+    case GENSIO_FILTER_FUNC_UL_WRITE_SG:
+	return msgdelim_ul_write(filter, func, data, count, cbuf, buflen, buf);
+
+    case GENSIO_FILTER_FUNC_LL_WRITE:
+	return msgdelim_ll_write(filter, func, data, count, buf, buflen, NULL);
+
+    case GENSIO_FILTER_FUNC_SETUP:
+	return msgdelim_setup(filter, data);
+
+    case GENSIO_FILTER_FUNC_CLEANUP:
+	msgdelim_cleanup(filter);
+	return 0;
+
+    case GENSIO_FILTER_FUNC_FREE:
+	msgdelim_free(filter);
+	return 0;
+
+    case GENSIO_FILTER_FUNC_TIMEOUT:
+    default:
+	return GE_NOTSUP;
+    }
+}
+
+static struct gensio_filter *
+gensio_msgdelim_filter_raw_alloc(struct gensio_os_funcs *o,
+				 gensiods max_msg_size,
+				 gensiods max_write_size)
+{
+    struct msgdelim_filter *mfilter;
+
+    mfilter = o->zalloc(o, sizeof(*mfilter));
+    if (!mfilter)
+	return NULL;
+
+    mfilter->o = o;
+    mfilter->max_msg_size = max_msg_size;
+    mfilter->max_write_size = max_write_size;
+
+    mfilter->lock = o->alloc_lock(o);
+    if (!mfilter->lock)
+	goto out_nomem;
+
+    mfilter->read_data = o->zalloc(o, max_msg_size);
+    if (!mfilter->read_data)
+	goto out_nomem;
+
+    mfilter->xmit_buf = o->zalloc(o, max_write_size);
+    if (!mfilter->xmit_buf)
+	goto out_nomem;
+
+    mfilter->filter = gensio_filter_alloc_data(o, gensio_msgdelim_filter_func,
+					       mfilter);
+    if (!mfilter->filter)
+	goto out_nomem;
+
+    return mfilter->filter;
+
+ out_nomem:
+    mfilter_free(mfilter);
+    return NULL;
+}
+
+int
+gensio_msgdelim_filter_config(struct gensio_os_funcs *o,
+			      const char * const args[],
+			      struct gensio_msgdelim_filter_data **rdata)
+{
+    unsigned int i;
+    struct gensio_msgdelim_filter_data *data = o->zalloc(o, sizeof(*data));
+    int rv, ival;
+
+    if (!data)
+	return GE_NOMEM;
+    data->o = o;
+    data->max_msg_size = 65536;
+
+    rv = gensio_get_default(o, "msgdelim", "maxmsg", false,
+			    GENSIO_DEFAULT_INT, NULL, &ival);
+    if (!rv)
+	data->max_msg_size = ival;
+
+    for (i = 0; args && args[i]; i++) {
+	if (gensio_check_keyds(args[i], "maxmsg", &data->max_msg_size) > 0)
+	    continue;
+	if (gensio_check_keyds(args[i], "writebuf", &data->max_write_size) > 0)
+	    continue;
+	goto out_inval;
+    }
+
+    /* The length has to fit in the header. */
+    if (data->max_msg_size == 0 || data->max_msg_size > 0xffffffff)
+	goto out_inval;
+    /* A message has to fit in the write buffer. */
+    if (data->max_write_size < data->max_msg_size + MSGDELIM_HDR_LEN)
+	data->max_write_size = data->max_msg_size + MSGDELIM_HDR_LEN;
+
+    *rdata = data;
+    return 0;
+
+ out_inval:
+    o->free(o, data);
+    return GE_INVAL;
+}
+
+void
+gensio_msgdelim_filter_config_free(struct gensio_msgdelim_filter_data *data)
+{
+    if (data)
+	data->o->free(data->o, data);
+}
+
+int
+gensio_msgdelim_filter_alloc(struct gensio_msgdelim_filter_data *data,
+			     struct gensio_filter **rfilter)
+{
+    struct gensio_filter *filter;
+
+    filter = gensio_msgdelim_filter_raw_alloc(data->o, data->max_msg_size,
+					      data->max_write_size);
+    if (!filter)
+	return GE_NOMEM;
+
+    *rfilter = filter;
+    return 0;
+}
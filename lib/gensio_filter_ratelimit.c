@@ -0,0 +1,941 @@
+/*
+ *  gensio - A library for abstracting stream I/O
+ *  Copyright (C) 2019  Corey Minyard <minyard@acm.org>
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public
+ *  License as published by the Free Software Foundation; either
+ *  version 2 of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307  USA
+ */
+
+/*
+ * A filter that limits the rate data goes through it with a token
+ * bucket in each direction.  A connection may also be put in a named
+ * group, then it must get tokens from the group's buckets, too, so
+ * all the connections in the group together are held to the group's
+ * rate.
+ *
+ * Data is never held in the filter.  When a bucket runs dry, writes
+ * take less than was offered and the filter reports itself blocked,
+ * so the base stops enabling write ready and lower layer reads.  A
+ * timer wakes things up again when the bucket has refilled.
+ */
+
+#include "config.h"
+#include <errno.h>
+#include <assert.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+
+#include <gensio/gensio_class.h>
+
+#include "gensio_filter_ratelimit.h"
+
+/* Bucket levels are kept in millionths of a byte. */
+#define RL_SCALE 1000000ULL
+
+struct rl_bucket {
+    gensiods rate; /* Bytes per second, 0 means no limit. */
+    uint64_t depth;
+    uint64_t level;
+    struct timeval last;
+};
+
+struct rl_group {
+    struct gensio_link link;
+    char *name;
+    /*
+     * Changed with both rl_groups_lock and lock held, so holding
+     * either one is enough to read it.
+     */
+    unsigned int refcount;
+    struct gensio_lock *lock;
+    struct rl_bucket read;
+    struct rl_bucket write;
+};
+
+static struct gensio_once rl_groups_initialized;
+static struct gensio_lock *rl_groups_lock;
+static struct gensio_list rl_groups;
+
+struct gensio_ratelimit_filter_data {
+    struct gensio_os_funcs *o;
+    gensiods read_rate;
+    gensiods write_rate;
+    gensiods burst;
+    char *group;
+    gensiods group_read_rate;
+    gensiods group_write_rate;
+};
+
+struct rl_dir {
+    struct rl_bucket bucket;
+    struct rl_bucket *gbucket; /* From the group, NULL if none. */
+
+    bool throttled;
+    struct timeval throttle_start;
+
+    /* Statistics */
+    unsigned long long bytes;
+    unsigned long long throttled_usec;
+};
+
+struct ratelimit_filter {
+    struct gensio_filter *filter;
+    struct gensio_os_funcs *o;
+    struct gensio_lock *lock;
+
+    gensio_filter_cb filter_cb;
+    void *filter_cb_data;
+
+    struct rl_group *group;
+    struct rl_dir read;
+    struct rl_dir write;
+
+    /*
+     * The filter holds a reference while the timer is running and
+     * while the timeout handler runs.  in_timeout keeps the base from
+     * finishing a close while the handler is calling into it.
+     */
+    struct gensio_timer *timer;
+    bool timer_running;
+    bool in_timeout;
+    unsigned int refcount;
+    bool freed;
+};
+
+#define filter_to_ratelimit(v) ((struct ratelimit_filter *) \
+				gensio_filter_get_user_data(v))
+
+static void
+ratelimit_lock(struct ratelimit_filter *rfilter)
+{
+    rfilter->o->lock(rfilter->lock);
+}
+
+static void
+ratelimit_unlock(struct ratelimit_filter *rfilter)
+{
+    rfilter->o->unlock(rfilter->lock);
+}
+
+static uint64_t
+rl_usec_diff(struct timeval *end, struct timeval *start)
+{
+    return ((end->tv_sec - start->tv_sec) * 1000000LL +
+	    (end->tv_usec - start->tv_usec));
+}
+
+static void
+rl_bucket_init(struct rl_bucket *b, gensiods rate, gensiods burst)
+{
+    b->rate = rate;
+    /* By default a bucket holds a tenth of a second of data. */
+    if (!burst)
+	burst = rate / 10;
+    if (!burst)
+	burst = 1;
+    b->depth = burst * RL_SCALE;
+    b->level = b->depth;
+}
+
+static void
+rl_bucket_refill(struct rl_bucket *b, struct timeval *now)
+{
+    uint64_t usec;
+
+    /* Another user of a group bucket may have been here first. */
+    if (now->tv_sec < b->last.tv_sec ||
+		(now->tv_sec == b->last.tv_sec &&
+		 now->tv_usec <= b->last.tv_usec))
+	return;
+
+    usec = rl_usec_diff(now, &b->last);
+    b->last = *now;
+    if (usec >= b->depth / b->rate)
+	b->level = b->depth;
+    else if (b->level + usec * b->rate > b->depth)
+	b->level = b->depth;
+    else
+	b->level += usec * b->rate;
+}
+
+static gensiods
+rl_bucket_avail(struct rl_bucket *b)
+{
+    return b->level / RL_SCALE;
+}
+
+static void
+rl_bucket_give(struct rl_bucket *b, gensiods count)
+{
+    b->level += count * RL_SCALE;
+    if (b->level > b->depth)
+	b->level = b->depth;
+}
+
+/*
+ * How much a blocked direction waits for before it goes again, ten
+ * milliseconds worth, so a throttled connection moves data in chunks
+ * instead of a byte at a time.
+ */
+static gensiods
+rl_bucket_wake_level(struct rl_bucket *b)
+{
+    gensiods level = b->rate / 100;
+
+    if (level == 0)
+	level = 1;
+    if (level > b->depth / RL_SCALE)
+	level = b->depth / RL_SCALE;
+    return level;
+}
+
+/* Microseconds until the bucket has wake level bytes in it. */
+static uint64_t
+rl_bucket_wait(struct rl_bucket *b)
+{
+    uint64_t want = rl_bucket_wake_level(b) * RL_SCALE;
+
+    if (b->level >= want)
+	return 0;
+    return (want - b->level + b->rate - 1) / b->rate;
+}
+
+/*
+ * The most a group member may take at once, so one can't starve
+ * others.  Called with the group lock held.
+ */
+static gensiods
+rl_group_share(struct rl_group *g, struct rl_bucket *gb)
+{
+    gensiods share = gb->depth / RL_SCALE / g->refcount;
+
+    if (share == 0)
+	share = 1;
+    return share;
+}
+
+static void
+rl_groups_init(void *cb_data)
+{
+    struct gensio_os_funcs *o = cb_data;
+
+    gensio_list_init(&rl_groups);
+    rl_groups_lock = o->alloc_lock(o);
+    if (!rl_groups_lock)
+	gensio_log(o, GENSIO_LOG_ERR,
+		   "Unable to allocate ratelimit group lock, groups disabled");
+}
+
+static void
+rl_group_free(struct gensio_os_funcs *o, struct rl_group *g)
+{
+    if (g->lock)
+	o->free_lock(g->lock);
+    if (g->name)
+	o->free(o, g->name);
+    o->free(o, g);
+}
+
+/*
+ * Find the group, or create it with the given rates if it doesn't
+ * exist.  The rates of an existing group are not changed.
+ */
+static int
+rl_group_get(struct gensio_os_funcs *o, const char *name,
+	     gensiods read_rate, gensiods write_rate,
+	     struct rl_group **rgroup)
+{
+    struct gensio_link *l;
+    struct rl_group *g;
+    int err = 0;
+
+    o->call_once(o, &rl_groups_initialized, rl_groups_init, o);
+    if (!rl_groups_lock)
+	return GE_NOMEM;
+
+    o->lock(rl_groups_lock);
+    gensio_list_for_each(&rl_groups, l) {
+	g = gensio_container_of(l, struct rl_group, link);
+	if (strcmp(g->name, name) == 0) {
+	    o->lock(g->lock);
+	    g->refcount++;
+	    o->unlock(g->lock);
+	    goto out_unlock;
+	}
+    }
+
+    g = o->zalloc(o, sizeof(*g));
+    if (!g) {
+	err = GE_NOMEM;
+	goto out_unlock;
+    }
+    g->name = gensio_strdup(o, name);
+    g->lock = o->alloc_lock(o);
+    if (!g->name || !g->lock) {
+	rl_group_free(o, g);
+	err = GE_NOMEM;
+	goto out_unlock;
+    }
+    g->refcount = 1;
+    rl_bucket_init(&g->read, read_rate, 0);
+    rl_bucket_init(&g->write, write_rate, 0);
+    o->get_monotonic_time(o, &g->read.last);
+    g->write.last = g->read.last;
+    gensio_list_add_tail(&rl_groups, &g->link);
+
+ out_unlock:
+    o->unlock(rl_groups_lock);
+    if (!err)
+	*rgroup = g;
+    return err;
+}
+
+static void
+rl_group_put(struct gensio_os_funcs *o, struct rl_group *g)
+{
+    unsigned int count;
+
+    o->lock(rl_groups_lock);
+    o->lock(g->lock);
+    count = --g->refcount;
+    o->unlock(g->lock);
+    if (count == 0)
+	gensio_list_rm(&rl_groups, &g->link);
+    else
+	g = NULL;
+    o->unlock(rl_groups_lock);
+
+    if (g)
+	rl_group_free(o, g);
+}
+
+static bool
+rl_dir_limited(struct rl_dir *d)
+{
+    return d->bucket.rate || (d->gbucket && d->gbucket->rate);
+}
+
+/*
+ * Take up to max bytes worth of tokens from the direction's buckets,
+ * returning how many were taken.  Called with the filter lock held.
+ */
+static gensiods
+rl_dir_reserve(struct ratelimit_filter *rfilter, struct rl_dir *d,
+	       gensiods max)
+{
+    struct timeval now;
+    gensiods count = max, avail;
+
+    if (!rl_dir_limited(d))
+	return max;
+
+    rfilter->o->get_monotonic_time(rfilter->o, &now);
+    if (d->bucket.rate) {
+	rl_bucket_refill(&d->bucket, &now);
+	avail = rl_bucket_avail(&d->bucket);
+	if (count > avail)
+	    count = avail;
+    }
+    if (d->gbucket && d->gbucket->rate) {
+	rfilter->o->lock(rfilter->group->lock);
+	rl_bucket_refill(d->gbucket, &now);
+	avail = rl_bucket_avail(d->gbucket);
+	if (avail > rl_group_share(rfilter->group, d->gbucket))
+	    avail = rl_group_share(rfilter->group, d->gbucket);
+	if (count > avail)
+	    count = avail;
+	d->gbucket->level -= count * RL_SCALE;
+	rfilter->o->unlock(rfilter->group->lock);
+    }
+    if (d->bucket.rate)
+	d->bucket.level -= count * RL_SCALE;
+
+    if (count < max && !d->throttled) {
+	/* Out of tokens, hold off until there is a useful amount. */
+	d->throttled = true;
+	d->throttle_start = now;
+    }
+
+    return count;
+}
+
+/* Give back tokens that were reserved but not used. */
+static void
+rl_dir_refund(struct ratelimit_filter *rfilter, struct rl_dir *d,
+	      gensiods count)
+{
+    if (!count)
+	return;
+    if (d->bucket.rate)
+	rl_bucket_give(&d->bucket, count);
+    if (d->gbucket && d->gbucket->rate) {
+	rfilter->o->lock(rfilter->group->lock);
+	rl_bucket_give(d->gbucket, count);
+	rfilter->o->unlock(rfilter->group->lock);
+    }
+}
+
+static void
+rl_start_timer(struct ratelimit_filter *rfilter, uint64_t usec)
+{
+    struct timeval timeout;
+
+    if (rfilter->timer_running)
+	return;
+    if (usec == 0)
+	usec = 1;
+    timeout.tv_sec = usec / 1000000;
+    timeout.tv_usec = usec % 1000000;
+    if (rfilter->o->start_timer(rfilter->timer, &timeout) == 0) {
+	rfilter->timer_running = true;
+	rfilter->refcount++; /* Released by the timeout or the stop. */
+    }
+}
+
+static void
+rl_stop_timer(struct ratelimit_filter *rfilter)
+{
+    if (rfilter->timer_running &&
+		rfilter->o->stop_timer(rfilter->timer) == 0) {
+	rfilter->timer_running = false;
+	/* The caller holds a ref, so this cannot go to zero. */
+	assert(rfilter->refcount > 1);
+	rfilter->refcount--;
+    }
+}
+
+static void rfilter_free(struct ratelimit_filter *rfilter);
+
+static void
+ratelimit_deref_and_unlock(struct ratelimit_filter *rfilter)
+{
+    unsigned int count;
+
+    assert(rfilter->refcount > 0);
+    count = --rfilter->refcount;
+    ratelimit_unlock(rfilter);
+    if (count == 0)
+	rfilter_free(rfilter);
+}
+
+/*
+ * Is the direction out of tokens?  Once blocked, it stays blocked
+ * until the buckets reach their wake level.  Starts the timer to
+ * wake things up if blocked.  Called with the filter lock held.
+ */
+static bool
+rl_dir_blocked(struct ratelimit_filter *rfilter, struct rl_dir *d)
+{
+    struct timeval now;
+    uint64_t wait = 0, gwait;
+    gensiods need;
+    bool blocked = false;
+
+    if (!rl_dir_limited(d))
+	return false;
+
+    rfilter->o->get_monotonic_time(rfilter->o, &now);
+    if (d->bucket.rate) {
+	rl_bucket_refill(&d->bucket, &now);
+	need = d->throttled ? rl_bucket_wake_level(&d->bucket) : 1;
+	if (rl_bucket_avail(&d->bucket) < need) {
+	    blocked = true;
+	    wait = rl_bucket_wait(&d->bucket);
+	}
+    }
+    if (d->gbucket && d->gbucket->rate) {
+	rfilter->o->lock(rfilter->group->lock);
+	rl_bucket_refill(d->gbucket, &now);
+	need = d->throttled ? rl_bucket_wake_level(d->gbucket) : 1;
+	if (need > rl_group_share(rfilter->group, d->gbucket))
+	    need = rl_group_share(rfilter->group, d->gbucket);
+	if (rl_bucket_avail(d->gbucket) < need) {
+	    blocked = true;
+	    gwait = rl_bucket_wait(d->gbucket);
+	    if (gwait > wait)
+		wait = gwait;
+	}
+	rfilter->o->unlock(rfilter->group->lock);
+    }
+
+    if (blocked && !d->throttled) {
+	d->throttled = true;
+	d->throttle_start = now;
+    } else if (!blocked && d->throttled) {
+	d->throttled = false;
+	d->throttled_usec += rl_usec_diff(&now, &d->throttle_start);
+    }
+    if (blocked)
+	rl_start_timer(rfilter, wait);
+
+    return blocked;
+}
+
+static unsigned long long
+rl_dir_throttled_usec(struct ratelimit_filter *rfilter, struct rl_dir *d)
+{
+    struct timeval now;
+
+    if (!d->throttled)
+	return d->throttled_usec;
+    rfilter->o->get_monotonic_time(rfilter->o, &now);
+    return d->throttled_usec + rl_usec_diff(&now, &d->throttle_start);
+}
+
+static void
+rl_dir_reset(struct ratelimit_filter *rfilter, struct rl_dir *d)
+{
+    d->bucket.level = d->bucket.depth;
+    rfilter->o->get_monotonic_time(rfilter->o, &d->bucket.last);
+    d->throttled = false;
+}
+
+static void
+ratelimit_timeout(struct gensio_timer *t, void *cb_data)
+{
+    struct ratelimit_filter *rfilter = cb_data;
+    bool freed;
+
+    /*
+     * Keep the timer's ref through the callback.  The timer may be
+     * restarted from the callback, that takes another ref.
+     */
+    ratelimit_lock(rfilter);
+    rfilter->timer_running = false;
+    freed = rfilter->freed;
+    rfilter->in_timeout = true;
+    ratelimit_unlock(rfilter);
+
+    /* Have the base check the blocks again. */
+    if (!freed && rfilter->filter_cb)
+	rfilter->filter_cb(rfilter->filter_cb_data,
+			   GENSIO_FILTER_CB_OUTPUT_READY, NULL);
+
+    ratelimit_lock(rfilter);
+    rfilter->in_timeout = false;
+    ratelimit_deref_and_unlock(rfilter);
+}
+
+static void
+ratelimit_set_callbacks(struct gensio_filter *filter,
+			gensio_filter_cb cb, void *cb_data)
+{
+    struct ratelimit_filter *rfilter = filter_to_ratelimit(filter);
+
+    rfilter->filter_cb = cb;
+    rfilter->filter_cb_data = cb_data;
+}
+
+static bool
+ratelimit_ll_read_blocked(struct gensio_filter *filter)
+{
+    struct ratelimit_filter *rfilter = filter_to_ratelimit(filter);
+    bool rv;
+
+    ratelimit_lock(rfilter);
+    rv = rl_dir_blocked(rfilter, &rfilter->read);
+    ratelimit_unlock(rfilter);
+    return rv;
+}
+
+static bool
+ratelimit_ul_write_blocked(struct gensio_filter *filter)
+{
+    struct ratelimit_filter *rfilter = filter_to_ratelimit(filter);
+    bool rv;
+
+    ratelimit_lock(rfilter);
+    rv = rl_dir_blocked(rfilter, &rfilter->write);
+    ratelimit_unlock(rfilter);
+    return rv;
+}
+
+static int
+ratelimit_ul_write(struct gensio_filter *filter,
+		   gensio_ul_filter_data_handler handler, void *cb_data,
+		   gensiods *rcount,
+		   const struct gensio_sg *sg, gensiods sglen,
+		   const char *const *auxdata)
+{
+    struct ratelimit_filter *rfilter = filter_to_ratelimit(filter);
+    gensiods i, total = 0, allowed, count = 0, left, len, written;
+    struct gensio_sg sg1;
+    int err = 0;
+
+    for (i = 0; i < sglen; i++)
+	total += sg[i].buflen;
+    if (total == 0)
+	goto out;
+
+    ratelimit_lock(rfilter);
+    allowed = rl_dir_reserve(rfilter, &rfilter->write, total);
+    if (allowed == total) {
+	err = handler(cb_data, &count, sg, sglen, auxdata);
+    } else {
+	/* Only pass on what the bucket allows. */
+	for (i = 0, left = allowed; !err && i < sglen && left; i++) {
+	    len = sg[i].buflen;
+	    if (len > left)
+		len = left;
+	    sg1.buf = sg[i].buf;
+	    sg1.buflen = len;
+	    written = 0;
+	    err = handler(cb_data, &written, &sg1, 1, auxdata);
+	    count += written;
+	    left -= written;
+	    if (written < len)
+		break;
+	}
+    }
+    if (err)
+	count = 0;
+    rl_dir_refund(rfilter, &rfilter->write, allowed - count);
+    rfilter->write.bytes += count;
+    ratelimit_unlock(rfilter);
+
+ out:
+    if (rcount)
+	*rcount = count;
+    return err;
+}
+
+static int
+ratelimit_ll_write(struct gensio_filter *filter,
+		   gensio_ll_filter_data_handler handler, void *cb_data,
+		   gensiods *rcount,
+		   unsigned char *buf, gensiods buflen,
+		   const char *const *auxdata)
+{
+    struct ratelimit_filter *rfilter = filter_to_ratelimit(filter);
+    gensiods allowed, count = 0;
+    int err = 0;
+
+    if (buflen == 0)
+	goto out;
+
+    ratelimit_lock(rfilter);
+    allowed = rl_dir_reserve(rfilter, &rfilter->read, buflen);
+    ratelimit_unlock(rfilter);
+
+    /* Whatever isn't taken stays in the lower layer. */
+    if (allowed)
+	err = handler(cb_data, &count, buf, allowed, auxdata);
+
+    ratelimit_lock(rfilter);
+    if (err)
+	count = 0;
+    rl_dir_refund(rfilter, &rfilter->read, allowed - count);
+    rfilter->read.bytes += count;
+    ratelimit_unlock(rfilter);
+
+ out:
+    if (rcount)
+	*rcount = count;
+    return err;
+}
+
+static int
+ratelimit_try_disconnect(struct gensio_filter *filter, struct timeval *timeout)
+{
+    struct ratelimit_filter *rfilter = filter_to_ratelimit(filter);
+    int rv = 0;
+
+    ratelimit_lock(rfilter);
+    rl_stop_timer(rfilter);
+    if (rfilter->timer_running || rfilter->in_timeout) {
+	/* The timer handler is running, don't let the base go away. */
+	timeout->tv_sec = 0;
+	timeout->tv_usec = 1000;
+	rv = GE_RETRY;
+    }
+    ratelimit_unlock(rfilter);
+
+    return rv;
+}
+
+static int
+ratelimit_setup(struct gensio_filter *filter, struct gensio *io)
+{
+    struct ratelimit_filter *rfilter = filter_to_ratelimit(filter);
+
+    ratelimit_lock(rfilter);
+    rl_dir_reset(rfilter, &rfilter->read);
+    rl_dir_reset(rfilter, &rfilter->write);
+    ratelimit_unlock(rfilter);
+    return 0;
+}
+
+static void
+ratelimit_cleanup(struct gensio_filter *filter)
+{
+    struct ratelimit_filter *rfilter = filter_to_ratelimit(filter);
+
+    ratelimit_lock(rfilter);
+    rl_stop_timer(rfilter);
+    rfilter->read.throttled_usec = rl_dir_throttled_usec(rfilter,
+							 &rfilter->read);
+    rfilter->read.throttled = false;
+    rfilter->write.throttled_usec = rl_dir_throttled_usec(rfilter,
+							  &rfilter->write);
+    rfilter->write.throttled = false;
+    ratelimit_unlock(rfilter);
+}
+
+static void
+rfilter_free(struct ratelimit_filter *rfilter)
+{
+    struct gensio_os_funcs *o = rfilter->o;
+
+    if (rfilter->timer)
+	o->free_timer(rfilter->timer);
+    if (rfilter->group)
+	rl_group_put(o, rfilter->group);
+    if (rfilter->lock)
+	o->free_lock(rfilter->lock);
+    if (rfilter->filter)
+	gensio_filter_free_data(rfilter->filter);
+    o->free(o, rfilter);
+}
+
+static void
+ratelimit_free(struct gensio_filter *filter)
+{
+    struct ratelimit_filter *rfilter = filter_to_ratelimit(filter);
+
+    ratelimit_lock(rfilter);
+    rfilter->freed = true;
+    rl_stop_timer(rfilter);
+    ratelimit_deref_and_unlock(rfilter);
+}
+
+static int
+ratelimit_filter_control(struct gensio_filter *filter, bool get, int op,
+			 char *data, gensiods *datalen)
+{
+    struct ratelimit_filter *rfilter = filter_to_ratelimit(filter);
+
+    switch (op) {
+    case GENSIO_CONTROL_RATELIMIT_STATS:
+	ratelimit_lock(rfilter);
+	if (get) {
+	    *datalen = snprintf(data, *datalen,
+			"write_bytes=%llu read_bytes=%llu"
+			" write_throttled=%llu read_throttled=%llu",
+			rfilter->write.bytes, rfilter->read.bytes,
+			rl_dir_throttled_usec(rfilter, &rfilter->write),
+			rl_dir_throttled_usec(rfilter, &rfilter->read));
+	} else {
+	    rfilter->write.bytes = 0;
+	    rfilter->read.bytes = 0;
+	    rfilter->write.throttled_usec = 0;
+	    rfilter->read.throttled_usec = 0;
+	    if (rfilter->write.throttled)
+		rfilter->o->get_monotonic_time(rfilter->o,
+					       &rfilter->write.throttle_start);
+	    if (rfilter->read.throttled)
+		rfilter->o->get_monotonic_time(rfilter->o,
+					       &rfilter->read.throttle_start);
+	}
+	ratelimit_unlock(rfilter);
+	return 0;
+
+    default:
+	return GE_NOTSUP;
+    }
+}
+
+static int gensio_ratelimit_filter_func(struct gensio_filter *filter, int op,
+					const void *func, void *data,
+					gensiods *count,
+					void *buf, const void *cbuf,
+					gensiods buflen,
+					const char *const *auxdata)
+{
+    switch (op) {
+    case GENSIO_FILTER_FUNC_SET_CALLBACK:
+	ratelimit_set_callbacks(filter, func, data);
+	return 0;
+
+    case GENSIO_FILTER_FUNC_UL_READ_PENDING:
+    case GENSIO_FILTER_FUNC_UL_WRITE_PENDING:
+    case GENSIO_FILTER_FUNC_LL_READ_NEEDED:
+	/* Nothing is ever held in the filter. */
+	return false;
+
+    case GENSIO_FILTER_FUNC_LL_READ_BLOCKED:
+	return ratelimit_ll_read_blocked(filter);
+
+    case GENSIO_FILTER_FUNC_UL_WRITE_BLOCKED:
+	return ratelimit_ul_write_blocked(filter);
+
+    case GENSIO_FILTER_FUNC_CHECK_OPEN_DONE:
+    case GENSIO_FILTER_FUNC_TRY_CONNECT:
+	return 0;
+
+    case GENSIO_FILTER_FUNC_TRY_DISCONNECT:
+	return ratelimit_try_disconnect(filter, data);
+
+    case GENSIO_FILTER_FUNC_UL_WRITE_SG:
+	return ratelimit_ul_write(filter, func, data, count, cbuf, buflen,
+				  buf);
+
+    case GENSIO_FILTER_FUNC_LL_WRITE:
+	return ratelimit_ll_write(filter, func, data, count, buf, buflen,
+				  auxdata);
+
+    case GENSIO_FILTER_FUNC_SETUP:
+	return ratelimit_setup(filter, data);
+
+    case GENSIO_FILTER_FUNC_CLEANUP:
+	ratelimit_cleanup(filter);
+	return 0;
+
+    case GENSIO_FILTER_FUNC_FREE:
+	ratelimit_free(filter);
+	return 0;
+
+    case GENSIO_FILTER_FUNC_CONTROL:
+	return ratelimit_filter_control(filter, *((bool *) cbuf), buflen, data,
+					count);
+
+    case GENSIO_FILTER_FUNC_TIMEOUT:
+    default:
+	return GE_NOTSUP;
+    }
+}
+
+int
+gensio_ratelimit_filter_config(struct gensio_os_funcs *o,
+			       const char * const args[],
+			       struct gensio_ratelimit_filter_data **rdata)
+{
+    unsigned int i;
+    struct gensio_ratelimit_filter_data *data = o->zalloc(o, sizeof(*data));
+    int rv, ival;
+    const char *cstr;
+
+    if (!data)
+	return GE_NOMEM;
+    data->o = o;
+
+    rv = gensio_get_default(o, "ratelimit", "read_rate", false,
+			    GENSIO_DEFAULT_INT, NULL, &ival);
+    if (!rv)
+	data->read_rate = ival;
+    rv = gensio_get_default(o, "ratelimit", "write_rate", false,
+			    GENSIO_DEFAULT_INT, NULL, &ival);
+    if (!rv)
+	data->write_rate = ival;
+    rv = gensio_get_default(o, "ratelimit", "burst", false,
+			    GENSIO_DEFAULT_INT, NULL, &ival);
+    if (!rv)
+	data->burst = ival;
+
+    for (i = 0; args && args[i]; i++) {
+	if (gensio_check_keyds(args[i], "read_rate", &data->read_rate) > 0)
+	    continue;
+	if (gensio_check_keyds(args[i], "write_rate", &data->write_rate) > 0)
+	    continue;
+	if (gensio_check_keyds(args[i], "burst", &data->burst) > 0)
+	    continue;
+	if (gensio_check_keyds(args[i], "group_read_rate",
+			       &data->group_read_rate) > 0)
+	    continue;
+	if (gensio_check_keyds(args[i], "group_write_rate",
+			       &data->group_write_rate) > 0)
+	    continue;
+	if (gensio_check_keyvalue(args[i], "group", &cstr)) {
+	    if (data->group)
+		o->free(o, data->group);
+	    data->group = gensio_strdup(o, cstr);
+	    if (!data->group) {
+		rv = GE_NOMEM;
+		goto out_err;
+	    }
+	    continue;
+	}
+	rv = GE_INVAL;
+	goto out_err;
+    }
+
+    *rdata = data;
+    return 0;
+
+ out_err:
+    gensio_ratelimit_filter_config_free(data);
+    return rv;
+}
+
+void
+gensio_ratelimit_filter_config_free(struct gensio_ratelimit_filter_data *data)
+{
+    struct gensio_os_funcs *o;
+
+    if (!data)
+	return;
+
+    o = data->o;
+    if (data->group)
+	o->free(o, data->group);
+    o->free(o, data);
+}
+
+int
+gensio_ratelimit_filter_alloc(struct gensio_ratelimit_filter_data *data,
+			      struct gensio_filter **rfilter)
+{
+    struct gensio_os_funcs *o = data->o;
+    struct ratelimit_filter *rlfilter;
+    int err = GE_NOMEM;
+
+    rlfilter = o->zalloc(o, sizeof(*rlfilter));
+    if (!rlfilter)
+	return GE_NOMEM;
+    rlfilter->o = o;
+    rlfilter->refcount = 1;
+    rl_bucket_init(&rlfilter->read.bucket, data->read_rate, data->burst);
+    rl_bucket_init(&rlfilter->write.bucket, data->write_rate, data->burst);
+
+    rlfilter->lock = o->alloc_lock(o);
+    if (!rlfilter->lock)
+	goto out_err;
+
+    rlfilter->timer = o->alloc_timer(o, ratelimit_timeout, rlfilter);
+    if (!rlfilter->timer)
+	goto out_err;
+
+    if (data->group) {
+	err = rl_group_get(o, data->group, data->group_read_rate,
+			   data->group_write_rate, &rlfilter->group);
+	if (err)
+	    goto out_err;
+	rlfilter->read.gbucket = &rlfilter->group->read;
+	rlfilter->write.gbucket = &rlfilter->group->write;
+	err = GE_NOMEM;
+    }
+
+    rlfilter->filter = gensio_filter_alloc_data(o,
+						gensio_ratelimit_filter_func,
+						rlfilter);
+    if (!rlfilter->filter)
+	goto out_err;
+
+    *rfilter = rlfilter->filter;
+    return 0;
+
+ out_err:
+    rfilter_free(rlfilter);
+    return err;
+}
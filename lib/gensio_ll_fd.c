@@ -27,6 +27,17 @@
 #include <gensio/gensio_ll_fd.h>
 #include <gensio/gensio_osops.h>
 
+/* Maximum number of simultaneous connection attempts when opening. */
+#define FD_MAX_OPEN_ATTEMPTS 8
+
+/*
+ * For read buffer sizing, grow the buffer after this many reads in a
+ * row fill it, and shrink it after this many reads in a row use less
+ * than a quarter of it.
+ */
+#define FD_READ_GROW_COUNT	2
+#define FD_READ_SHRINK_COUNT	16
+
 enum fd_state {
     FD_CLOSED,
     FD_IN_OPEN,
@@ -60,6 +71,18 @@ struct fd_ll {
     void *open_data;
     int open_err;
 
+    /*
+     * If open_stagger is set, when opening start a new connection
+     * attempt every open_stagger milliseconds and race them.  fd
+     * holds one attempt, the others are in extra_open_fds.  See
+     * gensio_fd_ll_set_open_stagger().
+     */
+    unsigned int open_stagger;
+    struct gensio_timer *open_timer;
+    bool open_timer_running;
+    int extra_open_fds[FD_MAX_OPEN_ATTEMPTS - 1];
+    unsigned int nr_extra_open_fds;
+
     struct gensio_timer *close_timer;
     gensio_ll_close_done close_done;
     void *close_data;
@@ -70,6 +93,37 @@ struct fd_ll {
     gensiods read_data_pos;
     const char *const *auxdata;
 
+    /*
+     * If read_data_max is not zero, read_data_size is adjusted
+     * between read_data_min and read_data_max depending on how much
+     * data is coming in.  See gensio_fd_ll_set_read_size_range().
+     */
+    gensiods read_data_min;
+    gensiods read_data_max;
+    unsigned int read_full_count;
+    unsigned int read_small_count;
+
+    /*
+     * When the fd is readable, keep reading and delivering until this
+     * many bytes have been read, the fd has no more data, or the user
+     * stops taking data.  Zero means do one read per read ready.  Set
+     * with gensio_fd_ll_set_read_budget().
+     */
+    gensiods read_budget;
+
+    /*
+     * If raw_ok is set, the fd is a plain byte stream that the user
+     * may access directly through GENSIO_LL_FUNC_RAW_FD.  If
+     * raw_read_ready is set, it is called when the fd is readable
+     * instead of reading the data.
+     */
+    bool raw_ok;
+    void (*raw_read_ready)(int fd, void *cb_data);
+    void *raw_cb_data;
+
+    /* Keep the except handler enabled for error queue messages. */
+    bool watch_errqueue;
+
     bool in_read;
 
     /*
@@ -97,6 +151,18 @@ fd_unlock(struct fd_ll *fdll)
     fdll->o->unlock(fdll->lock);
 }
 
+/*
+ * Except handling normally follows reads, but if the error queue is
+ * being watched it has to stay on while the fd is open.
+ */
+static void
+fd_set_except_handler(struct fd_ll *fdll, bool enabled)
+{
+    if (fdll->watch_errqueue && fdll->state == FD_OPEN)
+	enabled = true;
+    fdll->o->set_except_handler(fdll->o, fdll->fd, enabled);
+}
+
 static void
 fd_ref(struct fd_ll *fdll)
 {
@@ -118,6 +184,8 @@ static void fd_finish_free(struct fd_ll *fdll)
 	fdll->o->free_lock(fdll->lock);
     if (fdll->close_timer)
 	fdll->o->free_timer(fdll->close_timer);
+    if (fdll->open_timer)
+	fdll->o->free_timer(fdll->open_timer);
     if (fdll->deferred_op_runner)
 	fdll->o->free_runner(fdll->deferred_op_runner);
     if (fdll->read_data)
@@ -162,6 +230,19 @@ fd_write(struct gensio_ll *ll, gensiods *rcount,
     return gensio_os_write(fdll->o, fdll->fd, sg, sglen, rcount);
 }
 
+static int
+fd_write_msgs(struct gensio_ll *ll, gensiods *rcount,
+	      struct gensio_msg *msgs, gensiods nmsgs)
+{
+    struct fd_ll *fdll = ll_to_fd(ll);
+
+    if (!fdll->ops->write_msgs)
+	return GE_NOTSUP;
+
+    return fdll->ops->write_msgs(fdll->handler_data, fdll->fd,
+				 rcount, msgs, nmsgs);
+}
+
 static int
 fd_raddr_to_str(struct gensio_ll *ll, gensiods *pos,
 		char *buf, gensiods buflen)
@@ -214,9 +295,162 @@ fd_deliver_read_data(struct fd_ll *fdll, int err)
     }
 }
 
+static int fd_setup_fd_handlers(struct fd_ll *fdll, int fd);
+
+static void
+fd_start_open_timer(struct fd_ll *fdll)
+{
+    struct timeval timeout;
+
+    if (!fdll->open_stagger || !fdll->ops->retry_open ||
+		fdll->open_timer_running ||
+		fdll->nr_extra_open_fds >= FD_MAX_OPEN_ATTEMPTS - 1)
+	return;
+
+    timeout.tv_sec = fdll->open_stagger / 1000;
+    timeout.tv_usec = (fdll->open_stagger % 1000) * 1000;
+    if (fdll->o->start_timer(fdll->open_timer, &timeout) == 0) {
+	fdll->open_timer_running = true;
+	fd_ref(fdll); /* Released by the timer handler or the stop. */
+    }
+}
+
+static void
+fd_stop_open_timer(struct fd_ll *fdll)
+{
+    if (fdll->open_timer_running &&
+		fdll->o->stop_timer(fdll->open_timer) == 0) {
+	fdll->open_timer_running = false;
+	/* The caller holds a ref, so this cannot go to zero. */
+	assert(fdll->refcount > 1);
+	fdll->refcount--;
+    }
+}
+
+static void
+fd_close_open_fd(struct fd_ll *fdll, int fd)
+{
+    fdll->o->clear_fd_handlers_norpt(fdll->o, fd);
+    close(fd);
+}
+
+/* Throw away all connection attempts except the one in fdll->fd. */
+static void
+fd_cancel_extra_opens(struct fd_ll *fdll)
+{
+    unsigned int i;
+
+    fd_stop_open_timer(fdll);
+    for (i = 0; i < fdll->nr_extra_open_fds; i++)
+	fd_close_open_fd(fdll, fdll->extra_open_fds[i]);
+    fdll->nr_extra_open_fds = 0;
+}
+
+/* A connection attempt failed, remove it. */
+static void
+fd_drop_open_fd(struct fd_ll *fdll, int fd)
+{
+    unsigned int i;
+
+    fd_close_open_fd(fdll, fd);
+    if (fd == fdll->fd) {
+	if (fdll->nr_extra_open_fds)
+	    fdll->fd = fdll->extra_open_fds[--fdll->nr_extra_open_fds];
+	else
+	    fdll->fd = -1;
+	return;
+    }
+
+    for (i = 0; i < fdll->nr_extra_open_fds; i++) {
+	if (fdll->extra_open_fds[i] == fd) {
+	    fdll->extra_open_fds[i] =
+		fdll->extra_open_fds[--fdll->nr_extra_open_fds];
+	    break;
+	}
+    }
+}
+
+/*
+ * Start the next connection attempt.  Returns 0 if it connected
+ * immediately (the new fd is in *rfd), GE_INPROGRESS if it is
+ * pending, or an error.
+ */
+static int
+fd_start_open_attempt(struct fd_ll *fdll, int *rfd)
+{
+    int err, fd = -1;
+
+    err = fdll->ops->retry_open(fdll->handler_data, &fd);
+    if (err != 0 && err != GE_INPROGRESS)
+	return err;
+
+    if (fd_setup_fd_handlers(fdll, fd)) {
+	close(fd);
+	return GE_NOMEM;
+    }
+
+    if (err == GE_INPROGRESS) {
+	if (fdll->fd == -1)
+	    fdll->fd = fd;
+	else
+	    fdll->extra_open_fds[fdll->nr_extra_open_fds++] = fd;
+	fdll->o->set_write_handler(fdll->o, fd, true);
+	fdll->o->set_except_handler(fdll->o, fd, true);
+	fd_start_open_timer(fdll);
+    }
+    *rfd = fd;
+
+    return err;
+}
+
+static void fd_finish_open(struct fd_ll *fdll, int err);
+
+/* The connection on fd has completed, use it. */
+static void
+fd_open_won(struct fd_ll *fdll, int fd)
+{
+    unsigned int i;
+
+    if (fdll->fd != fd) {
+	for (i = 0; i < fdll->nr_extra_open_fds; i++) {
+	    if (fdll->extra_open_fds[i] == fd) {
+		fdll->extra_open_fds[i] =
+		    fdll->extra_open_fds[--fdll->nr_extra_open_fds];
+		break;
+	    }
+	}
+	if (fdll->fd != -1)
+	    fd_close_open_fd(fdll, fdll->fd);
+	fdll->fd = fd;
+    }
+    fd_cancel_extra_opens(fdll);
+    fd_finish_open(fdll, 0);
+}
+
+static void
+fd_open_timeout(struct gensio_timer *t, void *cb_data)
+{
+    struct fd_ll *fdll = cb_data;
+    int err, fd;
+
+    fd_lock(fdll);
+    fdll->open_timer_running = false;
+    if (fdll->state == FD_IN_OPEN && fdll->fd != -1) {
+	err = fd_start_open_attempt(fdll, &fd);
+	if (!err)
+	    fd_open_won(fdll, fd);
+	/*
+	 * On an error, just let the attempts already running finish.
+	 */
+    }
+    fd_deref_and_unlock(fdll);
+}
+
 static void
 fd_start_close(struct fd_ll *fdll)
 {
+    if (fdll->state == FD_IN_OPEN)
+	fd_cancel_extra_opens(fdll);
     if (fdll->ops->check_close)
 	fdll->ops->check_close(fdll->handler_data,
 			       GENSIO_LL_CLOSE_STATE_START, NULL);
@@ -251,10 +485,9 @@ fd_finish_open(struct fd_ll *fdll, int err)
     }
 
     if (fdll->state == FD_OPEN) {
-	if (fdll->read_enabled) {
+	if (fdll->read_enabled)
 	    fdll->o->set_read_handler(fdll->o, fdll->fd, true);
-	    fdll->o->set_except_handler(fdll->o, fdll->fd, true);
-	}
+	fd_set_except_handler(fdll, fdll->read_enabled);
 	if (fdll->write_enabled)
 	    fdll->o->set_write_handler(fdll->o, fdll->fd, true);
     }
@@ -303,7 +536,7 @@ fd_deferred_op(struct gensio_runner *runner, void *cbdata)
     fdll->deferred_op_pending = false;
     if (fdll->state == FD_OPEN) {
 	fdll->o->set_read_handler(fdll->o, fdll->fd, fdll->read_enabled);
-	fdll->o->set_except_handler(fdll->o, fdll->fd, fdll->read_enabled);
+	fd_set_except_handler(fdll, fdll->read_enabled);
 	fdll->o->set_write_handler(fdll->o, fdll->fd, fdll->write_enabled);
     }
     fd_deref_and_unlock(fdll);
@@ -320,6 +553,64 @@ fd_sched_deferred_op(struct fd_ll *fdll)
     }
 }
 
+/*
+ * Called after a read of count bytes into a buffer of size bytes has
+ * been delivered.  Must be called with in_read set.
+ */
+static void
+fd_adjust_read_size(struct fd_ll *fdll, gensiods count, gensiods size)
+{
+    struct gensio_os_funcs *o = fdll->o;
+    gensiods newsize = 0;
+    unsigned char *newbuf;
+
+    if (!fdll->read_data_max)
+	return;
+
+    if (count >= size) {
+	fdll->read_small_count = 0;
+	if (++fdll->read_full_count >= FD_READ_GROW_COUNT &&
+		size < fdll->read_data_max) {
+	    newsize = size * 2;
+	    if (newsize > fdll->read_data_max)
+		newsize = fdll->read_data_max;
+	}
+    } else if (count < size / 4) {
+	fdll->read_full_count = 0;
+	if (++fdll->read_small_count >= FD_READ_SHRINK_COUNT &&
+		size > fdll->read_data_min) {
+	    newsize = size / 2;
+	    if (newsize < fdll->read_data_min)
+		newsize = fdll->read_data_min;
+	}
+    } else {
+	fdll->read_full_count = 0;
+	fdll->read_small_count = 0;
+    }
+
+    /* Can't change the buffer while it still holds data. */
+    if (!newsize || fdll->read_data_len)
+	return;
+
+    newbuf = o->zalloc(o, newsize);
+    if (!newbuf)
+	return; /* Just keep using the old one. */
+    o->free(o, fdll->read_data);
+    fdll->read_data = newbuf;
+    fdll->read_data_size = newsize;
+    fdll->read_full_count = 0;
+    fdll->read_small_count = 0;
+}
+
+static int
+gensio_ll_fd_read(int fd, void *buf, gensiods count, gensiods *rcount,
+		  const char **auxdata, void *cb_data)
+{
+    struct fd_ll *fdll = cb_data;
+
+    return gensio_os_read(fdll->o, fd, buf, count, rcount);
+}
+
 static void
 fd_handle_incoming(struct fd_ll *fdll,
 		   int (*doread)(int fd, void *buf, gensiods count,
@@ -328,33 +619,54 @@ fd_handle_incoming(struct fd_ll *fdll,
 		   const char **auxdata, void *cb_data)
 {
     int err = 0;
-    gensiods count;
+    gensiods count, size, total = 0;
+    bool more;
 
     fd_lock_and_ref(fdll);
     fdll->o->set_read_handler(fdll->o, fdll->fd, false);
-    fdll->o->set_except_handler(fdll->o, fdll->fd, false);
+    fd_set_except_handler(fdll, false);
     if (fdll->in_read)
 	goto out;
     fdll->in_read = true;
     fd_unlock(fdll);
 
-    if (!fdll->read_data_len) {
-	err = doread(fdll->fd, fdll->read_data, fdll->read_data_size, &count,
-		     auxdata, cb_data);
-	if (!err) {
-	    fdll->read_data_len = count;
-	    fdll->auxdata = auxdata;
+    do {
+	count = 0;
+	size = fdll->read_data_size;
+	if (!fdll->read_data_len) {
+	    err = doread(fdll->fd, fdll->read_data, fdll->read_data_size,
+			 &count, auxdata, cb_data);
+	    if (!err) {
+		fdll->read_data_len = count;
+		fdll->auxdata = auxdata;
+	    }
 	}
-    }
 
-    fd_deliver_read_data(fdll, err);
+	fd_deliver_read_data(fdll, err);
+	if (err || count == 0)
+	    break;
+	total += count;
+	fd_adjust_read_size(fdll, count, size);
+
+	/*
+	 * Go back to the selector if the budget is used up, so other
+	 * fds get a chance, or if the user isn't taking the data.  A
+	 * short read on a plain stream means it's empty, don't waste a
+	 * read to find that out.
+	 */
+	fd_lock(fdll);
+	more = (fdll->state == FD_OPEN && fdll->read_enabled &&
+		!fdll->read_data_len && total < fdll->read_budget &&
+		!(doread == gensio_ll_fd_read && count < size));
+	fd_unlock(fdll);
+    } while (more);
 
     fd_lock(fdll);
     fdll->in_read = false;
  out:
     if (fdll->state == FD_OPEN && fdll->read_enabled) {
 	fdll->o->set_read_handler(fdll->o, fdll->fd, true);
-	fdll->o->set_except_handler(fdll->o, fdll->fd, true);
+	fd_set_except_handler(fdll, true);
     }
     fd_deref_and_unlock(fdll);
 }
@@ -373,20 +685,29 @@ void gensio_fd_ll_handle_incoming(struct gensio_ll *ll,
     fd_handle_incoming(fdll, doread, auxdata, cb_data);
 }
 
-static int
-gensio_ll_fd_read(int fd, void *buf, gensiods count, gensiods *rcount,
-		  const char **auxdata, void *cb_data)
-{
-    struct fd_ll *fdll = cb_data;
-
-    return gensio_os_read(fdll->o, fd, buf, count, rcount);
-}
-
 static void
 fd_read_ready(int fd, void *cbdata)
 {
     struct fd_ll *fdll = cbdata;
 
+    if (fdll->raw_read_ready) {
+	void (*raw_read_ready)(int fd, void *cb_data);
+	void *raw_cb_data;
+
+	fd_lock(fdll);
+	raw_read_ready = fdll->raw_read_ready;
+	raw_cb_data = fdll->raw_cb_data;
+	if (raw_read_ready) {
+	    fdll->o->set_read_handler(fdll->o, fdll->fd, false);
+	    fd_set_except_handler(fdll, false);
+	}
+	fd_unlock(fdll);
+	if (raw_read_ready) {
+	    raw_read_ready(fd, raw_cb_data);
+	    return;
+	}
+    }
+
     if (fdll->ops->read_ready) {
 	fdll->ops->read_ready(fdll->handler_data, fdll->fd);
 	return;
@@ -395,37 +716,51 @@ fd_read_ready(int fd, void *cbdata)
     fd_handle_incoming(fdll, gensio_ll_fd_read, NULL, fdll);
 }
 
-static int fd_setup_handlers(struct fd_ll *fdll);
+static void
+fd_check_open_attempt(struct fd_ll *fdll, int fd)
+{
+    int err;
+
+    err = fdll->ops->check_open(fdll->handler_data, fd);
+    if (!err) {
+	fd_open_won(fdll, fd);
+	return;
+    }
+    if (err == GE_INPROGRESS) {
+	/* Not done yet, keep waiting. */
+	fdll->o->set_write_handler(fdll->o, fd, true);
+	return;
+    }
+
+    if (!fdll->ops->retry_open) {
+	fd_finish_open(fdll, err);
+	return;
+    }
+
+    fd_drop_open_fd(fdll, fd);
+
+    /*
+     * Go straight to the next address, don't wait for the stagger
+     * timer (RFC 8305 section 5).  The timer restarts for the new
+     * attempt.
+     */
+    fd_stop_open_timer(fdll);
+    err = fd_start_open_attempt(fdll, &fd);
+    if (!err)
+	fd_open_won(fdll, fd);
+    else if (err != GE_INPROGRESS && fdll->fd == -1)
+	fd_finish_open(fdll, err);
+    /* On an error, let the attempts still running finish. */
+}
 
 static void
-fd_handle_write_ready(struct fd_ll *fdll)
+fd_handle_write_ready(struct fd_ll *fdll, int fd)
 {
-    fdll->o->set_write_handler(fdll->o, fdll->fd, false);
     if (fdll->state == FD_IN_OPEN) {
-	int err;
-
-	err = fdll->ops->check_open(fdll->handler_data, fdll->fd);
-	if (err && fdll->ops->retry_open) {
-	    fdll->o->clear_fd_handlers_norpt(fdll->o, fdll->fd);
-	    close(fdll->fd);
-	    fdll->fd = -1;
-	    err = fdll->ops->retry_open(fdll->handler_data, &fdll->fd);
-	    if (err != GE_INPROGRESS)
-		goto opened;
-	    else {
-		err = fd_setup_handlers(fdll);
-		if (err) {
-		    goto opened;
-		} else {
-		    fdll->o->set_write_handler(fdll->o, fdll->fd, true);
-		    fdll->o->set_except_handler(fdll->o, fdll->fd, true);
-		}
-	    }
-	} else {
-	opened:
-	    fd_finish_open(fdll, err);
-	}
+	fdll->o->set_write_handler(fdll->o, fd, false);
+	fd_check_open_attempt(fdll, fd);
     } else {
+	fdll->o->set_write_handler(fdll->o, fdll->fd, false);
 	fd_unlock(fdll);
 
 	if (fdll->ops->write_ready) {
@@ -446,7 +781,7 @@ fd_write_ready(int fd, void *cbdata)
     struct fd_ll *fdll = cbdata;
 
     fd_lock_and_ref(fdll);
-    fd_handle_write_ready(fdll);
+    fd_handle_write_ready(fdll, fd);
     fd_deref_and_unlock(fdll);
 }
 
@@ -462,8 +797,29 @@ fd_except_ready(int fd, void *cbdata)
      */
     if (fdll->state == FD_IN_OPEN) {
 	fd_ref(fdll);
-	fd_handle_write_ready(fdll);
+	fd_handle_write_ready(fdll, fd);
 	fd_deref_and_unlock(fdll);
+    } else if (fdll->watch_errqueue) {
+	fd_unlock(fdll);
+	if (fdll->ops->errqueue_ready &&
+		fdll->ops->errqueue_ready(fdll->handler_data, fdll->fd))
+	    return;
+	fd_lock(fdll);
+	if (!fdll->read_enabled || fdll->in_read) {
+	    /*
+	     * Out of band data or an error, leave it until reads are
+	     * enabled.  Turn off the except handler so it doesn't spin,
+	     * enabling reads will turn it back on.
+	     */
+	    if (fdll->state == FD_OPEN)
+		fdll->o->set_except_handler(fdll->o, fdll->fd, false);
+	    fd_unlock(fdll);
+	} else if (fdll->ops->except_ready) {
+	    fd_unlock(fdll);
+	    fdll->ops->except_ready(fdll->handler_data, fdll->fd);
+	} else {
+	    fd_unlock(fdll);
+	}
     } else if (fdll->ops->except_ready) {
 	fd_unlock(fdll);
 	fdll->ops->except_ready(fdll->handler_data, fdll->fd);
@@ -539,7 +895,7 @@ fd_open(struct gensio_ll *ll, gensio_ll_open_done done, void *open_data)
     fd_lock(fdll);
     err = fdll->ops->sub_open(fdll->handler_data, &fdll->fd);
     if (err == GE_INPROGRESS || err == 0) {
-	int err2 = fd_setup_handlers(fdll);
+	int err2 = fd_setup_fd_handlers(fdll, fdll->fd);
 	if (err2) {
 	    err = err2;
 	    close(fdll->fd);
@@ -553,6 +909,7 @@ fd_open(struct gensio_ll *ll, gensio_ll_open_done done, void *open_data)
 	    fdll->open_data = open_data;
 	    fdll->o->set_write_handler(fdll->o, fdll->fd, true);
 	    fdll->o->set_except_handler(fdll->o, fdll->fd, true);
+	    fd_start_open_timer(fdll);
 	} else {
 	    fdll->state = FD_OPEN;
 	}
@@ -564,9 +921,9 @@ fd_open(struct gensio_ll *ll, gensio_ll_open_done done, void *open_data)
 }
 
 static int
-fd_setup_handlers(struct fd_ll *fdll)
+fd_setup_fd_handlers(struct fd_ll *fdll, int fd)
 {
-    if (fdll->o->set_fd_handlers(fdll->o, fdll->fd, fdll, fd_read_ready,
+    if (fdll->o->set_fd_handlers(fdll->o, fd, fdll, fd_read_ready,
 				 fd_write_ready, fd_except_ready,
 				 fd_cleared))
 	return GE_NOMEM;
@@ -581,6 +938,12 @@ static int fd_close(struct gensio_ll *ll, gensio_ll_close_done done,
 
     fd_lock(fdll);
     if (fdll->state == FD_OPEN || fdll->state == FD_IN_OPEN) {
+	/*
+	 * A close while opening ends the open, only the close done
+	 * gets reported.  fd_finish_cleared() would otherwise report
+	 * it as an open finishing.
+	 */
+	fdll->open_done = NULL;
 	fdll->close_done = done;
 	fdll->close_data = close_data;
 	fd_start_close(fdll);
@@ -611,7 +974,7 @@ fd_set_read_callback_enable(struct gensio_ll *ll, bool enabled)
 	fd_sched_deferred_op(fdll);
     } else {
 	fdll->o->set_read_handler(fdll->o, fdll->fd, enabled);
-	fdll->o->set_except_handler(fdll->o, fdll->fd, enabled);
+	fd_set_except_handler(fdll, enabled);
     }
  out_unlock:
     fd_unlock(fdll);
@@ -642,6 +1005,16 @@ static int fd_control(struct gensio_ll *ll, bool get, unsigned int option,
 {
     struct fd_ll *fdll = ll_to_fd(ll);
 
+    if (option == GENSIO_CONTROL_READ_BUFFER_SIZE) {
+	if (!get)
+	    return GE_NOTSUP;
+	fd_lock(fdll);
+	*datalen = snprintf(data, *datalen, "%lu",
+			    (unsigned long) fdll->read_data_size);
+	fd_unlock(fdll);
+	return 0;
+    }
+
     if (!fdll->ops->control)
 	return GE_NOTSUP;
 
@@ -649,10 +1022,36 @@ static int fd_control(struct gensio_ll *ll, bool get, unsigned int option,
 			      datalen);
 }
 
+static int
+fd_raw_fd(struct gensio_ll *ll, struct gensio_raw_fd *raw)
+{
+    struct fd_ll *fdll = ll_to_fd(ll);
+    int err = 0;
+
+    fd_lock(fdll);
+    if (!fdll->raw_ok) {
+	err = GE_NOTSUP;
+    } else if (fdll->state != FD_OPEN) {
+	err = GE_NOTREADY;
+    } else if (raw->read_ready && (fdll->read_data_len || fdll->in_read)) {
+	/* Data is already buffered here, it has to be delivered first. */
+	err = GE_INUSE;
+    } else {
+	fdll->raw_read_ready = raw->read_ready;
+	fdll->raw_cb_data = raw->cb_data;
+	raw->fd = fdll->fd;
+    }
+    fd_unlock(fdll);
+
+    return err;
+}
+
 static void fd_disable(struct gensio_ll *ll)
 {
     struct fd_ll *fdll = ll_to_fd(ll);
 
+    if (fdll->state == FD_IN_OPEN)
+	fd_cancel_extra_opens(fdll);
     fdll->state = FD_CLOSED;
     fdll->o->clear_fd_handlers_norpt(fdll->o, fdll->fd);
     close(fdll->fd);
@@ -706,6 +1105,12 @@ gensio_ll_fd_func(struct gensio_ll *ll, int op, gensiods *count,
 	fd_disable(ll);
 	return 0;
 
+    case GENSIO_LL_FUNC_WRITE_MSGS:
+	return fd_write_msgs(ll, count, buf, buflen);
+
+    case GENSIO_LL_FUNC_RAW_FD:
+	return fd_raw_fd(ll, buf);
+
     default:
 	return GE_NOTSUP;
     }
@@ -720,6 +1125,65 @@ gensio_fd_ll_callback(struct gensio_ll *ll, int op, int val, void *buf,
     return fdll->cb(fdll->cb_data, op, val, buf, buflen, data);
 }
 
+void
+gensio_fd_ll_set_open_stagger(struct gensio_ll *ll, unsigned int msecs)
+{
+    struct fd_ll *fdll = ll_to_fd(ll);
+
+    fd_lock(fdll);
+    fdll->open_stagger = msecs;
+    fd_unlock(fdll);
+}
+
+void
+gensio_fd_ll_watch_errqueue(struct gensio_ll *ll)
+{
+    struct fd_ll *fdll = ll_to_fd(ll);
+
+    fd_lock(fdll);
+    fdll->watch_errqueue = true;
+    if (fdll->state == FD_OPEN)
+	fd_set_except_handler(fdll, fdll->read_enabled);
+    fd_unlock(fdll);
+}
+
+void
+gensio_fd_ll_allow_raw(struct gensio_ll *ll)
+{
+    struct fd_ll *fdll = ll_to_fd(ll);
+
+    fd_lock(fdll);
+    fdll->raw_ok = true;
+    fd_unlock(fdll);
+}
+
+void
+gensio_fd_ll_set_read_budget(struct gensio_ll *ll, gensiods budget)
+{
+    struct fd_ll *fdll = ll_to_fd(ll);
+
+    fd_lock(fdll);
+    fdll->read_budget = budget;
+    fd_unlock(fdll);
+}
+
+void
+gensio_fd_ll_set_read_size_range(struct gensio_ll *ll,
+				 gensiods min, gensiods max)
+{
+    struct fd_ll *fdll = ll_to_fd(ll);
+
+    fd_lock(fdll);
+    if (min && max > min) {
+	fdll->read_data_min = min;
+	fdll->read_data_max = max;
+    } else {
+	fdll->read_data_min = 0;
+	fdll->read_data_max = 0;
+    }
+    fd_unlock(fdll);
+}
+
 struct gensio_ll *
 fd_gensio_ll_alloc(struct gensio_os_funcs *o,
 		   int fd,
@@ -749,6 +1213,10 @@ fd_gensio_ll_alloc(struct gensio_os_funcs *o,
     if (!fdll->close_timer)
 	goto out_nomem;
 
+    fdll->open_timer = o->alloc_timer(o, fd_open_timeout, fdll);
+    if (!fdll->open_timer)
+	goto out_nomem;
+
     fdll->deferred_op_runner = o->alloc_runner(o, fd_deferred_op, fdll);
     if (!fdll->deferred_op_runner)
 	goto out_nomem;
@@ -769,7 +1237,7 @@ fd_gensio_ll_alloc(struct gensio_os_funcs *o,
 	goto out_nomem;
 
     if (fd != -1) {
-	int err = fd_setup_handlers(fdll);
+	int err = fd_setup_fd_handlers(fdll, fd);
 	if (err)
 	    goto out_nomem;
     }
@@ -18,10 +18,13 @@
  */
 
 #include "config.h"
+#define _GNU_SOURCE /* Get sendmmsg() */
 #define _XOPEN_SOURCE 600 /* Get posix_openpt() and friends. */
 #define _DEFAULT_SOURCE /* Get getgrouplist(), setgroups() */
 #include <stdio.h>
 #include <string.h>
+#include <strings.h>
+#include <netdb.h>
 #include <arpa/inet.h>
 #include <errno.h>
 #include <fcntl.h>
@@ -30,6 +33,8 @@
 #include <termios.h>
 #include <sys/ioctl.h>
 #include <sys/uio.h>
+#include <netinet/tcp.h>
+#include <netinet/udp.h>
 #include <grp.h>
 #include <pwd.h>
 
@@ -38,6 +43,7 @@
 #endif
 
 #include <gensio/gensio_osops.h>
+#include <gensio/gensio_class.h>
 
 static int
 check_ipv6_only(int family, int protocol, int flags, int fd)
@@ -107,6 +113,18 @@ gensio_os_read(struct gensio_os_funcs *o,
     ERRHANDLE();
 }
 
+int
+gensio_os_splice(struct gensio_os_funcs *o,
+		 int fd_in, int fd_out, gensiods len, gensiods *rcount)
+{
+    ssize_t rv;
+
+ retry:
+    rv = splice(fd_in, NULL, fd_out, NULL, len,
+		SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+    ERRHANDLE();
+}
+
 int
 gensio_os_recv(struct gensio_os_funcs *o,
 	       int fd, void *buf, gensiods buflen, gensiods *rcount, int flags)
@@ -154,6 +172,99 @@ gensio_os_sendto(struct gensio_os_funcs *o,
     ERRHANDLE();
 }
 
+/* Maximum number of messages passed to sendmmsg() at a time. */
+#define GENSIO_OS_MMSG_BATCH	64
+
+/* Maximum size of the per-message control data for l_sendmmsg(). */
+#define GENSIO_OS_MMSG_CMSG_MAX	64
+
+/*
+ * Send a set of messages with sendmmsg().  If cmsgdata is not NULL,
+ * each message gets a control message of the given level and type
+ * with cmsgsize bytes of data from the cmsgdata array.
+ */
+static int
+l_sendmmsg(struct gensio_os_funcs *o,
+	   int fd, struct gensio_msg *msgs, gensiods nmsgs,
+	   gensiods *rcount, int flags,
+	   const struct sockaddr *raddr, socklen_t raddrlen,
+	   int cmsglevel, int cmsgtype,
+	   const void *cmsgdata, size_t cmsgsize)
+{
+    struct mmsghdr hdrs[GENSIO_OS_MMSG_BATCH];
+    union {
+	char buf[CMSG_SPACE(GENSIO_OS_MMSG_CMSG_MAX)];
+	struct cmsghdr align;
+    } cbufs[GENSIO_OS_MMSG_BATCH];
+    struct cmsghdr *cmsg;
+    gensiods i, n, sent = 0;
+    int rv, err = 0;
+
+    if (cmsgdata && cmsgsize > GENSIO_OS_MMSG_CMSG_MAX)
+	return GE_INVAL;
+
+    while (sent < nmsgs) {
+	n = nmsgs - sent;
+	if (n > GENSIO_OS_MMSG_BATCH)
+	    n = GENSIO_OS_MMSG_BATCH;
+
+	memset(hdrs, 0, sizeof(*hdrs) * n);
+	for (i = 0; i < n; i++) {
+	    struct msghdr *hdr = &hdrs[i].msg_hdr;
+
+	    hdr->msg_name = (void *) raddr;
+	    hdr->msg_namelen = raddrlen;
+	    hdr->msg_iov = (struct iovec *) msgs[sent + i].sg;
+	    hdr->msg_iovlen = msgs[sent + i].sglen;
+	    if (cmsgdata) {
+		hdr->msg_control = cbufs[i].buf;
+		hdr->msg_controllen = CMSG_SPACE(cmsgsize);
+		cmsg = CMSG_FIRSTHDR(hdr);
+		cmsg->cmsg_level = cmsglevel;
+		cmsg->cmsg_type = cmsgtype;
+		cmsg->cmsg_len = CMSG_LEN(cmsgsize);
+		memcpy(CMSG_DATA(cmsg),
+		       ((const char *) cmsgdata) + ((sent + i) * cmsgsize),
+		       cmsgsize);
+	    }
+	}
+
+    retry:
+	rv = sendmmsg(fd, hdrs, n, flags);
+	if (rv < 0) {
+	    if (errno == EINTR)
+		goto retry;
+	    if (errno == EWOULDBLOCK || errno == EAGAIN)
+		break;
+	    err = gensio_os_err_to_err(o, errno);
+	    msgs[sent].err = err;
+	    break;
+	}
+
+	for (i = 0; i < (gensiods) rv; i++)
+	    msgs[sent + i].count = hdrs[i].msg_len;
+	sent += rv;
+	/*
+	 * On a short count just go around again, the next call will
+	 * return the error (or EAGAIN) for the message that stopped it.
+	 */
+    }
+
+    if (rcount)
+	*rcount = sent;
+    return err;
+}
+
+int
+gensio_os_sendmmsg(struct gensio_os_funcs *o,
+		   int fd, struct gensio_msg *msgs, gensiods nmsgs,
+		   gensiods *rcount, int flags,
+		   const struct sockaddr *raddr, socklen_t raddrlen)
+{
+    return l_sendmmsg(o, fd, msgs, nmsgs, rcount, flags, raddr, raddrlen,
+		      0, 0, NULL, 0);
+}
+
 int
 gensio_os_recvfrom(struct gensio_os_funcs *o,
 		   int fd, void *buf, gensiods buflen, gensiods *rcount,
@@ -166,18 +277,64 @@ gensio_os_recvfrom(struct gensio_os_funcs *o,
     ERRHANDLE();
 }
 
+int
+gensio_os_recvfrom_gro(struct gensio_os_funcs *o,
+		       int fd, void *buf, gensiods buflen, gensiods *rcount,
+		       int flags, struct sockaddr *raddr, socklen_t *raddrlen,
+		       gensiods *segsize)
+{
+    ssize_t rv;
+    struct msghdr hdr;
+    struct iovec iov;
+    struct cmsghdr *cmsg;
+    union {
+	char buf[CMSG_SPACE(sizeof(int))];
+	struct cmsghdr align;
+    } cbuf;
+
+    *segsize = 0;
+    iov.iov_base = buf;
+    iov.iov_len = buflen;
+    memset(&hdr, 0, sizeof(hdr));
+    hdr.msg_name = raddr;
+    hdr.msg_namelen = *raddrlen;
+    hdr.msg_iov = &iov;
+    hdr.msg_iovlen = 1;
+    hdr.msg_control = cbuf.buf;
+    hdr.msg_controllen = sizeof(cbuf.buf);
+ retry:
+    rv = recvmsg(fd, &hdr, flags);
+    if (rv > 0) {
+	*raddrlen = hdr.msg_namelen;
+#ifdef UDP_GRO
+	for (cmsg = CMSG_FIRSTHDR(&hdr); cmsg; cmsg = CMSG_NXTHDR(&hdr, cmsg)) {
+	    if (cmsg->cmsg_level == SOL_UDP && cmsg->cmsg_type == UDP_GRO) {
+		int val;
+
+		memcpy(&val, CMSG_DATA(cmsg), sizeof(val));
+		if (val > 0 && val < rv)
+		    *segsize = val;
+	    }
+	}
+#else
+	(void) cmsg;
+#endif
+    }
+    ERRHANDLE();
+}
+
 int
 gensio_os_accept(struct gensio_os_funcs *o,
 		 int fd, struct sockaddr *addr, socklen_t *addrlen,
 		 int *newsock)
 {
-    int rv = accept(fd, addr, addrlen);
+    int rv = accept4(fd, addr, addrlen, SOCK_NONBLOCK | SOCK_CLOEXEC);
 
     if (rv >= 0) {
 	*newsock = rv;
 	return 0;
     }
-    if (errno == EAGAIN && errno == EWOULDBLOCK)
+    if (errno == EAGAIN || errno == EWOULDBLOCK)
 	return GE_NODATA;
     return gensio_os_err_to_err(o, errno);
 }
@@ -227,6 +384,16 @@ gensio_os_sctp_send(struct gensio_os_funcs *o,
 	*rcount = total_write;
     return err;
 }
+
+int
+gensio_os_sctp_sendmmsg(struct gensio_os_funcs *o,
+			int fd, struct gensio_msg *msgs, gensiods nmsgs,
+			gensiods *rcount,
+			const struct sctp_sndrcvinfo *sinfo)
+{
+    return l_sendmmsg(o, fd, msgs, nmsgs, rcount, 0, NULL, 0,
+		      IPPROTO_SCTP, SCTP_SNDRCV, sinfo, sizeof(*sinfo));
+}
 #endif
 
 int
@@ -447,18 +614,41 @@ gensio_open_socket(struct gensio_os_funcs *o,
 		   void (*readhndlr)(int, void *),
 		   void (*writehndlr)(int, void *),
 		   void (*fd_handler_cleared)(int, void *),
-		   void *data,
+		   void *data, unsigned int opensock_flags,
 		   struct opensocks **rfds, unsigned int *nr_fds)
+{
+    return gensio_open_socket_multi(o, ai, readhndlr, writehndlr,
+				    fd_handler_cleared, data, opensock_flags,
+				    1, rfds, nr_fds);
+}
+
+int
+gensio_open_socket_multi(struct gensio_os_funcs *o,
+			 struct addrinfo *ai,
+			 void (*readhndlr)(int, void *),
+			 void (*writehndlr)(int, void *),
+			 void (*fd_handler_cleared)(int, void *),
+			 void *data, unsigned int opensock_flags,
+			 unsigned int nr_per_addr,
+			 struct opensocks **rfds, unsigned int *nr_fds)
 {
     struct addrinfo *rp;
     int family = AF_INET6; /* Try IPV6 first, then IPV4. */
     struct opensocks *fds;
     unsigned int curr_fd = 0;
     unsigned int max_fds = 0;
+    struct sockaddr_storage baddr;
+    socklen_t baddrlen;
+    unsigned int i;
     int rv = 0;
 
+    if (nr_per_addr == 0)
+	return GE_INVAL;
+    if (nr_per_addr > 1)
+	opensock_flags |= GENSIO_OPENSOCK_REUSEPORT;
+
     for (rp = ai; rp != NULL; rp = rp->ai_next)
-	max_fds++;
+	max_fds += nr_per_addr;
 
     if (max_fds == 0)
 	return GE_INVAL;
@@ -478,8 +668,33 @@ gensio_open_socket(struct gensio_os_funcs *o,
 					rp->ai_addr, rp->ai_addrlen,
 					readhndlr, writehndlr, data,
 					fd_handler_cleared, NULL,
-					&fds[curr_fd].fd);
-	if (!rv) {
+					opensock_flags, &fds[curr_fd].fd);
+	if (rv)
+	    continue;
+	fds[curr_fd].family = rp->ai_family;
+	curr_fd++;
+
+	if (nr_per_addr == 1)
+	    continue;
+
+	/*
+	 * Bind the other listeners to the address the first one got,
+	 * in case the port was dynamically assigned.
+	 */
+	baddrlen = sizeof(baddr);
+	if (getsockname(fds[curr_fd - 1].fd, (struct sockaddr *) &baddr,
+			&baddrlen) == -1)
+	    continue;
+	for (i = 1; i < nr_per_addr; i++) {
+	    if (gensio_setup_listen_socket(o, rp->ai_socktype == SOCK_STREAM,
+					   rp->ai_family, rp->ai_socktype,
+					   rp->ai_protocol, rp->ai_flags,
+					   (struct sockaddr *) &baddr,
+					   baddrlen,
+					   readhndlr, writehndlr, data,
+					   fd_handler_cleared, NULL,
+					   opensock_flags, &fds[curr_fd].fd))
+		break;
 	    fds[curr_fd].family = rp->ai_family;
 	    curr_fd++;
 	}
@@ -510,7 +725,7 @@ gensio_setup_listen_socket(struct gensio_os_funcs *o, bool do_listen,
 			   void (*writehndlr)(int, void *), void *data,
 			   void (*fd_handler_cleared)(int, void *),
 			   int (*call_b4_listen)(int, void *),
-			   int *rfd)
+			   unsigned int opensock_flags, int *rfd)
 {
     int optval = 1;
     int fd, rv = 0;
@@ -526,19 +741,39 @@ gensio_setup_listen_socket(struct gensio_os_funcs *o, bool do_listen,
 		   (void *)&optval, sizeof(optval)) == -1)
 	goto out_err;
 
+    if (opensock_flags & GENSIO_OPENSOCK_REUSEPORT) {
+	if (setsockopt(fd, SOL_SOCKET, SO_REUSEPORT,
+		       (void *)&optval, sizeof(optval)) == -1)
+	    goto out_err;
+    }
+
     if (check_ipv6_only(family, protocol, flags, fd) == -1)
 	goto out_err;
 
     if (bind(fd, addr, addrlen) != 0)
 	goto out_err;
 
+    if (do_listen && socktype == SOCK_STREAM &&
+		GENSIO_OPENSOCK_FASTOPEN_QLEN(opensock_flags)) {
+#ifdef TCP_FASTOPEN
+	int qlen = GENSIO_OPENSOCK_FASTOPEN_QLEN(opensock_flags);
+
+	if (setsockopt(fd, IPPROTO_TCP, TCP_FASTOPEN,
+		       (void *)&qlen, sizeof(qlen)) == -1)
+	    goto out_err;
+#else
+	rv = GE_NOTSUP;
+	goto out;
+#endif
+    }
+
     if (call_b4_listen) {
 	rv = call_b4_listen(fd, data);
 	if (rv)
 	    goto out;
     }
 
-    if (do_listen && listen(fd, 5) != 0)
+    if (do_listen && listen(fd, SOMAXCONN) != 0)
 	goto out_err;
 
     rv = o->set_fd_handlers(o, fd, data,
@@ -572,6 +807,332 @@ gensio_check_tcpd_ok(int new_fd)
     return NULL;
 }
 
+/*
+ * Cache of name lookups.  getaddrinfo() does not return the TTL of
+ * the records it found, so entries are kept for the time given by
+ * the "dns_ttl" default.  Numeric addresses are not cached, they
+ * don't need a lookup.
+ */
+#define GENSIO_DNS_CACHE_MAX 64
+
+struct gensio_dns_entry {
+    struct gensio_link link;
+    struct gensio_os_funcs *o;
+    char *node;
+    char *service;
+    int flags;
+    int family;
+    int socktype;
+    int protocol;
+    struct timeval expires;
+    struct addrinfo *ai;
+};
+
+static struct gensio_once gensio_dns_initialized;
+static struct gensio_lock *dns_lock;
+static struct gensio_list dns_cache;
+static unsigned int dns_cache_len;
+
+static void
+gensio_dns_init(void *cb_data)
+{
+    struct gensio_os_funcs *o = cb_data;
+
+    gensio_list_init(&dns_cache);
+    dns_lock = o->alloc_lock(o);
+    if (!dns_lock)
+	gensio_log(o, GENSIO_LOG_ERR,
+		   "Unable to allocate DNS cache lock, cache disabled");
+}
+
+static void
+dns_entry_free(struct gensio_dns_entry *e)
+{
+    struct gensio_os_funcs *o = e->o;
+
+    if (e->node)
+	o->free(o, e->node);
+    if (e->service)
+	o->free(o, e->service);
+    if (e->ai)
+	gensio_free_addrinfo(o, e->ai);
+    o->free(o, e);
+}
+
+static bool
+dns_str_equal(const char *s1, const char *s2)
+{
+    if (!s1 || !s2)
+	return s1 == s2;
+    return strcmp(s1, s2) == 0;
+}
+
+static bool
+dns_time_before(const struct timeval *t1, const struct timeval *t2)
+{
+    if (t1->tv_sec != t2->tv_sec)
+	return t1->tv_sec < t2->tv_sec;
+    return t1->tv_usec < t2->tv_usec;
+}
+
+/*
+ * Find an entry matching the lookup, removing any expired entries
+ * along the way.  Must be called with dns_lock held.
+ */
+static struct gensio_dns_entry *
+dns_cache_find(const char *node, const char *service,
+	       const struct addrinfo *hints, const struct timeval *now)
+{
+    struct gensio_link *l, *l2;
+    struct gensio_dns_entry *e, *found = NULL;
+
+    gensio_list_for_each_safe(&dns_cache, l, l2) {
+	e = gensio_container_of(l, struct gensio_dns_entry, link);
+	if (dns_time_before(&e->expires, now)) {
+	    gensio_list_rm(&dns_cache, l);
+	    dns_cache_len--;
+	    dns_entry_free(e);
+	    continue;
+	}
+	if (!found && strcasecmp(e->node, node) == 0 &&
+		dns_str_equal(e->service, service) &&
+		e->flags == hints->ai_flags && e->family == hints->ai_family &&
+		e->socktype == hints->ai_socktype &&
+		e->protocol == hints->ai_protocol)
+	    found = e;
+    }
+
+    return found;
+}
+
+static void
+dns_cache_add(struct gensio_os_funcs *o, const char *node,
+	      const char *service, const struct addrinfo *hints,
+	      struct addrinfo *ai, int ttl)
+{
+    struct gensio_dns_entry *e, *old;
+    struct timeval now;
+
+    e = o->zalloc(o, sizeof(*e));
+    if (!e)
+	return;
+    e->o = o;
+    e->node = gensio_strdup(o, node);
+    if (!e->node)
+	goto out_err;
+    if (service) {
+	e->service = gensio_strdup(o, service);
+	if (!e->service)
+	    goto out_err;
+    }
+    e->ai = gensio_dup_addrinfo(o, ai);
+    if (!e->ai)
+	goto out_err;
+    e->flags = hints->ai_flags;
+    e->family = hints->ai_family;
+    e->socktype = hints->ai_socktype;
+    e->protocol = hints->ai_protocol;
+
+    o->get_monotonic_time(o, &now);
+    e->expires = now;
+    e->expires.tv_sec += ttl;
+
+    o->lock(dns_lock);
+    old = dns_cache_find(node, service, hints, &now);
+    if (old) {
+	/* Somebody else looked it up at the same time. */
+	gensio_list_rm(&dns_cache, &old->link);
+	dns_cache_len--;
+	dns_entry_free(old);
+    }
+    if (dns_cache_len >= GENSIO_DNS_CACHE_MAX) {
+	/* Entries are added at the tail, so the head is the oldest. */
+	old = gensio_container_of(gensio_list_first(&dns_cache),
+				  struct gensio_dns_entry, link);
+	gensio_list_rm(&dns_cache, &old->link);
+	dns_cache_len--;
+	dns_entry_free(old);
+    }
+    gensio_list_add_tail(&dns_cache, &e->link);
+    dns_cache_len++;
+    o->unlock(dns_lock);
+    return;
+
+ out_err:
+    dns_entry_free(e);
+}
+
+void
+gensio_os_dns_flush(struct gensio_os_funcs *o)
+{
+    struct gensio_link *l, *l2;
+    struct gensio_dns_entry *e;
+
+    o->call_once(o, &gensio_dns_initialized, gensio_dns_init, o);
+    if (!dns_lock)
+	return;
+
+    o->lock(dns_lock);
+    gensio_list_for_each_safe(&dns_cache, l, l2) {
+	e = gensio_container_of(l, struct gensio_dns_entry, link);
+	gensio_list_rm(&dns_cache, l);
+	dns_entry_free(e);
+    }
+    dns_cache_len = 0;
+    o->unlock(dns_lock);
+}
+
+/*
+ * Look the name up in a file in hosts(5) format.  Returns GE_NOTFOUND
+ * if the file doesn't have the name.
+ */
+static int
+dns_hosts_lookup(struct gensio_os_funcs *o, const char *file,
+		 const char *node, const char *service,
+		 const struct addrinfo *hints, struct addrinfo **rai)
+{
+    FILE *f;
+    char line[512], *tok, *addr, *strtok_data;
+    struct addrinfo nhints = *hints, *ai, *ai2, *rv = NULL;
+    int err = 0;
+
+    f = fopen(file, "r");
+    if (!f) {
+	gensio_log(o, GENSIO_LOG_WARNING, "Unable to open DNS hosts file %s",
+		   file);
+	return GE_NOTFOUND;
+    }
+
+    /* The address in the file is always numeric. */
+    nhints.ai_flags |= AI_NUMERICHOST;
+    nhints.ai_flags &= ~AI_ADDRCONFIG;
+
+    while (fgets(line, sizeof(line), f)) {
+	tok = strchr(line, '#');
+	if (tok)
+	    *tok = '\0';
+	addr = strtok_r(line, " \t\r\n", &strtok_data);
+	if (!addr)
+	    continue;
+	while ((tok = strtok_r(NULL, " \t\r\n", &strtok_data))) {
+	    if (strcasecmp(tok, node) == 0)
+		break;
+	}
+	if (!tok)
+	    continue;
+
+	/* A family mismatch just means this entry doesn't apply. */
+	if (getaddrinfo(addr, service, &nhints, &ai))
+	    continue;
+	ai2 = gensio_dup_addrinfo(o, ai);
+	freeaddrinfo(ai);
+	if (!ai2) {
+	    err = GE_NOMEM;
+	    break;
+	}
+	if (rv)
+	    rv = gensio_cat_addrinfo(o, rv, ai2);
+	else
+	    rv = ai2;
+    }
+    fclose(f);
+
+    if (err) {
+	if (rv)
+	    gensio_free_addrinfo(o, rv);
+	return err;
+    }
+    if (!rv)
+	return GE_NOTFOUND;
+
+    *rai = rv;
+    return 0;
+}
+
+static bool
+dns_is_numeric(const char *node)
+{
+    struct in6_addr addr;
+
+    return (inet_pton(AF_INET, node, &addr) == 1 ||
+	    inet_pton(AF_INET6, node, &addr) == 1);
+}
+
+int
+gensio_os_getaddrinfo(struct gensio_os_funcs *o,
+		      const char *node, const char *service,
+		      const struct addrinfo *hints, struct addrinfo **rai)
+{
+    struct gensio_dns_entry *e;
+    struct addrinfo *ai, *ai2;
+    struct timeval now;
+    char *hostsfile = NULL;
+    int ttl = 0, err;
+    bool cacheable;
+
+    o->call_once(o, &gensio_dns_initialized, gensio_dns_init, o);
+
+    cacheable = node && dns_lock && !dns_is_numeric(node);
+    if (cacheable) {
+	err = gensio_get_default(o, NULL, "dns_ttl", false,
+				 GENSIO_DEFAULT_INT, NULL, &ttl);
+	if (err || ttl <= 0)
+	    cacheable = false;
+    }
+
+    if (cacheable) {
+	o->get_monotonic_time(o, &now);
+	o->lock(dns_lock);
+	e = dns_cache_find(node, service, hints, &now);
+	if (e) {
+	    ai = gensio_dup_addrinfo(o, e->ai);
+	    o->unlock(dns_lock);
+	    if (!ai)
+		return GE_NOMEM;
+	    *rai = ai;
+	    return 0;
+	}
+	o->unlock(dns_lock);
+    }
+
+    /* The hosts file stands in for the resolver, so it is cached, too. */
+    err = GE_NOTFOUND;
+    if (node) {
+	err = gensio_get_default(o, NULL, "dns_hosts", false,
+				 GENSIO_DEFAULT_STR, &hostsfile, NULL);
+	if (!err && hostsfile) {
+	    err = dns_hosts_lookup(o, hostsfile, node, service, hints, &ai2);
+	    o->free(o, hostsfile);
+	    if (err && err != GE_NOTFOUND)
+		return err;
+	} else {
+	    err = GE_NOTFOUND;
+	}
+    }
+
+    if (err == GE_NOTFOUND) {
+	err = getaddrinfo(node, service, hints, &ai);
+	if (err) {
+	    if (err == EAI_MEMORY)
+		return GE_NOMEM;
+	    if (err == EAI_SYSTEM)
+		return gensio_os_err_to_err(o, errno);
+	    return GE_NOTFOUND;
+	}
+
+	ai2 = gensio_dup_addrinfo(o, ai);
+	freeaddrinfo(ai);
+	if (!ai2)
+	    return GE_NOMEM;
+    }
+
+    if (cacheable)
+	dns_cache_add(o, node, service, hints, ai2, ttl);
+
+    *rai = ai2;
+    return 0;
+}
+
 const char *gensio_errs[] = {
     /*   0 */    "No error",
     /*   1 */    "Out of memory",
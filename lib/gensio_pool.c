@@ -0,0 +1,700 @@
+/*
+ *  gensio - A library for abstracting stream I/O
+ *  Copyright (C) 2019  Corey Minyard <minyard@acm.org>
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public
+ *  License as published by the Free Software Foundation; either
+ *  version 2 of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307  USA
+ */
+
+/*
+ * A pool of client gensios all created from the same string.  Instead
+ * of closing a gensio when the user is done with it, the user
+ * releases it back to the pool and it is handed out, still open, to
+ * the next user that asks for one.
+ *
+ * While a gensio is idle in the pool, reads are enabled on it.  Since
+ * nothing should be coming in on an idle connection, any data or
+ * error means the connection is no good and it is closed.
+ */
+
+#include "config.h"
+#include <stdio.h>
+#include <assert.h>
+#include <limits.h>
+#include <gensio/gensio.h>
+#include <gensio/gensio_class.h>
+
+#include "gensio_pool.h"
+#include "utils.h"
+
+enum pool_entry_state {
+    /* The gensio is being opened for a request. */
+    POOL_ENTRY_OPENING,
+
+    /* Handed out to a user. */
+    POOL_ENTRY_INUSE,
+
+    /* Sitting in the idle list. */
+    POOL_ENTRY_IDLE,
+
+    /* Being closed, will be freed when the close completes. */
+    POOL_ENTRY_CLOSING
+};
+
+struct gensio_pool_req {
+    struct gensio_link link;
+    struct gensio_pool *pool;
+
+    gensio_event cb;
+    void *user_data;
+    gensio_pool_done done;
+    void *done_data;
+
+    /* Used to report the result from the selector. */
+    struct gensio_timer *timer;
+    struct gensio_pool_entry *entry;
+    int err;
+};
+
+struct gensio_pool_entry {
+    struct gensio_link link;
+    struct gensio_pool *pool;
+    struct gensio *io;
+    enum pool_entry_state state;
+
+    /* When idle, when this entry should be closed. */
+    struct timeval expire;
+
+    /* The request this is being opened for. */
+    struct gensio_pool_req *req;
+};
+
+struct gensio_pool {
+    struct gensio_os_funcs *o;
+    struct gensio_lock *lock;
+    unsigned int refcount;
+    bool freed;
+
+    char *str;
+
+    unsigned int max_idle;
+    unsigned int max_total; /* 0 means no limit */
+    unsigned int idle_timeout; /* In seconds, 0 means no timeout */
+
+    /* Open gensios not in use, oldest first. */
+    struct gensio_list idle;
+    unsigned int nr_idle;
+
+    /* All gensios opening, in use, or idle. */
+    unsigned int nr_total;
+
+    /* Requests waiting for a gensio because max_total was hit. */
+    struct gensio_list waiting;
+
+    struct gensio_timer *timer;
+    bool timer_running;
+
+    /* Statistics */
+    unsigned long created;
+    unsigned long reused;
+    unsigned long expired;
+    unsigned long failed;
+};
+
+static void pool_close_entry(struct gensio_pool_entry *entry);
+static void pool_check_waiting(struct gensio_pool *pool);
+
+static void
+pool_lock(struct gensio_pool *pool)
+{
+    pool->o->lock(pool->lock);
+}
+
+static void
+pool_unlock(struct gensio_pool *pool)
+{
+    pool->o->unlock(pool->lock);
+}
+
+static void
+pool_ref(struct gensio_pool *pool)
+{
+    assert(pool->refcount > 0);
+    pool->refcount++;
+}
+
+static void
+pool_finish_free(struct gensio_pool *pool)
+{
+    struct gensio_os_funcs *o = pool->o;
+
+    if (pool->timer)
+	o->free_timer(pool->timer);
+    if (pool->lock)
+	o->free_lock(pool->lock);
+    if (pool->str)
+	o->free(o, pool->str);
+    o->free(o, pool);
+}
+
+static void
+pool_deref_and_unlock(struct gensio_pool *pool)
+{
+    assert(pool->refcount > 0);
+    pool->refcount--;
+    if (pool->refcount == 0) {
+	pool_unlock(pool);
+	pool_finish_free(pool);
+    } else {
+	pool_unlock(pool);
+    }
+}
+
+static void
+pool_free_req(struct gensio_pool_req *req)
+{
+    struct gensio_os_funcs *o = req->pool->o;
+
+    o->free_timer(req->timer);
+    o->free(o, req);
+}
+
+static void
+pool_req_done(struct gensio_timer *t, void *cb_data)
+{
+    struct gensio_pool_req *req = cb_data;
+    struct gensio_pool *pool = req->pool;
+    struct gensio *io = NULL;
+
+    if (req->entry) {
+	io = req->entry->io;
+	gensio_set_read_callback_enable(io, false);
+	gensio_set_callback(io, req->cb, req->user_data);
+    }
+    req->done(pool, io, req->err, req->done_data);
+    pool_free_req(req);
+
+    pool_lock(pool);
+    pool_deref_and_unlock(pool);
+}
+
+/*
+ * Report the result of a request.  This is done from a timer so the
+ * user callback is never called from inside a pool call and with no
+ * locks held.  Must be called with the pool lock held.
+ */
+static void
+pool_deliver(struct gensio_pool_req *req, struct gensio_pool_entry *entry,
+	     int err)
+{
+    struct timeval zerotime = { 0, 0 };
+
+    req->entry = entry;
+    req->err = err;
+    if (entry)
+	entry->state = POOL_ENTRY_INUSE;
+    req->pool->o->start_timer(req->timer, &zerotime);
+}
+
+static void
+pool_free_entry(struct gensio_pool_entry *entry)
+{
+    struct gensio_pool *pool = entry->pool;
+
+    pool->o->free(pool->o, entry);
+    pool_lock(pool);
+    pool_deref_and_unlock(pool);
+}
+
+static void
+pool_close_done(struct gensio *io, void *close_data)
+{
+    struct gensio_pool_entry *entry = close_data;
+    struct gensio_pool *pool = entry->pool;
+
+    gensio_free(io);
+
+    pool_lock(pool);
+    assert(pool->nr_total > 0);
+    pool->nr_total--;
+    pool_unlock(pool);
+
+    /* There may be room for a waiting request now. */
+    pool_check_waiting(pool);
+
+    pool_free_entry(entry);
+}
+
+/* Close the entry's gensio, the entry must not be in any list. */
+static void
+pool_close_entry(struct gensio_pool_entry *entry)
+{
+    int err;
+
+    entry->state = POOL_ENTRY_CLOSING;
+    gensio_set_read_callback_enable(entry->io, false);
+    gensio_set_write_callback_enable(entry->io, false);
+    err = gensio_close(entry->io, pool_close_done, entry);
+    if (err)
+	/* Already closed by the other end or an error. */
+	pool_close_done(entry->io, entry);
+}
+
+static int
+pool_idle_event(struct gensio *io, void *user_data, int event, int err,
+		unsigned char *buf, gensiods *buflen,
+		const char *const *auxdata)
+{
+    struct gensio_pool_entry *entry = user_data;
+    struct gensio_pool *pool = entry->pool;
+
+    if (event != GENSIO_EVENT_READ)
+	return GE_NOTSUP;
+
+    pool_lock(pool);
+    if (entry->state != POOL_ENTRY_IDLE) {
+	/*
+	 * Raced with the entry being handed out, leave the data for
+	 * the new user.
+	 */
+	pool_unlock(pool);
+	if (buflen)
+	    *buflen = 0;
+	return 0;
+    }
+
+    /* Data or an error on an idle connection, the connection is bad. */
+    gensio_list_rm(&pool->idle, &entry->link);
+    pool->nr_idle--;
+    pool->failed++;
+    entry->state = POOL_ENTRY_CLOSING;
+    pool_unlock(pool);
+
+    pool_close_entry(entry);
+    return 0;
+}
+
+static void
+pool_open_done(struct gensio *io, int err, void *open_data)
+{
+    struct gensio_pool_entry *entry = open_data;
+    struct gensio_pool *pool = entry->pool;
+    struct gensio_pool_req *req = entry->req;
+
+    entry->req = NULL;
+    pool_lock(pool);
+    if (err) {
+	assert(pool->nr_total > 0);
+	pool->nr_total--;
+	pool_deliver(req, NULL, err);
+	pool_unlock(pool);
+	gensio_free(io);
+	/* This one didn't count, a waiting request can have the slot. */
+	pool_check_waiting(pool);
+	pool_free_entry(entry);
+	return;
+    }
+    pool_deliver(req, entry, 0);
+    pool_unlock(pool);
+}
+
+/*
+ * Allocate a new gensio and start opening it for the given request.
+ * The caller must have already accounted for it in nr_total.  Must
+ * be called with the pool lock not held.
+ */
+static int
+pool_open_entry(struct gensio_pool *pool, struct gensio_pool_req *req)
+{
+    struct gensio_os_funcs *o = pool->o;
+    struct gensio_pool_entry *entry;
+    int err;
+
+    entry = o->zalloc(o, sizeof(*entry));
+    if (!entry)
+	return GE_NOMEM;
+    entry->pool = pool;
+    entry->req = req;
+    entry->state = POOL_ENTRY_OPENING;
+
+    err = str_to_gensio(pool->str, o, pool_idle_event, entry, &entry->io);
+    if (err) {
+	o->free(o, entry);
+	return err;
+    }
+    gensio_set_pool_data(entry->io, entry);
+
+    pool_lock(pool);
+    pool_ref(pool);
+    pool->created++;
+    pool_unlock(pool);
+
+    err = gensio_open(entry->io, pool_open_done, entry);
+    if (err) {
+	gensio_free(entry->io);
+	pool_lock(pool);
+	pool->created--;
+	pool_unlock(pool);
+	pool_free_entry(entry);
+    }
+    return err;
+}
+
+/* If a request is waiting and there is room, start a gensio for it. */
+static void
+pool_check_waiting(struct gensio_pool *pool)
+{
+    struct gensio_pool_req *req;
+    struct gensio_link *l;
+    int err;
+
+    pool_lock(pool);
+    while (!gensio_list_empty(&pool->waiting) &&
+	   (!pool->max_total || pool->nr_total < pool->max_total)) {
+	l = gensio_list_first(&pool->waiting);
+	req = gensio_container_of(l, struct gensio_pool_req, link);
+	gensio_list_rm(&pool->waiting, l);
+	pool->nr_total++;
+	pool_unlock(pool);
+
+	err = pool_open_entry(pool, req);
+
+	pool_lock(pool);
+	if (err) {
+	    pool->nr_total--;
+	    pool_deliver(req, NULL, err);
+	}
+    }
+    pool_unlock(pool);
+}
+
+static void
+pool_start_timer(struct gensio_pool *pool, struct timeval *expire)
+{
+    if (pool->timer_running)
+	return;
+    pool->timer_running = true;
+    pool_ref(pool);
+    pool->o->start_timer_abs(pool->timer, expire);
+}
+
+static void
+pool_timeout(struct gensio_timer *t, void *cb_data)
+{
+    struct gensio_pool *pool = cb_data;
+    struct gensio_list expired;
+    struct gensio_link *l, *l2;
+    struct gensio_pool_entry *entry;
+    struct timeval now;
+
+    gensio_list_init(&expired);
+
+    pool_lock(pool);
+    pool->timer_running = false;
+    pool->o->get_monotonic_time(pool->o, &now);
+    gensio_list_for_each_safe(&pool->idle, l, l2) {
+	entry = gensio_container_of(l, struct gensio_pool_entry, link);
+	if (cmp_timeval(&entry->expire, &now) > 0) {
+	    /* The list is in expire order, wait for this one. */
+	    pool_start_timer(pool, &entry->expire);
+	    break;
+	}
+	gensio_list_rm(&pool->idle, l);
+	pool->nr_idle--;
+	pool->expired++;
+	entry->state = POOL_ENTRY_CLOSING;
+	gensio_list_add_tail(&expired, l);
+    }
+    pool_unlock(pool);
+
+    gensio_list_for_each_safe(&expired, l, l2) {
+	entry = gensio_container_of(l, struct gensio_pool_entry, link);
+	gensio_list_rm(&expired, l);
+	pool_close_entry(entry);
+    }
+
+    pool_lock(pool);
+    pool_deref_and_unlock(pool);
+}
+
+int
+gensio_pool_alloc(struct gensio_os_funcs *o, const char *str,
+		  const char * const args[], struct gensio_pool **rpool)
+{
+    struct gensio_pool *pool;
+    unsigned int max_idle = 8, max_total = 0, idle_timeout = 60;
+    unsigned int i;
+    int ival, err;
+
+    if (!str)
+	return GE_INVAL;
+
+    err = gensio_get_default(o, "pool", "max_idle", false,
+			     GENSIO_DEFAULT_INT, NULL, &ival);
+    if (!err)
+	max_idle = ival;
+    err = gensio_get_default(o, "pool", "max_total", false,
+			     GENSIO_DEFAULT_INT, NULL, &ival);
+    if (!err)
+	max_total = ival;
+    err = gensio_get_default(o, "pool", "idle_timeout", false,
+			     GENSIO_DEFAULT_INT, NULL, &ival);
+    if (!err)
+	idle_timeout = ival;
+
+    for (i = 0; args && args[i]; i++) {
+	if (gensio_check_keyuint(args[i], "max_idle", &max_idle) > 0)
+	    continue;
+	if (gensio_check_keyuint(args[i], "max_total", &max_total) > 0)
+	    continue;
+	if (gensio_check_keyuint(args[i], "idle_timeout", &idle_timeout) > 0)
+	    continue;
+	return GE_INVAL;
+    }
+
+    pool = o->zalloc(o, sizeof(*pool));
+    if (!pool)
+	return GE_NOMEM;
+    pool->o = o;
+    pool->refcount = 1;
+    pool->max_idle = max_idle;
+    pool->max_total = max_total;
+    pool->idle_timeout = idle_timeout;
+    gensio_list_init(&pool->idle);
+    gensio_list_init(&pool->waiting);
+
+    pool->str = gensio_strdup(o, str);
+    if (!pool->str)
+	goto out_nomem;
+
+    pool->lock = o->alloc_lock(o);
+    if (!pool->lock)
+	goto out_nomem;
+
+    pool->timer = o->alloc_timer(o, pool_timeout, pool);
+    if (!pool->timer)
+	goto out_nomem;
+
+    *rpool = pool;
+    return 0;
+
+ out_nomem:
+    pool_finish_free(pool);
+    return GE_NOMEM;
+}
+
+int
+gensio_pool_get(struct gensio_pool *pool,
+		gensio_event cb, void *user_data,
+		gensio_pool_done done, void *done_data)
+{
+    struct gensio_os_funcs *o = pool->o;
+    struct gensio_pool_req *req;
+    struct gensio_pool_entry *entry;
+    int err;
+
+    if (!done)
+	return GE_INVAL;
+
+    req = o->zalloc(o, sizeof(*req));
+    if (!req)
+	return GE_NOMEM;
+    req->pool = pool;
+    req->cb = cb;
+    req->user_data = user_data;
+    req->done = done;
+    req->done_data = done_data;
+    req->timer = o->alloc_timer(o, pool_req_done, req);
+    if (!req->timer) {
+	o->free(o, req);
+	return GE_NOMEM;
+    }
+
+    pool_lock(pool);
+    if (pool->freed) {
+	pool_unlock(pool);
+	pool_free_req(req);
+	return GE_NOTREADY;
+    }
+    pool_ref(pool);
+
+    if (!gensio_list_empty(&pool->idle)) {
+	/* Hand out the most recently used one, it's most likely good. */
+	entry = gensio_container_of(gensio_list_last(&pool->idle),
+				    struct gensio_pool_entry, link);
+	gensio_list_rm(&pool->idle, &entry->link);
+	pool->nr_idle--;
+	pool->reused++;
+	pool_deliver(req, entry, 0);
+	pool_unlock(pool);
+	return 0;
+    }
+
+    if (pool->max_total && pool->nr_total >= pool->max_total) {
+	/* Wait for one to be released. */
+	gensio_list_add_tail(&pool->waiting, &req->link);
+	pool_unlock(pool);
+	return 0;
+    }
+
+    pool->nr_total++;
+    pool_unlock(pool);
+
+    err = pool_open_entry(pool, req);
+    if (err) {
+	pool_free_req(req);
+	pool_lock(pool);
+	pool->nr_total--;
+	pool_unlock(pool);
+	/* A request may have queued behind this one while it was open. */
+	pool_check_waiting(pool);
+	pool_lock(pool);
+	pool_deref_and_unlock(pool);
+    }
+    return err;
+}
+
+int
+gensio_pool_release(struct gensio_pool *pool, struct gensio *io)
+{
+    struct gensio_pool_entry *entry = gensio_get_pool_data(io);
+    struct gensio_pool_req *req;
+    struct gensio_link *l;
+
+    if (!entry || entry->pool != pool || entry->state != POOL_ENTRY_INUSE)
+	return GE_INVAL;
+
+    gensio_set_read_callback_enable(io, false);
+    gensio_set_write_callback_enable(io, false);
+    gensio_set_callback(io, pool_idle_event, entry);
+
+    pool_lock(pool);
+    if (!gensio_list_empty(&pool->waiting)) {
+	/* Give it straight to the oldest waiter. */
+	l = gensio_list_first(&pool->waiting);
+	req = gensio_container_of(l, struct gensio_pool_req, link);
+	gensio_list_rm(&pool->waiting, l);
+	pool->reused++;
+	pool_deliver(req, entry, 0);
+	pool_unlock(pool);
+	return 0;
+    }
+
+    if (pool->freed || pool->nr_idle >= pool->max_idle) {
+	entry->state = POOL_ENTRY_CLOSING;
+	pool_unlock(pool);
+	pool_close_entry(entry);
+	return 0;
+    }
+
+    entry->state = POOL_ENTRY_IDLE;
+    gensio_list_add_tail(&pool->idle, &entry->link);
+    pool->nr_idle++;
+    if (pool->idle_timeout) {
+	struct timeval timeout = { pool->idle_timeout, 0 };
+
+	pool->o->get_monotonic_time(pool->o, &entry->expire);
+	add_to_timeval(&entry->expire, &timeout);
+	pool_start_timer(pool, &entry->expire);
+    }
+    /* Watch for the other end closing or sending junk. */
+    gensio_set_read_callback_enable(io, true);
+    pool_unlock(pool);
+
+    return 0;
+}
+
+int
+gensio_pool_drop(struct gensio_pool *pool, struct gensio *io)
+{
+    struct gensio_pool_entry *entry = gensio_get_pool_data(io);
+
+    if (!entry || entry->pool != pool || entry->state != POOL_ENTRY_INUSE)
+	return GE_INVAL;
+
+    pool_lock(pool);
+    entry->state = POOL_ENTRY_CLOSING;
+    pool_unlock(pool);
+    pool_close_entry(entry);
+
+    return 0;
+}
+
+void
+gensio_pool_free(struct gensio_pool *pool)
+{
+    struct gensio_list closing;
+    struct gensio_link *l, *l2;
+    struct gensio_pool_entry *entry;
+    struct gensio_pool_req *req;
+
+    gensio_list_init(&closing);
+
+    pool_lock(pool);
+    pool->freed = true;
+    gensio_list_for_each_safe(&pool->idle, l, l2) {
+	entry = gensio_container_of(l, struct gensio_pool_entry, link);
+	gensio_list_rm(&pool->idle, l);
+	pool->nr_idle--;
+	entry->state = POOL_ENTRY_CLOSING;
+	gensio_list_add_tail(&closing, l);
+    }
+    gensio_list_for_each_safe(&pool->waiting, l, l2) {
+	req = gensio_container_of(l, struct gensio_pool_req, link);
+	gensio_list_rm(&pool->waiting, l);
+	pool_deliver(req, NULL, GE_NOTREADY);
+    }
+    if (pool->timer_running && pool->o->stop_timer(pool->timer) == 0) {
+	pool->timer_running = false;
+	pool->refcount--; /* Can't be the last one, we hold one. */
+    }
+    pool_unlock(pool);
+
+    gensio_list_for_each_safe(&closing, l, l2) {
+	entry = gensio_container_of(l, struct gensio_pool_entry, link);
+	gensio_list_rm(&closing, l);
+	pool_close_entry(entry);
+    }
+
+    /*
+     * Gensios in use or opening hold a reference and will be closed
+     * when they are released.
+     */
+    pool_lock(pool);
+    pool_deref_and_unlock(pool);
+}
+
+int
+gensio_pool_stats(void *pool_data, bool get, char *data, gensiods *datalen)
+{
+    struct gensio_pool_entry *entry = pool_data;
+    struct gensio_pool *pool = entry->pool;
+
+    pool_lock(pool);
+    if (get) {
+	*datalen = snprintf(data, *datalen,
+			    "created=%lu reused=%lu expired=%lu failed=%lu"
+			    " idle=%u total=%u",
+			    pool->created, pool->reused, pool->expired,
+			    pool->failed, pool->nr_idle, pool->nr_total);
+    } else {
+	pool->created = 0;
+	pool->reused = 0;
+	pool->expired = 0;
+	pool->failed = 0;
+    }
+    pool_unlock(pool);
+
+    return 0;
+}
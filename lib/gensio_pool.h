@@ -0,0 +1,39 @@
+/*
+ *  gensio - A library for abstracting stream I/O
+ *  Copyright (C) 2019  Corey Minyard <minyard@acm.org>
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public
+ *  License as published by the Free Software Foundation; either
+ *  version 2 of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307  USA
+ */
+
+/* Internal interfaces between the gensio core and connection pools. */
+
+#ifndef GENSIO_POOL_H
+#define GENSIO_POOL_H
+
+#include <gensio/gensio.h>
+
+/*
+ * Each gensio allocated by a pool has the pool's per-gensio data
+ * attached to it, so the pool can find it on release and so
+ * gensio_control() can get the pool statistics.
+ */
+void gensio_set_pool_data(struct gensio *io, void *pool_data);
+void *gensio_get_pool_data(struct gensio *io);
+
+/* Handle GENSIO_CONTROL_POOL_STATS for a gensio from a pool. */
+int gensio_pool_stats(void *pool_data, bool get,
+		      char *data, gensiods *datalen);
+
+#endif /* GENSIO_POOL_H */
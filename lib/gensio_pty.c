@@ -224,12 +224,35 @@ pty_gensio_alloc(const char * const argv[], const char * const args[],
     struct pty_data *tdata = NULL;
     struct gensio *io;
     gensiods max_read_size = GENSIO_DEFAULT_BUF_SIZE;
+    gensiods read_budget = 65536;
+    gensiods readbuf_min = 1024, readbuf_max = 0;
     unsigned int i;
-    int err;
+    int ival, err;
+
+    err = gensio_get_default(o, "pty", "read_budget", false,
+			     GENSIO_DEFAULT_INT, NULL, &ival);
+    if (!err)
+	read_budget = ival;
+
+    err = gensio_get_default(o, "pty", "readbuf_min", false,
+			     GENSIO_DEFAULT_INT, NULL, &ival);
+    if (!err)
+	readbuf_min = ival;
+
+    err = gensio_get_default(o, "pty", "readbuf_max", false,
+			     GENSIO_DEFAULT_INT, NULL, &ival);
+    if (!err)
+	readbuf_max = ival;
 
     for (i = 0; args && args[i]; i++) {
 	if (gensio_check_keyds(args[i], "readbuf", &max_read_size) > 0)
 	    continue;
+	if (gensio_check_keyds(args[i], "read_budget", &read_budget) > 0)
+	    continue;
+	if (gensio_check_keyds(args[i], "readbuf_min", &readbuf_min) > 0)
+	    continue;
+	if (gensio_check_keyds(args[i], "readbuf_max", &readbuf_max) > 0)
+	    continue;
 	return GE_INVAL;
     }
 
@@ -248,6 +271,8 @@ pty_gensio_alloc(const char * const argv[], const char * const args[],
 				   false);
     if (!tdata->ll)
 	goto out_nomem;
+    gensio_fd_ll_set_read_budget(tdata->ll, read_budget);
+    gensio_fd_ll_set_read_size_range(tdata->ll, readbuf_min, readbuf_max);
 
     io = base_gensio_alloc(o, tdata->ll, NULL, NULL, "pty", cb, user_data);
     if (!io) {
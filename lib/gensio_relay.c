@@ -0,0 +1,556 @@
+/*
+ *  gensio - A library for abstracting stream I/O
+ *  Copyright (C) 2019  Corey Minyard <minyard@acm.org>
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public
+ *  License as published by the Free Software Foundation; either
+ *  version 2 of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307  USA
+ */
+
+/*
+ * Pass data between two gensios in both directions.
+ *
+ * If both gensios will give up their file descriptors (see
+ * GENSIO_FUNC_RAW_FD), the data is moved with splice() through a pipe
+ * for each direction, so it never gets copied into user space.
+ * Otherwise the data is written from the read callback of one gensio
+ * to the other.  Either way, if the destination cannot take all the
+ * data, reads are disabled on the source until the destination is
+ * ready for more.
+ */
+
+#include "config.h"
+#define _GNU_SOURCE /* Get pipe2() */
+#include <assert.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <string.h>
+#include <strings.h>
+#include <sys/socket.h>
+#include <gensio/gensio.h>
+#include <gensio/gensio_class.h>
+#include <gensio/gensio_osops.h>
+
+/* How much to move into the pipe at a time. */
+#define RELAY_SPLICE_SIZE 65536
+
+struct relay_dir {
+    struct gensio_relay *relay;
+
+    struct gensio *from;
+    struct gensio *to;
+
+    /* The callback from had before the relay took it over. */
+    gensio_event old_cb;
+    void *old_user_data;
+
+    /* The raw fds, -1 if the gensio doesn't have one. */
+    int from_fd;
+    int to_fd;
+
+    /* Only used when splicing. */
+    int pipe[2];
+    gensiods in_pipe;
+
+    /* Waiting for the to side to be writable. */
+    bool write_pending;
+
+    /* Got end of file on from. */
+    bool eof;
+
+    /* Everything from from has been passed to to. */
+    bool done;
+};
+
+struct gensio_relay {
+    struct gensio_os_funcs *o;
+    struct gensio_lock *lock;
+    unsigned int refcount;
+    bool freed;
+
+    bool allow_splice;
+    bool spliced;
+
+    bool started;
+    bool stopped;
+    int err;
+
+    struct relay_dir dir[2];
+
+    gensio_relay_done done;
+    void *done_data;
+
+    /*
+     * Used to report that the relay is done from the selector.  It
+     * also does the final free, so callbacks already on their way in
+     * when the relay is freed still find it.
+     */
+    struct gensio_timer *timer;
+    bool timer_running;
+};
+
+static void
+relay_lock(struct gensio_relay *relay)
+{
+    relay->o->lock(relay->lock);
+}
+
+static void
+relay_unlock(struct gensio_relay *relay)
+{
+    relay->o->unlock(relay->lock);
+}
+
+static void
+relay_finish_free(struct gensio_relay *relay)
+{
+    struct gensio_os_funcs *o = relay->o;
+    unsigned int i;
+
+    for (i = 0; i < 2; i++) {
+	if (relay->dir[i].pipe[0] != -1)
+	    close(relay->dir[i].pipe[0]);
+	if (relay->dir[i].pipe[1] != -1)
+	    close(relay->dir[i].pipe[1]);
+    }
+    if (relay->timer)
+	o->free_timer(relay->timer);
+    if (relay->lock)
+	o->free_lock(relay->lock);
+    o->free(o, relay);
+}
+
+static void
+relay_deref_and_unlock(struct gensio_relay *relay)
+{
+    assert(relay->refcount > 0);
+    relay->refcount--;
+    if (relay->refcount == 0) {
+	relay_unlock(relay);
+	relay_finish_free(relay);
+    } else {
+	relay_unlock(relay);
+    }
+}
+
+static void
+relay_start_timer(struct gensio_relay *relay)
+{
+    struct timeval zerotime = { 0, 0 };
+
+    if (relay->timer_running)
+	return;
+    relay->refcount++;
+    relay->timer_running = true;
+    relay->o->start_timer(relay->timer, &zerotime);
+}
+
+static void
+relay_clear_raw(struct gensio_relay *relay)
+{
+    struct gensio_raw_fd raw;
+    unsigned int i;
+
+    if (!relay->spliced)
+	return;
+
+    memset(&raw, 0, sizeof(raw));
+    for (i = 0; i < 2; i++)
+	gensio_raw_fd(relay->dir[i].from, &raw);
+}
+
+/*
+ * Stop passing data and report the result to the user.  Must be
+ * called with the lock held.
+ */
+static void
+relay_stop(struct gensio_relay *relay, int err)
+{
+    unsigned int i;
+
+    if (relay->stopped)
+	return;
+    relay->stopped = true;
+    relay->err = err;
+
+    relay_clear_raw(relay);
+    for (i = 0; i < 2; i++) {
+	gensio_set_read_callback_enable(relay->dir[i].from, false);
+	gensio_set_write_callback_enable(relay->dir[i].to, false);
+    }
+
+    relay_start_timer(relay);
+}
+
+static void
+relay_stopped(struct gensio_timer *t, void *cb_data)
+{
+    struct gensio_relay *relay = cb_data;
+
+    relay_lock(relay);
+    relay->timer_running = false;
+    if (!relay->freed) {
+	relay_unlock(relay);
+	relay->done(relay, relay->err, relay->done_data);
+	relay_lock(relay);
+    }
+    relay_deref_and_unlock(relay);
+}
+
+/*
+ * Nothing more will come from the from side.  Pass the end of file on
+ * to the to side if it can take it, otherwise there is no way to tell
+ * the other end so the whole relay has to be shut down.
+ */
+static void
+relay_dir_finish(struct relay_dir *dir)
+{
+    struct gensio_relay *relay = dir->relay;
+
+    dir->done = true;
+    gensio_set_read_callback_enable(dir->from, false);
+    if (dir->to_fd == -1 || shutdown(dir->to_fd, SHUT_WR) == -1)
+	relay_stop(relay, 0);
+    else if (relay->dir[0].done && relay->dir[1].done)
+	relay_stop(relay, 0);
+}
+
+/*
+ * Move what is in the pipe to the to side.  If it's all gone, start
+ * reading again.
+ */
+static void
+relay_dir_flush(struct relay_dir *dir)
+{
+    struct gensio_relay *relay = dir->relay;
+    gensiods count;
+    int err;
+
+    if (dir->in_pipe) {
+	err = gensio_os_splice(relay->o, dir->pipe[0], dir->to_fd,
+			       dir->in_pipe, &count);
+	if (err) {
+	    relay_stop(relay, err);
+	    return;
+	}
+	dir->in_pipe -= count;
+	if (dir->in_pipe) {
+	    if (!dir->write_pending) {
+		dir->write_pending = true;
+		gensio_set_write_callback_enable(dir->to, true);
+	    }
+	    return;
+	}
+    }
+
+    if (dir->write_pending) {
+	dir->write_pending = false;
+	gensio_set_write_callback_enable(dir->to, false);
+    }
+    if (dir->eof)
+	relay_dir_finish(dir);
+    else
+	gensio_set_read_callback_enable(dir->from, true);
+}
+
+static void
+relay_raw_read_ready(int fd, void *cb_data)
+{
+    struct relay_dir *dir = cb_data;
+    struct gensio_relay *relay = dir->relay;
+    gensiods count;
+    int err;
+
+    relay_lock(relay);
+    relay->refcount++;
+    if (relay->stopped || dir->done)
+	goto out_unlock;
+
+    err = gensio_os_splice(relay->o, dir->from_fd, dir->pipe[1],
+			   RELAY_SPLICE_SIZE, &count);
+    if (err == GE_REMCLOSE) {
+	dir->eof = true;
+    } else if (err) {
+	relay_stop(relay, err);
+	goto out_unlock;
+    } else {
+	dir->in_pipe += count;
+    }
+    relay_dir_flush(dir);
+
+ out_unlock:
+    relay_deref_and_unlock(relay);
+}
+
+static bool
+relay_is_oob(const char *const *auxdata)
+{
+    unsigned int i;
+
+    for (i = 0; auxdata && auxdata[i]; i++) {
+	if (strcasecmp(auxdata[i], "oob") == 0)
+	    return true;
+    }
+    return false;
+}
+
+static int
+relay_read(struct relay_dir *dir, int readerr,
+	   unsigned char *buf, gensiods *buflen, const char *const *auxdata)
+{
+    struct gensio_relay *relay = dir->relay;
+    gensiods count;
+    int err;
+
+    if (readerr) {
+	if (readerr != GE_REMCLOSE) {
+	    relay_stop(relay, readerr);
+	    return 0;
+	}
+	dir->eof = true;
+	gensio_set_read_callback_enable(dir->from, false);
+	if (!dir->in_pipe && !dir->write_pending)
+	    relay_dir_finish(dir);
+	return 0;
+    }
+
+    /* Out of band data can't be passed on in the stream, drop it. */
+    if (relay_is_oob(auxdata))
+	return 0;
+
+    err = gensio_write(dir->to, &count, buf, *buflen, NULL);
+    if (err) {
+	relay_stop(relay, err);
+	return 0;
+    }
+    if (count < *buflen) {
+	/* The rest stays with from until to can take more. */
+	*buflen = count;
+	gensio_set_read_callback_enable(dir->from, false);
+	dir->write_pending = true;
+	gensio_set_write_callback_enable(dir->to, true);
+    }
+
+    return 0;
+}
+
+static int
+relay_event(struct gensio *io, void *user_data, int event, int err,
+	    unsigned char *buf, gensiods *buflen,
+	    const char *const *auxdata)
+{
+    struct gensio_relay *relay = user_data;
+    struct relay_dir *dir;
+    int rv = 0;
+
+    relay_lock(relay);
+    relay->refcount++;
+    if (relay->stopped) {
+	/* Leave the data for whoever has the gensio next. */
+	if (buflen)
+	    *buflen = 0;
+	if (!relay->freed) {
+	    gensio_set_read_callback_enable(io, false);
+	    gensio_set_write_callback_enable(io, false);
+	}
+	goto out_unlock;
+    }
+
+    switch (event) {
+    case GENSIO_EVENT_READ:
+	dir = &relay->dir[relay->dir[0].from == io ? 0 : 1];
+	rv = relay_read(dir, err, buf, buflen, auxdata);
+	break;
+
+    case GENSIO_EVENT_WRITE_READY:
+	dir = &relay->dir[relay->dir[0].to == io ? 0 : 1];
+	if (relay->spliced) {
+	    relay_dir_flush(dir);
+	} else {
+	    dir->write_pending = false;
+	    gensio_set_write_callback_enable(dir->to, false);
+	    if (dir->eof)
+		relay_dir_finish(dir);
+	    else
+		gensio_set_read_callback_enable(dir->from, true);
+	}
+	break;
+
+    default:
+	rv = GE_NOTSUP;
+    }
+
+ out_unlock:
+    relay_deref_and_unlock(relay);
+    return rv;
+}
+
+/*
+ * Try to set up splicing.  If anything goes wrong, just fall back to
+ * copying.
+ */
+static void
+relay_setup_splice(struct gensio_relay *relay)
+{
+    struct gensio_raw_fd raw;
+    unsigned int i;
+
+    for (i = 0; i < 2; i++) {
+	if (relay->dir[i].from_fd == -1 || relay->dir[i].to_fd == -1)
+	    return;
+	if (pipe2(relay->dir[i].pipe, O_NONBLOCK | O_CLOEXEC) == -1)
+	    return;
+    }
+
+    relay->spliced = true;
+    for (i = 0; i < 2; i++) {
+	memset(&raw, 0, sizeof(raw));
+	raw.read_ready = relay_raw_read_ready;
+	raw.cb_data = &relay->dir[i];
+	if (gensio_raw_fd(relay->dir[i].from, &raw)) {
+	    relay_clear_raw(relay);
+	    relay->spliced = false;
+	    return;
+	}
+    }
+}
+
+int
+gensio_relay_alloc(struct gensio_os_funcs *o,
+		   struct gensio *io1, struct gensio *io2,
+		   const char * const args[],
+		   gensio_relay_done done, void *done_data,
+		   struct gensio_relay **rrelay)
+{
+    struct gensio_relay *relay;
+    bool allow_splice = true;
+    unsigned int i;
+    int ival, err;
+
+    if (!done || io1 == io2)
+	return GE_INVAL;
+
+    err = gensio_get_default(o, "relay", "splice", false,
+			     GENSIO_DEFAULT_BOOL, NULL, &ival);
+    if (!err)
+	allow_splice = ival;
+
+    for (i = 0; args && args[i]; i++) {
+	if (gensio_check_keybool(args[i], "splice", &allow_splice) > 0)
+	    continue;
+	return GE_INVAL;
+    }
+
+    relay = o->zalloc(o, sizeof(*relay));
+    if (!relay)
+	return GE_NOMEM;
+    relay->o = o;
+    relay->refcount = 1;
+    relay->allow_splice = allow_splice;
+    relay->done = done;
+    relay->done_data = done_data;
+    for (i = 0; i < 2; i++) {
+	relay->dir[i].relay = relay;
+	relay->dir[i].from = i ? io2 : io1;
+	relay->dir[i].to = i ? io1 : io2;
+	relay->dir[i].from_fd = -1;
+	relay->dir[i].to_fd = -1;
+	relay->dir[i].pipe[0] = -1;
+	relay->dir[i].pipe[1] = -1;
+    }
+
+    relay->lock = o->alloc_lock(o);
+    if (!relay->lock)
+	goto out_nomem;
+
+    relay->timer = o->alloc_timer(o, relay_stopped, relay);
+    if (!relay->timer)
+	goto out_nomem;
+
+    *rrelay = relay;
+    return 0;
+
+ out_nomem:
+    relay_finish_free(relay);
+    return GE_NOMEM;
+}
+
+int
+gensio_relay_start(struct gensio_relay *relay)
+{
+    struct gensio_raw_fd raw;
+    unsigned int i;
+    int fd[2];
+
+    relay_lock(relay);
+    if (relay->started) {
+	relay_unlock(relay);
+	return GE_INUSE;
+    }
+    relay->started = true;
+
+    for (i = 0; i < 2; i++) {
+	memset(&raw, 0, sizeof(raw));
+	if (gensio_raw_fd(relay->dir[i].from, &raw) == 0)
+	    fd[i] = raw.fd;
+	else
+	    fd[i] = -1;
+    }
+    relay->dir[0].from_fd = fd[0];
+    relay->dir[0].to_fd = fd[1];
+    relay->dir[1].from_fd = fd[1];
+    relay->dir[1].to_fd = fd[0];
+
+    if (relay->allow_splice)
+	relay_setup_splice(relay);
+
+    for (i = 0; i < 2; i++) {
+	relay->dir[i].old_cb = gensio_get_cb(relay->dir[i].from);
+	relay->dir[i].old_user_data = gensio_get_user_data(relay->dir[i].from);
+	gensio_set_callback(relay->dir[i].from, relay_event, relay);
+    }
+    for (i = 0; i < 2; i++)
+	gensio_set_read_callback_enable(relay->dir[i].from, true);
+    relay_unlock(relay);
+
+    return 0;
+}
+
+void
+gensio_relay_free(struct gensio_relay *relay)
+{
+    struct relay_dir *dir;
+    unsigned int i;
+
+    relay_lock(relay);
+    relay->freed = true;
+    if (relay->started) {
+	relay_stop(relay, 0);
+
+	/* Give back the callbacks, unless the user already took them. */
+	for (i = 0; i < 2; i++) {
+	    dir = &relay->dir[i];
+	    if (gensio_get_cb(dir->from) == relay_event &&
+			gensio_get_user_data(dir->from) == relay)
+		gensio_set_callback(dir->from, dir->old_cb, dir->old_user_data);
+	}
+
+	/*
+	 * A callback may have fetched the relay just before the
+	 * callbacks were changed, let the timer do the final free
+	 * after it has run.
+	 */
+	relay_start_timer(relay);
+    }
+    relay_deref_and_unlock(relay);
+}
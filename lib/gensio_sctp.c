@@ -115,9 +115,6 @@ sctp_socket_setup(struct sctp_data *tdata, int fd)
     struct sctp_event_subscribe event_sub;
     struct addrinfo *ai = tdata->lai;
 
-    if (fcntl(fd, F_SETFL, O_NONBLOCK) == -1)
-	return errno;
-
     if (setsockopt(fd, SOL_SOCKET, SO_KEEPALIVE,
 		   (void *)&optval, sizeof(optval)) == -1)
 	return errno;
@@ -190,7 +187,9 @@ sctp_try_open(struct sctp_data *tdata, int *fd)
     if (err)
 	return err;
 
-    tdata->fd = socket(tdata->family, SOCK_STREAM, IPPROTO_SCTP);
+    tdata->fd = socket(tdata->family,
+		       SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC,
+		       IPPROTO_SCTP);
     if (tdata->fd == -1) {
 	err = errno;
 	goto out;
@@ -390,33 +389,89 @@ sctp_control(void *handler_data, int fd, bool get, unsigned int option,
 }
 
 static int
-sctp_write(void *handler_data, int fd, gensiods *rcount,
-	  const struct gensio_sg *sg, gensiods sglen,
-	  const char *const *auxdata)
+sctp_auxdata_to_sinfo(const char *const *auxdata,
+		      struct sctp_sndrcvinfo *sinfo)
 {
-    struct sctp_data *tdata = handler_data;
-    struct sctp_sndrcvinfo sinfo;
     unsigned int stream = 0, i;
 
-    memset(&sinfo, 0, sizeof(sinfo));
+    memset(sinfo, 0, sizeof(*sinfo));
 
     if (auxdata) {
 	for (i = 0; auxdata[i]; i++) {
 	    if (gensio_check_keyuint(auxdata[i], "stream", &stream) > 0)
 		continue;
 	    if (strcasecmp(auxdata[i], "oob") == 0) {
-		sinfo.sinfo_flags |= SCTP_UNORDERED;
+		sinfo->sinfo_flags |= SCTP_UNORDERED;
 		continue;
 	    }
 	    return GE_INVAL;
 	}
     }
 
-    sinfo.sinfo_stream = stream;
+    sinfo->sinfo_stream = stream;
+    return 0;
+}
+
+static int
+sctp_write(void *handler_data, int fd, gensiods *rcount,
+	  const struct gensio_sg *sg, gensiods sglen,
+	  const char *const *auxdata)
+{
+    struct sctp_data *tdata = handler_data;
+    struct sctp_sndrcvinfo sinfo;
+    int err;
+
+    err = sctp_auxdata_to_sinfo(auxdata, &sinfo);
+    if (err)
+	return err;
+
     return gensio_os_sctp_send(tdata->o,
 			       tdata->fd, sg, sglen, rcount, &sinfo, 0);
 }
 
+/* Number of messages to convert and send at a time. */
+#define SCTP_WRITE_MSGS_BATCH	16
+
+static int
+sctp_write_msgs(void *handler_data, int fd, gensiods *rcount,
+		struct gensio_msg *msgs, gensiods nmsgs)
+{
+    struct sctp_data *tdata = handler_data;
+    struct sctp_sndrcvinfo sinfo[SCTP_WRITE_MSGS_BATCH];
+    gensiods i, n, count, total = 0;
+    int err = 0;
+
+    while (total < nmsgs) {
+	n = nmsgs - total;
+	if (n > SCTP_WRITE_MSGS_BATCH)
+	    n = SCTP_WRITE_MSGS_BATCH;
+
+	for (i = 0; i < n; i++) {
+	    err = sctp_auxdata_to_sinfo(msgs[total + i].auxdata, &sinfo[i]);
+	    if (err)
+		break;
+	}
+	if (i == 0) {
+	    /* The first message has bad auxdata. */
+	    msgs[total].err = err;
+	    break;
+	}
+	/* Send up to a bad message, it will be reported next time around. */
+	n = i;
+
+	count = 0;
+	err = gensio_os_sctp_sendmmsg(tdata->o, fd, msgs + total, n,
+				      &count, sinfo);
+	total += count;
+	if (err || count < n)
+	    break;
+    }
+
+    if (rcount)
+	*rcount = total;
+    return err;
+}
+
 static int
 sctp_do_read(int fd, void *data, gensiods count, gensiods *rcount,
 	     const char **auxdata, void *cb_data)
@@ -464,6 +519,7 @@ static const struct gensio_fd_ll_ops sctp_fd_ll_ops = {
     .free = sctp_free,
     .control = sctp_control,
     .write = sctp_write,
+    .write_msgs = sctp_write_msgs,
     .read_ready = sctp_read_ready
 };
 
@@ -477,6 +533,8 @@ sctp_gensio_alloc(struct addrinfo *iai, const char * const args[],
     struct addrinfo *ai;
     struct gensio *io;
     gensiods max_read_size = GENSIO_DEFAULT_BUF_SIZE;
+    gensiods read_budget = 65536;
+    gensiods readbuf_min = 1024, readbuf_max = 0;
     unsigned int instreams = 1, ostreams = 1;
     int i, family = AF_INET, err, ival;
     struct addrinfo *lai = NULL;
@@ -487,6 +545,21 @@ sctp_gensio_alloc(struct addrinfo *iai, const char * const args[],
     if (!err)
 	nodelay = ival;
 
+    err = gensio_get_default(o, "sctp", "read_budget", false,
+			    GENSIO_DEFAULT_INT, NULL, &ival);
+    if (!err)
+	read_budget = ival;
+
+    err = gensio_get_default(o, "sctp", "readbuf_min", false,
+			     GENSIO_DEFAULT_INT, NULL, &ival);
+    if (!err)
+	readbuf_min = ival;
+
+    err = gensio_get_default(o, "sctp", "readbuf_max", false,
+			     GENSIO_DEFAULT_INT, NULL, &ival);
+    if (!err)
+	readbuf_max = ival;
+
     err = gensio_get_default(o, "sctp", "instreams", false,
 			     GENSIO_DEFAULT_INT, NULL, &ival);
     if (!err)
@@ -516,6 +589,12 @@ sctp_gensio_alloc(struct addrinfo *iai, const char * const args[],
 	    continue;
 	if (gensio_check_keyuint(args[i], "ostreams", &ostreams) > 0)
 	    continue;
+	if (gensio_check_keyds(args[i], "read_budget", &read_budget) > 0)
+	    continue;
+	if (gensio_check_keyds(args[i], "readbuf_min", &readbuf_min) > 0)
+	    continue;
+	if (gensio_check_keyds(args[i], "readbuf_max", &readbuf_max) > 0)
+	    continue;
 	err = GE_INVAL;
 	goto out_err;
     }
@@ -552,6 +631,8 @@ sctp_gensio_alloc(struct addrinfo *iai, const char * const args[],
 				   max_read_size, false);
     if (!tdata->ll)
 	goto out_nomem;
+    gensio_fd_ll_set_read_budget(tdata->ll, read_budget);
+    gensio_fd_ll_set_read_size_range(tdata->ll, readbuf_min, readbuf_max);
 
     io = base_gensio_alloc(o, tdata->ll, NULL, NULL, "sctp", cb, user_data);
     if (!io)
@@ -624,14 +705,32 @@ struct sctpna_data {
     struct gensio_os_funcs *o;
 
     gensiods max_read_size;
+    gensiods read_budget;
+    gensiods readbuf_min;
+    gensiods readbuf_max;
     bool nodelay;
 
+    /* Maximum number of connections to accept per read event. */
+    unsigned int accept_budget;
+
+    /*
+     * Statistics.  overflows counts the number of times the accept
+     * budget ran out with connections still pending.
+     */
+    unsigned long accepts;
+    unsigned long overflows;
+
     struct gensio_lock *lock;
 
     bool setup;			/* Network sockets are allocated. */
     bool enabled;		/* Accepts are being handled. */
     bool in_shutdown;		/* Currently being shut down. */
-    bool in_accept_cb;		/* Currently in a callback. */
+    /*
+     * Accepted gensios that are still opening or in the new
+     * connection callback.  Accept disable waiters are run when this
+     * goes to zero, so no new connection is reported after that.
+     */
+    unsigned int pending_accepts;
     struct sctpna_waiters *acc_disable_waiters;
 
     unsigned int refcount;
@@ -710,6 +809,7 @@ static const struct gensio_fd_ll_ops sctp_server_fd_ll_ops = {
     .free = sctp_free,
     .control = sctp_control,
     .write = sctp_write,
+    .write_msgs = sctp_write_msgs,
     .read_ready = sctp_read_ready
 };
 
@@ -733,9 +833,13 @@ sctpna_server_open_done(struct gensio *io, int err, void *open_data)
     }
 
     sctpna_lock(nadata);
-    nadata->in_accept_cb = false;
-    waiters = nadata->acc_disable_waiters;
-    nadata->acc_disable_waiters = NULL;
+    assert(nadata->pending_accepts > 0);
+    nadata->pending_accepts--;
+    waiters = NULL;
+    if (nadata->pending_accepts == 0) {
+	waiters = nadata->acc_disable_waiters;
+	nadata->acc_disable_waiters = NULL;
+    }
     sctpna_unlock(nadata);
     while (waiters) {
 	next = waiters->next;
@@ -747,36 +851,21 @@ sctpna_server_open_done(struct gensio *io, int err, void *open_data)
     sctpna_deref_and_unlock(nadata);
 }
 
+/* Called with the lock held. */
 static void
-sctpna_readhandler(int fd, void *cbdata)
+sctpna_new_connection(struct sctpna_data *nadata, int new_fd)
 {
-    struct sctpna_data *nadata = cbdata;
-    int new_fd;
-    struct sockaddr_storage addr;
-    socklen_t addrlen = sizeof(addr);
     struct sctp_data *tdata = NULL;
     struct gensio *io;
     const char *errstr;
     int err;
 
-    sctpna_lock(nadata);
-    if (!nadata->enabled)
-	goto out_unlock; /* We can race, just ignore this if so. */
-    err = gensio_os_accept(nadata->o,
-			   fd, (struct sockaddr *) &addr, &addrlen, &new_fd);
-    if (err) {
-	if (err != GE_NODATA)
-	    gensio_acc_log(nadata->acc, GENSIO_LOG_ERR,
-			   "Could not accept: %s", gensio_err_to_str(err));
-	goto out_unlock;
-    }
-
     tdata = nadata->o->zalloc(nadata->o, sizeof(*tdata));
     if (!tdata) {
 	errstr = "Out of memory\r\n";
 	write_nofail(new_fd, errstr, strlen(errstr));
 	close(new_fd);
-	goto out_unlock;
+	return;
     }
 
     tdata->o = nadata->o;
@@ -792,7 +881,7 @@ sctpna_readhandler(int fd, void *cbdata)
 		       "Error setting up sctp port: %s", strerror(err));
 	close(new_fd);
 	sctp_free(tdata);
-	goto out_unlock;
+	return;
     }
 
     tdata->ll = fd_gensio_ll_alloc(nadata->o, new_fd, &sctp_server_fd_ll_ops,
@@ -802,13 +891,15 @@ sctpna_readhandler(int fd, void *cbdata)
 		       "Out of memory allocating sctp ll");
 	close(new_fd);
 	sctp_free(tdata);
-	goto out_unlock;
+	return;
     }
+    gensio_fd_ll_set_read_budget(tdata->ll, nadata->read_budget);
+    gensio_fd_ll_set_read_size_range(tdata->ll, nadata->readbuf_min,
+				     nadata->readbuf_max);
 
     io = base_gensio_server_alloc(nadata->o, tdata->ll, NULL, NULL, "sctp",
 				  sctpna_server_open_done, nadata);
     if (!io) {
-	sctpna_unlock(nadata);
 	gensio_acc_log(nadata->acc, GENSIO_LOG_ERR,
 		       "Out of memory allocating sctp base");
 	gensio_ll_free(tdata->ll);
@@ -819,7 +910,40 @@ sctpna_readhandler(int fd, void *cbdata)
     sctpna_ref(nadata);
     gensio_set_is_reliable(io, true);
     gensio_acc_add_pending_gensio(nadata->acc, io);
-    nadata->in_accept_cb = true;
+    nadata->pending_accepts++;
+}
+
+static void
+sctpna_readhandler(int fd, void *cbdata)
+{
+    struct sctpna_data *nadata = cbdata;
+    int new_fd;
+    struct sockaddr_storage addr;
+    socklen_t addrlen;
+    unsigned int count;
+    int err;
+
+    sctpna_lock(nadata);
+    /* See tcpna_readhandler() for an explanation of the budget. */
+    for (count = 0; count < nadata->accept_budget; count++) {
+	if (!nadata->enabled)
+	    break; /* We can race, just ignore this if so. */
+
+	addrlen = sizeof(addr);
+	err = gensio_os_accept(nadata->o, fd, (struct sockaddr *) &addr,
+			       &addrlen, &new_fd);
+	if (err) {
+	    if (err != GE_NODATA)
+		gensio_acc_log(nadata->acc, GENSIO_LOG_ERR,
+			       "Could not accept: %s", gensio_err_to_str(err));
+	    goto out_unlock;
+	}
+
+	nadata->accepts++;
+	sctpna_new_connection(nadata, new_fd);
+    }
+    if (count == nadata->accept_budget)
+	nadata->overflows++;
  out_unlock:
     sctpna_unlock(nadata);
 }
@@ -942,7 +1066,7 @@ sctpna_startup(struct gensio_accepter *accepter)
 					ai->ai_addr, ai->ai_addrlen,
 					sctpna_readhandler, NULL, nadata,
 					sctpna_fd_cleared,
-					sctpna_setup_socket,
+					sctpna_setup_socket, 0,
 					&fds[i].fd);
 	if (rv)
 	    goto out_err;
@@ -1048,7 +1172,7 @@ sctpna_set_accept_callback_enable(struct gensio_accepter *accepter,
 	    w->o = o;
 	    w->done = done;
 	    w->done_data = done_data;
-	    if (nadata->in_accept_cb) {
+	    if (nadata->pending_accepts) {
 		w->next = nadata->acc_disable_waiters;
 		nadata->acc_disable_waiters = w;
 	    } else {
@@ -1176,6 +1300,30 @@ sctpna_str_to_gensio(struct gensio_accepter *accepter, const char *addr,
     return err;
 }
 
+static int
+sctpna_control(struct gensio_accepter *accepter, bool get, unsigned int option,
+	       char *data, gensiods *datalen)
+{
+    struct sctpna_data *nadata = gensio_acc_get_gensio_data(accepter);
+
+    switch (option) {
+    case GENSIO_CONTROL_ACCEPT_STATS:
+	sctpna_lock(nadata);
+	if (get) {
+	    *datalen = snprintf(data, *datalen, "accepts=%lu overflows=%lu",
+				nadata->accepts, nadata->overflows);
+	} else {
+	    nadata->accepts = 0;
+	    nadata->overflows = 0;
+	}
+	sctpna_unlock(nadata);
+	return 0;
+
+    default:
+	return GE_NOTSUP;
+    }
+}
+
 static int
 gensio_acc_sctp_func(struct gensio_accepter *acc, int func, int val,
 		     const char *addr, void *done, void *data,
@@ -1198,6 +1346,9 @@ gensio_acc_sctp_func(struct gensio_accepter *acc, int func, int val,
     case GENSIO_ACC_FUNC_STR_TO_GENSIO:
 	return sctpna_str_to_gensio(acc, addr, done, data, ret);
 
+    case GENSIO_ACC_FUNC_CONTROL:
+	return sctpna_control(acc, val, *((unsigned int *) addr), data, ret);
+
     case GENSIO_ACC_FUNC_DISABLE:
 	sctpna_disable(acc);
 	return 0;
@@ -1215,9 +1366,33 @@ sctp_gensio_accepter_alloc(struct addrinfo *iai, const char * const args[],
 {
     struct sctpna_data *nadata;
     gensiods max_read_size = GENSIO_DEFAULT_BUF_SIZE;
+    gensiods read_budget = 65536;
+    gensiods readbuf_min = 1024, readbuf_max = 0;
     unsigned int instreams = 1, ostreams = 1;
+    unsigned int accept_budget = 32;
     bool nodelay = false;
     unsigned int i;
+    int ival, err;
+
+    err = gensio_get_default(o, "sctp", "read_budget", false,
+			     GENSIO_DEFAULT_INT, NULL, &ival);
+    if (!err)
+	read_budget = ival;
+
+    err = gensio_get_default(o, "sctp", "readbuf_min", false,
+			     GENSIO_DEFAULT_INT, NULL, &ival);
+    if (!err)
+	readbuf_min = ival;
+
+    err = gensio_get_default(o, "sctp", "readbuf_max", false,
+			     GENSIO_DEFAULT_INT, NULL, &ival);
+    if (!err)
+	readbuf_max = ival;
+
+    err = gensio_get_default(o, "sctp", "accept_budget", false,
+			     GENSIO_DEFAULT_INT, NULL, &ival);
+    if (!err)
+	accept_budget = ival;
 
     for (i = 0; args && args[i]; i++) {
 	if (gensio_check_keyds(args[i], "readbuf", &max_read_size) > 0)
@@ -1228,9 +1403,20 @@ sctp_gensio_accepter_alloc(struct addrinfo *iai, const char * const args[],
 	    continue;
 	if (gensio_check_keyuint(args[i], "ostreams", &ostreams) > 0)
 	    continue;
+	if (gensio_check_keyuint(args[i], "accept_budget", &accept_budget) > 0)
+	    continue;
+	if (gensio_check_keyds(args[i], "read_budget", &read_budget) > 0)
+	    continue;
+	if (gensio_check_keyds(args[i], "readbuf_min", &readbuf_min) > 0)
+	    continue;
+	if (gensio_check_keyds(args[i], "readbuf_max", &readbuf_max) > 0)
+	    continue;
 	return GE_INVAL;
     }
 
+    if (accept_budget < 1)
+	return GE_INVAL;
+
     nadata = o->zalloc(o, sizeof(*nadata));
     if (!nadata)
 	return GE_NOMEM;
@@ -1256,7 +1442,11 @@ sctp_gensio_accepter_alloc(struct addrinfo *iai, const char * const args[],
     /* gensio_acc_set_is_packet(nadata->acc, true); */
 
     nadata->max_read_size = max_read_size;
+    nadata->read_budget = read_budget;
+    nadata->readbuf_min = readbuf_min;
+    nadata->readbuf_max = readbuf_max;
     nadata->nodelay = nodelay;
+    nadata->accept_budget = accept_budget;
 
     *accepter = nadata->acc;
     return 0;
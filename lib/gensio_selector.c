@@ -29,7 +29,14 @@
 #define pthread_mutex_lock(l) do { } while (0)
 #define pthread_mutex_unlock(l) do { } while (0)
 #define pthread_mutex_init(l, n) do { } while (0)
-#define pthread_mutex_destroy(l, n) do { } while (0)
+#define pthread_mutex_destroy(l) do { } while (0)
+#endif
+
+#ifdef HAVE_UCONTEXT_H
+#include <stdint.h>
+#include <ucontext.h>
+#include <sys/mman.h>
+#include <unistd.h>
 #endif
 
 #include <gensio/gensio_selector.h>
@@ -40,6 +47,9 @@
 struct gensio_data {
     struct selector_s *sel;
     int wake_sig;
+
+    /* Protects fiber scheduling and fibers waiting on waiters. */
+    pthread_mutex_t fiber_lock;
 };
 
 static void *
@@ -345,9 +355,15 @@ gensio_sel_run(struct gensio_runner *runner)
     return sel_run(runner->sel_runner, gensio_runner_handler, runner);
 }
 
+struct gensio_fiber;
+
 struct gensio_waiter {
     struct gensio_os_funcs *f;
     struct waiter_s *sel_waiter;
+
+    /* A fiber suspended waiting for fiber_count wakeups. */
+    struct gensio_fiber *fiber;
+    unsigned int fiber_count;
 };
 
 static struct gensio_waiter *
@@ -377,12 +393,333 @@ gensio_sel_free_waiter(struct gensio_waiter *waiter)
     waiter->f->free(waiter->f, waiter);
 }
 
+#ifdef HAVE_UCONTEXT_H
+
+#define GENSIO_FIBER_STACK_SIZE 262144
+
+enum gensio_fiber_state {
+    /* Not running and nothing has asked for it to run. */
+    GENSIO_FIBER_SUSPENDED,
+
+    /* The runner to resume it has been queued. */
+    GENSIO_FIBER_SCHEDULED,
+
+    /* Running, or on its way out of a thread after suspending. */
+    GENSIO_FIBER_RUNNING
+};
+
+struct gensio_fiber {
+    struct gensio_os_funcs *f;
+
+    ucontext_t ctx;
+
+    /* The context of the runner that resumed the fiber. */
+    ucontext_t caller;
+
+    void *stack;
+    size_t stack_size;
+
+    void (*func)(void *cb_data);
+    void *cb_data;
+
+    enum gensio_fiber_state state;
+
+    /*
+     * The fiber was woken while it was still running, it gets
+     * resumed as soon as it is out of the thread.
+     */
+    bool resume_pending;
+
+    bool done;
+
+    sel_runner_t *runner;
+
+    /* What the fiber is waiting for, and the result of the wait. */
+    struct gensio_waiter *waiter;
+    sel_timer_t *timer;
+    bool timer_running;
+    int err;
+};
+
+/* The fiber running in this thread, if any. */
+#ifdef USE_PTHREADS
+static __thread struct gensio_fiber *gensio_cur_fiber;
+#else
+static struct gensio_fiber *gensio_cur_fiber;
+#endif
+
+static void
+gensio_fiber_free(struct gensio_fiber *fiber)
+{
+    if (fiber->timer)
+	sel_free_timer(fiber->timer);
+    if (fiber->runner)
+	sel_free_runner(fiber->runner);
+    if (fiber->stack)
+	munmap(fiber->stack, fiber->stack_size);
+    fiber->f->free(fiber->f, fiber);
+}
+
+static void gensio_fiber_run(sel_runner_t *runner, void *cb_data);
+
+/* Get the fiber running again, must be called with fiber_lock held. */
+static void
+gensio_fiber_schedule(struct gensio_fiber *fiber)
+{
+    if (fiber->state == GENSIO_FIBER_SUSPENDED) {
+	fiber->state = GENSIO_FIBER_SCHEDULED;
+	sel_run(fiber->runner, gensio_fiber_run, fiber);
+    } else {
+	fiber->resume_pending = true;
+    }
+}
+
+static void
+gensio_fiber_run(sel_runner_t *runner, void *cb_data)
+{
+    struct gensio_fiber *fiber = cb_data;
+    struct gensio_data *d = fiber->f->user_data;
+    struct gensio_fiber *old_fiber = gensio_cur_fiber;
+
+    pthread_mutex_lock(&d->fiber_lock);
+    fiber->state = GENSIO_FIBER_RUNNING;
+    pthread_mutex_unlock(&d->fiber_lock);
+
+    gensio_cur_fiber = fiber;
+    swapcontext(&fiber->caller, &fiber->ctx);
+    gensio_cur_fiber = old_fiber;
+
+    /* The fiber is completely off its stack now. */
+    pthread_mutex_lock(&d->fiber_lock);
+    if (fiber->done) {
+	pthread_mutex_unlock(&d->fiber_lock);
+	gensio_fiber_free(fiber);
+	return;
+    }
+    fiber->state = GENSIO_FIBER_SUSPENDED;
+    if (fiber->resume_pending) {
+	fiber->resume_pending = false;
+	gensio_fiber_schedule(fiber);
+    }
+    pthread_mutex_unlock(&d->fiber_lock);
+}
+
+static void
+gensio_fiber_start(unsigned int hi, unsigned int lo)
+{
+    struct gensio_fiber *fiber;
+
+    /* makecontext() only passes ints, the pointer comes in halves. */
+    fiber = (struct gensio_fiber *) (((uintptr_t) hi << 16 << 16) | lo);
+    fiber->func(fiber->cb_data);
+    fiber->done = true;
+    setcontext(&fiber->caller);
+}
+
+static void
+gensio_fiber_timeout(struct selector_s *sel, sel_timer_t *timer, void *data)
+{
+    struct gensio_fiber *fiber = data;
+    struct gensio_data *d = fiber->f->user_data;
+
+    pthread_mutex_lock(&d->fiber_lock);
+    fiber->timer_running = false;
+    if (fiber->waiter) {
+	fiber->waiter->fiber = NULL;
+	fiber->waiter = NULL;
+	fiber->err = GE_TIMEDOUT;
+    }
+    /* If a wake beat the timeout, it left the resume to us. */
+    gensio_fiber_schedule(fiber);
+    pthread_mutex_unlock(&d->fiber_lock);
+}
+
+static int
+gensio_sel_start_fiber(struct gensio_os_funcs *f, unsigned int stack_size,
+		       void (*func)(void *cb_data), void *cb_data)
+{
+    struct gensio_data *d = f->user_data;
+    struct gensio_fiber *fiber;
+    long pagesize = sysconf(_SC_PAGESIZE);
+    uintptr_t p;
+    int rv;
+
+    if (!func)
+	return GE_INVAL;
+    if (stack_size == 0)
+	stack_size = GENSIO_FIBER_STACK_SIZE;
+
+    fiber = f->zalloc(f, sizeof(*fiber));
+    if (!fiber)
+	return GE_NOMEM;
+    fiber->f = f;
+    fiber->func = func;
+    fiber->cb_data = cb_data;
+    fiber->state = GENSIO_FIBER_SUSPENDED;
+
+    /* Memory only gets used as the stack grows, with a guard page. */
+    fiber->stack_size = ((stack_size + pagesize - 1) / pagesize + 1) * pagesize;
+    fiber->stack = mmap(NULL, fiber->stack_size, PROT_READ | PROT_WRITE,
+			MAP_PRIVATE | MAP_ANONYMOUS | MAP_STACK, -1, 0);
+    if (fiber->stack == MAP_FAILED) {
+	fiber->stack = NULL;
+	rv = GE_NOMEM;
+	goto out_err;
+    }
+    if (mprotect(fiber->stack, pagesize, PROT_NONE) == -1) {
+	rv = gensio_os_err_to_err(f, errno);
+	goto out_err;
+    }
+
+    rv = sel_alloc_runner(d->sel, &fiber->runner);
+    if (!rv)
+	rv = sel_alloc_timer(d->sel, gensio_fiber_timeout, fiber,
+			     &fiber->timer);
+    if (rv) {
+	rv = gensio_os_err_to_err(f, rv);
+	goto out_err;
+    }
+
+    if (getcontext(&fiber->ctx) == -1) {
+	rv = gensio_os_err_to_err(f, errno);
+	goto out_err;
+    }
+    fiber->ctx.uc_stack.ss_sp = ((char *) fiber->stack) + pagesize;
+    fiber->ctx.uc_stack.ss_size = fiber->stack_size - pagesize;
+    fiber->ctx.uc_link = NULL;
+    p = (uintptr_t) fiber;
+    makecontext(&fiber->ctx, (void (*)(void)) gensio_fiber_start, 2,
+		(unsigned int) (p >> 16 >> 16), (unsigned int) p);
+
+    pthread_mutex_lock(&d->fiber_lock);
+    gensio_fiber_schedule(fiber);
+    pthread_mutex_unlock(&d->fiber_lock);
+
+    return 0;
+
+ out_err:
+    gensio_fiber_free(fiber);
+    return rv;
+}
+
+/*
+ * Suspend the fiber until the waiter has count wakeups or the
+ * timeout expires, letting the thread go back to handling events.
+ */
+static int
+gensio_fiber_wait(struct gensio_fiber *fiber, struct gensio_waiter *waiter,
+		  unsigned int count, struct timeval *timeout)
+{
+    struct gensio_data *d = waiter->f->user_data;
+    struct timeval end, now;
+
+    pthread_mutex_lock(&d->fiber_lock);
+    /*
+     * Park on the waiter before checking it.  gensio_sel_wake() only
+     * takes fiber_lock if it sees a fiber parked, and the waiter's
+     * own lock orders the two, so either the wake sees the fiber or
+     * the check here sees the wake.
+     */
+    waiter->fiber = fiber;
+    waiter->fiber_count = count;
+    if (try_wait_for_waiter(waiter->sel_waiter, count)) {
+	waiter->fiber = NULL;
+	pthread_mutex_unlock(&d->fiber_lock);
+	return 0;
+    }
+    if (timeout && timeout->tv_sec == 0 && timeout->tv_usec == 0) {
+	waiter->fiber = NULL;
+	pthread_mutex_unlock(&d->fiber_lock);
+	return GE_TIMEDOUT;
+    }
+
+    fiber->waiter = waiter;
+    fiber->err = 0;
+    if (timeout) {
+	sel_get_monotonic_time(&end);
+	add_to_timeval(&end, timeout);
+	if (sel_start_timer(fiber->timer, &end) == 0)
+	    fiber->timer_running = true;
+    }
+    pthread_mutex_unlock(&d->fiber_lock);
+
+    swapcontext(&fiber->ctx, &fiber->caller);
+
+    if (timeout) {
+	sel_get_monotonic_time(&now);
+	if (cmp_timeval(&end, &now) <= 0) {
+	    timeout->tv_sec = 0;
+	    timeout->tv_usec = 0;
+	} else {
+	    timeout->tv_sec = end.tv_sec - now.tv_sec;
+	    timeout->tv_usec = end.tv_usec - now.tv_usec;
+	    if (timeout->tv_usec < 0) {
+		timeout->tv_usec += 1000000;
+		timeout->tv_sec--;
+	    }
+	}
+    }
+
+    return fiber->err;
+}
+
+/* Resume a fiber waiting on the waiter if it has enough wakeups now. */
+static void
+gensio_fiber_wake(struct gensio_waiter *waiter)
+{
+    struct gensio_fiber *fiber = waiter->fiber;
+
+    if (!fiber || !try_wait_for_waiter(waiter->sel_waiter,
+				       waiter->fiber_count))
+	return;
+
+    waiter->fiber = NULL;
+    fiber->waiter = NULL;
+    if (fiber->timer_running) {
+	if (sel_stop_timer(fiber->timer))
+	    /* The timeout handler is running, it will do the resume. */
+	    return;
+	fiber->timer_running = false;
+    }
+    gensio_fiber_schedule(fiber);
+}
+
+#else /* HAVE_UCONTEXT_H */
+
+struct gensio_fiber;
+
+#define gensio_cur_fiber ((struct gensio_fiber *) NULL)
+
+static int
+gensio_sel_start_fiber(struct gensio_os_funcs *f, unsigned int stack_size,
+		       void (*func)(void *cb_data), void *cb_data)
+{
+    return GE_NOTSUP;
+}
+
+static int
+gensio_fiber_wait(struct gensio_fiber *fiber, struct gensio_waiter *waiter,
+		  unsigned int count, struct timeval *timeout)
+{
+    return GE_NOTSUP;
+}
+
+static void
+gensio_fiber_wake(struct gensio_waiter *waiter)
+{
+}
+
+#endif /* HAVE_UCONTEXT_H */
+
 static int
 gensio_sel_wait(struct gensio_waiter *waiter, unsigned int count,
 		struct timeval *timeout)
 {
     int err;
 
+    if (gensio_cur_fiber)
+	return gensio_fiber_wait(gensio_cur_fiber, waiter, count, timeout);
+
     err = wait_for_waiter_timeout(waiter->sel_waiter, count, timeout);
     return gensio_os_err_to_err(waiter->f, err);
 }
@@ -394,6 +731,9 @@ gensio_sel_wait_intr(struct gensio_waiter *waiter, unsigned int count,
 {
     int err;
 
+    if (gensio_cur_fiber)
+	return gensio_fiber_wait(gensio_cur_fiber, waiter, count, timeout);
+
     err = wait_for_waiter_timeout_intr(waiter->sel_waiter, count, timeout);
     return gensio_os_err_to_err(waiter->f, err);
 }
@@ -401,7 +741,15 @@ gensio_sel_wait_intr(struct gensio_waiter *waiter, unsigned int count,
 static void
 gensio_sel_wake(struct gensio_waiter *waiter)
 {
+    struct gensio_data *d = waiter->f->user_data;
+
     wake_waiter(waiter->sel_waiter);
+    /* Only waits from fibers need fiber_lock, see gensio_fiber_wait(). */
+    if (waiter->fiber) {
+	pthread_mutex_lock(&d->fiber_lock);
+	gensio_fiber_wake(waiter);
+	pthread_mutex_unlock(&d->fiber_lock);
+    }
 }
 
 #ifdef USE_PTHREADS
@@ -462,7 +810,10 @@ gensio_sel_service(struct gensio_os_funcs *f, struct timeval *timeout)
 static void
 gensio_sel_free_funcs(struct gensio_os_funcs *f)
 {
-    free(f->user_data);
+    struct gensio_data *d = f->user_data;
+
+    pthread_mutex_destroy(&d->fiber_lock);
+    free(d);
     free(f);
 }
 
@@ -519,6 +870,7 @@ gensio_selector_alloc(struct selector_s *sel, int wake_sig)
     o->user_data = d;
     d->sel = sel;
     d->wake_sig = wake_sig;
+    pthread_mutex_init(&d->fiber_lock, NULL);
 
     o->zalloc = gensio_sel_zalloc;
     o->free = gensio_sel_free;
@@ -551,6 +903,7 @@ gensio_selector_alloc(struct selector_s *sel, int wake_sig)
     o->call_once = gensio_sel_call_once;
     o->get_monotonic_time = gensio_sel_get_monotonic_time;
     o->handle_fork = gensio_handle_fork;
+    o->start_fiber = gensio_sel_start_fiber;
 
     return o;
 }
@@ -0,0 +1,335 @@
+/*
+ *  gensio - A library for abstracting stream I/O
+ *  Copyright (C) 2019  Corey Minyard <minyard@acm.org>
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public
+ *  License as published by the Free Software Foundation; either
+ *  version 2 of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307  USA
+ */
+
+/*
+ * Send part of a file out a gensio in the background.
+ *
+ * If the gensio hands out its fd (see GENSIO_FUNC_RAW_FD) the data is
+ * sent with sendfile(), so it goes straight from the page cache to
+ * the socket.  Otherwise the file is read into a buffer and written
+ * with gensio_write(), and the kernel is told to start reading the
+ * next buffer's worth while the current one is going out.
+ *
+ * The transfer runs from the gensio's write ready events, which it
+ * takes over until it is done.
+ */
+
+#include "config.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/sendfile.h>
+#include <gensio/gensio.h>
+#include <gensio/gensio_class.h>
+
+#include "gensio_sendfile.h"
+
+struct gensio_sendfile_op {
+    struct gensio_os_funcs *o;
+    struct gensio_lock *lock;
+    struct gensio *io;
+
+    int fd;
+    off_t offset;
+    gensiods left; /* (gensiods) -1 means to end of file. */
+    gensiods count;
+
+    /* The socket to use with sendfile(), -1 if not using sendfile. */
+    int sockfd;
+
+    /* For copying through user space. */
+    unsigned char *buf;
+    gensiods bufsize;
+    gensiods buf_pos;
+    gensiods buf_len;
+
+    bool finished;
+    int err;
+
+    gensio_sendfile_done done;
+    void *done_data;
+
+    /* Used to report an abort from the selector. */
+    struct gensio_timer *timer;
+};
+
+static void
+sendfile_op_free(struct gensio_sendfile_op *op)
+{
+    struct gensio_os_funcs *o = op->o;
+
+    if (op->timer)
+	o->free_timer(op->timer);
+    if (op->buf)
+	o->free(o, op->buf);
+    if (op->lock)
+	o->free_lock(op->lock);
+    o->free(o, op);
+}
+
+static void
+sendfile_finish(struct gensio_sendfile_op *op)
+{
+    op->done(op->io, op->err, op->count, op->done_data);
+    sendfile_op_free(op);
+}
+
+static gensiods
+sendfile_chunk(struct gensio_sendfile_op *op, gensiods max)
+{
+    if (op->left < max)
+	return op->left;
+    return max;
+}
+
+/*
+ * Send with sendfile() until the socket is full.  Returns true if the
+ * transfer is finished.
+ */
+static bool
+sendfile_send(struct gensio_sendfile_op *op)
+{
+    ssize_t rv;
+
+    while (op->left) {
+	rv = sendfile(op->sockfd, op->fd, &op->offset,
+		      sendfile_chunk(op, op->bufsize * 16));
+	if (rv < 0) {
+	    if (errno == EINTR)
+		continue;
+	    if (errno == EAGAIN || errno == EWOULDBLOCK)
+		return false;
+	    if (op->count == 0 && (errno == EINVAL || errno == ENOSYS)) {
+		/* The file doesn't support sendfile(), copy it. */
+		op->sockfd = -1;
+		return false;
+	    }
+	    op->err = gensio_os_err_to_err(op->o, errno);
+	    return true;
+	}
+	if (rv == 0) /* End of file. */
+	    return true;
+	op->count += rv;
+	if (op->left != (gensiods) -1)
+	    op->left -= rv;
+    }
+
+    return true;
+}
+
+/*
+ * Copy through the buffer until the gensio won't take any more.
+ * Returns true if the transfer is finished.
+ */
+static bool
+sendfile_copy(struct gensio_sendfile_op *op)
+{
+    gensiods count;
+    ssize_t rv;
+    int err;
+
+    while (true) {
+	if (op->buf_pos == op->buf_len) {
+	    if (op->left == 0)
+		return true;
+	    rv = pread(op->fd, op->buf, sendfile_chunk(op, op->bufsize),
+		       op->offset);
+	    if (rv < 0) {
+		if (errno == EINTR)
+		    continue;
+		op->err = gensio_os_err_to_err(op->o, errno);
+		return true;
+	    }
+	    if (rv == 0) /* End of file. */
+		return true;
+	    op->buf_pos = 0;
+	    op->buf_len = rv;
+	    op->offset += rv;
+	    posix_fadvise(op->fd, op->offset, sendfile_chunk(op, op->bufsize),
+			  POSIX_FADV_WILLNEED);
+	    if (op->left != (gensiods) -1)
+		op->left -= rv;
+	}
+
+	err = gensio_write(op->io, &count, op->buf + op->buf_pos,
+			   op->buf_len - op->buf_pos, NULL);
+	if (err) {
+	    op->err = err;
+	    return true;
+	}
+	op->buf_pos += count;
+	op->count += count;
+	if (op->buf_pos < op->buf_len)
+	    return false;
+    }
+}
+
+int
+gensio_sendfile_write_ready(void *sendfile_data)
+{
+    struct gensio_sendfile_op *op = sendfile_data;
+    bool finished = false;
+
+    op->o->lock(op->lock);
+    if (op->finished)
+	goto out_unlock;
+
+    if (op->sockfd != -1) {
+	finished = sendfile_send(op);
+	if (!finished && op->sockfd == -1) {
+	    op->buf = op->o->zalloc(op->o, op->bufsize);
+	    if (!op->buf) {
+		op->err = GE_NOMEM;
+		finished = true;
+	    }
+	}
+    }
+    if (!finished && op->sockfd == -1)
+	finished = sendfile_copy(op);
+
+    if (finished) {
+	op->finished = true;
+	/* If a close took the transfer away, the abort finishes it. */
+	if (gensio_set_sendfile_data(op->io, NULL))
+	    finished = false;
+	else
+	    gensio_set_write_callback_enable(op->io, false);
+    }
+ out_unlock:
+    op->o->unlock(op->lock);
+
+    if (finished)
+	sendfile_finish(op);
+
+    return 0;
+}
+
+static void
+sendfile_aborted(struct gensio_timer *t, void *cb_data)
+{
+    sendfile_finish(cb_data);
+}
+
+void
+gensio_sendfile_abort(void *sendfile_data)
+{
+    struct gensio_sendfile_op *op = sendfile_data;
+    struct timeval zerotime = { 0, 0 };
+
+    op->o->lock(op->lock);
+    if (!op->finished) {
+	op->finished = true;
+	op->err = GE_NOTREADY;
+    }
+    op->o->unlock(op->lock);
+    op->o->start_timer(op->timer, &zerotime);
+}
+
+int
+gensio_sendfile(struct gensio *io, int fd, off_t offset, gensiods len,
+		const char * const args[],
+		gensio_sendfile_done done, void *done_data)
+{
+    struct gensio_os_funcs *o = gensio_get_os_funcs(io);
+    struct gensio_sendfile_op *op;
+    struct gensio_raw_fd raw;
+    gensiods bufsize = 262144;
+    bool use_sendfile = true;
+    struct stat st;
+    unsigned int i;
+    int ival, err;
+
+    if (!done || fd < 0)
+	return GE_INVAL;
+
+    /*
+     * The transfer runs from the gensio's write ready events, a pipe
+     * or socket with nothing to read would have it spin.
+     */
+    if (fstat(fd, &st) == -1)
+	return gensio_os_err_to_err(o, errno);
+    if (!S_ISREG(st.st_mode))
+	return GE_INVAL;
+
+    err = gensio_get_default(o, "sendfile", "bufsize", false,
+			     GENSIO_DEFAULT_INT, NULL, &ival);
+    if (!err)
+	bufsize = ival;
+    err = gensio_get_default(o, "sendfile", "use_sendfile", false,
+			     GENSIO_DEFAULT_BOOL, NULL, &ival);
+    if (!err)
+	use_sendfile = ival;
+
+    for (i = 0; args && args[i]; i++) {
+	if (gensio_check_keyds(args[i], "bufsize", &bufsize) > 0)
+	    continue;
+	if (gensio_check_keybool(args[i], "use_sendfile", &use_sendfile) > 0)
+	    continue;
+	return GE_INVAL;
+    }
+    if (bufsize == 0)
+	return GE_INVAL;
+
+    op = o->zalloc(o, sizeof(*op));
+    if (!op)
+	return GE_NOMEM;
+    op->o = o;
+    op->io = io;
+    op->fd = fd;
+    op->offset = offset;
+    op->left = len ? len : (gensiods) -1;
+    op->bufsize = bufsize;
+    op->done = done;
+    op->done_data = done_data;
+    op->sockfd = -1;
+
+    posix_fadvise(fd, offset, len, POSIX_FADV_SEQUENTIAL);
+
+    op->lock = o->alloc_lock(o);
+    if (!op->lock)
+	goto out_nomem;
+
+    op->timer = o->alloc_timer(o, sendfile_aborted, op);
+    if (!op->timer)
+	goto out_nomem;
+
+    memset(&raw, 0, sizeof(raw));
+    if (use_sendfile && gensio_raw_fd(io, &raw) == 0) {
+	op->sockfd = raw.fd;
+    } else {
+	op->buf = o->zalloc(o, bufsize);
+	if (!op->buf)
+	    goto out_nomem;
+    }
+
+    err = gensio_set_sendfile_data(io, op);
+    if (err) {
+	sendfile_op_free(op);
+	return err;
+    }
+    gensio_set_write_callback_enable(io, true);
+
+    return 0;
+
+ out_nomem:
+    sendfile_op_free(op);
+    return GE_NOMEM;
+}
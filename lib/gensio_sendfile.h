@@ -0,0 +1,43 @@
+/*
+ *  gensio - A library for abstracting stream I/O
+ *  Copyright (C) 2019  Corey Minyard <minyard@acm.org>
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public
+ *  License as published by the Free Software Foundation; either
+ *  version 2 of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307  USA
+ */
+
+/* Internal interfaces between the gensio core and gensio_sendfile(). */
+
+#ifndef GENSIO_SENDFILE_H
+#define GENSIO_SENDFILE_H
+
+#include <gensio/gensio.h>
+
+/*
+ * While a file is being sent, write ready events on the gensio go to
+ * gensio_sendfile_write_ready() instead of the user.  Setting it
+ * returns GE_INUSE if a file is already being sent.  Pass in NULL to
+ * clear it, that returns GE_NOTREADY if it was already cleared by a
+ * close, whoever clears it owns finishing the transfer.
+ */
+int gensio_set_sendfile_data(struct gensio *io, void *sendfile_data);
+int gensio_sendfile_write_ready(void *sendfile_data);
+
+/*
+ * The gensio is being closed, stop the transfer.  The sendfile data
+ * has already been cleared from the gensio.
+ */
+void gensio_sendfile_abort(void *sendfile_data);
+
+#endif /* GENSIO_SENDFILE_H */
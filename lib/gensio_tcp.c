@@ -30,6 +30,10 @@
 #include <string.h>
 #include <strings.h>
 #include <assert.h>
+#include <limits.h>
+#ifdef HAVE_LINUX_ERRQUEUE_H
+#include <linux/errqueue.h>
+#endif
 
 #include <gensio/gensio.h>
 #include <gensio/gensio_class.h>
@@ -37,6 +41,47 @@
 #include <gensio/argvutils.h>
 #include <gensio/gensio_osops.h>
 
+/*
+ * Zero-copy completions come back through the socket error queue, so
+ * zero-copy can only be used if those messages can be decoded.
+ */
+#if defined(SO_ZEROCOPY) && defined(MSG_ZEROCOPY) && \
+	defined(SO_EE_ORIGIN_ZEROCOPY)
+#define TCP_ZEROCOPY
+#endif
+
+/*
+ * Socket options that can be set with an option, a default, or a
+ * control.  A value of zero leaves the option at the system default.
+ */
+struct tcp_sockopt {
+    const char *name;
+    unsigned int control;
+    int level;
+    int optname;
+    bool is_bool;
+};
+
+static const struct tcp_sockopt tcp_sockopts[] = {
+    { "sndbuf",		GENSIO_CONTROL_SNDBUF, SOL_SOCKET, SO_SNDBUF },
+    { "rcvbuf",		GENSIO_CONTROL_RCVBUF, SOL_SOCKET, SO_RCVBUF },
+    { "notsent_lowat",	GENSIO_CONTROL_NOTSENT_LOWAT,
+			IPPROTO_TCP, TCP_NOTSENT_LOWAT },
+    { "cork",		GENSIO_CONTROL_CORK, IPPROTO_TCP, TCP_CORK, true },
+    { "quickack",	GENSIO_CONTROL_QUICKACK,
+			IPPROTO_TCP, TCP_QUICKACK, true },
+    { "busy_poll",	GENSIO_CONTROL_BUSY_POLL, SOL_SOCKET, SO_BUSY_POLL },
+    { "user_timeout",	GENSIO_CONTROL_USER_TIMEOUT,
+			IPPROTO_TCP, TCP_USER_TIMEOUT },
+};
+#define TCP_NR_SOCKOPTS (sizeof(tcp_sockopts) / sizeof(tcp_sockopts[0]))
+#define TCP_SOCKOPT_SNDBUF 0
+
+/* An sndbuf of this means size the send buffer from TCP_INFO. */
+#define TCP_SNDBUF_AUTO -1
+#define TCP_SNDBUF_AUTO_MIN 16384
+#define TCP_SNDBUF_AUTO_MAX (16 * 1024 * 1024)
+
 struct tcp_data {
     struct gensio_os_funcs *o;
 
@@ -53,9 +98,163 @@ struct tcp_data {
 
     bool nodelay;
 
+    /*
+     * Writes flagged "zerocopy" of at least this size are sent with
+     * MSG_ZEROCOPY, 0 means zero-copy is off.
+     */
+    gensiods zerocopy;
+
+    int sockopts[TCP_NR_SOCKOPTS];
+
+    /*
+     * Connect with TCP_FASTOPEN_CONNECT, so the connect is held until
+     * the first write and that data goes out in the SYN.
+     */
+    bool fastopen;
+
+    /* For sndbuf=auto, the current size and when to look again. */
+    int auto_sndbuf;
+    struct timeval next_sndbuf_check;
+
     int last_err;
 };
 
+static int
+tcp_sockopt_defaults(struct gensio_os_funcs *o, int *vals)
+{
+    unsigned int i;
+    int err, ival;
+
+    for (i = 0; i < TCP_NR_SOCKOPTS; i++) {
+	err = gensio_get_default(o, "tcp", tcp_sockopts[i].name, false,
+				 tcp_sockopts[i].is_bool ?
+				 GENSIO_DEFAULT_BOOL : GENSIO_DEFAULT_INT,
+				 NULL, &ival);
+	if (err)
+	    return err;
+	vals[i] = ival;
+    }
+    return 0;
+}
+
+static int
+tcp_sockopt_from_str(unsigned int i, const char *str, int *val)
+{
+    char *end;
+    long lval;
+
+    if (i == TCP_SOCKOPT_SNDBUF && strcmp(str, "auto") == 0) {
+	*val = TCP_SNDBUF_AUTO;
+	return 0;
+    }
+    lval = strtol(str, &end, 0);
+    if (*str == '\0' || *end != '\0' || lval < 0 || lval > INT_MAX)
+	return GE_INVAL;
+    *val = lval;
+    return 0;
+}
+
+/*
+ * Returns 1 if the arg is a socket option and was processed, 0 if it
+ * is not a socket option, and -1 if it's a socket option but the value
+ * is invalid.
+ */
+static int
+tcp_check_sockopt_arg(const char *arg, int *vals)
+{
+    unsigned int i;
+    const char *str;
+    bool bval;
+    int rv;
+
+    for (i = 0; i < TCP_NR_SOCKOPTS; i++) {
+	if (tcp_sockopts[i].is_bool) {
+	    rv = gensio_check_keybool(arg, tcp_sockopts[i].name, &bval);
+	    if (rv > 0)
+		vals[i] = bval;
+	} else {
+	    rv = gensio_check_keyvalue(arg, tcp_sockopts[i].name, &str);
+	    if (rv > 0 && tcp_sockopt_from_str(i, str, &vals[i]))
+		rv = -1;
+	}
+	if (rv)
+	    return rv;
+    }
+    return 0;
+}
+
+static int
+tcp_set_sockopt(struct tcp_data *tdata, int fd, unsigned int i)
+{
+    int val = tdata->sockopts[i];
+
+    if (i == TCP_SOCKOPT_SNDBUF && val == TCP_SNDBUF_AUTO) {
+	/* Start from the system's value, the first write sizes it. */
+	tdata->auto_sndbuf = 0;
+	tdata->next_sndbuf_check.tv_sec = 0;
+	tdata->next_sndbuf_check.tv_usec = 0;
+	return 0;
+    }
+    if (setsockopt(fd, tcp_sockopts[i].level, tcp_sockopts[i].optname,
+		   &val, sizeof(val)) == -1)
+	return errno;
+    return 0;
+}
+
+/*
+ * Size the send buffer to twice the bandwidth-delay product, which
+ * is what the congestion window holds.  That's enough to keep the
+ * pipe full while the next window is written, without letting a lot
+ * of data sit in the socket waiting to go out.
+ */
+static void
+tcp_auto_sndbuf(struct tcp_data *tdata, int fd)
+{
+    struct gensio_os_funcs *o = tdata->o;
+    struct tcp_info ti;
+    socklen_t len = sizeof(ti);
+    struct timeval now, interval;
+    unsigned long bdp;
+    int val;
+
+    o->get_monotonic_time(o, &now);
+    if (timercmp(&now, &tdata->next_sndbuf_check, <))
+	return;
+
+    if (getsockopt(fd, IPPROTO_TCP, TCP_INFO, &ti, &len) == -1 ||
+		ti.tcpi_rtt == 0)
+	return;
+
+    /* Look again after a few round trips, but not too often. */
+    interval.tv_sec = 0;
+    interval.tv_usec = ti.tcpi_rtt * 8;
+    if (interval.tv_usec < 100000)
+	interval.tv_usec = 100000;
+    while (interval.tv_usec >= 1000000) {
+	interval.tv_sec++;
+	interval.tv_usec -= 1000000;
+    }
+    timeradd(&now, &interval, &tdata->next_sndbuf_check);
+
+    bdp = (unsigned long) ti.tcpi_snd_cwnd * ti.tcpi_snd_mss;
+    if (bdp * 2 < TCP_SNDBUF_AUTO_MIN)
+	val = TCP_SNDBUF_AUTO_MIN;
+    else if (bdp * 2 > TCP_SNDBUF_AUTO_MAX)
+	val = TCP_SNDBUF_AUTO_MAX;
+    else
+	val = bdp * 2;
+
+    /* Don't bother with small changes. */
+    if (tdata->auto_sndbuf && val > tdata->auto_sndbuf - tdata->auto_sndbuf / 4
+		&& val < tdata->auto_sndbuf + tdata->auto_sndbuf / 4)
+	return;
+
+    /* The kernel doubles this for its overhead. */
+    len = val / 2;
+    if (setsockopt(fd, SOL_SOCKET, SO_SNDBUF, &len, sizeof(int)) == 0)
+	tdata->auto_sndbuf = val;
+}
+
 static int tcp_check_open(void *handler_data, int fd)
 {
     struct tcp_data *tdata = handler_data;
@@ -70,10 +269,20 @@ static int tcp_check_open(void *handler_data, int fd)
     optval = gensio_os_err_to_err(tdata->o, optval);
     tdata->last_err = optval;
     if (!optval) {
-	struct addrinfo *ai = tdata->curr_ai;
-
-	memcpy(tdata->raddr, ai->ai_addr, ai->ai_addrlen);
-	tdata->raddrlen = ai->ai_addrlen;
+	/*
+	 * With parallel connects, this may not be the last address
+	 * tried, so get the address from the socket.  This also
+	 * catches a stale write ready on a reused fd number, where
+	 * the connect hasn't finished yet.
+	 */
+	len = sizeof(tdata->remote);
+	if (getpeername(fd, tdata->raddr, &len) == -1) {
+	    if (errno == ENOTCONN)
+		return GE_INPROGRESS;
+	    tdata->last_err = gensio_os_err_to_err(tdata->o, errno);
+	    return tdata->last_err;
+	}
+	tdata->raddrlen = len;
     }
     return optval;
 }
@@ -82,9 +291,8 @@ static int
 tcp_socket_setup(struct tcp_data *tdata, int fd)
 {
     int optval = 1;
-
-    if (fcntl(fd, F_SETFL, O_NONBLOCK) == -1)
-	return errno;
+    unsigned int i;
+    int err;
 
     if (setsockopt(fd, SOL_SOCKET, SO_KEEPALIVE,
 		   (void *)&optval, sizeof(optval)) == -1)
@@ -101,6 +309,37 @@ tcp_socket_setup(struct tcp_data *tdata, int fd)
 	    return errno;
     }
 
+    if (tdata->fastopen) {
+#ifdef TCP_FASTOPEN_CONNECT
+	int val = 1;
+
+	if (setsockopt(fd, IPPROTO_TCP, TCP_FASTOPEN_CONNECT,
+		       &val, sizeof(val)) == -1)
+	    return errno;
+#else
+	return EOPNOTSUPP;
+#endif
+    }
+
+    if (tdata->zerocopy) {
+#ifdef TCP_ZEROCOPY
+	int val = 1;
+
+	if (setsockopt(fd, SOL_SOCKET, SO_ZEROCOPY, &val, sizeof(val)) == -1)
+	    return errno;
+#else
+	return EOPNOTSUPP;
+#endif
+    }
+
+    for (i = 0; i < TCP_NR_SOCKOPTS; i++) {
+	if (tdata->sockopts[i]) {
+	    err = tcp_set_sockopt(tdata, fd, i);
+	    if (err)
+		return err;
+	}
+    }
+
     if (tdata->lai) {
 	if (bind(fd, tdata->lai->ai_addr, tdata->lai->ai_addrlen) == -1)
 	    return errno;
@@ -115,45 +354,43 @@ tcp_try_open(struct tcp_data *tdata, int *fd)
     int new_fd, err = EBUSY;
     struct addrinfo *ai = tdata->curr_ai;
 
-    new_fd = socket(ai->ai_family, SOCK_STREAM, 0);
+ retry:
+    tdata->curr_ai = ai;
+    new_fd = socket(ai->ai_family, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC,
+		    0);
     if (new_fd == -1) {
 	err = errno;
-	goto out;
+	goto next;
     }
 
     err = tcp_socket_setup(tdata, new_fd);
     if (err)
-	goto out;
+	goto next;
 
- retry:
     err = connect(new_fd, ai->ai_addr, ai->ai_addrlen);
     if (err == -1) {
 	err = errno;
 	if (err == EINPROGRESS) {
-	    tdata->curr_ai = ai;
 	    *fd = new_fd;
 	    goto out_return;
 	}
-    } else {
-	err = 0;
-    }
-
-    if (err) {
-	ai = ai->ai_next;
-	if (ai)
-	    goto retry;
     } else {
 	memcpy(tdata->raddr, ai->ai_addr, ai->ai_addrlen);
 	tdata->raddrlen = ai->ai_addrlen;
-    }
- out:
-    if (err) {
-	if (new_fd != -1)
-	    close(new_fd);
-    } else {
 	*fd = new_fd;
+	err = 0;
+	goto out_return;
     }
 
+ next:
+    /* Each address needs its own socket, the family may differ. */
+    if (new_fd != -1)
+	close(new_fd);
+    ai = ai->ai_next;
+    if (ai)
+	goto retry;
+    tdata->last_err = gensio_os_err_to_err(tdata->o, err);
+
  out_return:
     return gensio_os_err_to_err(tdata->o, err);
 }
@@ -166,7 +403,8 @@ tcp_retry_open(void *handler_data, int *fd)
     if (tdata->curr_ai)
 	tdata->curr_ai = tdata->curr_ai->ai_next;
     if (!tdata->curr_ai)
-	return tdata->last_err;
+	/* Out of addresses, this must not look like a connect. */
+	return tdata->last_err ? tdata->last_err : GE_NOTFOUND;
     return tcp_try_open(tdata, fd);
 }
 
@@ -179,6 +417,54 @@ tcp_sub_open(void *handler_data, int *fd)
     return tcp_try_open(tdata, fd);
 }
 
+/*
+ * Reorder the address list so the address families alternate,
+ * keeping the order within each family (RFC 8305 section 4).  That
+ * way a broken family only delays the connection by one stagger
+ * period.
+ */
+static struct addrinfo *
+tcp_interleave_families(struct addrinfo *ai)
+{
+    struct addrinfo *first = NULL, **firstp = &first;
+    struct addrinfo *other = NULL, **otherp = &other;
+    struct addrinfo *rv = NULL, **rvp = &rv;
+    int family;
+
+    if (!ai)
+	return NULL;
+
+    family = ai->ai_family;
+    while (ai) {
+	if (ai->ai_family == family) {
+	    *firstp = ai;
+	    firstp = &ai->ai_next;
+	} else {
+	    *otherp = ai;
+	    otherp = &ai->ai_next;
+	}
+	ai = ai->ai_next;
+    }
+    *firstp = NULL;
+    *otherp = NULL;
+
+    while (first || other) {
+	if (first) {
+	    *rvp = first;
+	    rvp = &first->ai_next;
+	    first = first->ai_next;
+	}
+	if (other) {
+	    *rvp = other;
+	    rvp = &other->ai_next;
+	    other = other->ai_next;
+	}
+    }
+    *rvp = NULL;
+
+    return rv;
+}
+
 static int
 tcp_raddr_to_str(void *handler_data, gensiods *epos,
 		 char *buf, gensiods buflen)
@@ -218,8 +504,40 @@ tcp_control(void *handler_data, int fd, bool get, unsigned int option,
 	    char *data, gensiods *datalen)
 {
     struct tcp_data *tdata = handler_data;
+    unsigned int i;
     int rv, val;
 
+    for (i = 0; i < TCP_NR_SOCKOPTS; i++) {
+	if (tcp_sockopts[i].control == option)
+	    break;
+    }
+    if (i < TCP_NR_SOCKOPTS) {
+	if (get) {
+	    if (fd != -1) {
+		socklen_t vallen = sizeof(val);
+
+		rv = getsockopt(fd, tcp_sockopts[i].level,
+				tcp_sockopts[i].optname, &val, &vallen);
+		if (rv == -1)
+		    return gensio_os_err_to_err(tdata->o, errno);
+	    } else {
+		val = tdata->sockopts[i];
+	    }
+	    *datalen = snprintf(data, *datalen, "%d", val);
+	} else {
+	    rv = tcp_sockopt_from_str(i, data, &val);
+	    if (rv)
+		return rv;
+	    tdata->sockopts[i] = val;
+	    if (fd != -1 && (val || tcp_sockopts[i].is_bool)) {
+		rv = tcp_set_sockopt(tdata, fd, i);
+		if (rv)
+		    return gensio_os_err_to_err(tdata->o, rv);
+	    }
+	}
+	return 0;
+    }
+
     switch (option) {
     case GENSIO_CONTROL_NODELAY:
 	if (get) {
@@ -273,6 +591,7 @@ tcp_write(void *handler_data, int fd, gensiods *rcount,
 	  const char *const *auxdata)
 {
     struct tcp_data *tdata = handler_data;
+    bool zerocopy = false;
     int err = 0;
     int flags = 0;
 
@@ -282,6 +601,8 @@ tcp_write(void *handler_data, int fd, gensiods *rcount,
 	for (i = 0; !err && auxdata[i]; i++) {
 	    if (strcasecmp(auxdata[i], "oob") == 0) {
 		flags |= MSG_OOB;
+	    } else if (strcasecmp(auxdata[i], "zerocopy") == 0) {
+		zerocopy = true;
 	    } else {
 		err = EINVAL;
 	    }
@@ -291,7 +612,88 @@ tcp_write(void *handler_data, int fd, gensiods *rcount,
 	    return err;
     }
 
-    return gensio_os_send(tdata->o, fd, sg, sglen, rcount, flags);
+    if (zerocopy && tdata->zerocopy && !(flags & MSG_OOB)) {
+#ifdef TCP_ZEROCOPY
+	gensiods i, total = 0;
+
+	for (i = 0; i < sglen; i++)
+	    total += sg[i].buflen;
+	if (total >= tdata->zerocopy)
+	    flags |= MSG_ZEROCOPY;
+#endif
+    }
+
+    err = gensio_os_send(tdata->o, fd, sg, sglen, rcount, flags);
+    if (err && tdata->fastopen && errno == EINPROGRESS) {
+	/*
+	 * The first write of a fast open connection when there was no
+	 * cookie to send data in the SYN.  The SYN has gone out, the
+	 * data has to wait for the connection to come up.
+	 */
+	*rcount = 0;
+	err = 0;
+    }
+    if (!err && tdata->sockopts[TCP_SOCKOPT_SNDBUF] == TCP_SNDBUF_AUTO)
+	tcp_auto_sndbuf(tdata, fd);
+#ifdef TCP_ZEROCOPY
+    if (err && (flags & MSG_ZEROCOPY) && errno == ENOBUFS) {
+	/*
+	 * Out of memory for pinning pages, it will be freed as
+	 * completions come in.  Falling back to copying would leave
+	 * the user waiting for a completion that never comes, so
+	 * report it as a full socket.
+	 */
+	*rcount = 0;
+	err = 0;
+    }
+#endif
+
+    return err;
+}
+
+static bool
+tcp_errqueue_ready(void *handler_data, int fd)
+{
+    bool handled = false;
+#ifdef TCP_ZEROCOPY
+    struct tcp_data *tdata = handler_data;
+    struct gensio_write_complete wc;
+    struct sock_extended_err *serr;
+    struct cmsghdr *cm;
+    struct msghdr msg;
+    char control[128];
+
+    for (;;) {
+	memset(&msg, 0, sizeof(msg));
+	msg.msg_control = control;
+	msg.msg_controllen = sizeof(control);
+	if (recvmsg(fd, &msg, MSG_ERRQUEUE) == -1) {
+	    if (errno == EINTR)
+		continue;
+	    break;
+	}
+
+	for (cm = CMSG_FIRSTHDR(&msg); cm; cm = CMSG_NXTHDR(&msg, cm)) {
+	    if (!(cm->cmsg_level == IPPROTO_IP &&
+		  cm->cmsg_type == IP_RECVERR) &&
+		    !(cm->cmsg_level == IPPROTO_IPV6 &&
+		      cm->cmsg_type == IPV6_RECVERR))
+		continue;
+	    serr = (struct sock_extended_err *) CMSG_DATA(cm);
+	    if (serr->ee_errno != 0 ||
+			serr->ee_origin != SO_EE_ORIGIN_ZEROCOPY)
+		continue;
+	    wc.first = serr->ee_info;
+	    wc.last = serr->ee_data;
+	    wc.copied = serr->ee_code & SO_EE_CODE_ZEROCOPY_COPIED;
+	    handled = true;
+	    gensio_fd_ll_callback(tdata->ll, GENSIO_LL_CB_WRITE_COMPLETE, 0,
+				  &wc, sizeof(wc), NULL);
+	}
+    }
+#endif
+
+    return handled;
 }
 
 static const struct gensio_fd_ll_ops tcp_fd_ll_ops = {
@@ -303,6 +705,7 @@ static const struct gensio_fd_ll_ops tcp_fd_ll_ops = {
     .free = tcp_free,
     .control = tcp_control,
     .except_ready = tcp_except_ready,
+    .errqueue_ready = tcp_errqueue_ready,
     .write = tcp_write
 };
 
@@ -316,7 +719,13 @@ tcp_gensio_alloc(struct addrinfo *iai, const char * const args[],
     struct addrinfo *ai, *lai = NULL;
     struct gensio *io;
     gensiods max_read_size = GENSIO_DEFAULT_BUF_SIZE;
+    gensiods read_budget = 65536;
+    gensiods readbuf_min = 1024, readbuf_max = 0;
+    gensiods zerocopy = 0;
     bool nodelay = false;
+    unsigned int connect_stagger = 250;
+    unsigned int fastopen = 0;
+    int sockopts[TCP_NR_SOCKOPTS];
     unsigned int i;
     int ival;
     int err;
@@ -326,6 +735,40 @@ tcp_gensio_alloc(struct addrinfo *iai, const char * const args[],
     if (!err)
 	nodelay = ival;
 
+    err = gensio_get_default(o, "tcp", "read_budget", false,
+			    GENSIO_DEFAULT_INT, NULL, &ival);
+    if (!err)
+	read_budget = ival;
+
+    err = gensio_get_default(o, "tcp", "readbuf_min", false,
+			     GENSIO_DEFAULT_INT, NULL, &ival);
+    if (!err)
+	readbuf_min = ival;
+
+    err = gensio_get_default(o, "tcp", "readbuf_max", false,
+			     GENSIO_DEFAULT_INT, NULL, &ival);
+    if (!err)
+	readbuf_max = ival;
+
+    err = gensio_get_default(o, "tcp", "connect_stagger", false,
+			    GENSIO_DEFAULT_INT, NULL, &ival);
+    if (!err)
+	connect_stagger = ival;
+
+    err = gensio_get_default(o, "tcp", "zerocopy", false,
+			     GENSIO_DEFAULT_INT, NULL, &ival);
+    if (!err)
+	zerocopy = ival;
+
+    err = gensio_get_default(o, "tcp", "fastopen", false,
+			     GENSIO_DEFAULT_INT, NULL, &ival);
+    if (!err)
+	fastopen = ival;
+
+    err = tcp_sockopt_defaults(o, sockopts);
+    if (err)
+	return err;
+
     err = gensio_get_defaultaddr(o, "tcp", "laddr", false,
 				 IPPROTO_TCP, true, false, &lai);
     if (err != GE_NOTSUP)
@@ -340,6 +783,23 @@ tcp_gensio_alloc(struct addrinfo *iai, const char * const args[],
 	    continue;
 	if (gensio_check_keybool(args[i], "nodelay", &nodelay) > 0)
 	    continue;
+	if (gensio_check_keyuint(args[i], "connect_stagger",
+				 &connect_stagger) > 0)
+	    continue;
+	if (gensio_check_keyds(args[i], "read_budget", &read_budget) > 0)
+	    continue;
+	if (gensio_check_keyds(args[i], "readbuf_min", &readbuf_min) > 0)
+	    continue;
+	if (gensio_check_keyds(args[i], "readbuf_max", &readbuf_max) > 0)
+	    continue;
+	if (gensio_check_keyds(args[i], "zerocopy", &zerocopy) > 0)
+	    continue;
+	if (gensio_check_keyuint(args[i], "fastopen", &fastopen) > 0)
+	    continue;
+	if (tcp_check_sockopt_arg(args[i], sockopts) > 0)
+	    continue;
+	if (lai)
+	    gensio_free_addrinfo(o, lai);
 	return EINVAL;
     }
 
@@ -365,12 +825,17 @@ tcp_gensio_alloc(struct addrinfo *iai, const char * const args[],
 	o->free(o, tdata);
 	return ENOMEM;
     }
+    if (connect_stagger)
+	ai = tcp_interleave_families(ai);
 
     tdata->o = o;
     tdata->ai = ai;
     tdata->lai = lai;
     tdata->raddr = (struct sockaddr *) &tdata->remote;
     tdata->nodelay = nodelay;
+    tdata->zerocopy = zerocopy;
+    tdata->fastopen = fastopen;
+    memcpy(tdata->sockopts, sockopts, sizeof(sockopts));
 
     tdata->ll = fd_gensio_ll_alloc(o, -1, &tcp_fd_ll_ops, tdata, max_read_size,
 				   false);
@@ -381,6 +846,12 @@ tcp_gensio_alloc(struct addrinfo *iai, const char * const args[],
 	o->free(o, tdata);
 	return ENOMEM;
     }
+    gensio_fd_ll_set_open_stagger(tdata->ll, connect_stagger);
+    gensio_fd_ll_set_read_budget(tdata->ll, read_budget);
+    gensio_fd_ll_allow_raw(tdata->ll);
+    gensio_fd_ll_set_read_size_range(tdata->ll, readbuf_min, readbuf_max);
+    if (zerocopy)
+	gensio_fd_ll_watch_errqueue(tdata->ll);
 
     io = base_gensio_alloc(o, tdata->ll, NULL, NULL, "tcp", cb, user_data);
     if (!io) {
@@ -418,6 +889,9 @@ str_to_tcp_gensio(const char *str, const char * const args[],
 
 struct tcpna_data;
 
+/* Maximum number of listening sockets per address for an accepter. */
+#define TCP_MAX_LISTENERS 64
+
 struct tcpna_waiters {
     struct gensio_os_funcs *o;
     struct tcpna_data *nadata;
@@ -433,14 +907,40 @@ struct tcpna_data {
     struct gensio_os_funcs *o;
 
     gensiods max_read_size;
+    gensiods read_budget;
+    gensiods readbuf_min;
+    gensiods readbuf_max;
+    gensiods zerocopy;
     bool nodelay;
+    int sockopts[TCP_NR_SOCKOPTS];
+
+    /* Fast open queue length for the listening sockets, 0 if off. */
+    unsigned int fastopen;
+
+    /* Number of SO_REUSEPORT listening sockets to open per address. */
+    unsigned int nr_listeners;
+
+    /* Maximum number of connections to accept per read event. */
+    unsigned int accept_budget;
+
+    /*
+     * Statistics.  overflows counts the number of times the accept
+     * budget ran out with connections still pending.
+     */
+    unsigned long accepts;
+    unsigned long overflows;
 
     struct gensio_lock *lock;
 
     bool setup;			/* Network sockets are allocated. */
     bool enabled;		/* Accepts are being handled. */
     bool in_shutdown;		/* Currently being shut down. */
-    bool in_accept_cb;		/* Currently in a callback. */
+    /*
+     * Accepted gensios that are still opening or in the new
+     * connection callback.  Accept disable waiters are run when this
+     * goes to zero, so no new connection is reported after that.
+     */
+    unsigned int pending_accepts;
     struct tcpna_waiters *acc_disable_waiters;
 
     unsigned int refcount;
@@ -517,6 +1017,7 @@ static const struct gensio_fd_ll_ops tcp_server_fd_ll_ops = {
     .free = tcp_free,
     .control = tcp_control,
     .except_ready = tcp_except_ready,
+    .errqueue_ready = tcp_errqueue_ready,
     .write = tcp_write
 };
 
@@ -539,9 +1040,13 @@ tcpna_server_open_done(struct gensio *io, int err, void *open_data)
     }
 
     tcpna_lock(nadata);
-    nadata->in_accept_cb = false;
-    waiters = nadata->acc_disable_waiters;
-    nadata->acc_disable_waiters = NULL;
+    assert(nadata->pending_accepts > 0);
+    nadata->pending_accepts--;
+    waiters = NULL;
+    if (nadata->pending_accepts == 0) {
+	waiters = nadata->acc_disable_waiters;
+	nadata->acc_disable_waiters = NULL;
+    }
     tcpna_unlock(nadata);
     while (waiters) {
 	next = waiters->next;
@@ -553,37 +1058,21 @@ tcpna_server_open_done(struct gensio *io, int err, void *open_data)
     tcpna_deref_and_unlock(nadata);
 }
 
+/* Called with the lock held. */
 static void
-tcpna_readhandler(int fd, void *cbdata)
+tcpna_new_connection(struct tcpna_data *nadata, int new_fd,
+		     struct sockaddr_storage *addr, socklen_t addrlen)
 {
-    struct tcpna_data *nadata = cbdata;
-    int new_fd;
-    struct sockaddr_storage addr;
-    socklen_t addrlen = sizeof(addr);
     struct tcp_data *tdata = NULL;
     struct gensio *io;
     const char *errstr;
     int err;
 
-    tcpna_lock(nadata);
-    if (!nadata->enabled)
-	goto out_unlock; /* We can race, just ignore this if so. */
-
-    err = gensio_os_accept(nadata->o,
-			   fd, (struct sockaddr *) &addr, &addrlen, &new_fd);
-    if (err) {
-	if (err != EAGAIN)
-	    gensio_acc_log(nadata->acc, GENSIO_LOG_ERR,
-			   "Error accepting TCP gensio: %s",
-			   gensio_err_to_str(err));
-	goto out_unlock;
-    }
-
     errstr = gensio_check_tcpd_ok(new_fd);
     if (errstr) {
 	write_nofail(new_fd, errstr, strlen(errstr));
 	close(new_fd);
-	goto out_unlock;
+	return;
     }
 
     tdata = nadata->o->zalloc(nadata->o, sizeof(*tdata));
@@ -591,14 +1080,17 @@ tcpna_readhandler(int fd, void *cbdata)
 	errstr = "Out of memory\r\n";
 	write_nofail(new_fd, errstr, strlen(errstr));
 	close(new_fd);
-	goto out_unlock;
+	return;
     }
 
     tdata->o = nadata->o;
     tdata->raddr = (struct sockaddr *) &tdata->remote;
-    memcpy(tdata->raddr, &addr, addrlen);
+    memcpy(tdata->raddr, addr, addrlen);
     tdata->raddrlen = addrlen;
-    
+    tdata->nodelay = nadata->nodelay;
+    tdata->zerocopy = nadata->zerocopy;
+    memcpy(tdata->sockopts, nadata->sockopts, sizeof(tdata->sockopts));
+
     err = tcp_socket_setup(tdata, new_fd);
     if (err) {
 	err = gensio_os_err_to_err(tdata->o, err);
@@ -606,7 +1098,7 @@ tcpna_readhandler(int fd, void *cbdata)
 		       "Error setting up tcp port: %s", gensio_err_to_str(err));
 	close(new_fd);
 	tcp_free(tdata);
-	goto out_unlock;
+	return;
     }
 
     tdata->ll = fd_gensio_ll_alloc(nadata->o, new_fd, &tcp_server_fd_ll_ops,
@@ -616,13 +1108,18 @@ tcpna_readhandler(int fd, void *cbdata)
 		       "Out of memory allocating tcp ll");
 	close(new_fd);
 	tcp_free(tdata);
-	goto out_unlock;
+	return;
     }
+    gensio_fd_ll_set_read_budget(tdata->ll, nadata->read_budget);
+    gensio_fd_ll_allow_raw(tdata->ll);
+    gensio_fd_ll_set_read_size_range(tdata->ll, nadata->readbuf_min,
+				     nadata->readbuf_max);
+    if (tdata->zerocopy)
+	gensio_fd_ll_watch_errqueue(tdata->ll);
 
     io = base_gensio_server_alloc(nadata->o, tdata->ll, NULL, NULL, "tcp",
 				  tcpna_server_open_done, nadata);
     if (!io) {
-	tcpna_unlock(nadata);
 	gensio_acc_log(nadata->acc, GENSIO_LOG_ERR,
 		       "Out of memory allocating tcp base");
 	gensio_ll_free(tdata->ll);
@@ -633,7 +1130,46 @@ tcpna_readhandler(int fd, void *cbdata)
     tcpna_ref(nadata);
     gensio_set_is_reliable(io, true);
     gensio_acc_add_pending_gensio(nadata->acc, io);
-    nadata->in_accept_cb = true;
+    nadata->pending_accepts++;
+}
+
+static void
+tcpna_readhandler(int fd, void *cbdata)
+{
+    struct tcpna_data *nadata = cbdata;
+    int new_fd;
+    struct sockaddr_storage addr;
+    socklen_t addrlen;
+    unsigned int count;
+    int err;
+
+    tcpna_lock(nadata);
+    /*
+     * Drain the pending connections, up to the budget, so a burst of
+     * connections doesn't cost a trip through the selector for each
+     * one.
+     */
+    for (count = 0; count < nadata->accept_budget; count++) {
+	if (!nadata->enabled)
+	    break; /* We can race, just ignore this if so. */
+
+	addrlen = sizeof(addr);
+	err = gensio_os_accept(nadata->o, fd, (struct sockaddr *) &addr,
+			       &addrlen, &new_fd);
+	if (err) {
+	    if (err != GE_NODATA)
+		gensio_acc_log(nadata->acc, GENSIO_LOG_ERR,
+			       "Error accepting TCP gensio: %s",
+			       gensio_err_to_str(err));
+	    goto out_unlock;
+	}
+
+	nadata->accepts++;
+	tcpna_new_connection(nadata, new_fd, &addr, addrlen);
+    }
+    if (count == nadata->accept_budget)
+	/* Possibly more pending, the selector will call us again. */
+	nadata->overflows++;
  out_unlock:
     tcpna_unlock(nadata);
 }
@@ -686,9 +1222,12 @@ tcpna_startup(struct gensio_accepter *accepter)
 	goto out_unlock;
     }
 
-    rv = gensio_open_socket(nadata->o, nadata->ai,
-			    tcpna_readhandler, NULL, tcpna_fd_cleared, nadata,
-			    &nadata->acceptfds, &nadata->nr_acceptfds);
+    rv = gensio_open_socket_multi(nadata->o, nadata->ai,
+				  tcpna_readhandler, NULL, tcpna_fd_cleared,
+				  nadata,
+				  GENSIO_OPENSOCK_FASTOPEN(nadata->fastopen),
+				  nadata->nr_listeners,
+				  &nadata->acceptfds, &nadata->nr_acceptfds);
     if (!rv) {
 	nadata->setup = true;
 	tcpna_set_fd_enables(nadata, true);
@@ -771,7 +1310,7 @@ tcpna_set_accept_callback_enable(struct gensio_accepter *accepter, bool enabled,
 	    w->o = o;
 	    w->done = done;
 	    w->done_data = done_data;
-	    if (nadata->in_accept_cb) {
+	    if (nadata->pending_accepts) {
 		w->next = nadata->acc_disable_waiters;
 		nadata->acc_disable_waiters = w;
 	    } else {
@@ -887,6 +1426,30 @@ tcpna_str_to_gensio(struct gensio_accepter *accepter, const char *addr,
     return err;
 }
 
+static int
+tcpna_control(struct gensio_accepter *accepter, bool get, unsigned int option,
+	      char *data, gensiods *datalen)
+{
+    struct tcpna_data *nadata = gensio_acc_get_gensio_data(accepter);
+
+    switch (option) {
+    case GENSIO_CONTROL_ACCEPT_STATS:
+	tcpna_lock(nadata);
+	if (get) {
+	    *datalen = snprintf(data, *datalen, "accepts=%lu overflows=%lu",
+				nadata->accepts, nadata->overflows);
+	} else {
+	    nadata->accepts = 0;
+	    nadata->overflows = 0;
+	}
+	tcpna_unlock(nadata);
+	return 0;
+
+    default:
+	return GE_NOTSUP;
+    }
+}
+
 static int
 gensio_acc_tcp_func(struct gensio_accepter *acc, int func, int val,
 		    const char *addr, void *done, void *data, const void *data2,
@@ -909,6 +1472,9 @@ gensio_acc_tcp_func(struct gensio_accepter *acc, int func, int val,
     case GENSIO_ACC_FUNC_STR_TO_GENSIO:
 	return tcpna_str_to_gensio(acc, addr, done, data, ret);
 
+    case GENSIO_ACC_FUNC_CONTROL:
+	return tcpna_control(acc, val, *((unsigned int *) addr), data, ret);
+
     case GENSIO_ACC_FUNC_DISABLE:
 	tcpna_disable(acc);
 	return 0;
@@ -927,17 +1493,87 @@ tcp_gensio_accepter_alloc(struct addrinfo *iai,
 {
     struct tcpna_data *nadata;
     gensiods max_read_size = GENSIO_DEFAULT_BUF_SIZE;
+    gensiods read_budget = 65536;
+    gensiods readbuf_min = 1024, readbuf_max = 0;
+    gensiods zerocopy = 0;
     bool nodelay = false;
+    unsigned int nr_listeners = 1;
+    unsigned int accept_budget = 32;
+    unsigned int fastopen = 0;
+    int sockopts[TCP_NR_SOCKOPTS];
     unsigned int i;
+    int ival, err;
+
+    err = gensio_get_default(o, "tcp", "read_budget", false,
+			     GENSIO_DEFAULT_INT, NULL, &ival);
+    if (!err)
+	read_budget = ival;
+
+    err = gensio_get_default(o, "tcp", "readbuf_min", false,
+			     GENSIO_DEFAULT_INT, NULL, &ival);
+    if (!err)
+	readbuf_min = ival;
+
+    err = gensio_get_default(o, "tcp", "readbuf_max", false,
+			     GENSIO_DEFAULT_INT, NULL, &ival);
+    if (!err)
+	readbuf_max = ival;
+
+    err = gensio_get_default(o, "tcp", "listeners", false,
+			     GENSIO_DEFAULT_INT, NULL, &ival);
+    if (!err)
+	nr_listeners = ival;
+
+    err = gensio_get_default(o, "tcp", "accept_budget", false,
+			     GENSIO_DEFAULT_INT, NULL, &ival);
+    if (!err)
+	accept_budget = ival;
+
+    err = gensio_get_default(o, "tcp", "zerocopy", false,
+			     GENSIO_DEFAULT_INT, NULL, &ival);
+    if (!err)
+	zerocopy = ival;
+
+    err = gensio_get_default(o, "tcp", "fastopen", false,
+			     GENSIO_DEFAULT_INT, NULL, &ival);
+    if (!err)
+	fastopen = ival;
+
+    err = tcp_sockopt_defaults(o, sockopts);
+    if (err)
+	return err;
 
     for (i = 0; args && args[i]; i++) {
 	if (gensio_check_keyds(args[i], "readbuf", &max_read_size) > 0)
 	    continue;
 	if (gensio_check_keybool(args[i], "nodelay", &nodelay) > 0)
 	    continue;
+	if (gensio_check_keyuint(args[i], "listeners", &nr_listeners) > 0)
+	    continue;
+	if (gensio_check_keyuint(args[i], "accept_budget", &accept_budget) > 0)
+	    continue;
+	if (gensio_check_keyds(args[i], "read_budget", &read_budget) > 0)
+	    continue;
+	if (gensio_check_keyds(args[i], "readbuf_min", &readbuf_min) > 0)
+	    continue;
+	if (gensio_check_keyds(args[i], "readbuf_max", &readbuf_max) > 0)
+	    continue;
+	if (gensio_check_keyds(args[i], "zerocopy", &zerocopy) > 0)
+	    continue;
+	if (gensio_check_keyuint(args[i], "fastopen", &fastopen) > 0)
+	    continue;
+	if (tcp_check_sockopt_arg(args[i], sockopts) > 0)
+	    continue;
 	return EINVAL;
     }
 
+    if (nr_listeners < 1 || nr_listeners > TCP_MAX_LISTENERS)
+	return EINVAL;
+    if (fastopen > 65535)
+	return EINVAL;
+    if (accept_budget < 1)
+	return EINVAL;
+
     nadata = o->zalloc(o, sizeof(*nadata));
     if (!nadata)
 	return ENOMEM;
@@ -959,7 +1595,15 @@ tcp_gensio_accepter_alloc(struct addrinfo *iai,
     gensio_acc_set_is_reliable(nadata->acc, true);
 
     nadata->max_read_size = max_read_size;
+    nadata->read_budget = read_budget;
+    nadata->readbuf_min = readbuf_min;
+    nadata->readbuf_max = readbuf_max;
+    nadata->zerocopy = zerocopy;
     nadata->nodelay = nodelay;
+    memcpy(nadata->sockopts, sockopts, sizeof(sockopts));
+    nadata->fastopen = fastopen;
+    nadata->nr_listeners = nr_listeners;
+    nadata->accept_budget = accept_budget;
 
     *accepter = nadata->acc;
     return 0;
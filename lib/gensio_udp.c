@@ -25,6 +25,7 @@
 #include <unistd.h>
 #include <netinet/in.h>
 #include <netinet/tcp.h>
+#include <netinet/udp.h>
 #include <fcntl.h>
 #include <errno.h>
 #include <string.h>
@@ -41,6 +42,16 @@
  */
 #define GENSIO_DEFAULT_UDP_BUF_SIZE	65536
 
+/*
+ * Limits for a single GSO write.  The kernel won't take more than 64
+ * segments (on older kernels) or more than a maximum sized UDP
+ * packet in one send.  UDP_GSO_MAX_SG is how many sg entries software
+ * segmentation handles without allocating memory.
+ */
+#define UDP_GSO_MAX_SEGS		64
+#define UDP_GSO_MAX_LEN			65507
+#define UDP_GSO_MAX_SG			16
+
 struct udpna_data;
 
 enum udpn_state {
@@ -60,6 +71,25 @@ struct udpn_data {
 
     int myfd; /* fd the original request came in on, for sending. */
 
+    /*
+     * If the accepter has peersock set, each remote gets its own
+     * socket connected to the remote, so the kernel does the demux.
+     * myfd is that socket while own_fd is set, and the data read
+     * from it is held here.  accfd is the accepter's fd, myfd goes
+     * back to that when the own fd is closed.  A gensio with its own
+     * fd doesn't hold off reads on the accepter's fd when its read
+     * is disabled, so new remotes are still accepted.  A stray packet
+     * for it on the accepter's fd is held like any other.
+     */
+    bool own_fd;
+    bool own_fd_clearing;
+    int accfd;
+    unsigned char *read_data;
+    gensiods data_pending_len;
+    gensiods data_pos;
+    gensiods seg_size;
+    bool deferred_read;
+
     bool read_enabled;	/* Read callbacks are enabled. */
     bool write_enabled;	/* Write callbacks are enabled. */
     bool in_read;	/* Currently in a read callback. */
@@ -119,6 +149,18 @@ struct udpna_data {
     gensiods data_pos;
     struct udpn_data *pending_data_owner;
 
+    /*
+     * If the pending data was coalesced by GRO, this is the size of
+     * each datagram in it.  Zero if the data is a single datagram.
+     */
+    gensiods seg_size;
+
+    bool peersock;	/* Give each remote its own connected socket. */
+
+    bool gro;		/* Receive coalesced datagrams with UDP_GRO. */
+    gensiods gso_size;	/* Transmit segment size, zero if disabled. */
+    bool gso_ok;	/* The kernel supports UDP_SEGMENT on our fds. */
+
     struct gensio_list closed_udpns;
 
     /*
@@ -220,11 +262,18 @@ udpna_disable_read(struct udpna_data *nadata)
 	nadata->o->set_read_handler(nadata->o, nadata->fds[i].fd, false);
 }
 
+/*
+ * Reading is off while anything has it disabled or while data read
+ * from the accepter's fd is waiting for its owner.
+ */
 static void udpna_check_read_state(struct udpna_data *nadata)
 {
-    if (nadata->read_disabled && nadata->read_disable_count == 0)
+    bool disable = (nadata->read_disable_count > 0 ||
+		    nadata->data_pending_len);
+
+    if (nadata->read_disabled && !disable)
 	udpna_enable_read(nadata);
-    else if (!nadata->read_disabled && nadata->read_disable_count > 0)
+    else if (!nadata->read_disabled && disable)
 	udpna_disable_read(nadata);
 }
 
@@ -352,6 +401,8 @@ udpna_check_finish_free(struct udpna_data *nadata)
 static void
 udpn_do_free(struct udpn_data *ndata)
 {
+    if (ndata->read_data)
+	ndata->o->free(ndata->o, ndata->read_data);
     if (ndata->deferred_op_runner)
 	ndata->o->free_runner(ndata->deferred_op_runner);
     if (ndata->io)
@@ -371,14 +422,277 @@ udpn_finish_free(struct udpn_data *ndata)
     udpna_check_finish_free(nadata);
 }
 
+static void
+udpna_setup_fd_offload(struct udpna_data *nadata, int fd)
+{
+    int val;
+
+    if (nadata->gro) {
+#ifdef UDP_GRO
+	val = 1;
+	if (setsockopt(fd, SOL_UDP, UDP_GRO, &val, sizeof(val)) == -1)
+#endif
+	    gensio_log(nadata->o, GENSIO_LOG_INFO,
+		       "UDP GRO not supported, receiving single packets");
+    }
+
+    if (nadata->gso_ok) {
+#ifdef UDP_SEGMENT
+	val = nadata->gso_size;
+	if (setsockopt(fd, SOL_UDP, UDP_SEGMENT, &val, sizeof(val)) == -1)
+#endif
+	{
+	    gensio_log(nadata->o, GENSIO_LOG_INFO,
+		       "UDP GSO not supported, segmenting in software");
+	    nadata->gso_ok = false;
+	}
+    }
+    (void) val;
+}
+
+static void
+udpna_setup_offload(struct udpna_data *nadata)
+{
+    unsigned int i;
+
+    if (nadata->gso_size)
+	nadata->gso_ok = true;
+
+    for (i = 0; i < nadata->nr_fds; i++)
+	udpna_setup_fd_offload(nadata, nadata->fds[i].fd);
+}
+
+static void
+udpna_disable_gso(struct udpna_data *nadata)
+{
+    unsigned int i;
+    int val = 0;
+
+    if (!nadata->gso_ok)
+	return;
+
+    gensio_log(nadata->o, GENSIO_LOG_INFO,
+	       "UDP GSO send failed, segmenting in software");
+    nadata->gso_ok = false;
+#ifdef UDP_SEGMENT
+    for (i = 0; i < nadata->nr_fds; i++)
+	setsockopt(nadata->fds[i].fd, SOL_UDP, UDP_SEGMENT, &val, sizeof(val));
+#else
+    (void) i;
+    (void) val;
+#endif
+}
+
+/*
+ * Largest write that can be segmented, as many full segments as the
+ * kernel will take in one send.  Software segmentation uses the same
+ * limit so writes work the same either way.
+ */
+static gensiods
+udpna_gso_max_write(struct udpna_data *nadata)
+{
+    gensiods maxlen;
+
+    maxlen = nadata->gso_size * UDP_GSO_MAX_SEGS;
+    if (maxlen > UDP_GSO_MAX_LEN)
+	maxlen = (UDP_GSO_MAX_LEN / nadata->gso_size) * nadata->gso_size;
+    return maxlen;
+}
+
+static int
+udpn_send(struct udpn_data *ndata, gensiods *count,
+	  const struct gensio_sg *sg, gensiods sglen)
+{
+    if (ndata->own_fd)
+	return gensio_os_send(ndata->o, ndata->myfd, sg, sglen, count, 0);
+
+    return gensio_os_sendto(ndata->o, ndata->myfd, sg, sglen, count, 0,
+			    ndata->raddr, ndata->raddrlen);
+}
+
+static int
+udpn_send_msgs(struct udpn_data *ndata, gensiods *count,
+	       struct gensio_msg *msgs, gensiods nmsgs)
+{
+    if (ndata->own_fd)
+	return gensio_os_sendmmsg(ndata->o, ndata->myfd, msgs, nmsgs, count,
+				  0, NULL, 0);
+
+    return gensio_os_sendmmsg(ndata->o, ndata->myfd, msgs, nmsgs, count, 0,
+			      ndata->raddr, ndata->raddrlen);
+}
+
+/*
+ * Split the data into gso_size datagrams and send them with one
+ * sendmmsg().  The count is the bytes in the datagrams that went
+ * out, which always ends on a segment boundary, so the caller can
+ * write the rest later and it will be segmented the same way.  An
+ * error on a later segment is left for the next write to report.
+ */
+static int
+udpn_soft_segment(struct udpn_data *ndata, gensiods *count,
+		  const struct gensio_sg *sg, gensiods sglen, gensiods total)
+{
+    struct udpna_data *nadata = ndata->nadata;
+    struct gensio_os_funcs *o = ndata->o;
+    struct gensio_msg msgs[UDP_GSO_MAX_SEGS];
+    struct gensio_sg stsg[UDP_GSO_MAX_SG + UDP_GSO_MAX_SEGS], *tsg = stsg;
+    gensiods i, nmsgs = 0, ntsg = 0, pos, left, len, sent;
+    int err;
+
+    /* Each segment may start in the middle of an sg entry. */
+    if (sglen > UDP_GSO_MAX_SG) {
+	tsg = o->zalloc(o, sizeof(*tsg) * (sglen + UDP_GSO_MAX_SEGS));
+	if (!tsg)
+	    return GE_NOMEM;
+    }
+
+    memset(msgs, 0, sizeof(msgs));
+    left = 0;
+    for (i = 0; i < sglen; i++) {
+	for (pos = 0; pos < sg[i].buflen; pos += len) {
+	    if (left == 0) {
+		msgs[nmsgs].sg = tsg + ntsg;
+		nmsgs++;
+		left = nadata->gso_size;
+	    }
+	    len = sg[i].buflen - pos;
+	    if (len > left)
+		len = left;
+	    tsg[ntsg].buf = ((const unsigned char *) sg[i].buf) + pos;
+	    tsg[ntsg].buflen = len;
+	    ntsg++;
+	    msgs[nmsgs - 1].sglen++;
+	    left -= len;
+	}
+    }
+
+    err = udpn_send_msgs(ndata, &sent, msgs, nmsgs);
+    *count = 0;
+    if (sent > 0) {
+	for (i = 0; i < sent; i++)
+	    *count += msgs[i].count;
+	err = 0;
+    }
+
+    if (tsg != stsg)
+	o->free(o, tsg);
+    return err;
+}
+
+/*
+ * Send a single datagram.  With gso set, a write larger than the
+ * segment size goes out as a series of datagrams.  The kernel sends
+ * those all or nothing, in software only some of the segments may go
+ * out, see udpn_soft_segment().
+ */
+static int
+udpn_write_one(struct udpn_data *ndata, gensiods *count,
+	       const struct gensio_sg *sg, gensiods sglen)
+{
+    struct udpna_data *nadata = ndata->nadata;
+    gensiods i, total = 0;
+    int err;
+
+    if (!nadata->gso_size)
+	return udpn_send(ndata, count, sg, sglen);
+
+    for (i = 0; i < sglen; i++)
+	total += sg[i].buflen;
+    if (total > udpna_gso_max_write(nadata))
+	return GE_TOOBIG;
+    if (total <= nadata->gso_size)
+	return udpn_send(ndata, count, sg, sglen);
+
+    if (nadata->gso_ok) {
+	err = udpn_send(ndata, count, sg, sglen);
+	if (err != GE_INVAL && err != GE_IOERR)
+	    return err;
+	/* The kernel or the device can't do this, fall back. */
+	udpna_lock(nadata);
+	udpna_disable_gso(nadata);
+	udpna_unlock(nadata);
+    }
+
+    return udpn_soft_segment(ndata, count, sg, sglen, total);
+}
+
 static int
 udpn_write(struct gensio *io, gensiods *count,
 	   const struct gensio_sg *sg, gensiods sglen)
+{
+    return udpn_write_one(gensio_get_gensio_data(io), count, sg, sglen);
+}
+
+/*
+ * Messages that need no software segmentation go out in one
+ * sendmmsg(), the kernel does the segmenting with GSO.  If that
+ * fails on a segmented message, GSO is turned off and the rest are
+ * written one at a time, just like udpn_write().
+ */
+static int
+udpn_write_msgs(struct gensio *io, gensiods *count,
+		struct gensio_msg *msgs, gensiods nmsgs)
 {
     struct udpn_data *ndata = gensio_get_gensio_data(io);
+    struct udpna_data *nadata = ndata->nadata;
+    gensiods i, j, total, maxlen, sent = 0;
+    bool direct = true, toobig = false;
+    int err = 0;
+
+    if (!nadata->gso_size)
+	return udpn_send_msgs(ndata, count, msgs, nmsgs);
+
+    maxlen = udpna_gso_max_write(nadata);
+    for (i = 0; i < nmsgs; i++) {
+	for (j = 0, total = 0; j < msgs[i].sglen; j++)
+	    total += msgs[i].sg[j].buflen;
+	if (total > maxlen) {
+	    /* Send the ones before it, then report it. */
+	    nmsgs = i;
+	    toobig = true;
+	    break;
+	}
+	if (total > nadata->gso_size && !nadata->gso_ok)
+	    direct = false;
+    }
 
-    return gensio_os_sendto(ndata->o, ndata->myfd, sg, sglen, count, 0,
-			    ndata->raddr, ndata->raddrlen);
+    if (direct && nmsgs) {
+	err = udpn_send_msgs(ndata, &sent, msgs, nmsgs);
+	if (!err)
+	    goto out;
+	for (j = 0, total = 0; j < msgs[sent].sglen; j++)
+	    total += msgs[sent].sg[j].buflen;
+	if ((err != GE_INVAL && err != GE_IOERR) || total <= nadata->gso_size)
+	    goto out;
+	/* Let udpn_write_one() turn GSO off and segment it. */
+	msgs[sent].err = 0;
+	err = 0;
+    }
+
+    for (; sent < nmsgs; sent++) {
+	for (j = 0, total = 0; j < msgs[sent].sglen; j++)
+	    total += msgs[sent].sg[j].buflen;
+	msgs[sent].count = 0;
+	err = udpn_write_one(ndata, &msgs[sent].count,
+			     msgs[sent].sg, msgs[sent].sglen);
+	if (err) {
+	    msgs[sent].err = err;
+	    goto out;
+	}
+	/* A partial message has its count set, it is not counted. */
+	if (msgs[sent].count < total)
+	    goto out;
+    }
+
+ out:
+    if (!err && toobig && sent == nmsgs) {
+	err = GE_TOOBIG;
+	msgs[sent].err = err;
+    }
+    if (count)
+	*count = sent;
+    return err;
 }
 
 static int
@@ -403,10 +717,36 @@ udpn_get_raddr(struct gensio *io, void *addr, gensiods *addrlen)
     return 0;
 }
 
+static void
+udpn_check_own_read(struct udpn_data *ndata)
+{
+    if (!ndata->own_fd || ndata->own_fd_clearing)
+	return;
+
+    ndata->o->set_read_handler(ndata->o, ndata->myfd,
+			       (ndata->state == UDPN_OPEN &&
+				ndata->read_enabled &&
+				!ndata->data_pending_len));
+}
+
+static void
+udpn_fd_write_enable(struct udpn_data *ndata, bool enabled)
+{
+    if (ndata->own_fd) {
+	if (!ndata->own_fd_clearing)
+	    ndata->o->set_write_handler(ndata->o, ndata->myfd, enabled);
+    } else if (enabled) {
+	udpna_fd_write_enable(ndata->nadata);
+    } else {
+	udpna_fd_write_disable(ndata->nadata);
+    }
+}
+
 static void
 udpn_finish_close(struct udpna_data *nadata, struct udpn_data *ndata)
 {
-    if (ndata->in_read || ndata->in_write || ndata->in_open_cb)
+    if (ndata->in_read || ndata->in_write || ndata->in_open_cb ||
+		ndata->own_fd_clearing)
 	return;
 
     ndata->state = UDPN_CLOSED;
@@ -428,22 +768,65 @@ udpn_finish_close(struct udpna_data *nadata, struct udpn_data *ndata)
 	nadata->pending_data_owner = NULL;
 	nadata->data_pending_len = 0;
     }
+    ndata->data_pending_len = 0;
 
     if (ndata->freed)
 	udpn_finish_free(ndata);
 }
 
+/*
+ * Return the amount of pending data in the current datagram.  If the
+ * data was coalesced by GRO, this splits it back into the original
+ * datagrams.
+ */
+static gensiods
+udp_curr_datagram_len(gensiods pending_len, gensiods pos, gensiods seg_size)
+{
+    gensiods seglen;
+
+    if (seg_size) {
+	seglen = seg_size - (pos % seg_size);
+	if (seglen < pending_len)
+	    return seglen;
+    }
+    return pending_len;
+}
+
 static void
 udpn_finish_read(struct udpn_data *ndata)
 {
     struct udpna_data *nadata = ndata->nadata;
     struct gensio *io = ndata->io;
-    gensiods count;
+    gensiods count, len;
+    unsigned char *buf;
+    gensiods *pending_len, *pos, seg_size;
+    bool shared;
 
  retry:
+    /*
+     * Data from the accepter's socket comes first, there may be some
+     * of that even with an own fd, from before the fd was set up.
+     */
+    shared = (nadata->pending_data_owner == ndata &&
+	      nadata->data_pending_len);
+    if (shared) {
+	buf = nadata->read_data;
+	pending_len = &nadata->data_pending_len;
+	pos = &nadata->data_pos;
+	seg_size = nadata->seg_size;
+    } else {
+	buf = ndata->read_data;
+	pending_len = &ndata->data_pending_len;
+	pos = &ndata->data_pos;
+	seg_size = ndata->seg_size;
+    }
+    if (*pending_len == 0)
+	goto out;
+
+    len = udp_curr_datagram_len(*pending_len, *pos, seg_size);
     udpna_unlock(nadata);
-    count = nadata->data_pending_len;
-    gensio_cb(io, GENSIO_EVENT_READ, 0, nadata->read_data, &count, NULL);
+    count = len;
+    gensio_cb(io, GENSIO_EVENT_READ, 0, buf + *pos, &count, NULL);
     udpna_lock(nadata);
 
     if (ndata->state == UDPN_IN_CLOSE) {
@@ -451,19 +834,26 @@ udpn_finish_read(struct udpn_data *ndata)
 	goto out;
     }
 
-    if (count < nadata->data_pending_len) {
-	/* The user didn't comsume all the data */
-	nadata->data_pending_len -= count;
-	nadata->data_pos += count;
-	if (ndata->state == UDPN_OPEN && ndata->read_enabled)
-	    goto retry;
+    if (count > len)
+	count = len;
+    if (count < *pending_len) {
+	/*
+	 * The user didn't comsume all the data, or there are more
+	 * coalesced datagrams to deliver.
+	 */
+	*pending_len -= count;
+	*pos += count;
     } else {
-	nadata->pending_data_owner = NULL;
-	nadata->data_pending_len = 0;
+	if (shared)
+	    nadata->pending_data_owner = NULL;
+	*pending_len = 0;
     }
+    if (ndata->state == UDPN_OPEN && ndata->read_enabled)
+	goto retry;
  out:
     ndata->in_read = false;
     udpna_check_read_state(nadata);
+    udpn_check_own_read(ndata);
 }
 
 static void
@@ -519,6 +909,16 @@ udpn_deferred_op(struct gensio_runner *runner, void *cbdata)
 	udpna_check_read_state(nadata);
     }
 
+    if (ndata->deferred_read) {
+	ndata->deferred_read = false;
+	if (ndata->state == UDPN_OPEN && ndata->read_enabled) {
+	    udpn_finish_read(ndata);
+	} else {
+	    ndata->in_read = false;
+	    udpn_check_own_read(ndata);
+	}
+    }
+
     if (ndata->state == UDPN_IN_CLOSE) {
 	udpn_finish_close(nadata, ndata);
     }
@@ -569,17 +969,26 @@ udpn_start_close(struct udpn_data *ndata,
 	nadata->pending_data_owner = NULL;
 	nadata->data_pending_len = 0;
     }
+    ndata->data_pending_len = 0;
     ndata->close_done = close_done;
     ndata->close_data = close_data;
 
     if (ndata->read_enabled)
 	ndata->read_enabled = false;
-    else
+    else if (!ndata->own_fd)
 	udpna_fd_read_enable(nadata);
+    /* Data it had pending on the accepter's fd was dropped above. */
+    udpna_check_read_state(nadata);
 
     if (ndata->write_enabled) {
 	ndata->write_enabled = false;
-	udpna_fd_write_disable(nadata);
+	udpn_fd_write_enable(ndata, false);
+    }
+
+    if (ndata->own_fd && !ndata->own_fd_clearing) {
+	/* udpn_own_fd_cleared() will finish the close. */
+	ndata->own_fd_clearing = true;
+	ndata->o->clear_fd_handlers(ndata->o, ndata->myfd);
     }
 
     udpn_remove_from_list(&nadata->udpns, ndata);
@@ -656,7 +1065,9 @@ udpn_set_read_callback_enable(struct gensio *io, bool enabled)
     if (udpn_is_closed(ndata) || ndata->read_enabled == enabled)
 	goto out_unlock;
 
-    if (enabled) {
+    if (ndata->own_fd) {
+	/* Doesn't affect the accepter's fd. */
+    } else if (enabled) {
 	assert(nadata->read_disable_count > 0);
 	nadata->read_disable_count--;
     } else {
@@ -672,8 +1083,13 @@ udpn_set_read_callback_enable(struct gensio *io, bool enabled)
 	ndata->in_read = true;
 	/* Call the read from the selector to avoid lock nesting issues. */
 	udpna_start_deferred_op(nadata);
+    } else if (enabled && ndata->data_pending_len) {
+	ndata->in_read = true;
+	ndata->deferred_read = true;
+	udpn_start_deferred_op(ndata);
     } else {
 	udpna_check_read_state(ndata->nadata);
+	udpn_check_own_read(ndata);
     }
  out_unlock:
     udpna_unlock(nadata);
@@ -692,10 +1108,7 @@ udpn_set_write_callback_enable(struct gensio *io, bool enabled)
 	ndata->write_enabled = enabled;
 	if (ndata->state == UDPN_IN_OPEN)
 	    goto out_unlock;
-	if (enabled)
-	    udpna_fd_write_enable(ndata->nadata);
-	else
-	    udpna_fd_write_disable(ndata->nadata);
+	udpn_fd_write_enable(ndata, enabled);
     }
  out_unlock:
     udpna_unlock(nadata);
@@ -708,15 +1121,24 @@ udpn_disable(struct gensio *io)
     struct udpna_data *nadata = ndata->nadata;
 
     if (ndata->read_enabled) {
-	udpna_fd_read_disable(nadata);
+	if (!ndata->own_fd)
+	    udpna_fd_read_disable(nadata);
 	ndata->read_enabled = false;
     }
 
     if (ndata->write_enabled) {
-	udpna_fd_write_disable(nadata);
+	udpn_fd_write_enable(ndata, false);
 	ndata->write_enabled = false;
     }
 
+    if (ndata->own_fd && !ndata->own_fd_clearing) {
+	ndata->o->clear_fd_handlers_norpt(ndata->o, ndata->myfd);
+	close(ndata->myfd);
+	ndata->myfd = ndata->accfd;
+	ndata->own_fd = false;
+	ndata->own_fd_clearing = false;
+    }
+
     ndata->close_done = NULL;
     udpn_remove_from_list(&nadata->udpns, ndata);
     udpn_add_to_list(&nadata->closed_udpns, ndata);
@@ -753,7 +1175,7 @@ udpna_writehandler(int fd, void *cbdata)
     gensio_list_for_each(&nadata->udpns, l) {
 	struct udpn_data *ndata = gensio_link_to_ndata(l);
 
-	if (ndata->write_enabled) {
+	if (ndata->write_enabled && !ndata->own_fd) {
 	    udpn_handle_write_incoming(nadata, ndata);
 	    /*
 	     * Only handle one per callback, the above call releases
@@ -768,6 +1190,170 @@ udpna_writehandler(int fd, void *cbdata)
     udpna_unlock(nadata);
 }
 
+static void
+udpn_own_readhandler(int fd, void *cbdata)
+{
+    struct udpn_data *ndata = cbdata;
+    struct udpna_data *nadata = ndata->nadata;
+    socklen_t addrlen = 0;
+    gensiods datalen = 0;
+    int err;
+
+    udpna_lock(nadata);
+    if (ndata->state != UDPN_OPEN || !ndata->read_enabled || ndata->in_read ||
+		ndata->data_pending_len)
+	goto out_check;
+
+    if (nadata->gro)
+	err = gensio_os_recvfrom_gro(nadata->o, fd, ndata->read_data,
+				     nadata->max_read_size, &datalen, 0,
+				     NULL, &addrlen, &ndata->seg_size);
+    else
+	err = gensio_os_recv(nadata->o, fd, ndata->read_data,
+			     nadata->max_read_size, &datalen, 0);
+    if (err) {
+	/* A connected UDP socket reports ICMP errors, just ignore those. */
+	if (err != GE_CONNREFUSE)
+	    gensio_log(nadata->o, GENSIO_LOG_ERR,
+		       "Could not read from UDP peer socket: %s",
+		       gensio_err_to_str(err));
+	goto out_check;
+    }
+    if (datalen == 0)
+	goto out_check;
+
+    ndata->data_pending_len = datalen;
+    ndata->data_pos = 0;
+    ndata->in_read = true;
+    udpn_finish_read(ndata);
+    goto out_unlock;
+
+ out_check:
+    udpn_check_own_read(ndata);
+ out_unlock:
+    udpna_unlock(nadata);
+}
+
+static void
+udpn_own_writehandler(int fd, void *cbdata)
+{
+    struct udpn_data *ndata = cbdata;
+    struct udpna_data *nadata = ndata->nadata;
+
+    udpna_lock(nadata);
+    if (ndata->own_fd_clearing)
+	goto out_unlock;
+    ndata->o->set_write_handler(ndata->o, fd, false);
+    if (ndata->in_write || !ndata->write_enabled ||
+		ndata->state != UDPN_OPEN)
+	goto out_unlock;
+
+    /*
+     * The close can't finish until the fd is cleared, so ndata
+     * stays around through this.
+     */
+    udpn_handle_write_incoming(nadata, ndata);
+    if (ndata->write_enabled)
+	udpn_fd_write_enable(ndata, true);
+ out_unlock:
+    udpna_unlock(nadata);
+}
+
+static void
+udpn_own_fd_cleared(int fd, void *cbdata)
+{
+    struct udpn_data *ndata = cbdata;
+    struct udpna_data *nadata = ndata->nadata;
+
+    udpna_lock(nadata);
+    close(fd);
+    ndata->myfd = ndata->accfd;
+    ndata->own_fd = false;
+    ndata->own_fd_clearing = false;
+    /* If the deferred op is pending, it will finish the close. */
+    if (ndata->state == UDPN_IN_CLOSE && !ndata->deferred_op_pending)
+	udpn_finish_close(nadata, ndata);
+    udpna_unlock(nadata);
+}
+
+/*
+ * Open a socket for the given remote, bound to the same address as
+ * the accepter socket that the remote talked to and connected to the
+ * remote.  The kernel will then send the remote's packets to this
+ * socket instead of the accepter's socket.
+ */
+static int
+udpn_setup_peersock(struct udpna_data *nadata, struct udpn_data *ndata)
+{
+    struct gensio_os_funcs *o = nadata->o;
+    struct sockaddr_storage laddr;
+    socklen_t laddrlen = sizeof(laddr), optlen;
+    int fd, optval = 1, err;
+
+    ndata->read_data = o->zalloc(o, nadata->max_read_size);
+    if (!ndata->read_data)
+	return GE_NOMEM;
+
+    if (getsockname(ndata->accfd, (struct sockaddr *) &laddr,
+		    &laddrlen) == -1) {
+	err = gensio_os_err_to_err(o, errno);
+	goto out_free;
+    }
+
+    fd = socket(laddr.ss_family, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC,
+		IPPROTO_UDP);
+    if (fd == -1) {
+	err = gensio_os_err_to_err(o, errno);
+	goto out_free;
+    }
+
+    if (setsockopt(fd, SOL_SOCKET, SO_REUSEADDR,
+		   (void *)&optval, sizeof(optval)) == -1)
+	goto out_err;
+
+    if (setsockopt(fd, SOL_SOCKET, SO_REUSEPORT,
+		   (void *)&optval, sizeof(optval)) == -1)
+	goto out_err;
+
+    if (laddr.ss_family == AF_INET6) {
+	/* Must match the accepter socket to share the port. */
+	optlen = sizeof(optval);
+	if (getsockopt(ndata->accfd, IPPROTO_IPV6, IPV6_V6ONLY,
+		       &optval, &optlen) == -1)
+	    goto out_err;
+	if (setsockopt(fd, IPPROTO_IPV6, IPV6_V6ONLY,
+		       &optval, sizeof(optval)) == -1)
+	    goto out_err;
+    }
+
+    if (bind(fd, (struct sockaddr *) &laddr, laddrlen) == -1)
+	goto out_err;
+
+    if (connect(fd, ndata->raddr, ndata->raddrlen) == -1)
+	goto out_err;
+
+    udpna_setup_fd_offload(nadata, fd);
+
+    err = o->set_fd_handlers(o, fd, ndata,
+			     udpn_own_readhandler, udpn_own_writehandler,
+			     NULL, udpn_own_fd_cleared);
+    if (err)
+	goto out_close;
+
+    ndata->myfd = fd;
+    ndata->own_fd = true;
+    return 0;
+
+ out_err:
+    err = gensio_os_err_to_err(o, errno);
+ out_close:
+    close(fd);
+ out_free:
+    o->free(o, ndata->read_data);
+    ndata->read_data = NULL;
+    return err;
+}
+
 int
 udpn_control(bool get, int option, char *data, gensiods *datalen)
 {
@@ -794,6 +1380,9 @@ gensio_udp_func(struct gensio *io, int func, gensiods *count,
     case GENSIO_FUNC_WRITE_SG:
 	return udpn_write(io, count, cbuf, buflen);
 
+    case GENSIO_FUNC_WRITE_MSGS:
+	return udpn_write_msgs(io, count, buf, buflen);
+
     case GENSIO_FUNC_RADDR_TO_STR:
 	return udpn_raddr_to_str(io, count, buf, buflen);
 
@@ -867,6 +1456,7 @@ udp_alloc_gensio(struct udpna_data *nadata, int fd, struct sockaddr *addr,
     gensio_set_is_packet(ndata->io, true);
 
     ndata->myfd = fd;
+    ndata->accfd = fd;
     ndata->raddrlen = addrlen;
     memcpy(ndata->raddr, addr, addrlen);
 
@@ -892,10 +1482,17 @@ udpna_readhandler(int fd, void *cbdata)
     if (nadata->data_pending_len)
 	goto out_unlock;
 
-    err = gensio_os_recvfrom(nadata->o,
-			     fd, nadata->read_data, nadata->max_read_size,
-			     &datalen, 0,
-			     (struct sockaddr *) &addr, &addrlen);
+    if (nadata->gro)
+	err = gensio_os_recvfrom_gro(nadata->o,
+				     fd, nadata->read_data, nadata->max_read_size,
+				     &datalen, 0,
+				     (struct sockaddr *) &addr, &addrlen,
+				     &nadata->seg_size);
+    else
+	err = gensio_os_recvfrom(nadata->o,
+				 fd, nadata->read_data, nadata->max_read_size,
+				 &datalen, 0,
+				 (struct sockaddr *) &addr, &addrlen);
     if (err) {
 	gensio_acc_log(nadata->acc, GENSIO_LOG_ERR,
 		       "Could not accept on UDP: %s", gensio_err_to_str(err));
@@ -916,9 +1513,11 @@ udpna_readhandler(int fd, void *cbdata)
     nadata->data_pos = 0;
 
     ndata = udpn_find(&nadata->udpns, (struct sockaddr *) &addr, addrlen);
-    if (ndata)
+    if (ndata) {
 	/* Data belongs to an existing connection. */
+	nadata->pending_data_owner = ndata;
 	goto got_ndata;
+    }
 
     if (nadata->closed || !nadata->enabled) {
 	nadata->data_pending_len = 0;
@@ -931,8 +1530,17 @@ udpna_readhandler(int fd, void *cbdata)
     if (!ndata)
 	goto out_nomem;
 
+    if (nadata->peersock) {
+	err = udpn_setup_peersock(nadata, ndata);
+	if (err)
+	    gensio_acc_log(nadata->acc, GENSIO_LOG_WARNING,
+			   "Could not set up UDP peer socket, using the"
+			   " accepter socket: %s", gensio_err_to_str(err));
+    }
+
     ndata->state = UDPN_OPEN;
-    nadata->read_disable_count++;
+    if (!ndata->own_fd)
+	nadata->read_disable_count++;
 
     nadata->pending_data_owner = ndata;
     nadata->in_new_connection = true;
@@ -1002,10 +1610,12 @@ udpna_startup(struct gensio_accepter *accepter)
 	rv = gensio_open_socket(nadata->o, nadata->ai,
 				udpna_readhandler, udpna_writehandler,
 				udpna_fd_cleared, nadata,
+				nadata->peersock ? GENSIO_OPENSOCK_REUSEPORT : 0,
 				&nadata->fds, &nadata->nr_fds);
 	if (rv)
 	    goto out_unlock;
 	nadata->nr_accept_close_waiting = nadata->nr_fds;
+	udpna_setup_offload(nadata);
     }
 
     nadata->enabled = true;
@@ -1243,6 +1853,7 @@ gensio_acc_udp_func(struct gensio_accepter *acc, int func, int val,
 
 static int
 i_udp_gensio_accepter_alloc(struct addrinfo *iai, gensiods max_read_size,
+			    bool gro, gensiods gso_size, bool peersock,
 			    struct gensio_os_funcs *o,
 			    gensio_accepter_event cb, void *user_data,
 			    struct gensio_accepter **accepter)
@@ -1261,6 +1872,10 @@ i_udp_gensio_accepter_alloc(struct addrinfo *iai, gensiods max_read_size,
     if (!nadata->ai && iai) /* Allow a null ai if it was passed in. */
 	goto out_nomem;
 
+    /* Coalesced reads can be up to a full sized UDP packet. */
+    if (gro && max_read_size < GENSIO_DEFAULT_UDP_BUF_SIZE)
+	max_read_size = GENSIO_DEFAULT_UDP_BUF_SIZE;
+
     nadata->read_data = o->zalloc(o, max_read_size);
     if (!nadata->read_data)
 	goto out_nomem;
@@ -1280,6 +1895,9 @@ i_udp_gensio_accepter_alloc(struct addrinfo *iai, gensiods max_read_size,
     gensio_acc_set_is_packet(nadata->acc, true);
 
     nadata->max_read_size = max_read_size;
+    nadata->gro = gro;
+    nadata->gso_size = gso_size;
+    nadata->peersock = peersock;
 
     *accepter = nadata->acc;
     return 0;
@@ -1296,16 +1914,43 @@ udp_gensio_accepter_alloc(struct addrinfo *iai, const char * const args[],
 			  struct gensio_accepter **accepter)
 {
     gensiods max_read_size = GENSIO_DEFAULT_UDP_BUF_SIZE;
+    bool gro = false, peersock = false;
+    gensiods gso_size = 0;
     unsigned int i;
+    int ival, err;
+
+    err = gensio_get_default(o, "udp", "peersock", false,
+			     GENSIO_DEFAULT_BOOL, NULL, &ival);
+    if (!err)
+	peersock = ival;
+
+    err = gensio_get_default(o, "udp", "gro", false,
+			     GENSIO_DEFAULT_BOOL, NULL, &ival);
+    if (!err)
+	gro = ival;
+
+    err = gensio_get_default(o, "udp", "gso", false,
+			     GENSIO_DEFAULT_INT, NULL, &ival);
+    if (!err)
+	gso_size = ival;
 
     for (i = 0; args && args[i]; i++) {
 	if (gensio_check_keyds(args[i], "readbuf", &max_read_size) > 0)
 	    continue;
+	if (gensio_check_keybool(args[i], "gro", &gro) > 0)
+	    continue;
+	if (gensio_check_keyds(args[i], "gso", &gso_size) > 0)
+	    continue;
+	if (gensio_check_keybool(args[i], "peersock", &peersock) > 0)
+	    continue;
 	return GE_INVAL;
     }
 
-    return i_udp_gensio_accepter_alloc(iai, max_read_size, o, cb, user_data,
-				       accepter);
+    if (gso_size > UDP_GSO_MAX_LEN)
+	return GE_INVAL;
+
+    return i_udp_gensio_accepter_alloc(iai, max_read_size, gro, gso_size,
+				       peersock, o, cb, user_data, accepter);
 }
 
 int
@@ -1338,10 +1983,22 @@ udp_gensio_alloc(struct addrinfo *ai, const char * const args[],
     struct gensio_accepter *accepter;
     struct udpna_data *nadata = NULL;
     struct addrinfo *lai = NULL;
-    int err, new_fd, optval = 1;
+    int err, new_fd, optval = 1, ival;
     gensiods max_read_size = GENSIO_DEFAULT_UDP_BUF_SIZE;
+    bool gro = false;
+    gensiods gso_size = 0;
     unsigned int i;
 
+    err = gensio_get_default(o, "udp", "gro", false,
+			     GENSIO_DEFAULT_BOOL, NULL, &ival);
+    if (!err)
+	gro = ival;
+
+    err = gensio_get_default(o, "udp", "gso", false,
+			     GENSIO_DEFAULT_INT, NULL, &ival);
+    if (!err)
+	gso_size = ival;
+
     err = gensio_get_defaultaddr(o, "udp", "laddr", false,
 				 IPPROTO_UDP, true, false, &lai);
     if (err != GE_NOTSUP)
@@ -1354,6 +2011,16 @@ udp_gensio_alloc(struct addrinfo *ai, const char * const args[],
 	if (gensio_check_keyaddrs(o, args[i], "laddr", IPPROTO_UDP,
 				  true, false, &lai) > 0)
 	    continue;
+	if (gensio_check_keybool(args[i], "gro", &gro) > 0)
+	    continue;
+	if (gensio_check_keyds(args[i], "gso", &gso_size) > 0)
+	    continue;
+	return GE_INVAL;
+    }
+
+    if (gso_size > UDP_GSO_MAX_LEN) {
+	if (lai)
+	    gensio_free_addrinfo(o, lai);
 	return GE_INVAL;
     }
 
@@ -1396,8 +2063,8 @@ udp_gensio_alloc(struct addrinfo *ai, const char * const args[],
     }
 
     /* Allocate a dummy network accepter. */
-    err = i_udp_gensio_accepter_alloc(NULL, max_read_size, o,
-				      NULL, NULL, &accepter);
+    err = i_udp_gensio_accepter_alloc(NULL, max_read_size, gro, gso_size,
+				      false, o, NULL, NULL, &accepter);
     if (err) {
 	close(new_fd);
 	return err;
@@ -1413,6 +2080,7 @@ udp_gensio_alloc(struct addrinfo *ai, const char * const args[],
     nadata->fds->family = ai->ai_family;
     nadata->fds->fd = new_fd;
     nadata->nr_fds = 1;
+    udpna_setup_offload(nadata);
     /* fd belongs to udpn now, updn_do_free() will close it. */
 
     nadata->closed = true; /* Free nadata when ndata is freed. */
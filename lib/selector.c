@@ -206,6 +206,19 @@ struct selector_s
     void (*sel_unlock)(sel_lock_t *);
 };
 
+/*
+ * The selector this thread is currently running handlers for, if
+ * any.  A runner queued from one of those handlers gets run before
+ * the selector returns, so there is nothing to wake.  A runner queued
+ * from anywhere else has to wake a thread waiting in the selector, or
+ * it would sit there until something else happened.
+ */
+#ifdef USE_PTHREADS
+static __thread struct selector_s *sel_dispatching;
+#else
+static struct selector_s *sel_dispatching;
+#endif
+
 static void
 sel_timer_lock(struct selector_s *sel)
 {
@@ -892,6 +905,8 @@ sel_run(sel_runner_t *runner, sel_runner_func_t func, void *cb_data)
 	sel->runner_head = runner;
 	sel->runner_tail = runner;
     }
+    if (sel_dispatching != sel)
+	i_wake_sel_thread(sel);
     sel_timer_unlock(sel);
     return 0;
 }
@@ -1037,7 +1052,8 @@ process_fds_epoll(struct selector_s *sel, struct timeval *tvtimeout)
     sel_fd_lock(sel);
     fd = event.data.fd;
     fdc = (fd_control_t *) &sel->fds[fd];
-    if (event.events & (EPOLLHUP | EPOLLERR)) {
+    if ((event.events & EPOLLHUP) ||
+	    ((event.events & EPOLLERR) && !FD_ISSET(fd, &sel->except_set))) {
 	/*
 	 * The crazy people that designed epoll made it so that EPOLLHUP
 	 * and EPOLLERR always wake it up, even if they are not set.  That
@@ -1047,6 +1063,11 @@ process_fds_epoll(struct selector_s *sel, struct timeval *tvtimeout)
 	 * it, since in those cases you will not get anything but an
 	 * EPOLLHUP or EPOLLERR, anyway, and then doing the callback
 	 * by hand.
+	 *
+	 * If the except handler is enabled, an EPOLLERR by itself is
+	 * passed to it and it is expected to clear the condition.  This
+	 * is how error queue messages (like MSG_ZEROCOPY completions)
+	 * are received.
 	 */
 	sel_update_epoll(sel, fd, EPOLL_CTL_DEL, 0);
 	fdc->saved_events = event.events & (EPOLLHUP | EPOLLERR);
@@ -1113,12 +1134,14 @@ sel_select_intr(struct selector_s *sel,
     unsigned int    count;
     struct timeval  end = { 0, 0 }, now;
     int user_timeout = 0;
+    struct selector_s *old_dispatching = sel_dispatching;
 
     if (timeout) {
 	sel_get_monotonic_time(&now);
 	add_timeval(&end, &now, timeout);
     }
 
+    sel_dispatching = sel;
     sel_timer_lock(sel);
     count = process_runners(sel);
     /* If count is non-zero or any timers are processed, timeout is set to 0. */
@@ -1152,7 +1175,13 @@ sel_select_intr(struct selector_s *sel,
 
     sel_timer_lock(sel);
     remove_sel_wait_list(sel, &wait_entry);
+    /*
+     * Run anything the handlers queued now instead of on the next
+     * call, which may be a while if the caller has other things to do.
+     */
+    count += process_runners(sel);
     sel_timer_unlock(sel);
+    sel_dispatching = old_dispatching;
 
     if (timeout) {
 	sel_get_monotonic_time(&now);
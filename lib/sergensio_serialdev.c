@@ -1597,15 +1597,38 @@ serialdev_gensio_alloc(const char *devname, const char * const args[],
     int err;
     char *comma;
     gensiods max_read_size = GENSIO_DEFAULT_BUF_SIZE;
-    int i;
+    gensiods read_budget = 65536;
+    gensiods readbuf_min = 1024, readbuf_max = 0;
+    int i, ival;
     bool nouucplock_set = false;
 
     if (!sdata)
 	return GE_NOMEM;
 
+    err = gensio_get_default(o, "serialdev", "read_budget", false,
+			     GENSIO_DEFAULT_INT, NULL, &ival);
+    if (!err)
+	read_budget = ival;
+
+    err = gensio_get_default(o, "serialdev", "readbuf_min", false,
+			     GENSIO_DEFAULT_INT, NULL, &ival);
+    if (!err)
+	readbuf_min = ival;
+
+    err = gensio_get_default(o, "serialdev", "readbuf_max", false,
+			     GENSIO_DEFAULT_INT, NULL, &ival);
+    if (!err)
+	readbuf_max = ival;
+
     for (i = 0; args && args[i]; i++) {
 	if (gensio_check_keyds(args[i], "readbuf", &max_read_size) > 0)
 	    continue;
+	if (gensio_check_keyds(args[i], "read_budget", &read_budget) > 0)
+	    continue;
+	if (gensio_check_keyds(args[i], "readbuf_min", &readbuf_min) > 0)
+	    continue;
+	if (gensio_check_keyds(args[i], "readbuf_max", &readbuf_max) > 0)
+	    continue;
 	if (gensio_check_keybool(args[i], "nouucplock",
 				 &sdata->no_uucp_lock) > 0) {
 	    nouucplock_set = true;
@@ -1666,6 +1689,8 @@ serialdev_gensio_alloc(const char *devname, const char * const args[],
 			    sdata->write_only);
     if (!ll)
 	goto out_nomem;
+    gensio_fd_ll_set_read_budget(ll, read_budget);
+    gensio_fd_ll_set_read_size_range(ll, readbuf_min, readbuf_max);
 
     /*
      * After this point, freeing the ll or io will free sdata through
@@ -55,6 +55,7 @@ alloc_waiter(struct selector_s *sel, int wake_sig)
     if (waiter) {
 	memset(waiter, 0, sizeof(*waiter));
 	waiter->sel = sel;
+	waiter->wake_sig = wake_sig;
 	pthread_mutex_init(&waiter->lock, NULL);
 	waiter->wts.next = &waiter->wts;
 	waiter->wts.prev = &waiter->wts;
@@ -150,6 +151,21 @@ wake_waiter(waiter_t *waiter)
     pthread_mutex_unlock(&waiter->lock);
 }
 
+bool
+try_wait_for_waiter(waiter_t *waiter, unsigned int count)
+{
+    bool rv = false;
+
+    pthread_mutex_lock(&waiter->lock);
+    if (waiter->count >= count) {
+	waiter->count -= count;
+	rv = true;
+    }
+    pthread_mutex_unlock(&waiter->lock);
+
+    return rv;
+}
+
 #else /* USE_PTHREADS */
 
 struct waiter_s {
@@ -207,6 +223,15 @@ wake_waiter(waiter_t *waiter)
     waiter->count++;
 }
 
+bool
+try_wait_for_waiter(waiter_t *waiter, unsigned int count)
+{
+    if (waiter->count < count)
+	return false;
+    waiter->count -= count;
+    return true;
+}
+
 #endif /* USE_PTHREADS */
 
 int
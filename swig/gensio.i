@@ -24,8 +24,10 @@
 #include <signal.h>
 
 #include <gensio/gensio.h>
+#include <gensio/gensio_class.h>
 #include <gensio/sergensio.h>
 #include <gensio/gensio_selector.h>
+#include <gensio/gensio_osops.h>
 
 #if PYTHON_HAS_POSIX_THREADS
 #include <pthread.h>
@@ -37,6 +39,11 @@ struct waiter {
     struct gensio_waiter *waiter;
 };
 
+struct pool {
+    struct gensio_os_funcs *o;
+    struct gensio_pool *pool;
+};
+
 /*
  * If an exception occurs inside a waiter, we want to stop the wait
  * operation and propagate back.  So we wake it up
@@ -208,6 +215,35 @@ gensio_thread_sighandler(int sig)
 }
 #endif
 
+void str_to_gensio_asynct(struct gensio_os_funcs *o, char *str,
+			  swig_cb *handler, swig_cb *done)
+{
+    struct str_to_gensio_data *adata;
+    int rv;
+
+    adata = malloc(sizeof(*adata));
+    if (!adata) {
+	err_handle("str_to_gensio_async", GE_NOMEM);
+	return;
+    }
+    adata->data = alloc_gensio_data(o, handler);
+    if (!adata->data) {
+	free(adata);
+	err_handle("str_to_gensio_async", GE_NOMEM);
+	return;
+    }
+    adata->done_val = ref_swig_cb(done, str_to_gensio_done);
+
+    rv = str_to_gensio_async(str, o, gensio_child_event, adata->data,
+			     gensio_str_to_gensio_done, adata);
+    if (rv) {
+	deref_swig_cb_val(adata->done_val);
+	free_gensio_data(adata->data);
+	free(adata);
+    }
+    err_handle("str_to_gensio_async", rv);
+}
+
 struct gensio_os_funcs *alloc_gensio_selector(swig_cb *log_handler)
 {
     struct selector_s *sel;
@@ -293,11 +329,23 @@ struct sergensio { };
 struct gensio_accepter { };
 struct gensio_os_funcs { };
 struct waiter { };
+struct pool { };
+struct relay { };
 
 %extend gensio_os_funcs {
     ~gensio_os_funcs() {
 	check_os_funcs_free(self);
     }
+
+    void set_default(char *classname, char *name, char *strval, int intval) {
+	int rv = gensio_set_default(self, classname, name, strval, intval);
+
+	err_handle("set_default", rv);
+    }
+
+    void dns_flush() {
+	gensio_os_dns_flush(self);
+    }
 }
 
 %constant int GE_NOTSUP = GE_NOTSUP;
@@ -320,6 +368,20 @@ struct waiter { };
 %constant int GENSIO_CONTROL_SERVICE = GENSIO_CONTROL_SERVICE;
 %constant int GENSIO_CONTROL_CERT = GENSIO_CONTROL_CERT;
 %constant int GENSIO_CONTROL_CERT_FINGERPRINT = GENSIO_CONTROL_CERT_FINGERPRINT;
+%constant int GENSIO_CONTROL_ACCEPT_STATS = GENSIO_CONTROL_ACCEPT_STATS;
+%constant int GENSIO_CONTROL_POOL_STATS = GENSIO_CONTROL_POOL_STATS;
+%constant int GENSIO_CONTROL_READ_BUFFER_SIZE = GENSIO_CONTROL_READ_BUFFER_SIZE;
+%constant int GENSIO_CONTROL_SNDBUF = GENSIO_CONTROL_SNDBUF;
+%constant int GENSIO_CONTROL_RCVBUF = GENSIO_CONTROL_RCVBUF;
+%constant int GENSIO_CONTROL_NOTSENT_LOWAT = GENSIO_CONTROL_NOTSENT_LOWAT;
+%constant int GENSIO_CONTROL_CORK = GENSIO_CONTROL_CORK;
+%constant int GENSIO_CONTROL_QUICKACK = GENSIO_CONTROL_QUICKACK;
+%constant int GENSIO_CONTROL_BUSY_POLL = GENSIO_CONTROL_BUSY_POLL;
+%constant int GENSIO_CONTROL_USER_TIMEOUT = GENSIO_CONTROL_USER_TIMEOUT;
+%constant int GENSIO_CONTROL_WRITE_CORK = GENSIO_CONTROL_WRITE_CORK;
+%constant int GENSIO_CONTROL_WRITE_HIGH_WATER = GENSIO_CONTROL_WRITE_HIGH_WATER;
+%constant int GENSIO_CONTROL_WRITE_LOW_WATER = GENSIO_CONTROL_WRITE_LOW_WATER;
+%constant int GENSIO_CONTROL_WRITE_QUEUED = GENSIO_CONTROL_WRITE_QUEUED;
 
 %extend gensio {
     gensio(struct gensio_os_funcs *o, char *str, swig_cb *handler) {
@@ -417,6 +479,20 @@ struct waiter { };
 	err_handle("open_nochild", rv);
     }
 
+    void sendfile(int fd, long offset, long len, const char *const *args,
+		  swig_cb *done) {
+	swig_cb_val *done_val;
+	int rv;
+
+	done_val = ref_swig_cb(done, sendfile_done);
+	rv = gensio_sendfile(self, fd, offset, len, args,
+			     gensio_sendfile_finished, done_val);
+	if (rv)
+	    deref_swig_cb_val(done_val);
+
+	err_handle("sendfile", rv);
+    }
+
     %rename(open_s) open_st;
     void open_st() {
 	err_handle("open_s", gensio_open_s(self));
@@ -484,6 +560,25 @@ struct waiter { };
 	return io;
     }
 
+    %newobject raddr_to_str;
+    char *raddr_to_str() {
+	gensiods pos = 0;
+	char *buf = malloc(256);
+	int rv;
+
+	if (!buf) {
+	    err_handle("raddr_to_str", GE_NOMEM);
+	    return NULL;
+	}
+	rv = gensio_raddr_to_str(self, &pos, buf, 256);
+	if (rv) {
+	    free(buf);
+	    buf = NULL;
+	}
+	err_handle("raddr_to_str", rv);
+	return buf;
+    }
+
     %rename(get_type) get_typet;
     const char *get_typet(unsigned int depth) {
 	return gensio_get_type(self, depth);
@@ -522,6 +617,50 @@ struct waiter { };
 	return wr;
     }
 
+    /*
+     * The data is copied, so python doesn't have to keep it around
+     * until the write is done.
+     */
+    void write_queued(char *bytestr, my_ssize_t len, swig_cb *done) {
+	struct write_queued_data *wdata;
+	int rv;
+
+	wdata = malloc(sizeof(*wdata));
+	if (!wdata) {
+	    err_handle("write_queued", GE_NOMEM);
+	    return;
+	}
+	wdata->buf = malloc(len ? len : 1);
+	if (!wdata->buf) {
+	    free(wdata);
+	    err_handle("write_queued", GE_NOMEM);
+	    return;
+	}
+	memcpy(wdata->buf, bytestr, len);
+	wdata->done_val = NULL;
+	if (!nil_swig_cb(done))
+	    wdata->done_val = ref_swig_cb(done, write_queued_done);
+	rv = gensio_write_queued(self, wdata->buf, len,
+				 gensio_write_queued_finished, wdata);
+	if (rv) {
+	    if (wdata->done_val)
+		deref_swig_cb_val(wdata->done_val);
+	    free(wdata->buf);
+	    free(wdata);
+	}
+	err_handle("write_queued", rv);
+    }
+
+    %rename(write_msgs) write_msgst;
+    unsigned int write_msgst(struct gensio_msg *msgs, gensiods nmsgs) {
+	gensiods count = 0;
+	int rv;
+
+	rv = gensio_write_msgs(self, &count, msgs, nmsgs);
+	err_handle("write_msgs", rv);
+	return count;
+    }
+
     void read_cb_enable(bool enable) {
 	gensio_set_read_callback_enable(self, enable);
     }
@@ -536,6 +675,12 @@ struct waiter { };
 	err_handle("set_sync", rv);
     }
 
+    %rename(set_sync_ring) set_sync_ringt;
+    void set_sync_ringt(unsigned int ring_size) {
+	int rv = gensio_set_sync_ring(self, ring_size);
+	err_handle("set_sync_ring", rv);
+    }
+
     %rename(clear_sync) clear_synct;
     void clear_synct() {
 	int rv = gensio_clear_sync(self);
@@ -546,7 +691,7 @@ struct waiter { };
     void read_st(char **rbuffer, size_t *rbuffer_len, long *r_int,
 		 unsigned int reqlen, long timeout) {
 	int rv;
-	struct timeval tv = { timeout / 1000, timeout % 1000 };
+	struct timeval tv = { timeout / 1000, (timeout % 1000) * 1000 };
 	struct timeval *rtv = &tv;
 	char *buf = malloc(reqlen);
 	gensiods count = 0;
@@ -570,10 +715,70 @@ struct waiter { };
 	err_handle("read_s", rv);
     }
 
+    %rename(read_s_min) read_s_mint;
+    void read_s_mint(char **rbuffer, size_t *rbuffer_len, long *r_int,
+		     unsigned int reqlen, unsigned int minlen, long timeout) {
+	int rv;
+	struct timeval tv = { timeout / 1000, (timeout % 1000) * 1000 };
+	struct timeval *rtv = &tv;
+	char *buf = malloc(reqlen);
+	gensiods count = 0;
+
+	if (!buf) {
+	    rv = GE_NOMEM;
+	    goto out;
+	}
+	if (timeout < 0)
+	    rtv = NULL;
+	rv = gensio_read_s_min(self, &count, buf, reqlen, minlen, rtv);
+	if (!rv) {
+	    *rbuffer = buf;
+	    *rbuffer_len = count;
+	} else {
+	    free(buf);
+	}
+	if (rtv)
+	    *r_int = rtv->tv_sec * 1000 + ((rtv->tv_usec + 500) / 1000);
+	else
+	    *r_int = 0;
+    out:
+	err_handle("read_s_min", rv);
+    }
+
+    %rename(read_s_delim) read_s_delimt;
+    void read_s_delimt(char **rbuffer, size_t *rbuffer_len, long *r_int,
+		       unsigned int reqlen, int delim, long timeout) {
+	int rv;
+	struct timeval tv = { timeout / 1000, (timeout % 1000) * 1000 };
+	struct timeval *rtv = &tv;
+	char *buf = malloc(reqlen);
+	gensiods count = 0;
+
+	if (!buf) {
+	    rv = GE_NOMEM;
+	    goto out;
+	}
+	if (timeout < 0)
+	    rtv = NULL;
+	rv = gensio_read_s_delim(self, &count, buf, reqlen, delim, rtv);
+	if (!rv) {
+	    *rbuffer = buf;
+	    *rbuffer_len = count;
+	} else {
+	    free(buf);
+	}
+	if (rtv)
+	    *r_int = rtv->tv_sec * 1000 + ((rtv->tv_usec + 500) / 1000);
+	else
+	    *r_int = 0;
+    out:
+	err_handle("read_s_delim", rv);
+    }
+
     %rename(write_s) write_st;
     long write_st(long *r_int, char *bytestr, my_ssize_t len, long timeout) {
 	int rv;
-	struct timeval tv = { timeout / 1000, timeout % 1000 };
+	struct timeval tv = { timeout / 1000, (timeout % 1000) * 1000 };
 	struct timeval *rtv = &tv;
 	gensiods count = 0;
 
@@ -914,6 +1119,12 @@ struct waiter { };
 	err_handle("shutdown_s", rv);
     }
 
+    void set_accept_callback_enable_s(bool enabled) {
+	int rv = gensio_acc_set_accept_callback_enable_s(self, enabled);
+
+	err_handle("set_accept_callback_enable_s", rv);
+    }
+
     %newobject control;
     char *control(int depth, bool get, int option, char *controldata) {
 	int rv;
@@ -991,7 +1202,7 @@ struct waiter { };
     }
 
     long wait_timeout(unsigned int count, int timeout) {
-	struct timeval tv = { timeout / 1000, timeout % 1000 };
+	struct timeval tv = { timeout / 1000, (timeout % 1000) * 1000 };
 
 	gensio_do_wait(self, count, &tv);
 	return tv.tv_sec * 1000 + ((tv.tv_usec + 500) / 1000);
@@ -1006,6 +1217,150 @@ struct waiter { };
     }
 }
 
+%apply const char *const *auxdata { const char *const *args };
+%extend pool {
+    pool(struct gensio_os_funcs *o, char *str, const char *const *args) {
+	struct pool *p = malloc(sizeof(*p));
+	int rv;
+
+	if (!p) {
+	    err_handle("pool", GE_NOMEM);
+	    return NULL;
+	}
+	p->o = o;
+	rv = gensio_pool_alloc(o, str, args, &p->pool);
+	if (rv) {
+	    free(p);
+	    err_handle("pool", rv);
+	    return NULL;
+	}
+	os_funcs_ref(o);
+	return p;
+    }
+
+    ~pool() {
+	gensio_pool_free(self->pool);
+	check_os_funcs_free(self->o);
+	free(self);
+    }
+
+    void get(swig_cb *handler, swig_cb *done) {
+	struct pool_get_data *pdata;
+	int rv;
+
+	pdata = malloc(sizeof(*pdata));
+	if (!pdata) {
+	    err_handle("get", GE_NOMEM);
+	    return;
+	}
+	pdata->data = alloc_gensio_data(self->o, handler);
+	if (!pdata->data) {
+	    free(pdata);
+	    err_handle("get", GE_NOMEM);
+	    return;
+	}
+	pdata->done_val = ref_swig_cb(done, pool_get_done);
+
+	rv = gensio_pool_get(self->pool, gensio_child_event, pdata->data,
+			     gensio_pool_get_done, pdata);
+	if (rv) {
+	    deref_swig_cb_val(pdata->done_val);
+	    free_gensio_data(pdata->data);
+	    free(pdata);
+	}
+	err_handle("get", rv);
+    }
+
+    /*
+     * The gensio is not handed back until python is done with it, these
+     * just say what to do with it then.
+     */
+    void release(struct gensio *io) {
+	struct gensio_data *data = gensio_get_user_data(io);
+
+	if (data->pool != self->pool)
+	    err_handle("release", GE_INVAL);
+	else
+	    data->pool_keep = true;
+    }
+
+    void drop(struct gensio *io) {
+	struct gensio_data *data = gensio_get_user_data(io);
+
+	if (data->pool != self->pool)
+	    err_handle("drop", GE_INVAL);
+	else
+	    data->pool_keep = false;
+    }
+}
+
+%extend relay {
+    relay(struct gensio_os_funcs *o, struct gensio *io1, struct gensio *io2,
+	  const char *const *args, swig_cb *done) {
+	struct relay *r = malloc(sizeof(*r));
+	unsigned int i;
+	int rv;
+
+	if (!r) {
+	    err_handle("relay", GE_NOMEM);
+	    return NULL;
+	}
+	r->o = o;
+	r->io[0] = io1;
+	r->io[1] = io2;
+	r->done_val = ref_swig_cb(done, relay_done);
+	rv = gensio_relay_alloc(o, io1, io2, args, gensio_relay_finished, r,
+				&r->relay);
+	if (rv) {
+	    deref_swig_cb_val(r->done_val);
+	    free(r);
+	    err_handle("relay", rv);
+	    return NULL;
+	}
+	/* Keep the gensios around while the relay has them. */
+	for (i = 0; i < 2; i++) {
+	    r->data[i] = gensio_get_user_data(r->io[i]);
+	    ref_gensio_data(r->data[i]);
+	}
+	os_funcs_ref(o);
+	return r;
+    }
+
+    ~relay() {
+	unsigned int i;
+
+	relay_clear_override(self);
+	gensio_relay_free(self->relay);
+	for (i = 0; i < 2; i++)
+	    deref_gensio_data(self->data[i], self->io[i]);
+	deref_swig_cb_val(self->done_val);
+	check_os_funcs_free(self->o);
+	free(self);
+    }
+
+    void start() {
+	unsigned int i;
+	int rv;
+
+	rv = gensio_relay_start(self->relay);
+	if (!rv) {
+	    /*
+	     * The relay just took over the callbacks.  Put back the
+	     * python ones and have them pass the events on, so the user
+	     * data still points to the python data.
+	     */
+	    for (i = 0; i < 2; i++) {
+		self->data[i]->cb_override_data =
+		    gensio_get_user_data(self->io[i]);
+		self->data[i]->cb_override = gensio_get_cb(self->io[i]);
+		gensio_set_callback(self->io[i], gensio_child_event,
+				    self->data[i]);
+	    }
+	}
+	err_handle("start", rv);
+    }
+}
+
 /* Get a bunch of random bytes. */
 void get_random_bytes(char **rbuffer, size_t *rbuffer_len,
 		      int size_to_allocate);
@@ -1013,6 +1368,10 @@ void get_random_bytes(char **rbuffer, size_t *rbuffer_len,
 %newobject alloc_gensio_selector;
 struct gensio_os_funcs *alloc_gensio_selector(swig_cb *log_handler);
 
+%rename(str_to_gensio_async) str_to_gensio_asynct;
+void str_to_gensio_asynct(struct gensio_os_funcs *o, char *str,
+			  swig_cb *handler, swig_cb *done);
+
 %constant int GENSIO_LOG_FATAL = GENSIO_LOG_FATAL;
 %constant int GENSIO_LOG_ERR = GENSIO_LOG_ERR;
 %constant int GENSIO_LOG_WARNING = GENSIO_LOG_WARNING;
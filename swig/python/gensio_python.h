@@ -279,6 +279,21 @@ struct gensio_data {
     int refcount;
     swig_cb_val *handler_val;
     struct gensio_os_funcs *o;
+
+    /*
+     * Gensios from a pool go back to the pool when the last reference
+     * goes away, released if pool_keep is set, dropped otherwise.
+     */
+    struct gensio_pool *pool;
+    bool pool_keep;
+
+    /*
+     * If set, events go to this instead of python.  This is for C
+     * code (like a relay) that takes over the callbacks, the user
+     * data of the gensio has to stay pointing here.
+     */
+    gensio_event cb_override;
+    void *cb_override_data;
 };
 
 static struct gensio_data *
@@ -297,6 +312,10 @@ alloc_gensio_data(struct gensio_os_funcs *o, swig_cb *handler)
 	data->handler_val = ref_swig_cb(handler, read_callback);
     os_funcs_ref(o);
     data->o = o;
+    data->pool = NULL;
+    data->pool_keep = false;
+    data->cb_override = NULL;
+    data->cb_override_data = NULL;
 
     return data;
 }
@@ -328,7 +347,12 @@ deref_gensio_data(struct gensio_data *data, struct gensio *io)
     data->refcount--;
     if (data->refcount <= 0) {
 	os_funcs_unlock(odata);
-	gensio_free(io);
+	if (!data->pool)
+	    gensio_free(io);
+	else if (data->pool_keep)
+	    gensio_pool_release(data->pool, io);
+	else
+	    gensio_pool_drop(data->pool, io);
 	free_gensio_data(data);
     } else {
 	os_funcs_unlock(odata);
@@ -439,6 +463,193 @@ gensio_open_done(struct gensio *io, int err, void *cb_data) {
     OI_PY_STATE_PUT(gstate);
 }
 
+static void
+gensio_sendfile_finished(struct gensio *io, int err, gensiods count,
+			 void *cb_data) {
+    swig_cb_val *cb = cb_data;
+    swig_ref io_ref;
+    PyObject *args, *o;
+    OI_PY_STATE gstate;
+
+    gstate = OI_PY_STATE_GET();
+
+    io_ref = swig_make_ref(io, gensio);
+    gensio_ref(io);
+    args = PyTuple_New(3);
+    PyTuple_SET_ITEM(args, 0, io_ref.val);
+    if (err) {
+	o = OI_PI_FromString(gensio_err_to_str(err));
+    } else {
+	Py_INCREF(Py_None);
+	o = Py_None;
+    }
+    PyTuple_SET_ITEM(args, 1, o);
+    PyTuple_SET_ITEM(args, 2, PyInt_FromLong(count));
+
+    swig_finish_call(cb, "sendfile_done", args, false);
+
+    deref_swig_cb_val(cb);
+    OI_PY_STATE_PUT(gstate);
+}
+
+struct write_queued_data {
+    swig_cb_val *done_val;
+    char *buf;
+};
+
+static void
+gensio_write_queued_finished(struct gensio *io, int err, gensiods count,
+			     void *cb_data) {
+    struct write_queued_data *wdata = cb_data;
+    swig_ref io_ref;
+    PyObject *args, *o;
+    OI_PY_STATE gstate;
+
+    gstate = OI_PY_STATE_GET();
+
+    if (wdata->done_val) {
+	io_ref = swig_make_ref(io, gensio);
+	gensio_ref(io);
+	args = PyTuple_New(3);
+	PyTuple_SET_ITEM(args, 0, io_ref.val);
+	if (err) {
+	    o = OI_PI_FromString(gensio_err_to_str(err));
+	} else {
+	    Py_INCREF(Py_None);
+	    o = Py_None;
+	}
+	PyTuple_SET_ITEM(args, 1, o);
+	PyTuple_SET_ITEM(args, 2, PyInt_FromLong(count));
+
+	swig_finish_call(wdata->done_val, "write_queued_done", args, false);
+
+	deref_swig_cb_val(wdata->done_val);
+    }
+    free(wdata->buf);
+    free(wdata);
+    OI_PY_STATE_PUT(gstate);
+}
+
+struct str_to_gensio_data {
+    struct gensio_data *data;
+    swig_cb_val *done_val;
+};
+
+static void
+gensio_str_to_gensio_done(struct gensio *io, int err, void *cb_data) {
+    struct str_to_gensio_data *adata = cb_data;
+    swig_ref io_ref;
+    PyObject *args, *o;
+    OI_PY_STATE gstate;
+
+    gstate = OI_PY_STATE_GET();
+
+    args = PyTuple_New(2);
+    if (err) {
+	Py_INCREF(Py_None);
+	PyTuple_SET_ITEM(args, 0, Py_None);
+	o = OI_PI_FromString(gensio_err_to_str(err));
+    } else {
+	/* The new gensio's only reference goes to the python object. */
+	io_ref = swig_make_ref(io, gensio);
+	PyTuple_SET_ITEM(args, 0, io_ref.val);
+	Py_INCREF(Py_None);
+	o = Py_None;
+    }
+    PyTuple_SET_ITEM(args, 1, o);
+
+    swig_finish_call(adata->done_val, "str_to_gensio_done", args, false);
+
+    deref_swig_cb_val(adata->done_val);
+    if (err)
+	free_gensio_data(adata->data);
+    free(adata);
+    OI_PY_STATE_PUT(gstate);
+}
+
+struct pool_get_data {
+    struct gensio_data *data;
+    swig_cb_val *done_val;
+};
+
+static void
+gensio_pool_get_done(struct gensio_pool *pool, struct gensio *io, int err,
+		     void *cb_data) {
+    struct pool_get_data *pdata = cb_data;
+    swig_ref io_ref;
+    PyObject *args, *o;
+    OI_PY_STATE gstate;
+
+    gstate = OI_PY_STATE_GET();
+
+    args = PyTuple_New(2);
+    if (err) {
+	Py_INCREF(Py_None);
+	PyTuple_SET_ITEM(args, 0, Py_None);
+	o = OI_PI_FromString(gensio_err_to_str(err));
+    } else {
+	/* The gensio goes back to the pool when this reference goes. */
+	pdata->data->pool = pool;
+	io_ref = swig_make_ref(io, gensio);
+	PyTuple_SET_ITEM(args, 0, io_ref.val);
+	Py_INCREF(Py_None);
+	o = Py_None;
+    }
+    PyTuple_SET_ITEM(args, 1, o);
+
+    swig_finish_call(pdata->done_val, "pool_get_done", args, false);
+
+    deref_swig_cb_val(pdata->done_val);
+    if (err)
+	free_gensio_data(pdata->data);
+    free(pdata);
+    OI_PY_STATE_PUT(gstate);
+}
+
+struct relay {
+    struct gensio_os_funcs *o;
+    struct gensio_relay *relay;
+    struct gensio *io[2];
+    struct gensio_data *data[2];
+    swig_cb_val *done_val;
+};
+
+static void
+relay_clear_override(struct relay *r)
+{
+    unsigned int i;
+
+    for (i = 0; i < 2; i++) {
+	r->data[i]->cb_override = NULL;
+	r->data[i]->cb_override_data = NULL;
+    }
+}
+
+static void
+gensio_relay_finished(struct gensio_relay *relay, int err, void *cb_data) {
+    struct relay *r = cb_data;
+    PyObject *args, *o;
+    OI_PY_STATE gstate;
+
+    /* The relay is stopped, give the events back to python. */
+    relay_clear_override(r);
+
+    gstate = OI_PY_STATE_GET();
+
+    args = PyTuple_New(1);
+    if (err) {
+	o = OI_PI_FromString(gensio_err_to_str(err));
+    } else {
+	Py_INCREF(Py_None);
+	o = Py_None;
+    }
+    PyTuple_SET_ITEM(args, 0, o);
+
+    swig_finish_call(r->done_val, "relay_done", args, false);
+
+    OI_PY_STATE_PUT(gstate);
+}
+
 static void
 gensio_close_done(struct gensio *io, void *cb_data) {
     swig_cb_val *cb = cb_data;
@@ -647,6 +858,10 @@ gensio_child_event(struct gensio *io, void *user_data, int event, int readerr,
     int rv = 0;
     gensiods rsize;
 
+    if (data->cb_override)
+	return data->cb_override(io, data->cb_override_data, event, readerr,
+				 buf, buflen, auxdata);
+
     gstate = OI_PY_STATE_GET();
 
     if (!data->handler_val) {
@@ -711,6 +926,33 @@ gensio_child_event(struct gensio *io, void *user_data, int event, int readerr,
 	swig_finish_call(data->handler_val, "send_break", args, true);
 	break;
 
+    case GENSIO_EVENT_WRITE_HIGH:
+    case GENSIO_EVENT_WRITE_LOW:
+	io_ref = swig_make_ref(io, gensio);
+	args = PyTuple_New(1);
+	ref_gensio_data(data);
+	PyTuple_SET_ITEM(args, 0, io_ref.val);
+
+	swig_finish_call(data->handler_val,
+			 event == GENSIO_EVENT_WRITE_HIGH ?
+			 "write_high" : "write_low", args, true);
+	break;
+
+    case GENSIO_EVENT_WRITE_COMPLETE: {
+	struct gensio_write_complete *wc = (struct gensio_write_complete *) buf;
+
+	io_ref = swig_make_ref(io, gensio);
+	args = PyTuple_New(4);
+	ref_gensio_data(data);
+	PyTuple_SET_ITEM(args, 0, io_ref.val);
+	PyTuple_SET_ITEM(args, 1, PyInt_FromLong(wc->first));
+	PyTuple_SET_ITEM(args, 2, PyInt_FromLong(wc->last));
+	PyTuple_SET_ITEM(args, 3, PyBool_FromLong(wc->copied));
+
+	swig_finish_call(data->handler_val, "write_complete", args, true);
+	break;
+    }
+
     case GENSIO_EVENT_AUTH_BEGIN:
 	io_ref = swig_make_ref(io, gensio);
 	args = PyTuple_New(1);
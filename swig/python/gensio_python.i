@@ -116,3 +116,52 @@
 	free($1);
     }
 };
+
+%typemap(in) (struct gensio_msg *msgs, gensiods nmsgs) {
+    unsigned int i;
+    unsigned int len;
+    struct gensio_msg *msgs = NULL;
+    struct gensio_sg *sgs = NULL;
+
+    if (!PySequence_Check($input)) {
+	PyErr_SetString(PyExc_TypeError, "Expecting a sequence");
+	SWIG_fail;
+    }
+    len = PyObject_Length($input);
+    if (len > 0) {
+	msgs = malloc((sizeof(*msgs) + sizeof(*sgs)) * len);
+	if (!msgs) {
+	    PyErr_SetString(PyExc_ValueError, "Out of memory");
+	    SWIG_fail;
+	}
+	memset(msgs, 0, (sizeof(*msgs) + sizeof(*sgs)) * len);
+	sgs = (struct gensio_sg *) (msgs + len);
+    }
+    for (i = 0; i < len; i++) {
+	PyObject *o = PySequence_GetItem($input, i);
+	char *buf;
+	my_ssize_t buflen;
+
+	if (!OI_PI_BytesCheck(o)) {
+	    Py_XDECREF(o);
+	    free(msgs);
+	    PyErr_SetString(PyExc_ValueError,
+			    "Expecting a sequence of byte strings");
+	    SWIG_fail;
+	}
+	OI_PI_AsBytesAndSize(o, &buf, &buflen);
+	Py_DECREF(o);
+	sgs[i].buf = buf;
+	sgs[i].buflen = buflen;
+	msgs[i].sg = &sgs[i];
+	msgs[i].sglen = 1;
+    }
+    $1 = msgs;
+    $2 = len;
+}
+
+%typemap(freearg) (struct gensio_msg *msgs, gensiods nmsgs) {
+    if ($1) {
+	free($1);
+    }
+};
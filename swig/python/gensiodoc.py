@@ -16,6 +16,44 @@ class gensio_os_funcs:
     one, you might have to provide a Python/C interface to allocate it.
     """
 
+    def set_default(classname, name, strval, intval):
+        """Set a default value for gensios, see gensio_set_default().
+
+        classname -- The gensio class the default applies to, or None
+            for all gensios.
+        name -- The name of the default.
+        strval -- The string value, for string defaults, or None.
+        intval -- The integer value, for integer and bool defaults.
+        """
+        return
+
+    def dns_flush():
+        """Throw away all cached name lookups."""
+        return
+
+class StrToGensioDone:
+    """A template for a class handling the finish of str_to_gensio_async()."""
+
+    def str_to_gensio_done(io, err):
+        """Called when the gensio has been created.
+
+        io -- The new gensio, or None on an error.
+        err -- An error string, None if no error.
+        """
+        return
+
+def str_to_gensio_async(o, gensiostr, handler, done):
+    """Allocate a gensio like the gensio constructor, but do any name
+    lookups without blocking.  done.str_to_gensio_done() is called
+    with the new gensio when it is ready.
+
+    o -- The gensio_os_funcs object to use for this gensio.
+    gensiostr -- A string describing the gensio stack.
+    handler -- An EventHandler object to receive events.
+    done -- A class (like StrToGensioDone) to call when done.
+    """
+    return
+
 def alloc_gensio_selector(h):
     """Allocate a default gensio_os_funcs for your platform.
 
@@ -71,6 +109,27 @@ class EventHandler:
         """
         return
 
+    def write_high(self, io):
+        """The data held to be written reached the write high water
+        mark, see GENSIO_EVENT_WRITE_HIGH in gensio_event(3).
+        Optional."""
+        return
+
+    def write_low(self, io):
+        """The data held to be written dropped back to the write low
+        water mark.  Optional."""
+        return
+
+    def write_complete(self, io, first, last, copied):
+        """Zero-copy writes numbered first through last are done and
+        their data may be changed, see the zerocopy option of tcp in
+        gensio(5).  Optional.
+
+        io -- The gensio the writes were done on.
+        copied -- True if the kernel copied the data anyway.
+        """
+        return
+
     def auth_begin(self, io):
         """An authorization event has begun.  This is used by certauth server
         side to report that authorization has begun from the client.
@@ -336,6 +395,31 @@ class CloseDone:
         """
         return
 
+class SendfileDone:
+    """A template for a class handling the finish of a sendfile."""
+
+    def sendfile_done(io, err, count):
+        """Called when the sendfile operation completes.
+
+        io -- The gensio the file was sent on.
+        err -- An error string, None if no error.
+        count -- The number of bytes sent.
+        """
+        return
+
+class WriteQueuedDone:
+    """A template for a class handling the finish of a queued write."""
+
+    def write_queued_done(io, err, count):
+        """Called when a buffer from write_queued() has been written,
+        or the write failed.
+
+        io -- The gensio the data was written on.
+        err -- An error string, None if no error.
+        count -- The number of bytes of the buffer written.
+        """
+        return
+
 class gensio:
     def __init__(o, gensiostr, handler):
         """Allocate a gensio.
@@ -428,10 +512,28 @@ class gensio:
         """
         return
 
+    def raddr_to_str():
+        """Return the remote address of the gensio as a string."""
+        return
+
     def get_type():
         """Return the type string for the gensio."""
         return
 
+    def sendfile(fd, offset, len, args, done):
+        """Send part of a file out the gensio in the background, see
+        gensio_sendfile(3).  The write callback belongs to the
+        transfer until done.sendfile_done() is called.
+
+        fd -- The file descriptor of a regular file.
+        offset -- Where in the file to start.
+        len -- The number of bytes to send, 0 to send to the end of file.
+        args -- A sequence of option strings, like "bufsize=65536",
+            or None.
+        done -- A class (like SendfileDone) to call when done.
+        """
+        return
+
     def close(close_done):
         """Close the gensio.  If it is not open this will raise an exception.
         When the close_done() method is called, the gensio is closed.
@@ -448,6 +550,16 @@ class gensio:
         """
         return
 
+    def write_queued(bytestr, done):
+        """Add the data to the gensio's write queue, see
+        gensio_write_queued(3).  The data is copied.
+
+        bytestr -- The data to write.
+        done -- A class (like WriteQueuedDone) to call when the data is
+            written, or None.
+        """
+        return
+
     def write(bytestr, auxdata):
         """Write the given byte string.
 
@@ -461,6 +573,19 @@ class gensio:
         """
         return 0
 
+    def write_msgs(msgs):
+        """Write a sequence of byte strings, each as its own message.
+
+        msgs -- A sequence of byte strings.
+
+        On a packet gensio each byte string goes out as one packet, in
+        as few system calls as the gensio can manage.  Returns the
+        number of messages completely written.  Messages after that
+        were not written, you must account for that when calling
+        write_msgs().
+        """
+        return 0
+
     def read_cb_enable(enable):
         """Allow read events from the gensio.  When the gensio is opened read
         is disabled, you must call this to get read events to
@@ -492,6 +617,14 @@ class gensio:
         """
         return
 
+    def set_sync_ring(ring_size):
+        """Like set_sync(), but data is read ahead into a ring buffer of
+        ring_size bytes whenever there is room, so small reads can
+        often be satisfied without waiting.  Anything left in the ring
+        is passed to the event handler after clear_sync().
+        """
+        return
+
     def clear_sync():
         """Disable synchronous I/O on the gensio.  If you call this, then read
         and write events will go the the event handler.  Read and
@@ -516,6 +649,20 @@ class gensio:
         """
         return { bytes(""), 0 }
 
+    def read_s_min(reqlen, minlen, timeout):
+        """Like read_s(), but wait until at least minlen bytes have been
+        read.  On a timeout, whatever was read so far is returned.
+        """
+        return { bytes(""), 0 }
+
+    def read_s_delim(reqlen, delim, timeout):
+        """Like read_s(), but wait until the byte delim (an integer) has
+        been read or reqlen bytes have been read.  The delimiter is
+        included, nothing after it is read.  On a timeout, whatever
+        was read so far is returned.
+        """
+        return { bytes(""), 0 }
+
     def write_s(bytestr, timeout):
         """Attempt to write the given byte string to the gensio.  This
         will wait up to timeout milliseconds for the write to complete.
@@ -584,6 +731,83 @@ class gensio:
         """
         return None
 
+class PoolGetDone:
+    """A template for a class handling the finish of pool.get()."""
+
+    def pool_get_done(io, err):
+        """Called when a gensio from the pool is ready.
+
+        io -- The open gensio, or None on an error.
+        err -- An error string, None if no error.
+        """
+        return
+
+class pool:
+    """A pool of open client gensios created from the same string, see
+    gensio_pool(3).  A gensio from the pool goes back to the pool when
+    the last python reference to it goes away.  By default it is closed
+    then, call release() to have it kept for reuse instead.
+    """
+    def __init__(o, gensiostr, args):
+        """Allocate a pool.
+
+        o -- The gensio_os_funcs object to use for the gensios.
+        gensiostr -- A string describing the gensio stack.
+        args -- A sequence of option strings, like "max_idle=4", or None.
+        """
+        return
+
+    def get(handler, done):
+        """Get an open gensio from the pool.  done.pool_get_done() is
+        called with the gensio when it is ready.
+
+        handler -- An EventHandler object to receive events, or None.
+        done -- A class (like PoolGetDone) to call when done.
+        """
+        return
+
+    def release(io):
+        """Keep the gensio in the pool for reuse when python is done
+        with it.  Don't use the gensio after this."""
+        return
+
+    def drop(io):
+        """Close the gensio when python is done with it, use this if an
+        error happened on it.  This is the default."""
+        return
+
+class RelayDone:
+    """A template for a class handling the finish of a relay."""
+
+    def relay_done(err):
+        """Called when the relay has finished moving data, see
+        gensio_relay(3).
+
+        err -- An error string, None if both sides closed normally.
+        """
+        return
+
+class relay:
+    """Move data between two open gensios, see gensio_relay(3).  The
+    relay holds references to both gensios while it runs.  Their
+    events go to the relay until it is done, then back to the python
+    event handlers.
+    """
+    def __init__(o, io1, io2, args, done):
+        """Allocate a relay.
+
+        o -- The gensio_os_funcs object to use.
+        io1, io2 -- The open gensios to relay between.
+        args -- A sequence of option strings, like "bufsize=65536",
+                or None.
+        done -- A class (like RelayDone) to call when the relay is done.
+        """
+        return
+
+    def start():
+        """Start moving data.  The relay may only be started once."""
+        return
+
 class SergensioDone:
     """These are methods called when a sergensio request from a client
     completes.  Note that the base code may not honor the request or
@@ -922,6 +1146,14 @@ class gensio_accepter:
             """Like shutdown, but blocks until the shutdown is complete."""
             return
 
+        def set_accept_callback_enable_s(enabled):
+            """Enable or disable new connection reports.  When this
+            returns after a disable, no more new connections will be
+            reported until they are enabled again, even ones that were
+            accepted but were still being set up.
+            """
+            return
+
         def control(depth, get, option, data):
         """Do a gensio_accepter-specific control operation.  See the specific
         gensio and the C interface for specific gensio_accepter controls.
@@ -0,0 +1,440 @@
+/*
+ *  gensio - A library for abstracting stream I/O
+ *  Copyright (C) 2018  Corey Minyard <minyard@acm.org>
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public
+ *  License as published by the Free Software Foundation; either
+ *  version 2 of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307  USA
+ */
+
+/*
+ * Tests for fibers in the default os handler: lots of synchronous
+ * sessions on one or two service threads, wait timeouts racing wakes,
+ * and fibers finishing after waits with a timer still set.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <signal.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <gensio/gensio.h>
+
+#define TEST_PORT "3035"
+#define NUM_SESSIONS 50
+#define NUM_XFERS 20
+#define NUM_RACERS 200
+#define NUM_RACE_ROUNDS 10
+#define RACE_TIMEOUT_US 2000
+
+static struct gensio_os_funcs *o;
+
+static pthread_mutex_t count_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct gensio_waiter *all_done;
+static unsigned int failures;
+
+static void
+fail(const char *str, int err)
+{
+    fprintf(stderr, "%s: %s\n", str, gensio_err_to_str(err));
+    pthread_mutex_lock(&count_lock);
+    failures++;
+    pthread_mutex_unlock(&count_lock);
+}
+
+static void
+fiber_finished(void)
+{
+    o->wake(all_done);
+}
+
+static void
+wait_for_fibers(unsigned int count)
+{
+    struct timeval timeout = { 20, 0 };
+    int err;
+
+    err = o->wait(all_done, count, &timeout);
+    if (err) {
+	fail("Waiting for fibers", err);
+	exit(1);
+    }
+}
+
+/*
+ * Service threads, so fibers can be resumed on a thread other than
+ * the one that started them.
+ */
+static volatile bool service_stop;
+
+static void *
+service_thread(void *cb_data)
+{
+    while (!service_stop) {
+	struct timeval timeout = { 0, 100000 };
+
+	o->service(o, &timeout);
+    }
+    return NULL;
+}
+
+/* The server side, echo everything back. */
+static int
+echo_event(struct gensio *io, void *user_data, int event, int err,
+	   unsigned char *buf, gensiods *buflen,
+	   const char *const *auxdata)
+{
+    gensiods count;
+
+    switch (event) {
+    case GENSIO_EVENT_READ:
+	if (err) {
+	    gensio_set_read_callback_enable(io, false);
+	    gensio_free(io);
+	    return 0;
+	}
+	err = gensio_write(io, &count, buf, *buflen, NULL);
+	if (err) {
+	    gensio_set_read_callback_enable(io, false);
+	    return 0;
+	}
+	if (count < *buflen) {
+	    gensio_set_read_callback_enable(io, false);
+	    gensio_set_write_callback_enable(io, true);
+	}
+	*buflen = count;
+	return 0;
+
+    case GENSIO_EVENT_WRITE_READY:
+	gensio_set_write_callback_enable(io, false);
+	gensio_set_read_callback_enable(io, true);
+	return 0;
+
+    default:
+	return GE_NOTSUP;
+    }
+}
+
+static int
+acc_event(struct gensio_accepter *accepter, void *user_data, int event,
+	  void *data)
+{
+    struct gensio *io = data;
+
+    if (event != GENSIO_ACC_EVENT_NEW_CONNECTION)
+	return GE_NOTSUP;
+
+    gensio_set_callback(io, echo_event, NULL);
+    gensio_set_read_callback_enable(io, true);
+    return 0;
+}
+
+/* A client session done entirely with the synchronous calls. */
+static void
+session_fiber(void *cb_data)
+{
+    unsigned int id = (unsigned long) cb_data, i;
+    struct gensio *io;
+    char wbuf[100], rbuf[100];
+    gensiods len, count;
+    struct timeval timeout;
+    int err;
+
+    err = str_to_gensio("tcp,localhost," TEST_PORT, o, NULL, NULL, &io);
+    if (err) {
+	fail("Session alloc", err);
+	goto out;
+    }
+    err = gensio_set_sync(io);
+    if (err) {
+	fail("Session set sync", err);
+	goto out_free;
+    }
+    err = gensio_open_s(io);
+    if (err) {
+	fail("Session open", err);
+	goto out_free;
+    }
+
+    for (i = 0; i < NUM_XFERS; i++) {
+	len = snprintf(wbuf, sizeof(wbuf), "Session %u transfer %u", id, i);
+	timeout.tv_sec = 5;
+	timeout.tv_usec = 0;
+	err = gensio_write_s(io, &count, wbuf, len, &timeout);
+	if (!err && count != len)
+	    err = GE_TIMEDOUT;
+	if (err) {
+	    fail("Session write", err);
+	    break;
+	}
+	err = gensio_read_s_min(io, &count, rbuf, len, len, &timeout);
+	if (!err && count != len)
+	    err = GE_TIMEDOUT;
+	if (err) {
+	    fail("Session read", err);
+	    break;
+	}
+	if (memcmp(wbuf, rbuf, len) != 0) {
+	    fail("Session data mismatch", GE_INVAL);
+	    break;
+	}
+    }
+
+    gensio_close_s(io);
+ out_free:
+    gensio_free(io);
+ out:
+    fiber_finished();
+}
+
+static void
+test_sessions(unsigned int nthreads)
+{
+    struct gensio_accepter *acc;
+    pthread_t threads[2];
+    unsigned long i;
+    int err;
+
+    printf("Test %d sync sessions in fibers on %u service thread(s)\n",
+	   NUM_SESSIONS, nthreads);
+
+    err = str_to_gensio_accepter("tcp," TEST_PORT, o, acc_event, NULL, &acc);
+    if (!err)
+	err = gensio_acc_startup(acc);
+    if (err) {
+	fail("Accepter startup", err);
+	exit(1);
+    }
+
+    service_stop = false;
+    /* The main thread services while it waits, so start one less. */
+    for (i = 1; i < nthreads; i++)
+	pthread_create(&threads[i], NULL, service_thread, NULL);
+
+    for (i = 0; i < NUM_SESSIONS; i++) {
+	err = o->start_fiber(o, 0, session_fiber, (void *) i);
+	if (err) {
+	    fail("Start fiber", err);
+	    exit(1);
+	}
+    }
+    wait_for_fibers(NUM_SESSIONS);
+
+    service_stop = true;
+    for (i = 1; i < nthreads; i++)
+	pthread_join(threads[i], NULL);
+
+    gensio_acc_shutdown_s(acc);
+    gensio_acc_free(acc);
+}
+
+/*
+ * A fiber waits with a timeout while another thread wakes it at about
+ * the same time.  Whichever wins, the wakeup must not be lost or
+ * counted twice.
+ */
+struct racer {
+    struct gensio_waiter *waiter;
+    int err;
+    bool got_late_wake;
+};
+
+static struct racer racers[NUM_RACERS];
+
+static void
+racer_fiber(void *cb_data)
+{
+    struct racer *r = cb_data;
+    struct timeval timeout = { 0, RACE_TIMEOUT_US };
+
+    r->err = o->wait(r->waiter, 1, &timeout);
+    if (r->err == GE_TIMEDOUT) {
+	/* The wake comes later, it has to still be there. */
+	timeout.tv_sec = 5;
+	timeout.tv_usec = 0;
+	if (o->wait(r->waiter, 1, &timeout) == 0)
+	    r->got_late_wake = true;
+    }
+    fiber_finished();
+}
+
+static void *
+waker_thread(void *cb_data)
+{
+    unsigned int i;
+
+    /* The waits all started at about the same time, wake them as they end. */
+    usleep(RACE_TIMEOUT_US);
+    for (i = 0; i < NUM_RACERS; i++)
+	o->wake(racers[i].waiter);
+    return NULL;
+}
+
+static void
+test_wait_races(void)
+{
+    pthread_t waker, service;
+    unsigned int i, round, timeouts = 0;
+    int err;
+
+    printf("Test fiber wait timeouts racing wakes\n");
+
+    service_stop = false;
+    pthread_create(&service, NULL, service_thread, NULL);
+
+    for (round = 0; round < NUM_RACE_ROUNDS; round++) {
+	for (i = 0; i < NUM_RACERS; i++) {
+	    racers[i].waiter = o->alloc_waiter(o);
+	    if (!racers[i].waiter) {
+		fail("Alloc waiter", GE_NOMEM);
+		exit(1);
+	    }
+	    racers[i].got_late_wake = false;
+	    err = o->start_fiber(o, 0, racer_fiber, &racers[i]);
+	    if (err) {
+		fail("Start fiber", err);
+		exit(1);
+	    }
+	}
+	pthread_create(&waker, NULL, waker_thread, NULL);
+	wait_for_fibers(NUM_RACERS);
+	pthread_join(waker, NULL);
+
+	for (i = 0; i < NUM_RACERS; i++) {
+	    if (racers[i].err == GE_TIMEDOUT) {
+		timeouts++;
+		if (!racers[i].got_late_wake)
+		    fail("Wake lost after a timeout", GE_TIMEDOUT);
+	    } else if (racers[i].err) {
+		fail("Racing wait", racers[i].err);
+	    }
+	    /* A wake that a finished wait didn't take would show up here. */
+	    if (o->wait(racers[i].waiter, 1, &(struct timeval) { 0, 0 }) == 0)
+		fail("Wake left on the waiter", GE_INVAL);
+	    o->free_waiter(racers[i].waiter);
+	}
+    }
+
+    service_stop = true;
+    pthread_join(service, NULL);
+
+    printf("  %u of %u waits timed out\n", timeouts,
+	   NUM_RACERS * NUM_RACE_ROUNDS);
+}
+
+/*
+ * A fiber that is woken before its timeout and finishes right away.
+ * Its timer must not go off after the fiber is gone.
+ */
+static void
+early_wake_fiber(void *cb_data)
+{
+    struct gensio_waiter *waiter = cb_data;
+    struct timeval timeout = { 0, 200000 };
+    int err;
+
+    err = o->wait(waiter, 1, &timeout);
+    if (err)
+	fail("Early wake wait", err);
+    fiber_finished();
+}
+
+static void
+test_finish_with_timer(void)
+{
+    struct gensio_waiter *waiters[NUM_RACERS];
+    struct timeval timeout = { 0, 400000 };
+    unsigned int i;
+    int err;
+
+    printf("Test fibers finishing before their wait timeout\n");
+
+    for (i = 0; i < NUM_RACERS; i++) {
+	waiters[i] = o->alloc_waiter(o);
+	if (!waiters[i]) {
+	    fail("Alloc waiter", GE_NOMEM);
+	    exit(1);
+	}
+	err = o->start_fiber(o, 0, early_wake_fiber, waiters[i]);
+	if (err) {
+	    fail("Start fiber", err);
+	    exit(1);
+	}
+    }
+    /* Let them all start waiting, then wake them. */
+    o->service(o, &(struct timeval) { 0, 0 });
+    for (i = 0; i < NUM_RACERS; i++)
+	o->wake(waiters[i]);
+    wait_for_fibers(NUM_RACERS);
+
+    /* Run past the timeouts, nothing should fire. */
+    o->wait(all_done, 1, &timeout);
+
+    for (i = 0; i < NUM_RACERS; i++)
+	o->free_waiter(waiters[i]);
+}
+
+static void
+wake_sig_handler(int sig)
+{
+}
+
+int
+main(int argc, char *argv[])
+{
+    struct sigaction act;
+    int rv;
+
+    memset(&act, 0, sizeof(act));
+    act.sa_handler = wake_sig_handler;
+    sigaction(SIGUSR1, &act, NULL);
+
+    rv = gensio_default_os_hnd(SIGUSR1, &o);
+    if (rv) {
+	fprintf(stderr, "Could not allocate OS handler: %s\n",
+		gensio_err_to_str(rv));
+	return 1;
+    }
+
+    if (!o->start_fiber) {
+	printf("No fiber support, skipping\n");
+	return 77;
+    }
+    all_done = o->alloc_waiter(o);
+    if (!all_done) {
+	fprintf(stderr, "Could not allocate waiter\n");
+	return 1;
+    }
+
+    rv = o->start_fiber(o, 0, NULL, NULL);
+    if (rv == GE_NOTSUP) {
+	printf("No fiber support, skipping\n");
+	return 77;
+    }
+
+    test_sessions(1);
+    test_sessions(2);
+    test_wait_races();
+    test_finish_with_timer();
+
+    o->free_waiter(all_done);
+
+    if (failures) {
+	printf("%u failures\n", failures);
+	return 1;
+    }
+    printf("  Success!\n");
+    return 0;
+}
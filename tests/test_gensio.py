@@ -2,6 +2,11 @@
 import utils
 import gensio
 import sys
+import time
+import socket
+import threading
+import os
+import tempfile
 from serialsim import *
 
 class Logger:
@@ -29,7 +34,7 @@ def test_serial_pipe_device():
 
 class TestAccept:
     def __init__(self, o, io1, iostr, tester, name = None,
-                 io1_dummy_write = None, do_close = True):
+                 io1_dummy_write = None, do_close = True, io1_write = None):
         self.o = o
         if (name):
             self.name = name
@@ -44,6 +49,11 @@ class TestAccept:
         if (io1_dummy_write):
             # For UDP, kick start things.
             io1.write(io1_dummy_write, None)
+        if (io1_write):
+            # Nothing goes out until the first write with tcp fast
+            # open, and that write may have to wait for the connect.
+            io1.handler.set_write_data(io1_write)
+            io1_dummy_write = io1_write
         self.wait()
         if (io1_dummy_write):
             self.io2.handler.set_compare(io1_dummy_write)
@@ -81,6 +91,42 @@ class TestAccept:
     def wait(self):
         self.waiter.wait(1)
 
+class MultiAccept:
+    """Accept connections and keep them, in order, in the ios list"""
+
+    def __init__(self, o, iostr, name = None):
+        self.o = o
+        if (name):
+            self.name = name
+        else:
+            self.name = iostr
+        self.ios = []
+        self.waiter = gensio.waiter(o)
+        self.acc = gensio.gensio_accepter(o, iostr, self);
+        self.acc.startup()
+
+    def wait_for(self, count, timeout = 1000):
+        while len(self.ios) < count:
+            if self.waiter.wait_timeout(1, timeout) == 0:
+                raise Exception("%s: Timed out waiting for connection %d" %
+                                (self.name, len(self.ios) + 1))
+
+    def close(self):
+        for io in self.ios:
+            io.read_cb_enable(False)
+            utils.io_close(io)
+        self.ios = []
+        self.acc.shutdown_s()
+        del self.acc
+
+    def new_connection(self, acc, io):
+        utils.HandleData(self.o, None, io = io, name = self.name)
+        self.ios.append(io)
+        self.waiter.wake()
+
+    def accepter_log(self, acc, level, logstr):
+        print("***%s LOG: %s: %s" % (level, self.name, logstr))
+
 def do_test(io1, io2):
     utils.test_dataxfer(io1, io2, "This is a test string!")
     print("  Success!")
@@ -103,6 +149,1058 @@ def ta_sctp():
     if c != "instreams=1,ostreams=1":
         raise Exception("Invalid stream settings: %s" % c)
 
+def count_tcp_listeners(port):
+    count = 0
+    for f in ("/proc/net/tcp", "/proc/net/tcp6"):
+        try:
+            with open(f) as fd:
+                lines = fd.readlines()[1:]
+        except IOError:
+            continue
+        for l in lines:
+            fields = l.split()
+            # State 0A is TCP_LISTEN
+            if fields[1].endswith(":%04X" % port) and fields[3] == "0A":
+                count += 1
+    return count
+
+def ta_tcp_listeners():
+    print("Test accept tcp multiple listeners")
+    ma = MultiAccept(o, "tcp,3023")
+    single = count_tcp_listeners(3023)
+    ma.close()
+    ma = MultiAccept(o, "tcp(listeners=4),3023")
+    count = count_tcp_listeners(3023)
+    if count != single * 4:
+        raise Exception("Expected %d listening sockets, found %d" %
+                        (single * 4, count))
+    # The kernel spreads these across the listeners by source port.
+    for i in range(0, 16):
+        io1 = utils.alloc_io(o, "tcp,localhost,3023")
+        ma.wait_for(i + 1)
+        io2 = ma.ios[i]
+        utils.test_dataxfer(io1, io2, "Connection %d" % i)
+        utils.test_dataxfer(io2, io1, "Reply %d" % i)
+        utils.io_close(io1)
+    ma.close()
+    print("  Success!")
+
+def get_accept_stats(acc):
+    stats = {}
+    for i in acc.control(0, True, gensio.GENSIO_CONTROL_ACCEPT_STATS,
+                         "").split():
+        (name, val) = i.split("=")
+        stats[name] = int(val)
+    return stats
+
+def ta_tcp_accept_burst():
+    print("Test accept tcp connection burst")
+    ma = MultiAccept(o, "tcp(accept_budget=2),3023")
+    # The listen backlog is small, keep this under it so no connection
+    # has to wait for a retransmit.
+    ios = []
+    for i in range(0, 10):
+        io = utils.alloc_io(o, "tcp,localhost,3023", do_open = False)
+        io.open(None)
+        ios.append(io)
+    ma.wait_for(1, timeout = 5000)
+    # Connections that were already accepted and opening must not be
+    # reported once this returns.
+    ma.acc.set_accept_callback_enable_s(False)
+    count = len(ma.ios)
+    # Nothing wakes this waiter, it just runs the selector for a bit.
+    gensio.waiter(o).wait_timeout(1, 200)
+    if len(ma.ios) != count:
+        raise Exception("%d connections reported after accepts disabled" %
+                        (len(ma.ios) - count))
+    ma.acc.set_accept_callback_enable_s(True)
+    ma.wait_for(len(ios), timeout = 5000)
+    stats = get_accept_stats(ma.acc)
+    if stats["accepts"] != len(ios):
+        raise Exception("Expected %d accepts, got %d" %
+                        (len(ios), stats["accepts"]))
+    if stats["overflows"] == 0:
+        raise Exception("The accept budget was never hit")
+    for io in ios:
+        utils.io_close(io)
+    ma.close()
+    print("  Success!")
+
+class OrderReader:
+    """Read a fixed amount, noting which reader got each read in order"""
+
+    def __init__(self, o, io, name, order, waiter, total):
+        self.io = io
+        self.name = name
+        self.order = order
+        self.waiter = waiter
+        self.total = total
+        self.count = 0
+        io.set_cbs(self)
+
+    def read_callback(self, io, err, buf, auxdata):
+        if err:
+            raise Exception("%s: read error: %s" % (self.name, err))
+        self.order.append(self.name)
+        self.count += len(buf)
+        if self.count >= self.total:
+            io.read_cb_enable(False)
+            self.waiter.wake()
+        return len(buf)
+
+    def write_callback(self, io):
+        io.write_cb_enable(False)
+
+def ta_tcp_read_budget():
+    print("Test accept tcp read budget fairness")
+    ma = MultiAccept(o, "tcp(readbuf=1024,read_budget=4096),3023")
+    data = bytes(65536)
+    ios = []
+    for i in range(0, 2):
+        io = utils.alloc_io(o, "tcp,localhost,3023")
+        ma.wait_for(i + 1)
+        io.handler.set_write_data(data)
+        if io.handler.wait_timeout(1000) == 0:
+            raise Exception("Timed out writing read budget data")
+        ios.append(io)
+    # Let the data all get to the other end before reading any.
+    gensio.waiter(o).wait_timeout(1, 100)
+    order = []
+    waiter = gensio.waiter(o)
+    readers = [OrderReader(o, ma.ios[i], i, order, waiter, len(data))
+               for i in range(0, 2)]
+    for r in readers:
+        r.io.read_cb_enable(True)
+    if waiter.wait_timeout(2, 2000) == 0:
+        raise Exception("Timed out reading read budget data")
+    # Each wakeup reads up to the budget, then the other one gets a turn.
+    maxrun = run = 0
+    for i in range(0, len(order)):
+        if i > 0 and order[i] == order[i - 1]:
+            run += 1
+        else:
+            run = 1
+        maxrun = max(maxrun, run)
+    if maxrun < 2 or maxrun > 4:
+        raise Exception("Longest run of reads from one fd was %d, expected"
+                        " 2 to 4" % maxrun)
+    for r in readers:
+        del r.io
+    for io in ios:
+        utils.io_close(io)
+    for io in ma.ios:
+        utils.HandleData(o, None, io = io)
+    ma.close()
+    print("  Success!")
+
+def check_read_buffer_size(io, expected):
+    size = int(io.control(0, True, gensio.GENSIO_CONTROL_READ_BUFFER_SIZE,
+                          ""))
+    if size != expected:
+        raise Exception("Read buffer size was %d, expected %d" %
+                        (size, expected))
+
+def ta_tcp_adaptive_readbuf():
+    print("Test accept tcp adaptive read buffer")
+    ma = MultiAccept(o, "tcp(readbuf=1024,readbuf_min=1024,"
+                     "readbuf_max=16384),3023")
+    io1 = utils.alloc_io(o, "tcp,localhost,3023")
+    ma.wait_for(1)
+    io2 = ma.ios[0]
+    check_read_buffer_size(io2, 1024)
+
+    # Queue it all up first so the reads fill the buffer.
+    data = bytes(262144)
+    io1.handler.set_write_data(data)
+    if io1.handler.wait_timeout(2000) == 0:
+        raise Exception("Timed out writing bulk data")
+    io2.handler.set_compare(data)
+    if io2.handler.wait_timeout(2000) == 0:
+        raise Exception("Timed out reading bulk data")
+    check_read_buffer_size(io2, 16384)
+
+    # Small reads shrink it again, by half every 16 reads.
+    for i in range(0, 16):
+        utils.test_dataxfer(io1, io2, "small %2d" % i)
+    check_read_buffer_size(io2, 8192)
+    for i in range(16, 64):
+        utils.test_dataxfer(io1, io2, "small %2d" % i)
+    check_read_buffer_size(io2, 1024)
+
+    utils.io_close(io1)
+    ma.close()
+    print("  Success!")
+
+def tcp_blackhole(addr, port):
+    """Return sockets that make connects to addr,port hang
+
+    The listener's accept queue is filled and never drained, so the
+    kernel drops any more SYNs to it."""
+    ls = socket.socket()
+    ls.setsockopt(socket.SOL_SOCKET, socket.SO_REUSEADDR, 1)
+    ls.bind((addr, port))
+    ls.listen(0)
+    socks = [ls]
+    for i in range(0, 3):
+        s = socket.socket()
+        s.setblocking(False)
+        try:
+            s.connect((addr, port))
+        except BlockingIOError:
+            pass
+        socks.append(s)
+    time.sleep(0.1)
+    return socks
+
+def check_tcp_connect_time(ma, name, mintime, maxtime):
+    io = utils.alloc_io(o, "tcp(connect_stagger=500),%s,3023" % name,
+                        do_open = False)
+    start = time.time()
+    io.open_s()
+    secs = time.time() - start
+    ma.wait_for(len(ma.ios) + 1)
+    raddr = io.raddr_to_str()
+    if not raddr.startswith("::1,"):
+        raise Exception("%s: connected to %s, not ::1" % (name, raddr))
+    if secs < mintime or secs > maxtime:
+        raise Exception("%s: connect took %f seconds, expected %f to %f" %
+                        (name, secs, mintime, maxtime))
+    utils.io_close(io)
+
+def ta_tcp_connect_stagger():
+    print("Test tcp staggered connects")
+    blackholes = (tcp_blackhole("127.0.0.3", 3023) +
+                  tcp_blackhole("127.0.0.4", 3023))
+    o.dns_flush()
+    o.set_default(None, "dns_hosts",
+                  "%s/dnsstub3.hosts" % utils.srcdir, 0)
+    ma = MultiAccept(o, "tcp,::1,3023")
+    # Two black holes and then ::1.  The families are interleaved, so
+    # ::1 is tried second, when the first stagger timer goes off.
+    check_tcp_connect_time(ma, "stagger1.example", 0.4, 0.9)
+    # The refused address starts ::1 right away, without waiting for
+    # the stagger time.
+    check_tcp_connect_time(ma, "stagger2.example", 0, 0.3)
+    ma.close()
+    o.set_default(None, "dns_hosts", None, 0)
+    o.dns_flush()
+    for s in blackholes:
+        s.close()
+    print("  Success!")
+
+def tcp_fastopen_enabled():
+    # Both client (1) and server (2) support are needed on loopback.
+    try:
+        with open("/proc/sys/net/ipv4/tcp_fastopen") as f:
+            return (int(f.read()) & 3) == 3
+    except (IOError, ValueError):
+        return False
+
+def get_tcpext_stat(name):
+    with open("/proc/net/netstat") as f:
+        lines = f.readlines()
+    for i in range(0, len(lines) - 1, 2):
+        names = lines[i].split()
+        if names[0] != "TcpExt:":
+            continue
+        return int(lines[i + 1].split()[names.index(name)])
+    return 0
+
+def ta_tcp_fastopen():
+    print("Test accept tcp fast open")
+    if not tcp_fastopen_enabled():
+        print("  Skipped, fast open is not enabled in the kernel")
+        return
+    active = get_tcpext_stat("TCPFastOpenActive")
+    passive = get_tcpext_stat("TCPFastOpenPassive")
+    # The first connection gets the cookie, the others use it.
+    for i in range(0, 3):
+        io1 = utils.alloc_io(o, "tcp(fastopen=1),localhost,3023",
+                             do_open = False)
+        TestAccept(o, io1, "tcp(fastopen=16),3023", do_test,
+                   io1_write = "Data in the SYN")
+    active = get_tcpext_stat("TCPFastOpenActive") - active
+    passive = get_tcpext_stat("TCPFastOpenPassive") - passive
+    if active < 2 or passive < 2:
+        raise Exception("Fast open not used: %d active, %d passive" %
+                        (active, passive))
+
+class WriteQueuedDone:
+    """Record the done calls of queued writes, in the order they come"""
+
+    def __init__(self, results, index):
+        self.results = results
+        self.index = index
+
+    def write_queued_done(self, io, err, count):
+        self.results.append((self.index, err, count))
+
+def wait_write_queued(results, count, timeout):
+    w = gensio.waiter(o)
+    end = time.time() + timeout / 1000.0
+    while len(results) < count and time.time() < end:
+        w.wait_timeout(1, 10)
+    if len(results) < count:
+        raise Exception("Only %d of %d queued writes done" %
+                        (len(results), count))
+
+def ta_tcp_write_queued():
+    print("Test accept tcp write queued")
+    ma = MultiAccept(o, "tcp(rcvbuf=16384),3023")
+    io1 = utils.alloc_io(o, "tcp(sndbuf=16384),localhost,3023")
+    ma.wait_for(1)
+    io2 = ma.ios[0]
+    # Big enough that the socket takes each one in a number of pieces.
+    bufs = (gensio.get_random_bytes(200000), gensio.get_random_bytes(300000))
+    results = []
+    io2.handler.set_compare(bufs[0] + bufs[1] + b"after")
+    io1.write_queued(bufs[0], WriteQueuedDone(results, 0))
+    if io1.write(b"x", None) != 0:
+        raise Exception("A write went around the write queue")
+    io1.write_queued(bufs[1], WriteQueuedDone(results, 1))
+    wait_write_queued(results, 2, 3000)
+    if results != [(0, None, len(bufs[0])), (1, None, len(bufs[1]))]:
+        raise Exception("Bad queued write results: %s" % str(results))
+    if io1.write(b"after", None) != 5:
+        raise Exception("Write after the queue emptied was short")
+    if io2.handler.wait_timeout(3000) == 0:
+        raise Exception("Timed out reading queued data")
+
+    # Close with data queued that the other end won't read.  The close
+    # waits for it, so close the other end to make the write fail.
+    results = []
+    for i in range(0, 4):
+        io1.write_queued(bufs[1], WriteQueuedDone(results, i))
+    gensio.waiter(o).wait_timeout(1, 200)
+    io1.handler.close()
+    if io1.handler.wait_timeout(100) != 0:
+        raise Exception("Close didn't wait for the queued data")
+    utils.io_close(io2)
+    if io1.handler.wait_timeout(3000) == 0:
+        raise Exception("Timed out closing with queued data")
+    wait_write_queued(results, 4, 1000)
+    for i in range(0, 4):
+        (index, err, count) = results[i]
+        if index != i:
+            raise Exception("Queued writes done out of order: %s" %
+                            str(results))
+        if i == 3 and not err:
+            raise Exception("Queued write on a failed close had no error")
+        if err and count >= len(bufs[1]):
+            raise Exception("Failed queued write %d wrote everything" % i)
+    del io1.handler.io
+    del io1.handler
+    ma.ios = []
+    ma.close()
+    print("  Success!")
+
+class WatermarkWatcher:
+    """Record the write watermark events and the held data at each"""
+
+    def __init__(self, o, io):
+        self.io = io
+        self.events = []
+        io.set_cbs(self)
+
+    def read_callback(self, io, err, buf, auxdata):
+        return len(buf)
+
+    def write_callback(self, io):
+        io.write_cb_enable(False)
+
+    def write_high(self, io):
+        self.events.append(("high", get_control_int(io,
+                                        gensio.GENSIO_CONTROL_WRITE_QUEUED)))
+
+    def write_low(self, io):
+        self.events.append(("low", get_control_int(io,
+                                        gensio.GENSIO_CONTROL_WRITE_QUEUED)))
+
+def ta_tcp_write_watermarks():
+    print("Test accept tcp write watermarks")
+    ma = MultiAccept(o, "tcp(rcvbuf=16384),3023")
+    io1 = utils.alloc_io(o, "tcp(sndbuf=16384),localhost,3023")
+    ma.wait_for(1)
+    io2 = ma.ios[0]
+    io1.control(0, False, gensio.GENSIO_CONTROL_WRITE_HIGH_WATER, "65536")
+    io1.control(0, False, gensio.GENSIO_CONTROL_WRITE_LOW_WATER, "16384")
+    h = WatermarkWatcher(o, io1)
+    chunk = gensio.get_random_bytes(8192)
+    w = gensio.waiter(o)
+    # Each round must get exactly one high and one low event, however
+    # many times the held data goes up and down in between.
+    for r in range(0, 2):
+        data = b""
+        while len(h.events) == r * 2 and len(data) < 100 * len(chunk):
+            io1.write_queued(chunk, None)
+            data += chunk
+            w.wait_timeout(1, 1)
+        if len(h.events) != r * 2 + 1 or h.events[-1][0] != "high":
+            raise Exception("No high event: %s" % str(h.events))
+        if h.events[-1][1] < 65536:
+            raise Exception("High event with only %d held" % h.events[-1][1])
+        for i in range(0, 4):
+            io1.write_queued(chunk, None)
+            data += chunk
+        w.wait_timeout(1, 100)
+        if len(h.events) != r * 2 + 1:
+            raise Exception("Extra events above high water: %s" %
+                            str(h.events))
+        io2.handler.set_compare(data)
+        if io2.handler.wait_timeout(5000) == 0:
+            raise Exception("Timed out reading watermark data")
+        w.wait_timeout(1, 50)
+        if len(h.events) != r * 2 + 2 or h.events[-1][0] != "low":
+            raise Exception("No low event: %s" % str(h.events))
+        if h.events[-1][1] > 16384:
+            raise Exception("Low event with %d held" % h.events[-1][1])
+    io1.set_cbs(io1.handler)
+    utils.io_close(io1)
+    ma.close()
+    print("  Success!")
+
+def get_control_int(io, option):
+    return int(io.control(0, True, option, None))
+
+def ta_tcp_sockopts():
+    print("Test accept tcp socket option controls")
+    ma = MultiAccept(o, "tcp,3023")
+    io1 = utils.alloc_io(o,
+            "tcp(sndbuf=8192,rcvbuf=32768,user_timeout=5000),localhost,3023",
+            do_open = False)
+    # Not open yet, so what will be set.
+    v = get_control_int(io1, gensio.GENSIO_CONTROL_SNDBUF)
+    if v != 8192:
+        raise Exception("Closed sndbuf was %d, not 8192" % v)
+    io1.open_s()
+    ma.wait_for(1)
+    io2 = ma.ios[0]
+    # The kernel reports twice the buffer sizes set.
+    for (option, name, expect) in ((gensio.GENSIO_CONTROL_SNDBUF, "sndbuf",
+                                    16384),
+                                   (gensio.GENSIO_CONTROL_RCVBUF, "rcvbuf",
+                                    65536),
+                                   (gensio.GENSIO_CONTROL_USER_TIMEOUT,
+                                    "user_timeout", 5000)):
+        v = get_control_int(io1, option)
+        if v != expect:
+            raise Exception("Open %s was %d, not %d" % (name, v, expect))
+    for (option, name, val) in ((gensio.GENSIO_CONTROL_CORK, "cork", "1"),
+                                (gensio.GENSIO_CONTROL_CORK, "cork", "0"),
+                                (gensio.GENSIO_CONTROL_NOTSENT_LOWAT,
+                                 "notsent_lowat", "16384")):
+        io1.control(0, False, option, val)
+        v = get_control_int(io1, option)
+        if v != int(val):
+            raise Exception("Set %s to %s, got %d" % (name, val, v))
+    try:
+        io1.control(0, False, gensio.GENSIO_CONTROL_RCVBUF, "abc")
+        raise Exception("Bad rcvbuf value was accepted")
+    except Exception as E:
+        if not str(E).endswith("Invalid data to parameter"):
+            raise
+
+    # The sndbuf set above locked the size, so the kernel won't grow
+    # it.  Only auto sizing can.
+    io1.control(0, False, gensio.GENSIO_CONTROL_SNDBUF, "auto")
+    v = get_control_int(io1, gensio.GENSIO_CONTROL_SNDBUF)
+    if v != 16384:
+        raise Exception("sndbuf changed to %d before writing" % v)
+    utils.test_dataxfer(io1, io2, gensio.get_random_bytes(1048576),
+                        timeout = 5000)
+    v = get_control_int(io1, gensio.GENSIO_CONTROL_SNDBUF)
+    if v <= 65536 or v > 16777216:
+        raise Exception("Auto sndbuf was %d after writing" % v)
+    utils.io_close(io1)
+    ma.close()
+    print("  Success!")
+
+class ZeroCopyWriter:
+    """Write chunks with zerocopy auxdata and check the completions"""
+
+    def __init__(self, o, io, chunks, minsize):
+        self.io = io
+        self.chunks = chunks
+        self.minsize = minsize
+        self.waiter = gensio.waiter(o)
+        self.chunk = 0
+        self.pos = 0
+        self.ids = 0
+        self.next_complete = 0
+        self.copied = False
+        # The kernel may still be using these until completion.
+        self.written = []
+        io.set_cbs(self)
+        io.write_cb_enable(True)
+
+    def done(self):
+        return (self.chunk == len(self.chunks) and
+                self.next_complete == self.ids)
+
+    def read_callback(self, io, err, buf, auxdata):
+        return len(buf)
+
+    def write_callback(self, io):
+        while self.chunk < len(self.chunks):
+            data = self.chunks[self.chunk][self.pos:]
+            count = io.write(data, ("zerocopy",))
+            if count == 0:
+                return
+            self.written.append(data)
+            if len(data) >= self.minsize:
+                self.ids += 1
+            self.pos += count
+            if count < len(data):
+                return
+            self.chunk += 1
+            self.pos = 0
+        io.write_cb_enable(False)
+        if self.done():
+            self.waiter.wake()
+
+    def write_complete(self, io, first, last, copied):
+        if first != self.next_complete or last < first or last >= self.ids:
+            raise Exception("Bad zerocopy completion %d-%d, expected %d" %
+                            (first, last, self.next_complete))
+        self.next_complete = last + 1
+        if copied:
+            self.copied = True
+        if self.done():
+            self.written = []
+            self.waiter.wake()
+
+def ta_tcp_zerocopy():
+    print("Test accept tcp zerocopy")
+    ma = MultiAccept(o, "tcp,3023")
+    try:
+        io1 = utils.alloc_io(o, "tcp(zerocopy=4096),localhost,3023")
+    except Exception as E:
+        if str(E).endswith("Operation not supported"):
+            print("  Skipped, zerocopy is not supported")
+            ma.close()
+            return
+        raise
+    ma.wait_for(1)
+    io2 = ma.ios[0]
+    chunks = []
+    for i in range(0, 16):
+        chunks.append(gensio.get_random_bytes(16384))
+    # Too small to be sent without copying, it must not get a number.
+    chunks.append(gensio.get_random_bytes(100))
+    io2.handler.set_compare(b"".join(chunks))
+    h = ZeroCopyWriter(o, io1, chunks, 4096)
+    if io2.handler.wait_timeout(3000) == 0:
+        raise Exception("Timed out reading zerocopy data")
+    if h.waiter.wait_timeout(1, 2000) == 0:
+        raise Exception("Zerocopy completions missing: %d of %d" %
+                        (h.next_complete, h.ids))
+    if h.ids < 16:
+        raise Exception("Only %d zerocopy writes" % h.ids)
+    # Traffic to the local host always gets copied.
+    if not h.copied:
+        raise Exception("Loopback zerocopy writes not reported as copied")
+    io1.set_cbs(io1.handler)
+    utils.io_close(io1)
+    ma.close()
+    print("  Success!")
+
+def do_compress_test(io1, io2):
+    rb = gensio.get_random_bytes(65536)
+    text = "Oct 18 12:00:01 host kernel: eth0: link up, 1000Mbps\n" * 2000
+    print("  testing io1 to io2")
+    utils.test_dataxfer(io1, io2, rb, timeout = 5000)
+    utils.test_dataxfer(io1, io2, text, timeout = 5000)
+    print("  testing io2 to io1")
+    utils.test_dataxfer(io2, io1, rb, timeout = 5000)
+    utils.test_dataxfer(io2, io1, text, timeout = 5000)
+    # Data held back by flush_delay must go out on the close.
+    print("  testing close with unflushed data")
+    utils.test_write_drain(io1, io2, "A short unflushed string")
+    print("  Success!")
+
+def ta_compress_tcp():
+    print("Test accept compress-tcp")
+    io1 = utils.alloc_io(o, "compress(flush_delay=100000),tcp,localhost,3023",
+                         do_open = False)
+    ta = TestAccept(o, io1, "compress,tcp,3023", do_compress_test,
+                    do_close = False)
+    # The write drain test closed io1, wait for that to finish.
+    if (io1.handler.wait_timeout(1000) == 0):
+        raise Exception("ta_compress_tcp: Timed out waiting for close")
+    del io1.handler.io
+    del io1.handler
+    utils.io_close(ta.io2)
+    del ta.io1
+    del ta.io2
+    ta.acc.shutdown_s()
+    del ta.acc
+
+def do_ratelimit_test(io1, io2):
+    rate = 50000
+    rb = gensio.get_random_bytes(100000)
+    print("  testing io1 to io2 at %d bytes/sec" % rate)
+    start = time.time()
+    utils.test_dataxfer(io1, io2, rb, timeout = 10000)
+    secs = time.time() - start
+    # The first burst goes out right away, the rest at the rate.
+    expected = float(len(rb) - rate / 10) / rate
+    print("  took %.2f seconds, expected %.2f" % (secs, expected))
+    # Only check that it wasn't too fast.  A loaded machine can always
+    # make it slower, and the transfer timeout catches a stall.
+    if secs < expected * 0.8:
+        raise Exception("ratelimit: transfer took %.2f seconds, expected "
+                        "at least %.2f" % (secs, expected * 0.8))
+    print("  Success!")
+
+def ta_ratelimit_tcp():
+    print("Test accept ratelimit-tcp")
+    io1 = utils.alloc_io(o, "ratelimit(write_rate=50000),tcp,localhost,3023",
+                         do_open = False)
+    TestAccept(o, io1, "tcp,3023", do_ratelimit_test)
+
+class MsgDelimHandler:
+    """Write messages and check that each read is exactly one message"""
+
+    def __init__(self, o, io, name, check_eom = True):
+        self.io = io
+        self.name = name
+        self.check_eom = check_eom
+        self.waiter = gensio.waiter(o)
+        self.to_write = []
+        self.to_compare = []
+        io.set_cbs(self)
+
+    def set_write_msgs(self, msgs):
+        self.to_write = list(msgs)
+        self.io.write_cb_enable(True)
+
+    def set_compare_msgs(self, msgs):
+        self.to_compare = list(msgs)
+        self.compared = 0
+        self.io.read_cb_enable(True)
+
+    def wait_timeout(self, timeout):
+        return self.waiter.wait_timeout(1, timeout)
+
+    def read_callback(self, io, err, buf, auxdata):
+        if err:
+            raise utils.HandlerException(self.name + ": read: " + err)
+        if not self.to_compare:
+            raise utils.HandlerException(self.name + ": unexpected message")
+        msg = self.to_compare.pop(0)
+        if len(buf) != len(msg):
+            raise utils.HandlerException(
+                "%s: message %d is %d bytes, expected %d" %
+                (self.name, self.compared, len(buf), len(msg)))
+        if buf != msg:
+            raise utils.HandlerException("%s: message %d data mismatch" %
+                                         (self.name, self.compared))
+        if self.check_eom and (not auxdata or "eom" not in auxdata):
+            raise utils.HandlerException("%s: message %d has no eom" %
+                                         (self.name, self.compared))
+        self.compared += 1
+        if not self.to_compare:
+            io.read_cb_enable(False)
+            self.waiter.wake()
+        return len(buf)
+
+    def write_callback(self, io):
+        while self.to_write:
+            # A message is either all written or not at all.
+            if io.write(self.to_write[0], None) == 0:
+                return
+            self.to_write.pop(0)
+        io.write_cb_enable(False)
+        self.waiter.wake()
+
+def msgdelim_xfer(h1, h2, msgs):
+    h2.set_compare_msgs(msgs)
+    h1.set_write_msgs(msgs)
+    if h1.wait_timeout(5000) == 0:
+        raise Exception("%s: Timed out writing messages, %d left" %
+                        (h1.name, len(h1.to_write)))
+    if h2.wait_timeout(5000) == 0:
+        raise Exception("%s: Timed out reading messages at %d" %
+                        (h2.name, h2.compared))
+
+def do_msgdelim_test(io1, io2):
+    sizes = (1, 7, 100, 1000, 40000, 65536, 3, 5000, 2, 65535)
+    msgs = [utils.conv_to_bytes(gensio.get_random_bytes(i)) for i in sizes * 2]
+    h1 = MsgDelimHandler(o, io1, "msgdelim io1")
+    h2 = MsgDelimHandler(o, io2, "msgdelim io2")
+    print("  testing io1 to io2")
+    msgdelim_xfer(h1, h2, msgs)
+    print("  testing io2 to io1")
+    msgdelim_xfer(h2, h1, msgs)
+    # Put the handlers back so the ios can be closed normally.
+    io1.set_cbs(io1.handler)
+    io2.set_cbs(io2.handler)
+    print("  Success!")
+
+def ta_msgdelim_tcp():
+    print("Test accept msgdelim-tcp")
+    io1 = utils.alloc_io(o, "msgdelim,tcp,localhost,3023", do_open = False)
+    TestAccept(o, io1, "msgdelim,tcp,3023", do_msgdelim_test)
+
+def ta_msgdelim_ssl_tcp():
+    print("Test accept msgdelim-ssl-tcp")
+    io1 = utils.alloc_io(o,
+                "msgdelim,ssl(CA=%s/CA.pem),tcp,localhost,3023" % utils.srcdir,
+                do_open = False)
+    TestAccept(o, io1,
+               "msgdelim,ssl(key=%s/key.pem,cert=%s/cert.pem),tcp,3023" %
+               (utils.srcdir, utils.srcdir), do_msgdelim_test)
+
+def do_write_msgs_test(io1, io2):
+    msgs = [utils.conv_to_bytes(s) for s in ("Message 1", "Msg 2",
+                                             "The third message")]
+    if io1.is_packet():
+        # Each message must arrive as its own packet.
+        h2 = MsgDelimHandler(o, io2, "write_msgs io2", check_eom = False)
+        h2.set_compare_msgs(msgs)
+        count = io1.write_msgs(msgs)
+        if count != len(msgs):
+            raise Exception("write_msgs wrote %d of %d" % (count, len(msgs)))
+        if h2.wait_timeout(1000) == 0:
+            raise Exception("%s: Timed out reading messages at %d" %
+                            (h2.name, h2.compared))
+        io2.set_cbs(io2.handler)
+    else:
+        # Falls back to one write per message on a stream.
+        io2.handler.set_compare(b"".join(msgs))
+        count = io1.write_msgs(msgs)
+        if count != len(msgs):
+            raise Exception("write_msgs wrote %d of %d" % (count, len(msgs)))
+        if io2.handler.wait_timeout(1000) == 0:
+            raise Exception("%s: Timed out waiting for read at byte %d" %
+                            (io2.handler.name, io2.handler.compared))
+    print("  Success!")
+
+def ta_write_msgs_udp():
+    print("Test accept write_msgs udp")
+    io1 = utils.alloc_io(o, "udp,localhost,3023", do_open = False)
+    TestAccept(o, io1, "udp,3023", do_write_msgs_test, io1_dummy_write = "A")
+
+def ta_write_msgs_tcp():
+    print("Test accept write_msgs tcp")
+    io1 = utils.alloc_io(o, "tcp,localhost,3023", do_open = False)
+    TestAccept(o, io1, "tcp,3023", do_write_msgs_test)
+
+def do_gso_test(io1, io2):
+    segsize = 1000
+    data = utils.conv_to_bytes(gensio.get_random_bytes(10 * segsize + 500))
+    # Each segment must come out of the receiver as its own packet.
+    msgs = [data[i:i + segsize] for i in range(0, len(data), segsize)]
+    h2 = MsgDelimHandler(o, io2, "gso io2", check_eom = False)
+    h2.set_compare_msgs(msgs)
+    count = io1.write(data, None)
+    if count != len(data):
+        raise Exception("gso write wrote %d of %d" % (count, len(data)))
+    if h2.wait_timeout(1000) == 0:
+        raise Exception("%s: Timed out reading segments at %d" %
+                        (h2.name, h2.compared))
+    io2.set_cbs(io2.handler)
+    print("  Success!")
+
+def ta_udp_gso_gro():
+    print("Test accept udp gso and gro")
+    io1 = utils.alloc_io(o, "udp(gso=1000),localhost,3023", do_open = False)
+    TestAccept(o, io1, "udp(gro),3023", do_gso_test, io1_dummy_write = "A")
+
+def count_udp_peer_socks(port):
+    # Sockets bound to the port and connected to a remote.
+    count = 0
+    for f in ("/proc/net/udp", "/proc/net/udp6"):
+        try:
+            with open(f) as fd:
+                lines = fd.readlines()[1:]
+        except IOError:
+            continue
+        for l in lines:
+            fields = l.split()
+            if (fields[1].endswith(":%04X" % port) and
+                    not fields[2].endswith(":0000")):
+                count += 1
+    return count
+
+def ta_udp_peersock():
+    print("Test accept udp peersock")
+    io1 = utils.alloc_io(o, "udp,localhost,3023", do_open = False)
+    ta = TestAccept(o, io1, "udp(peersock),3023", do_test,
+                    io1_dummy_write = "A", do_close = False)
+    io2 = ta.io2
+    # io2 is not reading, a new remote must still get through.
+    io3 = utils.alloc_io(o, "udp,localhost,3023")
+    io3.write("B", None)
+    ta.wait()
+    io4 = ta.io2
+    ta.io2 = io2
+    io4.handler.set_compare("B")
+    if io4.handler.wait_timeout(1000) == 0:
+        raise Exception("ta_udp_peersock: Timed out waiting for second remote")
+    count = count_udp_peer_socks(3023)
+    if count != 2:
+        raise Exception("Expected 2 udp peer sockets, found %d" % count)
+    utils.test_dataxfer(io2, io1, "Reply to io1")
+    utils.test_dataxfer(io4, io3, "Reply to io3")
+    utils.io_close(io3)
+    utils.io_close(io4)
+    ta.close()
+    count = count_udp_peer_socks(3023)
+    if count != 0:
+        raise Exception("%d udp peer sockets left after close" % count)
+    print("  Success!")
+
+class SendfileDone:
+    def __init__(self, o):
+        self.waiter = gensio.waiter(o)
+        self.err = None
+        self.count = 0
+        self.done = False
+
+    def sendfile_done(self, io, err, count):
+        self.err = err
+        self.count = count
+        self.done = True
+        self.waiter.wake()
+
+    def wait(self, timeout = 2000):
+        if self.waiter.wait_timeout(1, timeout) == 0 and not self.done:
+            raise Exception("Timed out waiting for sendfile")
+
+def do_sendfile_test(accstr, clientstr):
+    data = bytes([(i * 7 + i // 251) & 0xff for i in range(0, 1048576)])
+    f = tempfile.TemporaryFile()
+    f.write(data)
+    f.flush()
+    ma = MultiAccept(o, accstr)
+    io1 = utils.alloc_io(o, clientstr)
+    ma.wait_for(1)
+    io2 = ma.ios[0]
+
+    # Nothing would tell the transfer that a pipe has data.
+    r, w = os.pipe()
+    try:
+        io1.sendfile(r, 0, 0, None, SendfileDone(o))
+        raise Exception("sendfile on a pipe did not fail")
+    except Exception as E:
+        if not str(E).endswith("Invalid data to parameter"):
+            raise
+    os.close(r)
+    os.close(w)
+
+    done = SendfileDone(o)
+    io2.handler.set_compare(data[1000:6000])
+    io1.sendfile(f.fileno(), 1000, 5000, None, done)
+    done.wait()
+    if done.err or done.count != 5000:
+        raise Exception("Partial sendfile: err %s count %d" %
+                        (str(done.err), done.count))
+    if io2.handler.wait_timeout(2000) == 0:
+        raise Exception("Timed out reading partial sendfile data")
+
+    # A zero length goes to the end of file.
+    done = SendfileDone(o)
+    io2.handler.set_compare(data)
+    io1.sendfile(f.fileno(), 0, 0, None, done)
+    if io2.handler.wait_timeout(5000) == 0:
+        raise Exception("Timed out reading sendfile data")
+    done.wait()
+    if done.err or done.count != len(data):
+        raise Exception("Sendfile to end of file: err %s count %d" %
+                        (str(done.err), done.count))
+
+    # Data held by the gensio must go out before the file.
+    done = SendfileDone(o)
+    io2.handler.set_compare(b"header" + data)
+    io1.control(0, False, gensio.GENSIO_CONTROL_WRITE_CORK, "1")
+    if io1.write(b"header", None) != 6:
+        raise Exception("Short header write")
+    io1.sendfile(f.fileno(), 0, 0, None, done)
+    done.wait()
+    io1.control(0, False, gensio.GENSIO_CONTROL_WRITE_CORK, "0")
+    if done.err or done.count != len(data):
+        raise Exception("Sendfile after held data: err %s count %d" %
+                        (str(done.err), done.count))
+    if io2.handler.wait_timeout(5000) == 0:
+        raise Exception("Timed out reading sendfile data after held data")
+
+    # The other end doesn't read, closing must abort the transfer.
+    done = SendfileDone(o)
+    io1.sendfile(f.fileno(), 0, 0, None, done)
+    gensio.waiter(o).wait_timeout(1, 100)
+    if done.done:
+        raise Exception("Sendfile finished with the other end not reading")
+    utils.io_close(io1)
+    done.wait()
+    if not done.err or done.count >= len(data):
+        raise Exception("Sendfile not aborted on close: err %s count %d" %
+                        (str(done.err), done.count))
+    f.close()
+    ma.close()
+    print("  Success!")
+
+def ta_sendfile_tcp():
+    print("Test sendfile tcp")
+    do_sendfile_test("tcp(rcvbuf=16384),3023",
+                     "tcp(sndbuf=16384),localhost,3023")
+
+def ta_sendfile_ssl_tcp():
+    print("Test sendfile ssl,tcp")
+    do_sendfile_test("ssl(key=%s/key.pem,cert=%s/cert.pem),tcp(rcvbuf=16384),3023"
+                     % (utils.srcdir, utils.srcdir),
+                     "ssl(CA=%s/CA.pem),tcp(sndbuf=16384),localhost,3023"
+                     % utils.srcdir)
+
+class RelayDone:
+    def __init__(self, o):
+        self.waiter = gensio.waiter(o)
+        self.err = None
+        self.done = False
+
+    def relay_done(self, err):
+        self.err = err
+        self.done = True
+        self.waiter.wake()
+
+class EofReader:
+    """Wait for a read error, normally the end of file"""
+
+    def __init__(self, o, io):
+        self.waiter = gensio.waiter(o)
+        self.err = None
+        io.set_cbs(self)
+        io.read_cb_enable(True)
+
+    def read_callback(self, io, err, buf, auxdata):
+        if err:
+            self.err = err
+            io.read_cb_enable(False)
+            self.waiter.wake()
+        return len(buf)
+
+    def write_callback(self, io):
+        io.write_cb_enable(False)
+
+def relay_far_recv(conn, size, timeout, chunk = None):
+    """Receive size bytes on the non-blocking socket conn while
+    running the selector, return what was read before timeout ms"""
+    w = gensio.waiter(o)
+    data = b""
+    end = time.time() + timeout / 1000.0
+    while len(data) < size and time.time() < end:
+        try:
+            count = size - len(data)
+            if chunk and count > chunk:
+                count = chunk
+            buf = conn.recv(count)
+            if not buf:
+                break
+            data += buf
+        except BlockingIOError:
+            pass
+        w.wait_timeout(1, 5)
+    return data
+
+def relay_far_send(conn, data, timeout):
+    w = gensio.waiter(o)
+    end = time.time() + timeout / 1000.0
+    while data and time.time() < end:
+        try:
+            data = data[conn.send(data):]
+        except BlockingIOError:
+            pass
+        w.wait_timeout(1, 5)
+    if data:
+        raise Exception("Timed out sending relay data")
+
+def do_relay_test(accstr, clientstr, spliced):
+    data = bytes([(i * 7 + i // 251) & 0xff for i in range(0, 100000)])
+    bigdata = data * 42
+    far = socket.socket(socket.AF_INET, socket.SOCK_STREAM)
+    far.setsockopt(socket.SOL_SOCKET, socket.SO_REUSEADDR, 1)
+    # Small so the slow reader backs up quickly.
+    far.setsockopt(socket.SOL_SOCKET, socket.SO_RCVBUF, 4096)
+    far.bind(("127.0.0.1", 3024))
+    far.listen(5)
+    ma = MultiAccept(o, accstr)
+    A = utils.alloc_io(o, clientstr)
+    ma.wait_for(1)
+    C2 = utils.alloc_io(o, "tcp(sndbuf=16384),127.0.0.1,3024")
+    conn, addr = far.accept()
+    conn.setblocking(False)
+    far.close()
+    done = RelayDone(o)
+    relay = gensio.relay(o, ma.ios[0], C2, None, done)
+    relay.start()
+
+    A.handler.set_write_data(data)
+    rdata = relay_far_recv(conn, len(data), 3000)
+    if rdata != data:
+        raise Exception("Relay data to far end bad, got %d bytes" % len(rdata))
+    if A.handler.wait_timeout(1000) == 0:
+        raise Exception("Timed out finishing the relay write")
+
+    A.handler.set_compare(data)
+    relay_far_send(conn, data, 3000)
+    if A.handler.wait_timeout(3000) == 0:
+        raise Exception("Timed out reading relay data from far end")
+
+    # Nobody reads on the far end, the writer must stall.
+    A.handler.set_write_data(bigdata)
+    gensio.waiter(o).wait_timeout(1, 500)
+    if A.handler.wrpos >= len(bigdata):
+        raise Exception("Relay writer never stalled on a slow reader")
+    rdata = relay_far_recv(conn, len(bigdata), 20000, chunk = 8192)
+    if rdata != bigdata:
+        raise Exception("Slow reader relay data bad, got %d bytes" %
+                        len(rdata))
+    if A.handler.wait_timeout(1000) == 0:
+        raise Exception("Timed out finishing the slow reader write")
+
+    # End of file from the far end only.
+    conn.shutdown(socket.SHUT_WR)
+    if spliced:
+        # The other direction still runs, A can keep writing.
+        h = EofReader(o, A)
+        if h.waiter.wait_timeout(1, 2000) == 0:
+            raise Exception("Relay end of file never got to the client")
+        count = A.write(b"after eof", None)
+        if count != 9:
+            raise Exception("Short write after end of file: %d" % count)
+        rdata = relay_far_recv(conn, 9, 2000)
+        if rdata != b"after eof":
+            raise Exception("Bad data after end of file: %s" % str(rdata))
+        if done.done:
+            raise Exception("Relay finished with one direction open")
+        A.set_cbs(A.handler)
+        utils.io_close(A)
+        if relay_far_recv(conn, 1, 2000) != b"":
+            raise Exception("Far end never got the end of file")
+    if not done.done and done.waiter.wait_timeout(1, 2000) == 0:
+        raise Exception("Timed out waiting for the relay to finish")
+    if done.err:
+        raise Exception("Relay finished with error: %s" % done.err)
+    del relay
+    if not spliced:
+        utils.io_close(A)
+    conn.close()
+    utils.io_close(C2)
+    ma.close()
+    print("  Success!")
+
+def ta_relay_tcp():
+    print("Test relay tcp to tcp")
+    do_relay_test("tcp(rcvbuf=16384),3023", "tcp(sndbuf=16384),localhost,3023",
+                  True)
+
+def ta_relay_ssl_tcp():
+    print("Test relay ssl,tcp to tcp")
+    do_relay_test("ssl(key=%s/key.pem,cert=%s/cert.pem),tcp(rcvbuf=16384),3023"
+                  % (utils.srcdir, utils.srcdir),
+                  "ssl(CA=%s/CA.pem),tcp(sndbuf=16384),localhost,3023"
+                  % utils.srcdir, False)
+
 def ta_ssl_tcp():
     print("Test accept ssl-tcp")
     io1 = utils.alloc_io(o, "ssl(CA=%s/CA.pem),tcp,localhost,3023" % utils.srcdir, do_open = False)
@@ -159,6 +1257,85 @@ def ta_certauth_tcp():
             "Invalid service, expected %s, got %s" % ("myservice", service))
     ta.close()
 
+def do_fused_test(clientstr, accstr, toptype, peercn):
+    o.set_default(None, "fuse_filters", None, 1)
+    try:
+        io1 = utils.alloc_io(o, clientstr, do_open = False)
+    finally:
+        o.set_default(None, "fuse_filters", None, 0)
+    # The filters are all in the top gensio, right over tcp.
+    if io1.get_type(0) != toptype or io1.get_type(1) != "tcp":
+        raise Exception("%s was not fused: %s,%s" %
+                        (clientstr, io1.get_type(0), io1.get_type(1)))
+    ta = TestAccept(o, io1, accstr, do_test, do_close = False)
+    # Controls for the merged filters go to the top gensio.
+    cn = io1.control(0, True, gensio.GENSIO_CONTROL_GET_PEER_CERT_NAME,
+                     "-1,CN")
+    if not cn.endswith(",CN," + peercn):
+        raise Exception("Invalid peer certificate name, expected %s, got %s"
+                        % (peercn, cn))
+    ta.close()
+
+def ta_fused_ssl_tcp():
+    print("Test accept fused ssl-tcp")
+    do_fused_test("ssl(CA=%s/CA.pem),tcp,localhost,3023" % utils.srcdir,
+                  "ssl(key=%s/key.pem,cert=%s/cert.pem),tcp,3023" %
+                  (utils.srcdir, utils.srcdir), "ssl", "ser2net.org")
+
+def ta_fused_certauth_tcp():
+    print("Test accept fused certauth-ssl-tcp")
+    do_fused_test("certauth(cert=%s/clientcert.pem,key=%s/clientkey.pem,username=testuser,service=myservice),ssl(CA=%s/CA.pem),tcp,localhost,3023" % (utils.srcdir, utils.srcdir, utils.srcdir),
+                  "certauth(CA=%s/clientcert.pem),ssl(key=%s/key.pem,cert=%s/cert.pem),tcp,3023" % (utils.srcdir, utils.srcdir, utils.srcdir),
+                  "certauth", "gensio.org")
+
+def ta_fused_telnet_ssl_tcp():
+    print("Test accept fused telnet-ssl-tcp")
+    do_fused_test("telnet,ssl(CA=%s/CA.pem),tcp,localhost,3023" %
+                  utils.srcdir,
+                  "telnet,ssl(key=%s/key.pem,cert=%s/cert.pem),tcp,3023" %
+                  (utils.srcdir, utils.srcdir), "telnet", "ser2net.org")
+
+class OpenCloseDone:
+    def __init__(self, o):
+        self.waiter = gensio.waiter(o)
+        self.opened = False
+        self.closed = False
+
+    def open_done(self, io, err):
+        self.opened = True
+
+    def close_done(self, io):
+        self.closed = True
+        self.waiter.wake()
+
+def ta_fused_close_in_open():
+    print("Test close of a fused gensio while it is opening")
+    # Nothing answers the ssl handshake, so the open stays in progress.
+    ma = MultiAccept(o, "tcp,3023")
+    o.set_default(None, "fuse_filters", None, 1)
+    try:
+        # First with the tcp connection up and the ssl handshake
+        # going, then with the tcp connect still going.
+        for wait_conn in (True, False):
+            io = utils.alloc_io(o,
+                    "telnet,ssl(CA=%s/CA.pem),tcp,localhost,3023" %
+                    utils.srcdir, do_open = False)
+            h = OpenCloseDone(o)
+            io.open(h)
+            if wait_conn:
+                ma.wait_for(1)
+            io.close(h)
+            if h.waiter.wait_timeout(1, 2000) == 0:
+                raise Exception("Close while opening never finished")
+            gensio.waiter(o).wait_timeout(1, 50)
+            if h.opened:
+                raise Exception("Open finished after a close while opening")
+            del io
+    finally:
+        o.set_default(None, "fuse_filters", None, 0)
+    ma.close()
+    print("  Success!")
+
 class SigRspHandler:
     def __init__(self, o, sigval):
         self.sigval = sigval
@@ -723,16 +1900,246 @@ def test_certauth_ssl_tcp_acc_connect():
                       do_small_test, expect_pw = "jkl;", expect_pw_rv = 0,
                       password = "jkl;")
 
+class StrToGensioDone:
+    def __init__(self, o):
+        self.o = o
+        self.waiter = gensio.waiter(o)
+        self.io = None
+        self.err = None
+        self.done = False
+
+    def str_to_gensio_done(self, io, err):
+        if io:
+            utils.HandleData(self.o, None, io = io, name = "async")
+        self.io = io
+        self.err = err
+        self.done = True
+        self.waiter.wake()
+
+    def wait(self):
+        # The allocation is done in another thread, don't trust one wait.
+        for i in range(0, 50):
+            if self.done:
+                return
+            self.waiter.wait_timeout(1, 100)
+        raise Exception("Timed out waiting for str_to_gensio_async")
+
+def check_dns_stub_addr(io, addr):
+    def do_check_addr(io1, io2):
+        raddr = io1.raddr_to_str()
+        if not raddr.startswith(addr + ","):
+            raise Exception("Expected address %s, got %s" % (addr, raddr))
+    TestAccept(o, io, "tcp,3023", do_check_addr)
+
+def test_dns_cache():
+    print("Test dns cache")
+    hosts1 = "%s/dnsstub1.hosts" % utils.srcdir
+    hosts2 = "%s/dnsstub2.hosts" % utils.srcdir
+    o.dns_flush()
+    o.set_default(None, "dns_ttl", None, 2)
+    o.set_default(None, "dns_hosts", hosts1, 0)
+    io = utils.alloc_io(o, "tcp,gensiotest.example,3023", do_open = False)
+    check_dns_stub_addr(io, "127.0.0.1")
+
+    # The name is cached, so the new stub file is not used yet.
+    o.set_default(None, "dns_hosts", hosts2, 0)
+    io = utils.alloc_io(o, "tcp,gensiotest.example,3023", do_open = False)
+    check_dns_stub_addr(io, "127.0.0.1")
+
+    # Wait for the cache entry to expire.
+    time.sleep(3)
+    io = utils.alloc_io(o, "tcp,gensiotest.example,3023", do_open = False)
+    check_dns_stub_addr(io, "127.0.0.2")
+
+    o.dns_flush()
+    o.set_default(None, "dns_hosts", hosts1, 0)
+    done = StrToGensioDone(o)
+    gensio.str_to_gensio_async(o, "tcp,gensiotest.example,3023", None, done)
+    done.wait()
+    if done.err:
+        raise Exception("str_to_gensio_async failed: %s" % done.err)
+    check_dns_stub_addr(done.io, "127.0.0.1")
+    del done.io
+
+    done = StrToGensioDone(o)
+    gensio.str_to_gensio_async(o, "tcp,gensiotest.invalid,3023", None, done)
+    done.wait()
+    if not done.err or done.io:
+        raise Exception("str_to_gensio_async didn't fail on a bad name")
+
+    # More requests than resolver threads get queued, not dropped.
+    o.set_default(None, "dns_threads", None, 1)
+    dones = []
+    for i in range(0, 8):
+        done = StrToGensioDone(o)
+        gensio.str_to_gensio_async(o, "tcp,gensiotest.example,3023", None,
+                                   done)
+        dones.append(done)
+    for done in dones:
+        done.wait()
+        if done.err:
+            raise Exception("queued str_to_gensio_async failed: %s" %
+                            done.err)
+        del done.io
+    o.set_default(None, "dns_threads", None, 4)
+
+    # The cache is off by default, a new stub file is used right away.
+    o.dns_flush()
+    o.set_default(None, "dns_ttl", None, 0)
+    io = utils.alloc_io(o, "tcp,gensiotest.example,3023", do_open = False)
+    check_dns_stub_addr(io, "127.0.0.1")
+    o.set_default(None, "dns_hosts", hosts2, 0)
+    io = utils.alloc_io(o, "tcp,gensiotest.example,3023", do_open = False)
+    check_dns_stub_addr(io, "127.0.0.2")
+
+    o.set_default(None, "dns_hosts", None, 0)
+    o.dns_flush()
+    print("  Success!")
+
+class PoolGetDone:
+    def __init__(self, o):
+        self.o = o
+        self.waiter = gensio.waiter(o)
+        self.io = None
+        self.err = None
+        self.done = False
+
+    def pool_get_done(self, io, err):
+        if io:
+            utils.HandleData(self.o, None, io = io, name = "pool")
+        self.io = io
+        self.err = err
+        self.done = True
+        self.waiter.wake()
+
+    def wait(self):
+        if self.waiter.wait_timeout(1, 2000) == 0 and not self.done:
+            raise Exception("Timed out waiting for pool get")
+
+def pool_get(pool):
+    done = PoolGetDone(o)
+    pool.get(None, done)
+    done.wait()
+    if done.err:
+        raise Exception("pool get failed: %s" % done.err)
+    return done.io
+
+def pool_put(pool, io, keep = True):
+    """Give io back to the pool, the caller must drop its reference"""
+    if keep:
+        pool.release(io)
+    else:
+        pool.drop(io)
+    # Break the circular references so python lets go of it.
+    del io.handler.io
+    del io.handler
+
+def check_pool_stats(io, **expected):
+    stats = {}
+    for i in io.control(0, True, gensio.GENSIO_CONTROL_POOL_STATS,
+                        "").split():
+        (name, val) = i.split("=")
+        stats[name] = int(val)
+    for name in expected:
+        if stats[name] != expected[name]:
+            raise Exception("Pool stat %s was %d, expected %d" %
+                            (name, stats[name], expected[name]))
+
+def test_pool():
+    print("Test gensio pool")
+    # Nothing listens here.  When the first open fails, the request
+    # waiting on max_total must get its turn.
+    pool = gensio.pool(o, "tcp,localhost,3029", ["max_total=1"])
+    done1 = PoolGetDone(o)
+    done2 = PoolGetDone(o)
+    pool.get(None, done1)
+    pool.get(None, done2)
+    done1.wait()
+    done2.wait()
+    if not done1.err or not done2.err:
+        raise Exception("Pool gets to a closed port didn't fail")
+    del pool
+
+    ma = MultiAccept(o, "tcp,3023")
+    pool = gensio.pool(o, "tcp,localhost,3023", ["idle_timeout=1"])
+    io = pool_get(pool)
+    ma.wait_for(1)
+    utils.test_dataxfer(io, ma.ios[0], "Pool data 1")
+    check_pool_stats(io, created = 1, reused = 0, total = 1)
+
+    # A released gensio is reused, on the same connection.
+    pool_put(pool, io)
+    del io
+    io1 = pool_get(pool)
+    check_pool_stats(io1, created = 1, reused = 1, total = 1)
+    utils.test_dataxfer(io1, ma.ios[0], "Pool data 2")
+    utils.test_dataxfer(ma.ios[0], io1, "Pool data 3")
+    if len(ma.ios) != 1:
+        raise Exception("Pool reuse made a new connection")
+
+    # One that sits idle too long is closed.
+    io = pool_get(pool)
+    ma.wait_for(2)
+    pool_put(pool, io)
+    del io
+    gensio.waiter(o).wait_timeout(1, 1500)
+    check_pool_stats(io1, created = 2, expired = 1, idle = 0, total = 1)
+
+    # An idle one that the other end closes is thrown away.
+    pool_put(pool, io1)
+    del io1
+    utils.io_close(ma.ios.pop(0))
+    gensio.waiter(o).wait_timeout(1, 200)
+    io = pool_get(pool)
+    check_pool_stats(io, created = 3, failed = 1, idle = 0, total = 1)
+    ma.wait_for(2)
+    utils.test_dataxfer(io, ma.ios[1], "Pool data 4")
+
+    io.control(0, False, gensio.GENSIO_CONTROL_POOL_STATS, "")
+    check_pool_stats(io, created = 0, reused = 0, expired = 0, failed = 0,
+                     total = 1)
+    pool_put(pool, io, keep = False)
+    del io
+    del pool
+    ma.close()
+    print("  Success!")
+
 test_echo_device()
 test_serial_pipe_device()
 test_stdio_basic()
 test_stdio_basic_stderr()
 test_stdio_small()
 ta_tcp()
+ta_tcp_listeners()
+ta_tcp_accept_burst()
+ta_tcp_connect_stagger()
+ta_tcp_read_budget()
+ta_tcp_adaptive_readbuf()
+ta_tcp_fastopen()
+ta_tcp_zerocopy()
+ta_tcp_sockopts()
+ta_tcp_write_queued()
+ta_tcp_write_watermarks()
 ta_udp()
 ta_telnet()
 ta_ssl_tcp()
+ta_compress_tcp()
+ta_ratelimit_tcp()
+ta_msgdelim_tcp()
+ta_msgdelim_ssl_tcp()
+ta_write_msgs_udp()
+ta_write_msgs_tcp()
+ta_udp_gso_gro()
+ta_udp_peersock()
+ta_relay_tcp()
+ta_relay_ssl_tcp()
+ta_sendfile_tcp()
+ta_sendfile_ssl_tcp()
 ta_certauth_tcp()
+ta_fused_ssl_tcp()
+ta_fused_certauth_tcp()
+ta_fused_telnet_ssl_tcp()
+ta_fused_close_in_open()
 ta_sctp()
 test_tcp_small()
 test_tcp_urgent()
@@ -751,6 +2158,62 @@ test_telnet_sctp_acc_connect()
 test_ssl_sctp_acc_connect()
 test_certauth_sctp_acc_connect()
 test_certauth_ssl_tcp_acc_connect()
+class EchoPinger:
+    """Write to an echo gensio from another thread, timing the echos"""
+
+    def __init__(self, o):
+        self.io = gensio.gensio(o, "echo", self)
+        self.io.open_s()
+        self.io.read_cb_enable(True)
+        self.cond = threading.Condition()
+        self.received = 0
+        self.times = []
+
+    def read_callback(self, io, err, buf, auxdata):
+        with self.cond:
+            self.received += len(buf)
+            self.cond.notify()
+        return len(buf)
+
+    def write_callback(self, io):
+        io.write_cb_enable(False)
+
+    def ping(self, count):
+        for i in range(0, count):
+            start = time.time()
+            with self.cond:
+                want = self.received + 1
+                self.io.write(b"x", None)
+                self.cond.wait_for(lambda: self.received >= want, 1)
+            self.times.append(time.time() - start)
+
+def test_runner_wakeup():
+    print("Test runners queued from another thread")
+    # The echo gensio delivers from a runner.  The write queues it from
+    # a thread that is not in the selector, so the thread waiting in
+    # the selector has to be woken to run it.
+    p = EchoPinger(o)
+    w = gensio.waiter(o)
+    def pinger():
+        p.ping(20)
+        w.wake()
+    t = threading.Thread(target = pinger)
+    t.start()
+    if w.wait_timeout(1, 30000) == 0:
+        raise Exception("Timed out waiting for the pings")
+    t.join()
+    if p.received != 20:
+        raise Exception("Only got %d of 20 echos" % p.received)
+    avg = sum(p.times) / len(p.times)
+    if avg > 0.05:
+        raise Exception("Echo from another thread took %fs" % avg)
+    p.io.read_cb_enable(False)
+    p.io.close_s()
+    print("  Success!")
+
 
 test_ipmisol_large()
 test_rs485()
+test_dns_cache()
+test_pool()
+test_runner_wakeup()
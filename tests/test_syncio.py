@@ -40,3 +40,63 @@ if buf != "" or time != 0:
     raise Exception("Invalid read timeout return: '%s' %d\n" % (buf, time))
 
 g.close_s()
+
+# Read ahead ring, min and delimiter reads.  The echo only holds 4
+# bytes, so data comes in many small reads.
+class Leftover:
+    def __init__(self, o):
+        self.waiter = gensio.waiter(o)
+        self.data = b""
+
+    def read_callback(self, io, err, buf, auxdata):
+        self.data += buf
+        self.waiter.wake()
+        return len(buf)
+
+    def write_callback(self, io):
+        io.write_cb_enable(False)
+
+g = gensio.gensio(o, "echo(readbuf=4)", None)
+g.set_sync_ring(1024)
+g.open_s()
+
+# Not enough data, this should time out with what was there
+(count, time) = g.write_s(b"Hello", 1000)
+if count != 5:
+    raise Exception("Invalid write return: %d %d\n" % (count, time))
+(buf, time) = g.read_s_min(10, 8, 250)
+if buf != b"Hello" or time != 0:
+    raise Exception("Invalid read_s_min timeout return: '%s' %d\n" %
+                    (buf, time))
+
+# The second line's delimiter comes in a different read than its start
+(count, time) = g.write_s(b"abc\ndefgh\nij", 1000)
+if count != 12:
+    raise Exception("Invalid write return: %d %d\n" % (count, time))
+(buf, time) = g.read_s_delim(20, ord("\n"), 1000)
+if buf != b"abc\n" or time < 500:
+    raise Exception("Invalid read_s_delim return: '%s' %d\n" % (buf, time))
+(buf, time) = g.read_s_delim(20, ord("\n"), 1000)
+if buf != b"defgh\n" or time < 500:
+    raise Exception("Invalid read_s_delim return: '%s' %d\n" % (buf, time))
+(buf, time) = g.read_s_min(10, 2, 1000)
+if buf != b"ij" or time < 500:
+    raise Exception("Invalid read_s_min return: '%s' %d\n" % (buf, time))
+
+# Data read ahead into the ring goes to the handler after clear_sync
+(count, time) = g.write_s(b"leftover", 1000)
+if count != 8:
+    raise Exception("Invalid write return: %d %d\n" % (count, time))
+gensio.waiter(o).wait_timeout(1, 100)
+g.clear_sync()
+h = Leftover(o)
+g.set_cbs(h)
+g.read_cb_enable(True)
+while len(h.data) < 8:
+    if h.waiter.wait_timeout(1, 1000) == 0:
+        raise Exception("Leftover ring data not delivered: '%s'\n" % h.data)
+if h.data != b"leftover":
+    raise Exception("Invalid leftover ring data: '%s'\n" % h.data)
+g.read_cb_enable(False)
+
+g.close_s()
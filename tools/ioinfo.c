@@ -18,6 +18,7 @@
  */
 
 
+#include <stdio.h>
 #include <stdlib.h>
 #include <ctype.h>
 #include <errno.h>
@@ -25,12 +26,26 @@
 
 #include "ioinfo.h"
 
+/*
+ * Watermarks used for the write queue if the gensio doesn't have its
+ * own.  Reading from the other side stops when this much is queued
+ * and starts again when it has drained to the low mark.
+ */
+#define IOINFO_WRITE_HIGH_WATER	65536
+#define IOINFO_WRITE_LOW_WATER	16384
+
 struct ioinfo {
     struct gensio *io;
     struct ioinfo *otherio;
     struct gensio_os_funcs *o;
     bool ready;
 
+    /*
+     * Data for this gensio is queued with gensio_write_queued() and
+     * the write watermark events control reading the other side.
+     */
+    bool queue_writes;
+
     int escape_char;
     bool in_escape;
     char escape_data[11];
@@ -150,6 +165,36 @@ handle_escapechar(struct ioinfo *ioinfo, char c)
     return rv;
 }
 
+static void
+queued_write_done(struct gensio *io, int err, gensiods count, void *done_data)
+{
+    /* A failed write is reported by the next write or a read error. */
+    free(done_data);
+}
+
+static int
+ioinfo_write(struct ioinfo *ioinfo, gensiods *count, unsigned char *buf,
+	     gensiods buflen)
+{
+    unsigned char *data;
+    int rv;
+
+    if (!ioinfo->queue_writes)
+	return gensio_write(ioinfo->io, count, buf, buflen, NULL);
+
+    data = malloc(buflen);
+    if (!data)
+	return GE_NOMEM;
+    memcpy(data, buf, buflen);
+    rv = gensio_write_queued(ioinfo->io, data, buflen, queued_write_done,
+			     data);
+    if (rv)
+	free(data);
+    else
+	*count = buflen;
+    return rv;
+}
+
 static int
 io_event(struct gensio *io, void *user_data, int event, int err,
 	 unsigned char *buf, gensiods *buflen,
@@ -195,7 +240,7 @@ io_event(struct gensio *io, void *user_data, int event, int err,
 	    }
 	}
 	if (rioinfo->ready) {
-	    rv = gensio_write(rioinfo->io, &count, buf, *buflen, NULL);
+	    rv = ioinfo_write(rioinfo, &count, buf, *buflen);
 	    if (rv) {
 		gensio_set_read_callback_enable(ioinfo->io, false);
 		ioinfo_err(rioinfo, "write error: %s", gensio_err_to_str(rv));
@@ -225,6 +270,16 @@ io_event(struct gensio *io, void *user_data, int event, int err,
 	gensio_set_write_callback_enable(ioinfo->io, false);
 	return 0;
 
+    case GENSIO_EVENT_WRITE_HIGH:
+	if (ioinfo->queue_writes)
+	    gensio_set_read_callback_enable(rioinfo->io, false);
+	return 0;
+
+    case GENSIO_EVENT_WRITE_LOW:
+	if (ioinfo->queue_writes)
+	    gensio_set_read_callback_enable(rioinfo->io, true);
+	return 0;
+
     default:
 	break;
     }
@@ -242,10 +297,38 @@ io_event(struct gensio *io, void *user_data, int event, int err,
     return rv;
 }
 
+/*
+ * Use the write queue if the gensio has one, setting watermarks on it
+ * if the user didn't.  Otherwise each partial write stops reading
+ * the other side until the write ready event.
+ */
+static void
+ioinfo_setup_write_queue(struct ioinfo *ioinfo)
+{
+    char buf[20];
+    gensiods len = sizeof(buf);
+
+    if (gensio_control(ioinfo->io, 0, true, GENSIO_CONTROL_WRITE_HIGH_WATER,
+		       buf, &len))
+	return;
+    if (strtoul(buf, NULL, 0) == 0) {
+	len = snprintf(buf, sizeof(buf), "%d", IOINFO_WRITE_LOW_WATER);
+	if (gensio_control(ioinfo->io, 0, false,
+			   GENSIO_CONTROL_WRITE_LOW_WATER, buf, &len))
+	    return;
+	len = snprintf(buf, sizeof(buf), "%d", IOINFO_WRITE_HIGH_WATER);
+	if (gensio_control(ioinfo->io, 0, false,
+			   GENSIO_CONTROL_WRITE_HIGH_WATER, buf, &len))
+	    return;
+    }
+    ioinfo->queue_writes = true;
+}
+
 void
 ioinfo_set_ready(struct ioinfo *ioinfo, struct gensio *io)
 {
     ioinfo->io = io;
+    ioinfo_setup_write_queue(ioinfo);
     gensio_set_callback(io, io_event, ioinfo);
     gensio_set_read_callback_enable(ioinfo->io, true);
     ioinfo->ready = true;